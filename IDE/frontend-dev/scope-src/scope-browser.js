@@ -287,16 +287,21 @@ function CPU(data){
   });
   channelView.on('channelConfig', (config) => channelConfig = config );
   
-  let frame, length, plot = false;
+  let frame, length, minMax = false, plot = false;
 
   worker.onmessage = function(e) {
-    frame = e.data;
+    frame = e.data.frame;
+    // when downsampling, frame contains min/max pairs
+    minMax = e.data.minMax;
     length = Math.floor(frame.length/numChannels);
     // if scope is paused, don't set the plot flag
     plot = !paused;
     
-    // interpolate the trigger sample to get the sub-pixel x-offset
-    if (settings.getKey('plotMode') == 0){
+    if (minMax){
+      // each point spans several samples: don't bother with sub-pixel offsets
+      xOff = 0;
+    } else if (settings.getKey('plotMode') == 0){
+      // interpolate the trigger sample to get the sub-pixel x-offset
   //    if (upSampling == 1){
         let one = Math.abs(frame[Math.floor(triggerChannel*length+length/2)+xOffset-1] + (height/2) * ((channelConfig[triggerChannel].yOffset + triggerLevel)/channelConfig[triggerChannel].yAmplitude - 1));
         let two = Math.abs(frame[Math.floor(triggerChannel*length+length/2)+xOffset] + (height/2) * ((channelConfig[triggerChannel].yOffset + triggerLevel)/channelConfig[triggerChannel].yAmplitude - 1));
@@ -324,6 +329,15 @@ function CPU(data){
       for (var i=0; i<numChannels; i++){
         ctx.lineStyle(channelConfig[i].lineWeight, channelConfig[i].color, 1);
         let iLength = i*length;
+        if (minMax){
+          // a vertical line for each point, from its min to its max
+          ctx.moveTo(0, frame[iLength]);
+          for (var j=0; j<length; j+=2){
+            ctx.lineTo(j/2, frame[j+iLength]);
+            ctx.lineTo(j/2, frame[j+iLength+1]);
+          }
+          continue;
+        }
         ctx.moveTo(0, frame[iLength] + xOff*(frame[iLength + 1] - frame[iLength]));
         for (var j=1; (j-xOff)<length; j++){
           ctx.lineTo(j-xOff, frame[j+iLength]);
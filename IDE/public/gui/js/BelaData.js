@@ -5,113 +5,57 @@ export default class BelaData extends BelaWebSocket {
 		super(port, address, ip)
 
         this.buffers = new Array();
-        this.states = ['id/type', 'data'];
-        this.currentState = this.states[0];
         this.bufferReady = false;
-        this.newBuffer = {};
         this.target = new EventTarget();
         this.events = [
             new CustomEvent('buffer-ready')
         ];
     }
 
-    dataError(data) {
-        // most likely we are off by 1 in the state machine, so we attempt to resync.
-        console.log("Invalid data length %d. Resetting state machine", data.byteLength);
-        this.currentState = 'id/type';
-        this.onData(data);
-        return true;
-	}
-
+    // Each message contains one or more buffers. Each buffer has a header
+    // of 4 uint32: id, type (as a char code), size of the payload in bytes
+    // and a reserved field. The payload follows and it is padded to a
+    // multiple of 8 bytes.
     onData(data) {
-        if('id/type' === this.currentState) {
-            this.bufferReady = false;
-            this.newBuffer = {};
-            let msgIdType = new Uint8Array(data);
-            msgIdType = String.fromCharCode.apply(null, msgIdType).split('/');
-            let err = false;
-            if(2 != msgIdType.length) {
-                err = true;
-            } else if (1 != msgIdType[1].length) {
-                err = true;
-            } else {
-                let success = false;
-                this.newBuffer['type'] = msgIdType[1];
-                for(let ch of ['c', 'j', 'i', 'f', 'd']) {
-                    if(this.newBuffer['type'] === ch) {
-                        success = true;
-                        break;
-                    }
-                }
-                if(!success)
-                    err = true;
-            }
-            this.newBuffer['id'] = parseInt(msgIdType[0]);
-            if(isNaN(this.newBuffer['id']))
-                err = true;
-            if(err) {
-                console.log('Unknown buffer type ', this.newBuffer['type'],
-                    'for bufferId ', this.newBuffer['id'],
-                    ', or wrong length. Restarting state machine');
-                this.currentState = this.states[0];
+        const headerSize = 16;
+        let offset = 0;
+        while(offset + headerSize <= data.byteLength) {
+            let header = new Uint32Array(data, offset, 4);
+            let id = header[0];
+            let type = String.fromCharCode(header[1]);
+            let size = header[2];
+            let start = offset + headerSize;
+            offset = (start + size + 7) & ~7;
+            if(start + size > data.byteLength) {
+                console.log("Invalid length %d for bufferId %d", size, id);
                 return;
             }
-            this.currentState = this.states[1];
-        } else if ('data' === this.currentState) {
-                this.currentState = this.states[0];
-                let type = this.newBuffer['type'];
-                let err = false;
-                switch(type) {
-                        case 'c':
-                                let charInt = new Uint8Array(data);
-                                charInt = Array.from(charInt);
-                                let charArr = charInt.map((e) => {
-                                        return String.fromCharCode(e);
-                                });
-                                this.newBuffer['data'] = charArr;
-                                break;
-                        case 'j': // unsigned int
-                                if(data.byteLength & 3)
-                                        err = this.dataError(data);
-                                else {
-                                        let uintArr = new Uint32Array(data);
-                                        this.newBuffer['data'] = Array.from(uintArr);
-                                }
-                                break;
-                        case 'i': // int
-                                if(data.byteLength & 3)
-                                        err = this.dataError(data);
-                                else {
-                                        let intArr = new Int32Array(data);
-                                        this.newBuffer['data'] = Array.from(intArr);
-                                }
-                                break;
-                        case 'f': // float
-                                if(data.byteLength & 3)
-                                        err = this.dataError(data);
-                                else {
-                                        let floatArr = new Float32Array(data);
-                                        this.newBuffer['data'] = Array.from(floatArr);
-                                }
-                                break;
-                        case 'd':
-                                if(data.byteLength & 7)
-                                        err = this.dataError(data);
-                                else {
-                                        let doubleArr = new Float64Array(data);
-                                        this.newBuffer['data'] = Array.from(doubleArr);
-                                }
-                                break;
-                        default:
-                                console.log("Unknown buffer type ", type);
-
-                }
-                if(err)
-                        return;
-                this.buffers[this.newBuffer['id']] = this.newBuffer['data'];
-                this.bufferReady = true;
-
-                this.target.dispatchEvent( new CustomEvent('buffer-ready', { detail: this.newBuffer['id'] }) );
+            let buffer;
+            switch(type) {
+                case 'c':
+                    buffer = Array.from(new Uint8Array(data, start, size)).map((e) => {
+                        return String.fromCharCode(e);
+                    });
+                    break;
+                case 'j': // unsigned int
+                    buffer = Array.from(new Uint32Array(data, start, size >> 2));
+                    break;
+                case 'i': // int
+                    buffer = Array.from(new Int32Array(data, start, size >> 2));
+                    break;
+                case 'f': // float
+                    buffer = Array.from(new Float32Array(data, start, size >> 2));
+                    break;
+                case 'd':
+                    buffer = Array.from(new Float64Array(data, start, size >> 3));
+                    break;
+                default:
+                    console.log("Unknown buffer type ", type, "for bufferId ", id);
+                    continue;
+            }
+            this.buffers[id] = buffer;
+            this.bufferReady = true;
+            this.target.dispatchEvent( new CustomEvent('buffer-ready', { detail: id }) );
         }
     }
 
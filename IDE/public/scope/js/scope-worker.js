@@ -56,42 +56,90 @@ onmessage = function(e){
 		channelConfig = e.data.channelConfig;
 		//console.log(channelConfig);
 	}
+	render(lastData);
 }
 
+// frames are sent by Scope::sendFrame(): an 8-byte header ("SF", version,
+// flags, numChannels, numPoints), an offset and a scale for each channel, then
+// the int16 points of each channel, or min/max pairs of points if the
+// frameMinMax flag is set
+const frameHeaderSize = 8;
+const frameVersion = 1;
+const frameMinMax = 1;
+const frameNoData = -32768;
+
+// the last frame received, so that it can be redrawn when the settings change
+var lastData;
+
 var ws_onmessage = function(e){
+	lastData = e.data;
+	render(e.data);
+};
 
-	var inArray = new Float32Array(e.data);
-// 	console.log("worker: recieved buffer of length "+inArray.length, inArrayWidth);
-//	console.log(settings.frameHeight, settings.numChannels, settings.frameWidth, channelConfig);
+function render(data){
+	if (!data || data.byteLength < frameHeaderSize || !channelConfig.length) return;
+	var header = new DataView(data, 0, frameHeaderSize);
+	if (header.getUint8(0) !== 0x53 || header.getUint8(1) !== 0x46 || header.getUint8(2) !== frameVersion){
+		console.log('worker: unknown frame format');
+		return;
+	}
+	var minMax = header.getUint8(3) & frameMinMax;
+	var frameChannels = header.getUint16(4, true);
+	var frameWidth = header.getUint16(6, true);
+	// values per point
+	var stride = minMax ? 2 : 1;
 	
-	var outArray = new Float32Array(outArrayWidth);
-		
-	if (inArray.length !== inArrayWidth) {
-		console.log(inArray.length, inArrayWidth, inFrameWidth);
+	if (frameChannels !== numChannels || frameWidth !== inFrameWidth || data.byteLength !== frameHeaderSize + numChannels * (8 + 2 * stride * inFrameWidth)) {
+		console.log(frameChannels, frameWidth, inFrameWidth);
 		console.log('worker: frame dropped');
 		return;
 	}
+	var params = new DataView(data, frameHeaderSize, numChannels * 8);
+	var inArray = new Int16Array(data, frameHeaderSize + numChannels * 8);
+	
+	var outArray = new Float32Array(outArrayWidth * stride);
 	
 	for (var channel=0; channel<numChannels; ++channel){
+		var offset = params.getFloat32(channel * 8, true);
+		var scale = params.getFloat32(channel * 8 + 4, true);
+		var toPixels = function(q){
+			if (q === frameNoData)
+				return NaN;
+			return zero * (1 - (channelConfig[channel].yOffset + offset + q * scale) * channelConfig[channel].yAmplitude);
+		};
 		var outIndex;
-		var endOfInArray = (channel + 1) * inFrameWidth;
+		var endOfInArray = (channel + 1) * inFrameWidth * stride;
 		for (var frame=0; frame<inFrameWidth; ++frame){
+			var inIndex = (channel*inFrameWidth + frame) * stride;
+			if (minMax){
+				// draw the whole range of each point: there is no
+				// point interpolating
+				var min = toPixels(inArray[inIndex]);
+				var max = toPixels(inArray[inIndex + 1]);
+				for (var u=0; u<upSampling; ++u){
+					outIndex = (channel*outFrameWidth + frame*upSampling + u) * 2;
+					outArray[outIndex] = min;
+					outArray[outIndex + 1] = max;
+				}
+				continue;
+			}
+			var first = toPixels(inArray[inIndex]);
+			var second = toPixels(inArray[inIndex + 1 < endOfInArray ? inIndex + 1 : endOfInArray - 1]);
 			for (var u=0; u<upSampling; ++u){
-				var inIndex = channel*inFrameWidth + frame;
-				var first = inArray[inIndex];
-				var second = inArray[inIndex + 1 < endOfInArray ? inIndex + 1 : endOfInArray];
 				var diff = interpolation ? u*(second-first)/upSampling : 0;
 				outIndex = channel*outFrameWidth + frame*upSampling + u;
-				outArray[outIndex] = zero * (1 - (channelConfig[channel].yOffset + (inArray[inIndex]+diff)) * channelConfig[channel].yAmplitude);
+				outArray[outIndex] = first + diff;
 			}
 		}
 		// the above will not always get to the end of outArray, depending on the ratio between upSampling and outFrameWidth
 		// fill in the remaining of the buffer
-		var endOfOutArray = (channel + 1) * outFrameWidth;
+		var endOfOutArray = (channel + 1) * outFrameWidth * stride;
 		// we could fill with nans or zero-order hold
 		//var fillValue = outArray[outIndex]; // ZOH
 		var fillValue = NaN; // NaN
-		if(interpolation){
+		if (minMax){
+			outIndex += 2;
+		} else if(interpolation){
 			// if we are interpolating, we will now have a flat line at the end of the frame,
 			// as we have interpolated between two values that are the same
 			// so let's overwrite those as well
@@ -101,11 +149,8 @@ var ws_onmessage = function(e){
 			outArray[outIndex++] = fillValue;
 		}
 	}
-//  	for(var n = 0; n < upSampling; ++n){
-// 		outArray[outArray.length - 1 - n] = outArray[outArray.length - upSampling - 1];
-// 	}
 	
-	postMessage(outArray, [outArray.buffer]);
+	postMessage({frame: outArray, minMax: !!minMax}, [outArray.buffer]);
 
-};
+}
 ws.onmessage = ws_onmessage;
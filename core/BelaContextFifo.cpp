@@ -1,8 +1,10 @@
 #include <BelaContextFifo.h>
+#include <errno.h>
 
-BelaContext* BelaContextFifo::setup(const BelaContext* context, unsigned int factor)
+BelaContext* BelaContextFifo::setup(const BelaContext* context, unsigned int factor, backend_t backend)
 {
 	this->factor = factor;
+	this->backend = backend;
 	for(auto& bcs : bcss[kToLong])
 		bcs.setup(factor, 1, context);
 
@@ -15,37 +17,104 @@ BelaContext* BelaContextFifo::setup(const BelaContext* context, unsigned int fac
 	for(auto& bcs : bcss[kToShort])
 		bcs.setup(1, factor, (BelaContext*)ctx);
 
-	if(dfs[kToLong].setup("/toLong", sizeof(BelaContext*), factor * kNumBuffers, 1))
+	blocking[kToLong] = true;
+	blocking[kToShort] = false;
+	if(kBackendRing == backend)
 	{
-		printf("couldn't create queue\n");
-		return nullptr;
-	}
-	if(dfs[kToShort].setup("/toShort", sizeof(BelaContext*), factor * kNumBuffers, 0))
-	{
-		printf("couldn't create queue\n");
-		return nullptr;
+		for(unsigned int n = 0; n < kNumFifos; ++n)
+		{
+			// all the contexts that can be in flight at any time are
+			// preallocated in the splitters above: the rings only
+			// carry references to them.
+			if(rings[n].setup(factor * kNumBuffers))
+			{
+				printf("couldn't create ring\n");
+				return nullptr;
+			}
+			waiting[n] = false;
+			if(!semsInited && __wrap_sem_init(&sems[n], 0, 0))
+			{
+				printf("couldn't create semaphore\n");
+				return nullptr;
+			}
+		}
+		semsInited = true;
+	} else {
+		if(dfs[kToLong].setup("/toLong", sizeof(BelaContext*), factor * kNumBuffers, blocking[kToLong]))
+		{
+			printf("couldn't create queue\n");
+			return nullptr;
+		}
+		if(dfs[kToShort].setup("/toShort", sizeof(BelaContext*), factor * kNumBuffers, blocking[kToShort]))
+		{
+			printf("couldn't create queue\n");
+			return nullptr;
+		}
 	}
 
 	counts.fill(0);
+	underruns.fill(0);
+	overruns.fill(0);
 	return bcss[kToLong][0].getContext();
 }
 
+BelaContextFifo::~BelaContextFifo()
+{
+	if(semsInited)
+	{
+		for(auto& sem : sems)
+			__wrap_sem_destroy(&sem);
+	}
+}
+
 void BelaContextFifo::push(fifo_id_t fifo, const BelaContext* context)
 {
 	unsigned int& count = counts[fifo];
 	BelaContextSplitter& bcs = bcss[fifo][getCurrentBuffer(fifo)];
-	DataFifo& df = dfs[fifo];
 
 	bcs.push(context);
 	const BelaContext* ctx;
 	while((ctx = bcs.pop())){
-		df.send((const char*)&ctx, sizeof(ctx));
+		if(send(fifo, ctx))
+			overruns[fifo]++;
 		count++;
 	}
 }
 
-BelaContext* BelaContextFifo::pop(fifo_id_t fifo, double timeoutMs)
+BelaContext* BelaContextFifo::pop(fifo_id_t fifo, double timeoutMs, bool countUnderrun)
+{
+	BelaContext* ctx = receive(fifo, timeoutMs);
+	if(!ctx && countUnderrun)
+		underruns[fifo]++;
+	return ctx;
+}
+
+int BelaContextFifo::send(fifo_id_t fifo, const BelaContext* ctx)
+{
+	if(kBackendRing == backend)
+	{
+		if(!rings[fifo].push((BelaContext*)ctx))
+			return -EAGAIN;
+		if(blocking[fifo])
+		{
+			// make the new write index visible before checking
+			// whether the consumer is (about to be) asleep. Pairs
+			// with the fence in receiveRing().
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			// only enter the kernel if the consumer is actually
+			// waiting for us
+			if(waiting[fifo].exchange(false))
+				__wrap_sem_post(&sems[fifo]);
+		}
+		return 0;
+	}
+	return dfs[fifo].send((const char*)&ctx, sizeof(ctx));
+}
+
+BelaContext* BelaContextFifo::receive(fifo_id_t fifo, double timeoutMs)
 {
+	if(kBackendRing == backend)
+		return receiveRing(fifo, timeoutMs);
 	DataFifo& df = dfs[fifo];
 
 	BelaContext* ctx;
@@ -55,6 +124,43 @@ BelaContext* BelaContextFifo::pop(fifo_id_t fifo, double timeoutMs)
 	return ctx;
 }
 
+BelaContext* BelaContextFifo::receiveRing(fifo_id_t fifo, double timeoutMs)
+{
+	SpscQueue<BelaContext*>& ring = rings[fifo];
+	BelaContext* ctx;
+	if(ring.pop(ctx))
+		return ctx;
+	if(!blocking[fifo] || !timeoutMs)
+		return nullptr;
+
+	struct timespec timeout;
+	__wrap_clock_gettime(CLOCK_REALTIME, &timeout);
+	long long int ns = timeout.tv_nsec + (long long int)(timeoutMs * 1000000);
+	timeout.tv_sec += ns / 1000000000;
+	timeout.tv_nsec = ns % 1000000000;
+	while(1)
+	{
+		// announce that we are about to sleep, then check again, so
+		// that a producer that pushed in the meantime either sees
+		// the flag or has its context seen by us.
+		waiting[fifo] = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(ring.pop(ctx))
+		{
+			waiting[fifo] = false;
+			return ctx;
+		}
+		int ret = __wrap_sem_timedwait(&sems[fifo], &timeout);
+		waiting[fifo] = false;
+		if(ring.pop(ctx))
+			return ctx;
+		// a post may be left over from a previous timed out wait:
+		// in that case we go back to sleep
+		if(ret && EINTR != errno)
+			return nullptr;
+	}
+}
+
 unsigned int BelaContextFifo::getCurrentBuffer(fifo_id_t fifo)
 {
 	if(kToLong == fifo)
@@ -83,6 +189,11 @@ static void contextFill(InternalBelaContext* ctx, unsigned int start)
 }
 
 bool BelaContextFifo::test()
+{
+	return test(kBackendMqueue) && test(kBackendRing);
+}
+
+bool BelaContextFifo::test(backend_t backend)
 {
 	InternalBelaContext ctx;
 
@@ -99,7 +210,7 @@ bool BelaContextFifo::test()
 	unsigned int factor = 4;
 	BelaContextFifo bcf;
 
-	BelaContext* tmp = bcf.setup((BelaContext*)&ctx, factor);
+	BelaContext* tmp = bcf.setup((BelaContext*)&ctx, factor, backend);
 	assert(tmp);
 
 	unsigned int buffers = BelaContextFifo::kNumBuffers;
@@ -131,6 +242,10 @@ bool BelaContextFifo::test()
 		BelaContextSplitter::contextCopy(rctx, &recCtxs[n]);
 		assert(BelaContextSplitter::contextEqual(&recCtxs[n], &sentCtxs[n]));
 	}
+	// nothing left to read
+	assert(!bcf.pop(kToShort));
+	assert(1 == bcf.getUnderruns(kToShort));
+	assert(0 == bcf.getOverruns(kToLong));
 
 	return true;
 }
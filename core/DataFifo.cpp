@@ -95,9 +95,12 @@ int DataFifo::receive(char* buf, double timeoutMs)
 
 int DataFifo::cleanup()
 {
+	if(-1 == queue)
+		return 0;
 	int ret = __wrap_mq_close(queue);
 	if(ret < 0)
 		return -errno;
+	queue = -1;
 	ret = __wrap_mq_unlink(qName.c_str());
 	if(ret <0)
 		return -errno;
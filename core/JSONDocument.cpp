@@ -0,0 +1,414 @@
+#include <JSONDocument.h>
+#include <string.h>
+#include <stdlib.h>
+
+constexpr unsigned int JSONDocument::kMaxDepth;
+
+bool JSONDocument::Value::equals(const char* str) const
+{
+	if(!isString())
+		return false;
+	size_t len = strlen(str);
+	return len == node->size && !memcmp(node->string, str, len);
+}
+
+JSONDocument::Value JSONDocument::Value::operator[](const char* key) const
+{
+	if(!isObject())
+		return Value();
+	size_t len = strlen(key);
+	for(Value v = getFirst(); v.isValid(); v = v.getNext())
+	{
+		if(len == v.node->keySize && !memcmp(v.node->key, key, len))
+			return v;
+	}
+	return Value();
+}
+
+JSONDocument::Value JSONDocument::Value::operator[](unsigned int n) const
+{
+	Value v = getFirst();
+	for(unsigned int k = 0; k < n && v.isValid(); ++k)
+		v = v.getNext();
+	return v;
+}
+
+JSONDocument::Value JSONDocument::Value::getFirst() const
+{
+	// the first child always follows its parent
+	if(!size())
+		return Value();
+	return Value(nodes, node + 1);
+}
+
+JSONDocument::Value JSONDocument::Value::getNext() const
+{
+	if(!node || !node->next)
+		return Value();
+	return Value(nodes, nodes + node->next);
+}
+
+JSONDocument::JSONDocument(size_t maxSize)
+{
+	text.reserve(maxSize + 1);
+	// a rough estimate: values are at least two characters apart
+	nodes.reserve(maxSize / 2);
+}
+
+bool JSONDocument::parse(const char* str)
+{
+	return parse(str, strlen(str));
+}
+
+bool JSONDocument::parse(const char* str, size_t size)
+{
+	// this only allocates if the capacity is not enough
+	text.assign(str, str + size);
+	// so that strtod() stops at the end of the text
+	text.push_back('\0');
+	nodes.clear();
+	ptr = text.data();
+	end = ptr + size;
+	skipSpace();
+	valid = parseValue(0);
+	if(valid)
+	{
+		skipSpace();
+		valid = (ptr == end);
+	}
+	errorOffset = valid ? 0 : ptr - text.data();
+	return valid;
+}
+
+JSONDocument::Value JSONDocument::getRoot() const
+{
+	if(!valid || nodes.empty())
+		return Value();
+	return Value(nodes.data(), nodes.data());
+}
+
+void JSONDocument::skipSpace()
+{
+	while(ptr < end && (' ' == *ptr || '\t' == *ptr || '\n' == *ptr || '\r' == *ptr))
+		++ptr;
+}
+
+uint32_t JSONDocument::addNode(Type type)
+{
+	nodes.emplace_back();
+	Node& node = nodes.back();
+	node.type = type;
+	node.size = 0;
+	node.next = 0;
+	node.keySize = 0;
+	node.key = nullptr;
+	node.number = 0;
+	return nodes.size() - 1;
+}
+
+bool JSONDocument::parseValue(unsigned int depth)
+{
+	if(ptr >= end)
+		return false;
+	switch(*ptr)
+	{
+	case '{':
+	case '[':
+	{
+		bool object = ('{' == *ptr);
+		char close = object ? '}' : ']';
+		if(depth >= kMaxDepth)
+			return false;
+		uint32_t idx = addNode(object ? kObject : kArray);
+		++ptr;
+		skipSpace();
+		if(ptr < end && close == *ptr)
+		{
+			++ptr;
+			return true;
+		}
+		uint32_t prev = 0;
+		while(1)
+		{
+			const char* key = nullptr;
+			uint32_t keySize = 0;
+			skipSpace();
+			if(object)
+			{
+				if(ptr >= end || '"' != *ptr || !parseString(key, keySize))
+					return false;
+				skipSpace();
+				if(ptr >= end || ':' != *ptr)
+					return false;
+				++ptr;
+				skipSpace();
+			}
+			uint32_t child = nodes.size();
+			if(!parseValue(depth + 1))
+				return false;
+			nodes[child].key = key;
+			nodes[child].keySize = keySize;
+			if(prev)
+				nodes[prev].next = child;
+			prev = child;
+			nodes[idx].size++;
+			skipSpace();
+			if(ptr >= end)
+				return false;
+			if(',' == *ptr)
+			{
+				++ptr;
+				continue;
+			}
+			if(close == *ptr)
+			{
+				++ptr;
+				return true;
+			}
+			return false;
+		}
+	}
+	case '"':
+	{
+		uint32_t idx = addNode(kString);
+		const char* str;
+		uint32_t size;
+		if(!parseString(str, size))
+			return false;
+		nodes[idx].string = str;
+		nodes[idx].size = size;
+		return true;
+	}
+	case 't':
+		if(!parseLiteral("true"))
+			return false;
+		nodes[addNode(kBool)].boolean = true;
+		return true;
+	case 'f':
+		if(!parseLiteral("false"))
+			return false;
+		nodes[addNode(kBool)].boolean = false;
+		return true;
+	case 'n':
+		if(!parseLiteral("null"))
+			return false;
+		addNode(kNull);
+		return true;
+	default:
+	{
+		double number;
+		if(!parseNumber(number))
+			return false;
+		nodes[addNode(kNumber)].number = number;
+		return true;
+	}
+	}
+}
+
+bool JSONDocument::parseLiteral(const char* literal)
+{
+	size_t len = strlen(literal);
+	if((size_t)(end - ptr) < len || memcmp(ptr, literal, len))
+		return false;
+	ptr += len;
+	return true;
+}
+
+static bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+bool JSONDocument::parseNumber(double& out)
+{
+	char* start = ptr;
+	if(ptr < end && '-' == *ptr)
+		++ptr;
+	if(ptr >= end || !isDigit(*ptr))
+		return false;
+	while(ptr < end && isDigit(*ptr))
+		++ptr;
+	if(ptr < end && '.' == *ptr)
+	{
+		++ptr;
+		if(ptr >= end || !isDigit(*ptr))
+			return false;
+		while(ptr < end && isDigit(*ptr))
+			++ptr;
+	}
+	if(ptr < end && ('e' == *ptr || 'E' == *ptr))
+	{
+		++ptr;
+		if(ptr < end && ('+' == *ptr || '-' == *ptr))
+			++ptr;
+		if(ptr >= end || !isDigit(*ptr))
+			return false;
+		while(ptr < end && isDigit(*ptr))
+			++ptr;
+	}
+	out = strtod(start, nullptr);
+	return true;
+}
+
+static int hexValue(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool parseHex4(const char* ptr, const char* end, uint32_t& out)
+{
+	if(end - ptr < 4)
+		return false;
+	out = 0;
+	for(unsigned int n = 0; n < 4; ++n)
+	{
+		int v = hexValue(ptr[n]);
+		if(v < 0)
+			return false;
+		out = (out << 4) | v;
+	}
+	return true;
+}
+
+// the escaped form is always at least as long as the UTF-8 encoding, so
+// strings can be unescaped in place
+bool JSONDocument::parseString(const char*& str, uint32_t& size)
+{
+	++ptr; // opening quote
+	char* out = ptr;
+	str = out;
+	while(ptr < end)
+	{
+		char c = *ptr;
+		if('"' == c)
+		{
+			size = out - str;
+			*out = '\0';
+			++ptr;
+			return true;
+		}
+		if((unsigned char)c < 0x20)
+			return false;
+		if('\\' != c)
+		{
+			*out++ = c;
+			++ptr;
+			continue;
+		}
+		if(++ptr >= end)
+			return false;
+		c = *ptr++;
+		switch(c)
+		{
+		case '"':
+		case '\\':
+		case '/':
+			*out++ = c;
+			break;
+		case 'b':
+			*out++ = '\b';
+			break;
+		case 'f':
+			*out++ = '\f';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'u':
+		{
+			uint32_t cp;
+			if(!parseHex4(ptr, end, cp))
+				return false;
+			ptr += 4;
+			if(cp >= 0xD800 && cp <= 0xDBFF)
+			{
+				uint32_t low;
+				if(end - ptr >= 6 && '\\' == ptr[0] && 'u' == ptr[1] && parseHex4(ptr + 2, end, low) && low >= 0xDC00 && low <= 0xDFFF)
+				{
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					ptr += 6;
+				} else
+					cp = 0xFFFD;
+			} else if(cp >= 0xDC00 && cp <= 0xDFFF)
+				cp = 0xFFFD;
+			if(cp < 0x80)
+				*out++ = cp;
+			else if(cp < 0x800)
+			{
+				*out++ = 0xC0 | (cp >> 6);
+				*out++ = 0x80 | (cp & 0x3F);
+			} else if(cp < 0x10000)
+			{
+				*out++ = 0xE0 | (cp >> 12);
+				*out++ = 0x80 | ((cp >> 6) & 0x3F);
+				*out++ = 0x80 | (cp & 0x3F);
+			} else {
+				*out++ = 0xF0 | (cp >> 18);
+				*out++ = 0x80 | ((cp >> 12) & 0x3F);
+				*out++ = 0x80 | ((cp >> 6) & 0x3F);
+				*out++ = 0x80 | (cp & 0x3F);
+			}
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <JSONWriter.h>
+#include <stdio.h>
+bool JSONDocumentTest()
+{
+	JSONDocument doc;
+	const char* text = " {\"event\": \"slider\", \"slider\" : 3, \"value\":-1.5e1,"
+		"\"list\": [1, true, null, {\"a\": []}], \"esc\": \"a\\\"b\\\\c\\u00e9\\ud83d\\ude00\\n\"} ";
+	assert(doc.parse(text));
+	JSONDocument::Value root = doc.getRoot();
+	assert(root.isObject() && 5 == root.size());
+	assert(root["event"].equals("slider"));
+	assert(3 == root["slider"].asNumber());
+	assert(-15 == root["value"].asNumber());
+	assert(!root["missing"].isValid() && 42 == root["missing"].asNumber(42));
+	JSONDocument::Value list = root["list"];
+	assert(list.isArray() && 4 == list.size());
+	assert(list[1].asBool() && list[2].isNull() && list[3]["a"].isArray());
+	assert(!list[4].isValid());
+	assert(root["esc"].equals("a\"b\\c\xc3\xa9\xf0\x9f\x98\x80\n"));
+	unsigned int n = 0;
+	for(JSONDocument::Value v = root.getFirst(); v.isValid(); v = v.getNext())
+		++n;
+	assert(5 == n && !strcmp("list", root[3].getKey()));
+	const char* bad[] = {"", "{", "{\"a\" 1}", "[1,]", "[01.]", "\"\\x\"", "[1] 2", "tru"};
+	for(auto b : bad)
+		assert(!doc.parse(b) && !doc.getRoot().isValid());
+	// round trip through the writer
+	JSONWriter writer;
+	writer.beginObject();
+	writer.key("s").value("\"\xc3\xa9\x01");
+	writer.key("n").value(0.25);
+	writer.key("a").beginArray().value(true).value(nullptr).endArray();
+	writer.endObject();
+	assert(!strcmp("{\"s\":\"\\\"\xc3\xa9\\u0001\",\"n\":0.25,\"a\":[true,null]}", writer.c_str()));
+	assert(doc.parse(writer.c_str(), writer.size()));
+	assert(doc.getRoot()["s"].equals("\"\xc3\xa9\x01") && 0.25 == doc.getRoot()["n"].asNumber());
+	printf("JSONDocumentTest successful\n");
+	return true;
+}
+#endif
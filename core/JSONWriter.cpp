@@ -0,0 +1,161 @@
+#include <JSONWriter.h>
+#include <string.h>
+#include <stdio.h>
+#include <cmath>
+
+constexpr unsigned int JSONWriter::kMaxDepth;
+
+JSONWriter::JSONWriter(size_t capacity)
+{
+	text.reserve(capacity);
+	clear();
+}
+
+void JSONWriter::clear()
+{
+	text.clear();
+	depth = 0;
+	hasElements[0] = false;
+	afterKey = false;
+}
+
+// add a comma if this is not the first element of the current array or
+// object
+void JSONWriter::separate()
+{
+	if(afterKey)
+	{
+		afterKey = false;
+		return;
+	}
+	if(hasElements[depth])
+		text += ',';
+	hasElements[depth] = true;
+}
+
+JSONWriter& JSONWriter::beginObject()
+{
+	separate();
+	text += '{';
+	if(depth < kMaxDepth)
+		++depth;
+	hasElements[depth] = false;
+	return *this;
+}
+
+JSONWriter& JSONWriter::endObject()
+{
+	text += '}';
+	if(depth)
+		--depth;
+	return *this;
+}
+
+JSONWriter& JSONWriter::beginArray()
+{
+	separate();
+	text += '[';
+	if(depth < kMaxDepth)
+		++depth;
+	hasElements[depth] = false;
+	return *this;
+}
+
+JSONWriter& JSONWriter::endArray()
+{
+	text += ']';
+	if(depth)
+		--depth;
+	return *this;
+}
+
+JSONWriter& JSONWriter::key(const char* key)
+{
+	return this->key(key, strlen(key));
+}
+
+JSONWriter& JSONWriter::key(const char* key, size_t size)
+{
+	separate();
+	writeString(key, size);
+	text += ':';
+	afterKey = true;
+	return *this;
+}
+
+JSONWriter& JSONWriter::value(const char* str)
+{
+	return value(str, strlen(str));
+}
+
+JSONWriter& JSONWriter::value(const char* str, size_t size)
+{
+	separate();
+	writeString(str, size);
+	return *this;
+}
+
+JSONWriter& JSONWriter::value(double number)
+{
+	separate();
+	if(std::isinf(number) || std::isnan(number))
+	{
+		text += "null";
+		return *this;
+	}
+	// same precision as JSONValue::Stringify()
+	char str[32];
+	int len = snprintf(str, sizeof(str), "%.15g", number);
+	text.append(str, len);
+	return *this;
+}
+
+JSONWriter& JSONWriter::value(bool boolean)
+{
+	separate();
+	text += boolean ? "true" : "false";
+	return *this;
+}
+
+JSONWriter& JSONWriter::value(std::nullptr_t)
+{
+	separate();
+	text += "null";
+	return *this;
+}
+
+void JSONWriter::writeString(const char* str, size_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	text += '"';
+	for(size_t n = 0; n < size; ++n)
+	{
+		unsigned char c = str[n];
+		switch(c)
+		{
+		case '"':
+			text += "\\\"";
+			break;
+		case '\\':
+			text += "\\\\";
+			break;
+		case '\n':
+			text += "\\n";
+			break;
+		case '\r':
+			text += "\\r";
+			break;
+		case '\t':
+			text += "\\t";
+			break;
+		default:
+			if(c < 0x20)
+			{
+				char esc[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+				text.append(esc, sizeof(esc));
+			} else
+				text += c; // UTF-8 sequences are copied as they are
+		}
+	}
+	text += '"';
+}
@@ -22,6 +22,7 @@
 #include "../include/PruArmCommon.h"
 #include "../include/board_detect.h"
 #include "../include/Mcasp.h"
+#include "../include/SampleConversion.h"
 
 #include <iostream>
 #include <stdlib.h>
@@ -76,11 +77,6 @@ static int rtdm_fd_mcasp_to_pru = 0;
 using namespace std;
 using namespace BelaHwComponent;
 
-// Select whether to use NEON-based sample conversion
-// (this will probably go away in a future commit once its performance
-//  is verified over extended use)
-#undef USE_NEON_FORMAT_CONVERSION
-
 // PRU memory: PRU0- and PRU1- DATA RAM are 8kB (0x2000) long each
 //             PRU-SHARED RAM is 12kB (0x3000) long
 
@@ -198,16 +194,6 @@ const unsigned int saltSwitch1Gpio = 60; // P9_12
 const unsigned int PRU::kPruGPIODACSyncPin = 5;	// GPIO0(5); P9-17
 const unsigned int PRU::kPruGPIOADCSyncPin = 48; // GPIO1(16); P9-15
 
-#ifdef USE_NEON_FORMAT_CONVERSION
-// These four functions are written in assembly in FormatConvert.S
-extern "C" {
-	void int16_to_float_audio(int numSamples, int16_t *inBuffer, float *outBuffer);
-	void int16_to_float_analog(int numSamples, uint16_t *inBuffer, float *outBuffer);
-	void float_to_int16_audio(int numSamples, float *inBuffer, int16_t *outBuffer);
-	void float_to_int16_analog(int numSamples, float *inBuffer, uint16_t *outBuffer);
-}
-#endif /* USE_NEON_FORMAT_CONVERSION */
-
 // Constructor: specify a PRU number (0 or 1)
 PRU::PRU(InternalBelaContext *input_context)
 : context(input_context),
@@ -468,54 +454,15 @@ int PRU::initialise(BelaHw newBelaHw, int pru_num, bool uniformSampleRate, int m
 	}
 
 	// Allocate audio buffers
-#ifdef USE_NEON_FORMAT_CONVERSION
-	if(belaHw == BelaHw_Salt)
-	{
-		fprintf(stderr, "USE_NEON_FORMAT_CONVERSION is incompatible with Salt\n");
-		return 1;
-	}
-	if(uniform_sample_rate && context->analogFrames != hardaware_analog_frames)
-	{
-		fprintf(stderr, "Error: using uniform_sample_rate is not allowed with USE_NEON_FORMAT_CONVERSION\n");
-		return 1;
-	}
-	if(posix_memalign((void **)&context->audioIn, 16, 2 * context->audioFrames * sizeof(float))) {
-		fprintf(stderr, "Error allocating audio input buffer\n");
-		return 1;
-	}
-	if(posix_memalign((void **)&context->audioOut, 16, 2 * context->audioFrames * sizeof(float))) {
-		fprintf(stderr, "Error allocating audio output buffer\n");
-		return 1;
-	}
-#else
 	context->audioIn = (float *)malloc(context->audioInChannels * context->audioFrames * sizeof(float));
 	context->audioOut = (float *)calloc(1, context->audioOutChannels * context->audioFrames * sizeof(float));
 	if(context->audioIn == 0 || context->audioOut == 0) {
 		fprintf(stderr, "Error: couldn't allocate audio buffers\n");
 		return 1;
 	}
-#endif
 	
 	// Allocate analog buffers
 	if(analog_enabled) {
-#ifdef USE_NEON_FORMAT_CONVERSION
-		if(posix_memalign((void **)&context->analogIn, 16, 
-							context->analogInChannels * context->analogFrames * sizeof(float))) {
-			fprintf(stderr, "Error allocating analog input buffer\n");
-			return 1;
-		}
-		if(posix_memalign((void **)&context->analogOut, 16, 
-							context->analogOutChannels * context->analogFrames * sizeof(float))) {
-			fprintf(stderr, "Error allocating analog output buffer\n");
-			return 1;
-		}
-		last_analog_out_frame = (float *)malloc(context->analogOutChannels * sizeof(float));
-
-		if(last_analog_out_frame == 0) {
-			fprintf(stderr, "Error: couldn't allocate analog persistence buffer\n");
-			return 1;
-		}		
-#else
 		context->analogIn = (float *)malloc(context->analogInChannels * context->analogFrames * sizeof(float));
 		context->analogOut = (float *)calloc(1, context->analogOutChannels * context->analogFrames * sizeof(float));
 		last_analog_out_frame = (float *)calloc(1, context->analogOutChannels * sizeof(float));
@@ -524,7 +471,6 @@ int PRU::initialise(BelaHw newBelaHw, int pru_num, bool uniformSampleRate, int m
 			fprintf(stderr, "Error: couldn't allocate analog buffers\n");
 			return 1;
 		}
-#endif
 		
 		memset(last_analog_out_frame, 0, context->analogOutChannels * sizeof(float));
 
@@ -884,30 +830,6 @@ int PRU::testPruError()
 	}
 }
 
-static inline int16_t audioFloatToAudioRaw(float value)
-{
-	int out = value * 32768.0f;
-	if(out < -32768) out = -32768;
-	else if(out > 32767) out = 32767;
-	return out;
-}
-
-static inline int16_t analogFloatToAudioRaw(float value)
-{
-#if 0
-	// Es9080Q EVB: FS output is scaled via inverting amp to 0V:5V, we use
-	// the full range
-	return audioFloatToAudioRaw((1.f - value) * 2.f - 1.f);
-#else
-	// Cape Rev C: FS outupt is scaled via non-inverting amp to -5V:5V, but
-	// we are only using the positive range of that (15 bit) when not on Pepper
-	float out = audioFloatToAudioRaw(value);
-	if(out < 0)
-		out = 0;
-	return out;
-#endif
-}
-
 // Main loop to read and write data from/to PRU
 void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerformanceMode, BelaCpuData* cpuData)
 {
@@ -1015,31 +937,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		pruMemory->copyFromPru(pruBufferForArm);
 
 		// Convert short (16-bit) samples to float
-#ifdef USE_NEON_FORMAT_CONVERSION
-		int16_to_float_audio(2 * context->audioFrames, audio_adc_pru_buffer, context->audioIn);
-		// TODO: implement non-interlaved
-#else
-		unsigned int audioInChannels = context->audioInChannels;
-		if(interleaved)
-		{
-			for(unsigned int n = 0; n < audioInChannels * context->audioFrames; n++) {
-				context->audioIn[n] = (float)audioInRaw[n] / 32768.0f;
-			}
-		}
-		else
-		{
-			for(unsigned int f = 0; f < context->audioFrames; ++f)
-			{
-				for(unsigned int c = 0; c < audioInChannels; ++c)
-				{
-					unsigned int srcIdx = f * context->audioInChannels + c;
-					unsigned int dstIdx = c * context->audioFrames + f;
-					float value = (float)audioInRaw[srcIdx] / 32768.0f;
-					context->audioIn[dstIdx] = value;
-				}
-			}
-		}
-#endif /* defined USE_NEON_FORMAT_CONVERSION */
+		SampleConversion::audioRawToFloat(context->audioIn, audioInRaw, context->audioFrames, context->audioInChannels, interleaved);
 		if(BelaHw_CtagBeast == belaHw || BelaHw_CtagBeastBela == belaHw)
 		{
 			// on the input data line we get:
@@ -1051,26 +949,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 			// For historical reasons, we want them to be all in the same
 			// order, with secondary codec's channels first. So here we
 			// swap the inputs
-			for(unsigned int f = 0; f < context->audioFrames; ++f)
-			{
-				for(unsigned int c = 0; c < audioInChannels / 2; ++c)
-				{
-					size_t offset0;
-					size_t offset1;
-					if(interleaved)
-					{
-						offset0 = context->audioInChannels * f + c;
-						offset1 = context->audioInChannels * f + c + context->audioInChannels / 2;
-					} else {
-						offset0 = context->audioFrames * c + f;
-						offset1 = context->audioFrames * (c + context->audioInChannels / 2) + f;
-					}
-					float valueA = context->audioIn[offset1];
-					float valueB = context->audioIn[offset0];
-					context->audioIn[offset0] = valueA;
-					context->audioIn[offset1] = valueB;
-				}
-			}
+			SampleConversion::swapChannelHalves(context->audioIn, context->audioFrames, context->audioInChannels, interleaved);
 		}
 		
 		if(analog_enabled) {
@@ -1094,12 +973,10 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 					int multiplexerChannel = multiplexerChannelLastFrame;
 
 					for(int n = hardware_analog_frames - 1; n >= 0; n--) {
-						for(unsigned int ch = 0; ch < context->analogInChannels; ch++) {
-							 // rather than supporting all possible combinations of (non-)interleavead/(non-)uniform,
-							 // we go back to the raw samples and convert them again.
-							context->multiplexerAnalogIn[multiplexerChannel * context->analogInChannels + ch] =
-								analogInRaw[n * context->analogInChannels + ch] / 65536.f;
-						}
+						// rather than supporting all possible combinations of (non-)interleavead/(non-)uniform,
+						// we go back to the raw samples and convert them again.
+						SampleConversion::analogRawToFloat(context->multiplexerAnalogIn + multiplexerChannel * context->analogInChannels,
+								analogInRaw + n * context->analogInChannels, 1, context->analogInChannels, true);
 
 						multiplexerChannel--;
 						if(multiplexerChannel < 0)
@@ -1112,98 +989,16 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 				}
 			}
 			
-#ifdef USE_NEON_FORMAT_CONVERSION
-			// TODO: add support for different analogs_per_audio ratios
-			int16_to_float_analog(context->analogInChannels * context->analogFrames, 
-									analogInRaw, context->analogIn);
-#else
+			// Convert short (16-bit) samples to float
 			if(uniform_sample_rate && analogs_per_audio == 0.5)
-			{
-				unsigned int channels = context->analogInChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							float value = (float)analogInRaw[f * channels + c] / 65536.0f;
-							int firstFrame = channels * 2 * f + c;
-							context->analogIn[firstFrame] = value;
-							context->analogIn[firstFrame + channels] = value;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = f * channels + c;
-							unsigned int dstIdx = frames * c * 2 + f * 2;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-							context->analogIn[dstIdx + 1] = value;
-						}
-					}
-				}
-			}
+				SampleConversion::analogRawToFloat(context->analogIn, analogInRaw, hardware_analog_frames,
+						context->analogInChannels, interleaved, SampleConversion::kDuplicate);
 			else if (!uniform_sample_rate || analogs_per_audio == 1)
-			{
-				if(interleaved)
-				{
-					for(unsigned int n = 0;
-						n < context->analogInChannels * context->analogFrames;
-						++n)
-					{
-						float value = (float)analogInRaw[n] / 65536.0f;
-						context->analogIn[n] = value;
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < context->analogFrames; ++f)
-					{
-						for(unsigned int c = 0; c < context->analogInChannels; ++c)
-						{
-							unsigned int srcIdx = context->analogInChannels * f + c;
-							unsigned int dstIdx = context->analogFrames * c + f;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-						}
-					}
-				}
-			}
+				SampleConversion::analogRawToFloat(context->analogIn, analogInRaw, context->analogFrames,
+						context->analogInChannels, interleaved, SampleConversion::kOneToOne);
 			else if (uniform_sample_rate && analogs_per_audio == 2)
-			{
-				unsigned int channels = context->analogInChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							float value = (float)analogInRaw[f * channels + c] / 65536.0f;
-							context->analogIn[(f / 2) * channels + c] = value;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = f * channels + c;
-							unsigned int dstIdx = c * (frames / 2) + f / 2;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-						}
-					}
-				}
-			}
+				SampleConversion::analogRawToFloat(context->analogIn, analogInRaw, hardware_analog_frames,
+						context->analogInChannels, interleaved, SampleConversion::kDecimate);
 			if(belaHw == BelaHw_Salt) {
 				const float analogInMax = 65535.f/65536.f;
 				for(unsigned int n = 0; n < context->analogInChannels * context->analogFrames; ++n)
@@ -1215,7 +1010,6 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 						// context->analogIn[n] = 1;
 				}
 			}
-#endif /* USE_NEON_FORMAT_CONVERSION */
 			
 			if((context->audioExpanderEnabled & 0x0000FFFF) != 0) {
 				// Audio expander enabled on at least one analog input
@@ -1367,130 +1161,22 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 			}
 
 			// Convert float back to short for SPI output
-#ifdef USE_NEON_FORMAT_CONVERSION
-			float_to_int16_analog(context->analogOutChannels * context->analogFrames, 
-								  context->analogOut, dac_pru_buffer);
-#else // USE_NEON_FORMAT_CONVERSION
 			if(analog_out_is_audio)
 			{
-				// currently sending to PRU all samples, despite the fact that when
-				// running analog at half sampling rate, we could actually
-				// interpolate/ZOH in the PRU and avoid extra memory copy
-				// TODO: no support here for running analogs at double sample rate
-				const unsigned int div = context->audioFrames == context->analogFrames ? 1 : 2;
 				const unsigned int minCommonChannels = context->audioOutChannels < context->analogOutChannels ? context->audioOutChannels : context->analogOutChannels;
-				for(unsigned int n = 0; n < context->audioFrames; ++n) // NOTE: audioFrames
-				{
-					unsigned int analogN = n / div;
-					for(unsigned int c = 0; c < context->analogOutChannels; ++c)
-					{
-						unsigned int srcIdx = interleaved ? analogN * context->analogOutChannels + c : c * context->analogFrames + n;
-						// we assume that there are two seralizers, with audio out on the first one and analog out on the second one
-						unsigned int audioOutC = c < minCommonChannels ? c * minCommonChannels + 1 : c + minCommonChannels;
-						unsigned int dstIdx = n * pru_audio_out_channels + audioOutC;
-						audioOutRaw[dstIdx] = analogFloatToAudioRaw(context->analogOut[srcIdx]);
-					}
-				}
-			} else if(uniform_sample_rate && analogs_per_audio == 0.5)
-			{
-				unsigned int channels = context->analogOutChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							int out = context->analogOut[f * channels * 2 + c] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[f * channels + c] = (uint16_t)out;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = c * frames * 2 + f * 2;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-						}
-					}
-				}
+				SampleConversion::analogFloatToAudioRaw(audioOutRaw, context->analogOut, context->audioFrames,
+						context->analogFrames, context->analogOutChannels, interleaved,
+						pru_audio_out_channels, minCommonChannels);
 			}
+			else if(uniform_sample_rate && analogs_per_audio == 0.5)
+				SampleConversion::analogFloatToRaw(analogOutRaw, context->analogOut, hardware_analog_frames,
+						context->analogOutChannels, interleaved, SampleConversion::kDecimate);
 			else if(!uniform_sample_rate || analogs_per_audio == 1)
-			{
-				unsigned int frames = context->analogFrames;
-				unsigned int channels = context->analogOutChannels;
-				if(interleaved)
-				{
-					for(unsigned int n = 0; n < frames * channels; ++n)
-					{
-						int out = context->analogOut[n] * 65536.0f;
-						if(out < 0) out = 0;
-						else if(out > 65535) out = 65535;
-						analogOutRaw[n] = (uint16_t)out;
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = c * frames + f;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-						}
-					}
-				}
-			}
+				SampleConversion::analogFloatToRaw(analogOutRaw, context->analogOut, context->analogFrames,
+						context->analogOutChannels, interleaved, SampleConversion::kOneToOne);
 			else if(uniform_sample_rate && analogs_per_audio == 2)
-			{
-				unsigned int channels = context->analogOutChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							int out = context->analogOut[f * channels / 2 + c] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							unsigned int firstFrame = f * channels + c;
-							analogOutRaw[firstFrame] = (uint16_t)out;
-							analogOutRaw[firstFrame + channels] = (uint16_t)out;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = frames / 2 * c + f / 2;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-							analogOutRaw[dstIdx + channels] = (uint16_t)out;
-						}
-					}
-				}
-			}
-#endif /* USE_NEON_FORMAT_CONVERSION */
+				SampleConversion::analogFloatToRaw(analogOutRaw, context->analogOut, hardware_analog_frames,
+						context->analogOutChannels, interleaved, SampleConversion::kDuplicate);
 		}
 
 		if(digital_enabled) { // keep track of past digital values
@@ -1510,24 +1196,13 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		}
 
 		// Convert float back to short for audio
-#ifdef USE_NEON_FORMAT_CONVERSION
-		float_to_int16_audio(2 * context->audioFrames, context->audioOut, audio_dac_pru_buffer);
-#else	
 		const bool handleSerialisersSplit = analog_out_is_audio;
 		const unsigned int minCommonChannelMult = handleSerialisersSplit ?
 			(context->audioOutChannels < context->analogOutChannels ? context->audioOutChannels : context->analogOutChannels)
 			: 1;
-		for(unsigned int n = 0; n < context->audioFrames; ++n)
-		{
-			for(unsigned int c = 0; c < context->audioOutChannels; ++c)
-			{
-				unsigned int srcIdx = interleaved ? n * context->audioOutChannels + c : c * context->audioFrames + n;
-				// we assume that the audio serialiser is first and the analog as audio serialiser is second
-				unsigned int dstIdx = n * pru_audio_out_channels + c * minCommonChannelMult;
-				audioOutRaw[dstIdx] = audioFloatToAudioRaw(context->audioOut[srcIdx]);
-			}
-		}
-#endif /* USE_NEON_FORMAT_CONVERSION */
+		// we assume that the audio serialiser is first and the analog as audio serialiser is second
+		SampleConversion::audioFloatToRaw(audioOutRaw, context->audioOut, context->audioFrames,
+				context->audioOutChannels, interleaved, pru_audio_out_channels, minCommonChannelMult);
 		pruMemory->copyToPru(pruBufferForArm);
 
 		// Check for underruns by comparing the number of samples reported
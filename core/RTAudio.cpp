@@ -739,7 +739,8 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	{
 		gFifoContent = 0;
 		gBcf = new BelaContextFifo;
-		if(!(gUserContext = gBcf->setup((BelaContext*)&gContext, gFifoFactor)))
+		BelaContextFifo::backend_t backend = settings->lockFreeFifo ? BelaContextFifo::kBackendRing : BelaContextFifo::kBackendMqueue;
+		if(!(gUserContext = gBcf->setup((BelaContext*)&gContext, gFifoFactor, backend)))
 		{
 			fprintf(stderr, "Error: unable to initialise BelaContextFifo\n");
 			return 1;
@@ -835,22 +836,47 @@ void fifoRender(BelaContext* context, void* userData)
 	gBcf->push(BelaContextFifo::kToLong, context);
 	++gFifoContent;
 	InternalBelaContext* rctx = nullptr;
+	const bool lockFree = BelaContextFifo::kBackendRing == gBcf->getBackend();
+	bool late = false; // an underrun has been counted for this block
 	// only start reading when the FIFO is "full" to its nominal level:
 	// the 2 * is because of roundtrip.
 	// If we were reading unconditionally, we may obtain a smaller roundtrip
 	// to begin with, depending on CPU load, but it may increase when an
-	// "underrun" happens in the fifoLoop thread (currently undetected).
+	// "underrun" happens in the fifoLoop thread.
 	while(gFifoContent >= gFifoFactor * 2 && !Bela_stopRequested())
 	{
-		rctx = (InternalBelaContext*)gBcf->pop(BelaContextFifo::kToShort);
+		rctx = (InternalBelaContext*)gBcf->pop(BelaContextFifo::kToShort, 100, !late);
 		if(rctx) {
 			--gFifoContent;
+			late = false;
+		} else if(lockFree) {
+			// if a ctx was not ready, it means that the user's
+			// render function took too long to execute (i.e.:
+			// underrun). Rather than waiting for it, we output
+			// silence for this block. The late context will be
+			// discarded next time around, when the loop above
+			// drains the fifo back to its nominal level.
+			if(gContext.flags & BELA_FLAG_DETECT_UNDERRUNS)
+				rt_fprintf(stderr, "Fifo underrun detected: %u blocks dropped so far\n", gBcf->getUnderruns(BelaContextFifo::kToShort));
+			memset(context->audioOut, 0, context->audioFrames * context->audioOutChannels * sizeof(context->audioOut[0]));
+			// analog outputs are cleared unless they are meant to
+			// hold their last value, as PRU::loop() does before
+			// calling render()
+			if(context->analogFrames && !(context->flags & BELA_FLAG_ANALOG_OUTPUTS_PERSIST))
+				memset(context->analogOut, 0, context->analogFrames * context->analogOutChannels * sizeof(context->analogOut[0]));
+			// digital outputs go low. Inputs and pin directions
+			// are left alone
+			for(unsigned int n = 0; n < context->digitalFrames; ++n)
+				context->digital[n] &= ~((~context->digital[n] & 0xffff) << 16);
+			break;
 		} else {
 			// if a ctx was not ready, it means that the user's
 			// render function took too long to execute (i.e.:
 			// underrun), so we wait for it. This will cause an
 			// underrun in the audio thread which will be detected
-			// in PRU::loop() as usual
+			// in PRU::loop() as usual. Only the first poll for
+			// this context counts as a fifo underrun
+			late = true;
 			struct timespec ts = {
 				.tv_sec = 0,
 				.tv_nsec = 5 * 1000 * 1000,
@@ -1089,6 +1115,10 @@ void Bela_cleanupAudio()
 	delete gPRU;
 	delete gAudioCodec;
 	delete gDisabledCodec;
+	if(gBcf && gRTAudioVerbose)
+		printf("Audio fifo: %u underruns, %u overruns\n",
+			gBcf->getUnderruns(BelaContextFifo::kToShort),
+			gBcf->getOverruns(BelaContextFifo::kToLong));
 	delete gBcf;
 
 	if(gAmplifierMutePin >= 0)
@@ -22,6 +22,7 @@ enum {
 	OPT_HIGH_PERFORMANCE_MODE,
 	OPT_BOARD,
 	OPT_CODEC_MODE,
+	OPT_LOCK_FREE_FIFO,
 };
 
 extern const float BELA_INVALID_GAIN = 999999;
@@ -62,6 +63,7 @@ struct option gDefaultLongOptions[] =
 	{"uniform-sample-rate", 0, NULL, OPT_UNIFORM_SAMPLE_RATE},
 	{"board", 1, NULL, OPT_BOARD},
 	{"codec-mode", 1, NULL, OPT_CODEC_MODE},
+	{"lock-free-fifo", 1, NULL, OPT_LOCK_FREE_FIFO},
 	{NULL, 0, NULL, 0}
 };
 
@@ -119,6 +121,7 @@ void Bela_defaultSettings(BelaInitSettings *settings)
 	settings->enableLED = 1;
 	settings->stopButtonPin = kBelaCapeButtonPin;
 	settings->highPerformanceMode = 0;
+	settings->lockFreeFifo = 0;
 	settings->board = BelaHw_NoHw;
 	settings->projectName = NULL;
 
@@ -351,6 +354,9 @@ int Bela_getopt_long(int argc, char * const argv[], const char *customShortOptio
 		case OPT_CODEC_MODE:
 			settings->codecMode = strdup(optarg);
 			break;
+		case OPT_LOCK_FREE_FIFO:
+			settings->lockFreeFifo = atoi(optarg);
+			break;
 		case '?':
 		default:
 			return c;
@@ -389,6 +395,7 @@ void Bela_usage()
 	std::cerr << "   --uniform-sample-rate               Internally resample the analog channels so that they match the audio sample rate\n";
 	std::cerr << "   --board val:                        Select a different board to work with\n";
 	std::cerr << "   --codec-mode val:                   A codec-specific string representing an intialisation parameter\n";
+	std::cerr << "   --lock-free-fifo val:               Set whether the audio fifo (used for large period sizes) should use a lock-free ring instead of message queues (options: 0 or 1, default: 0)\n";
 	std::cerr << "   --verbose [-v]:                     Enable verbose logging information\n";
 	std::cerr << " `changains` must be one or more `channel,gain` pairs. A negative channel number means all channels. A single value is interpreted as gain, with channel=-1\n";
 }
@@ -0,0 +1,315 @@
+#include <RenderGraph.h>
+#include "../include/xenomai_wraps.h"
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+// how many times a thread checks the barrier before going to sleep
+static constexpr unsigned int kBarrierSpins = 2000;
+
+int RenderGraph::setup(const BelaContext* context, unsigned int numThreads, unsigned int numBuses, int priority)
+{
+	cleanup();
+	this->context = context;
+	frames = context->audioFrames;
+	numAudioIn = context->audioInChannels;
+	numAudioOut = context->audioOutChannels;
+	numChannels = numAudioIn + numAudioOut + numBuses;
+	buffers.resize(numChannels * frames);
+	// more threads than cores would only get in each other's way
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores < 1)
+		cores = 1;
+	if(!numThreads || numThreads > (unsigned int)cores)
+		numThreads = cores;
+	shouldStop = false;
+	barrierCount = 0;
+	barrierGeneration = 0;
+	sleepers = std::vector<Sleeper>(numThreads);
+	for(unsigned int n = 0; n < sleepers.size(); ++n)
+	{
+		if(__wrap_sem_init(&sleepers[n].wake, 0, 0))
+		{
+			fprintf(stderr, "RenderGraph: unable to create semaphore: %d %s\n", errno, strerror(errno));
+			while(n--)
+				__wrap_sem_destroy(&sleepers[n].wake);
+			sleepers.clear();
+			return -1;
+		}
+	}
+	// the thread calling process() is one of the threads, so we only
+	// need numThreads - 1 workers. workers must not be resized once the
+	// semaphores have been initialised.
+	workers.resize(numThreads - 1);
+	for(unsigned int n = 0; n < workers.size(); ++n)
+	{
+		Worker& w = workers[n];
+		w.graph = this;
+		w.index = n;
+		w.started = false;
+		if(__wrap_sem_init(&w.start, 0, 0))
+		{
+			fprintf(stderr, "RenderGraph: unable to create semaphore: %d %s\n", errno, strerror(errno));
+			workers.resize(n);
+			return -1;
+		}
+		std::string name = "bela-graph-" + std::to_string(n + 1);
+		if(int ret = create_and_start_thread(&w.thread, name.c_str(), priority, 0, (pthread_callback_t*)workerLoop, &w))
+		{
+			fprintf(stderr, "RenderGraph: unable to start worker thread %s: %d %s\n", name.c_str(), ret, strerror(ret));
+			__wrap_sem_destroy(&w.start);
+			workers.resize(n);
+			return -1;
+		}
+		w.started = true;
+	}
+	return 0;
+}
+
+RenderGraph::~RenderGraph()
+{
+	cleanup();
+}
+
+void RenderGraph::cleanup()
+{
+	shouldStop = true;
+	for(auto& w : workers)
+	{
+		if(!w.started)
+			continue;
+		__wrap_sem_post(&w.start);
+		__wrap_pthread_join(w.thread, NULL);
+		__wrap_sem_destroy(&w.start);
+	}
+	workers.clear();
+	for(auto& s : sleepers)
+		__wrap_sem_destroy(&s.wake);
+	sleepers.clear();
+	nodes.clear();
+	stages.clear();
+	stageCursors.clear();
+}
+
+int RenderGraph::addNode(const std::string& name, Callback callback, const std::vector<Channel>& inputs, const std::vector<Channel>& outputs)
+{
+	if(!context)
+	{
+		fprintf(stderr, "RenderGraph: call setup() before adding nodes\n");
+		return -1;
+	}
+	for(auto& ch : inputs)
+	{
+		if(ch >= numChannels)
+		{
+			fprintf(stderr, "RenderGraph: node %s: input channel %u out of range\n", name.c_str(), ch);
+			return -1;
+		}
+	}
+	for(auto& ch : outputs)
+	{
+		if(ch >= numChannels)
+		{
+			fprintf(stderr, "RenderGraph: node %s: output channel %u out of range\n", name.c_str(), ch);
+			return -1;
+		}
+	}
+	Node node;
+	node.name = name;
+	node.callback = callback;
+	node.inputs = inputs;
+	node.outputs = outputs;
+	for(auto& ch : inputs)
+		node.inPtrs.push_back(buffers.data() + ch * frames);
+	for(auto& ch : outputs)
+		node.outPtrs.push_back(buffers.data() + ch * frames);
+
+	// the node has to run after all the earlier nodes it conflicts
+	// with: read-after-write, write-after-read and write-after-write
+	auto contains = [](const std::vector<Channel>& v, Channel ch) {
+		return v.end() != std::find(v.begin(), v.end(), ch);
+	};
+	node.stage = 0;
+	for(auto& other : nodes)
+	{
+		bool conflict = false;
+		for(auto& ch : node.inputs)
+			conflict |= contains(other.outputs, ch);
+		for(auto& ch : node.outputs)
+			conflict |= contains(other.outputs, ch) || contains(other.inputs, ch);
+		if(conflict)
+			node.stage = std::max(node.stage, other.stage + 1);
+	}
+	if(node.stage >= stages.size())
+		stages.resize(node.stage + 1);
+	stages[node.stage].push_back(nodes.size());
+	nodes.push_back(node);
+	stageCursors = std::vector<std::atomic<unsigned int>>(stages.size());
+	return nodes.size() - 1;
+}
+
+void RenderGraph::process(BelaContext* context)
+{
+	bool interleaved = context->flags & BELA_FLAG_INTERLEAVED;
+	for(unsigned int c = 0; c < numAudioIn; ++c)
+	{
+		float* in = buffers.data() + audioIn(c) * frames;
+		for(unsigned int n = 0; n < frames; ++n)
+			in[n] = interleaved ? audioRead(context, n, c) : audioReadNI(context, n, c);
+	}
+	// clear outputs and buses
+	memset(buffers.data() + audioOut(0) * frames, 0, (numChannels - numAudioIn) * frames * sizeof(buffers[0]));
+
+	for(auto& cursor : stageCursors)
+		cursor.store(0, std::memory_order_relaxed);
+	processContext = context;
+	// the semaphore post has release semantics, so the workers will see
+	// the above writes.
+	for(auto& w : workers)
+		__wrap_sem_post(&w.start);
+	runStages(workers.size());
+
+	for(unsigned int c = 0; c < numAudioOut; ++c)
+	{
+		const float* out = buffers.data() + audioOut(c) * frames;
+		for(unsigned int n = 0; n < frames; ++n)
+		{
+			if(interleaved)
+				audioWrite(context, n, c, out[n]);
+			else
+				audioWriteNI(context, n, c, out[n]);
+		}
+	}
+}
+
+void RenderGraph::runStages(unsigned int thread)
+{
+	for(unsigned int s = 0; s < stages.size(); ++s)
+	{
+		const std::vector<unsigned int>& stage = stages[s];
+		// each thread grabs the next node that hasn't been run yet,
+		// so that the load is balanced even if nodes have different
+		// costs
+		unsigned int idx;
+		while((idx = stageCursors[s].fetch_add(1, std::memory_order_relaxed)) < stage.size())
+		{
+			Node& node = nodes[stage[idx]];
+			node.callback(processContext, node.inPtrs.data(), node.outPtrs.data());
+		}
+		barrier(thread);
+	}
+}
+
+void RenderGraph::barrier(unsigned int thread)
+{
+	const unsigned int numThreads = getNumThreads();
+	if(1 == numThreads)
+		return;
+	unsigned int generation = barrierGeneration.load(std::memory_order_acquire);
+	if(barrierCount.fetch_add(1, std::memory_order_acq_rel) + 1 == numThreads)
+	{
+		// last one to arrive: release the others, waking up those that
+		// went to sleep
+		barrierCount.store(0, std::memory_order_relaxed);
+		barrierGeneration.fetch_add(1, std::memory_order_seq_cst);
+		for(auto& s : sleepers)
+		{
+			if(s.sleeping.exchange(false, std::memory_order_seq_cst))
+				__wrap_sem_post(&s.wake);
+		}
+		return;
+	}
+	// all threads are usually busy on the same block on separate cores,
+	// so the wait is expected to be short: spin for a while. If the
+	// thread we are waiting for has been preempted, though, spinning
+	// could keep it from running, so then go to sleep.
+	for(unsigned int n = 0; n < kBarrierSpins; ++n)
+	{
+		if(barrierGeneration.load(std::memory_order_acquire) != generation)
+			return;
+	}
+	Sleeper& s = sleepers[thread];
+	s.sleeping.store(true, std::memory_order_seq_cst);
+	if(barrierGeneration.load(std::memory_order_seq_cst) != generation)
+	{
+		// released in the meantime. If the last thread has already
+		// cleared our flag, it is also posting, so we have to consume it
+		if(s.sleeping.exchange(false, std::memory_order_seq_cst))
+			return;
+	}
+	while(__wrap_sem_wait(&s.wake) && EINTR == errno)
+		;
+}
+
+void* RenderGraph::workerLoop(void* arg)
+{
+	Worker* w = (Worker*)arg;
+	RenderGraph* that = w->graph;
+	while(1)
+	{
+		if(__wrap_sem_wait(&w->start))
+		{
+			if(EINTR == errno)
+				continue;
+			break;
+		}
+		if(that->shouldStop)
+			break;
+		that->runStages(w->index);
+	}
+	return NULL;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <BelaContextSplitter.h>
+
+bool RenderGraph::test()
+{
+	InternalBelaContext ctx;
+	memset((void*)&ctx, 0, sizeof(ctx));
+	ctx.audioFrames = 16;
+	ctx.audioInChannels = 2;
+	ctx.audioOutChannels = 2;
+	ctx.flags = BELA_FLAG_INTERLEAVED;
+	BelaContextSplitter::contextAllocate(&ctx);
+	for(unsigned int n = 0; n < ctx.audioFrames * ctx.audioInChannels; ++n)
+		ctx.audioIn[n] = n;
+
+	// nodes get the context passed to process()
+	InternalBelaContext processCtx = ctx;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	for(unsigned int numThreads = 1; numThreads <= 3; ++numThreads)
+	{
+		RenderGraph graph;
+		assert(0 == graph.setup((BelaContext*)&ctx, numThreads, 2));
+		assert(std::min<long>(numThreads, cores) == graph.getNumThreads());
+		auto gain = [&processCtx](float g) {
+			return [g, &processCtx](const BelaContext* context, const float* const* in, float* const* out) {
+				assert((const BelaContext*)&processCtx == context);
+				for(unsigned int n = 0; n < context->audioFrames; ++n)
+					out[0][n] += in[0][n] * g;
+			};
+		};
+		// two independent chains, mixed into the first output
+		assert(0 == graph.addNode("a", gain(2), {graph.audioIn(0)}, {graph.bus(0)}));
+		assert(1 == graph.addNode("b", gain(3), {graph.audioIn(1)}, {graph.bus(1)}));
+		assert(2 == graph.addNode("c", gain(1), {graph.bus(0)}, {graph.audioOut(0)}));
+		assert(3 == graph.addNode("d", gain(1), {graph.bus(1)}, {graph.audioOut(0)}));
+		assert(4 == graph.addNode("e", gain(-1), {graph.audioIn(0)}, {graph.audioOut(1)}));
+		assert(graph.addNode("f", gain(1), {100}, {graph.audioOut(1)}) < 0);
+		assert(3 == graph.getNumStages());
+		for(unsigned int k = 0; k < 4; ++k)
+		{
+			graph.process((BelaContext*)&processCtx);
+			for(unsigned int n = 0; n < ctx.audioFrames; ++n)
+			{
+				float in0 = ctx.audioIn[n * 2];
+				float in1 = ctx.audioIn[n * 2 + 1];
+				assert(ctx.audioOut[n * 2] == in0 * 2 + in1 * 3);
+				assert(ctx.audioOut[n * 2 + 1] == -in0);
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,602 @@
+#include <SampleConversion.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SAMPLE_CONVERSION_SIMD
+typedef float32x4_t v4f;
+static inline v4f vLoad(const float* p) { return vld1q_f32(p); }
+static inline void vStore(float* p, v4f v) { vst1q_f32(p, v); }
+static inline v4f vSet(float f) { return vdupq_n_f32(f); }
+static inline v4f vMul(v4f a, v4f b) { return vmulq_f32(a, b); }
+static inline v4f vClamp(v4f v, v4f lo, v4f hi) { return vminq_f32(vmaxq_f32(v, lo), hi); }
+static inline v4f vLoadRaw(const int16_t* p) { return vcvtq_f32_s32(vmovl_s16(vld1_s16(p))); }
+static inline v4f vLoadRaw(const uint16_t* p) { return vcvtq_f32_u32(vmovl_u16(vld1_u16(p))); }
+// these expect values that have already been clamped to the range of the
+// destination type
+static inline void vStoreRaw(int16_t* p, v4f v) { vst1_s16(p, vmovn_s32(vcvtq_s32_f32(v))); }
+static inline void vStoreRaw(uint16_t* p, v4f v) { vst1_u16(p, vmovn_u32(vcvtq_u32_f32(v))); }
+static inline void vTranspose(v4f& a, v4f& b, v4f& c, v4f& d)
+{
+	float32x4x2_t ab = vtrnq_f32(a, b); // a0 b0 a2 b2 | a1 b1 a3 b3
+	float32x4x2_t cd = vtrnq_f32(c, d); // c0 d0 c2 d2 | c1 d1 c3 d3
+	a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+	b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+	c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+// lo = a0 b0 a1 b1, hi = a2 b2 a3 b3
+static inline void vZip(v4f a, v4f b, v4f& lo, v4f& hi)
+{
+	float32x4x2_t z = vzipq_f32(a, b);
+	lo = z.val[0];
+	hi = z.val[1];
+}
+// even = a0 a2 b0 b2, odd = a1 a3 b1 b3
+static inline void vUnzip(v4f a, v4f b, v4f& even, v4f& odd)
+{
+	float32x4x2_t u = vuzpq_f32(a, b);
+	even = u.val[0];
+	odd = u.val[1];
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SAMPLE_CONVERSION_SIMD
+typedef __m128 v4f;
+static inline v4f vLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void vStore(float* p, v4f v) { _mm_storeu_ps(p, v); }
+static inline v4f vSet(float f) { return _mm_set1_ps(f); }
+static inline v4f vMul(v4f a, v4f b) { return _mm_mul_ps(a, b); }
+static inline v4f vClamp(v4f v, v4f lo, v4f hi) { return _mm_min_ps(_mm_max_ps(v, lo), hi); }
+static inline v4f vLoadRaw(const int16_t* p)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i*)p);
+	// sign-extend to 32 bit
+	x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+	return _mm_cvtepi32_ps(x);
+}
+static inline v4f vLoadRaw(const uint16_t* p)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i*)p);
+	x = _mm_unpacklo_epi16(x, _mm_setzero_si128());
+	return _mm_cvtepi32_ps(x);
+}
+// these expect values that have already been clamped to the range of the
+// destination type
+static inline void vStoreRaw(int16_t* p, v4f v)
+{
+	__m128i x = _mm_cvttps_epi32(v);
+	_mm_storel_epi64((__m128i*)p, _mm_packs_epi32(x, x));
+}
+static inline void vStoreRaw(uint16_t* p, v4f v)
+{
+	// SSE2 has no unsigned saturating pack: offset the values to the
+	// signed range, pack them and flip the sign bit back
+	__m128i x = _mm_sub_epi32(_mm_cvttps_epi32(v), _mm_set1_epi32(32768));
+	x = _mm_packs_epi32(x, x);
+	_mm_storel_epi64((__m128i*)p, _mm_xor_si128(x, _mm_set1_epi16((short)0x8000)));
+}
+static inline void vTranspose(v4f& a, v4f& b, v4f& c, v4f& d)
+{
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+}
+static inline void vZip(v4f a, v4f b, v4f& lo, v4f& hi)
+{
+	lo = _mm_unpacklo_ps(a, b);
+	hi = _mm_unpackhi_ps(a, b);
+}
+static inline void vUnzip(v4f a, v4f b, v4f& even, v4f& odd)
+{
+	even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+#endif
+
+using namespace SampleConversion;
+
+// Scaling and clipping for each type of raw samples
+struct AudioFormat {
+	typedef int16_t raw_t;
+	static float scale() { return 32768.f; }
+	static float minRaw() { return -32768.f; }
+	static float maxRaw() { return 32767.f; }
+};
+
+struct AnalogFormat {
+	typedef uint16_t raw_t;
+	static float scale() { return 65536.f; }
+	static float minRaw() { return 0; }
+	static float maxRaw() { return 65535.f; }
+};
+
+// analog outputs sent to an audio DAC.
+// Cape Rev C: FS outupt is scaled via non-inverting amp to -5V:5V, but
+// we are only using the positive range of that (15 bit) when not on Pepper
+// (Es9080Q EVB would instead be scaled via inverting amp to 0V:5V and use
+// the full range)
+struct AnalogAsAudioFormat {
+	typedef int16_t raw_t;
+	static float scale() { return 32768.f; }
+	static float minRaw() { return 0; }
+	static float maxRaw() { return 32767.f; }
+};
+
+template <class F>
+static inline float toFloat(typename F::raw_t raw)
+{
+	return (float)raw / F::scale();
+}
+
+// we clip before converting to integer, so that out-of-range values
+// give well-defined results
+template <class F>
+static inline typename F::raw_t toRaw(float value)
+{
+	value *= F::scale();
+	if(value < F::minRaw())
+		value = F::minRaw();
+	else if(value > F::maxRaw())
+		value = F::maxRaw();
+	return (typename F::raw_t)(int)value;
+}
+
+#ifdef SAMPLE_CONVERSION_SIMD
+template <class F>
+static inline v4f vToFloat(const typename F::raw_t* raw)
+{
+	// scale() is a power of two, so multiplying by its reciprocal is
+	// exactly the same as dividing by it
+	return vMul(vLoadRaw(raw), vSet(1.f / F::scale()));
+}
+
+template <class F>
+static inline void vToRaw(typename F::raw_t* raw, v4f value)
+{
+	vStoreRaw(raw, vClamp(vMul(value, vSet(F::scale())), vSet(F::minRaw()), vSet(F::maxRaw())));
+}
+
+// store 4 consecutive frames of a channel, optionally writing each of them
+// twice
+static inline void vStoreFrames(float* dst, v4f v, bool duplicate)
+{
+	if(duplicate)
+	{
+		v4f lo, hi;
+		vZip(v, v, lo, hi);
+		vStore(dst, lo);
+		vStore(dst + 4, hi);
+	} else
+		vStore(dst, v);
+}
+#endif /* SAMPLE_CONVERSION_SIMD */
+
+template <class F>
+static void toFloatContiguous(float* dst, const typename F::raw_t* src, unsigned int n)
+{
+	unsigned int i = 0;
+#ifdef SAMPLE_CONVERSION_SIMD
+	for(; i + 4 <= n; i += 4)
+		vStore(dst + i, vToFloat<F>(src + i));
+#endif /* SAMPLE_CONVERSION_SIMD */
+	for(; i < n; ++i)
+		dst[i] = toFloat<F>(src[i]);
+}
+
+template <class F>
+static void toRawContiguous(typename F::raw_t* dst, const float* src, unsigned int n)
+{
+	unsigned int i = 0;
+#ifdef SAMPLE_CONVERSION_SIMD
+	for(; i + 4 <= n; i += 4)
+		vToRaw<F>(dst + i, vLoad(src + i));
+#endif /* SAMPLE_CONVERSION_SIMD */
+	for(; i < n; ++i)
+		dst[i] = toRaw<F>(src[i]);
+}
+
+template <class F>
+static void rawToFloat(float* dst, const typename F::raw_t* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio)
+{
+	const bool duplicate = kDuplicate == ratio;
+	// distance between used frames in src
+	const unsigned int srcStep = kDecimate == ratio ? 2 : 1;
+	// number of frames read from src
+	const unsigned int usedFrames = rawFrames / srcStep;
+	// number of frames written to dst for each frame read from src
+	const unsigned int dstMult = duplicate ? 2 : 1;
+	const unsigned int dstFrames = usedFrames * dstMult;
+	if(interleaved)
+	{
+		if(kOneToOne == ratio)
+		{
+			toFloatContiguous<F>(dst, src, rawFrames * channels);
+			return;
+		}
+		for(unsigned int f = 0; f < usedFrames; ++f)
+		{
+			float* d = dst + f * dstMult * channels;
+			toFloatContiguous<F>(d, src + f * srcStep * channels, channels);
+			if(duplicate)
+				memcpy(d + channels, d, channels * sizeof(float));
+		}
+		return;
+	}
+	unsigned int f = 0;
+#ifdef SAMPLE_CONVERSION_SIMD
+	if(0 == channels % 4)
+	{
+		// transpose tiles of 4 frames by 4 channels
+		const unsigned int rowStride = srcStep * channels;
+		for(; f + 4 <= usedFrames; f += 4)
+		{
+			const typename F::raw_t* s = src + f * rowStride;
+			for(unsigned int c = 0; c < channels; c += 4)
+			{
+				v4f r0 = vToFloat<F>(s + c);
+				v4f r1 = vToFloat<F>(s + rowStride + c);
+				v4f r2 = vToFloat<F>(s + 2 * rowStride + c);
+				v4f r3 = vToFloat<F>(s + 3 * rowStride + c);
+				vTranspose(r0, r1, r2, r3);
+				float* d = dst + c * dstFrames + f * dstMult;
+				vStoreFrames(d, r0, duplicate);
+				vStoreFrames(d + dstFrames, r1, duplicate);
+				vStoreFrames(d + 2 * dstFrames, r2, duplicate);
+				vStoreFrames(d + 3 * dstFrames, r3, duplicate);
+			}
+		}
+	}
+	else if(2 == channels && kDecimate != ratio)
+	{
+		for(; f + 4 <= usedFrames; f += 4)
+		{
+			v4f c0, c1;
+			vUnzip(vToFloat<F>(src + f * 2), vToFloat<F>(src + f * 2 + 4), c0, c1);
+			vStoreFrames(dst + f * dstMult, c0, duplicate);
+			vStoreFrames(dst + dstFrames + f * dstMult, c1, duplicate);
+		}
+	}
+#endif /* SAMPLE_CONVERSION_SIMD */
+	// leftover frames and layouts that don't fit in vectors
+	for(; f < usedFrames; ++f)
+	{
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			float value = toFloat<F>(src[f * srcStep * channels + c]);
+			float* d = dst + c * dstFrames + f * dstMult;
+			d[0] = value;
+			if(duplicate)
+				d[1] = value;
+		}
+	}
+}
+
+template <class F>
+static void floatToRaw(typename F::raw_t* dst, const float* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio, unsigned int dstChannels, unsigned int channelStride)
+{
+	const bool duplicate = kDuplicate == ratio;
+	const bool decimate = kDecimate == ratio;
+	const unsigned int srcFrames = duplicate ? rawFrames / 2 : (decimate ? rawFrames * 2 : rawFrames);
+	const bool contiguous = dstChannels == channels && 1 == channelStride;
+	// the first frame of dst not yet written
+	unsigned int f = 0;
+	if(contiguous && interleaved)
+	{
+		if(kOneToOne == ratio)
+		{
+			toRawContiguous<F>(dst, src, rawFrames * channels);
+			return;
+		}
+		for(; f < rawFrames; ++f)
+		{
+			unsigned int sf = duplicate ? f / 2 : f * 2;
+			toRawContiguous<F>(dst + f * channels, src + sf * channels, channels);
+		}
+		return;
+	}
+#ifdef SAMPLE_CONVERSION_SIMD
+	if(contiguous && 0 == channels % 4)
+	{
+		// transpose tiles of 4 frames by 4 channels. k is the first
+		// frame of the tile, in src for kOneToOne and kDuplicate, in
+		// dst for kDecimate.
+		unsigned int k = 0;
+		const unsigned int units = duplicate ? rawFrames / 2 : rawFrames;
+		const unsigned int dstMult = duplicate ? 2 : 1;
+		for(; k + 4 <= units; k += 4)
+		{
+			for(unsigned int c = 0; c < channels; c += 4)
+			{
+				v4f r[4];
+				for(unsigned int i = 0; i < 4; ++i)
+				{
+					const float* s = src + (c + i) * srcFrames;
+					if(decimate)
+					{
+						v4f odd;
+						vUnzip(vLoad(s + 2 * k), vLoad(s + 2 * k + 4), r[i], odd);
+					} else
+						r[i] = vLoad(s + k);
+				}
+				vTranspose(r[0], r[1], r[2], r[3]);
+				for(unsigned int i = 0; i < 4; ++i)
+				{
+					typename F::raw_t* d = dst + (k + i) * dstMult * channels + c;
+					vToRaw<F>(d, r[i]);
+					if(duplicate)
+						vToRaw<F>(d + channels, r[i]);
+				}
+			}
+		}
+		f = k * dstMult;
+	}
+	else if(contiguous && 2 == channels && kOneToOne == ratio)
+	{
+		for(; f + 4 <= rawFrames; f += 4)
+		{
+			v4f lo, hi;
+			vZip(vLoad(src + f), vLoad(src + srcFrames + f), lo, hi);
+			vToRaw<F>(dst + f * 2, lo);
+			vToRaw<F>(dst + f * 2 + 4, hi);
+		}
+	}
+#endif /* SAMPLE_CONVERSION_SIMD */
+	// leftover frames and layouts that don't fit in vectors
+	for(; f < rawFrames; ++f)
+	{
+		unsigned int sf = duplicate ? f / 2 : (decimate ? f * 2 : f);
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = interleaved ? sf * channels + c : c * srcFrames + sf;
+			dst[f * dstChannels + c * channelStride] = toRaw<F>(src[srcIdx]);
+		}
+	}
+}
+
+static void swapRegions(float* a, float* b, unsigned int n)
+{
+	unsigned int i = 0;
+#ifdef SAMPLE_CONVERSION_SIMD
+	for(; i + 4 <= n; i += 4)
+	{
+		v4f x = vLoad(a + i);
+		v4f y = vLoad(b + i);
+		vStore(a + i, y);
+		vStore(b + i, x);
+	}
+#endif /* SAMPLE_CONVERSION_SIMD */
+	for(; i < n; ++i)
+	{
+		float tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+void SampleConversion::audioRawToFloat(float* dst, const int16_t* src, unsigned int frames, unsigned int channels, bool interleaved)
+{
+	rawToFloat<AudioFormat>(dst, src, frames, channels, interleaved, kOneToOne);
+}
+
+void SampleConversion::audioFloatToRaw(int16_t* dst, const float* src, unsigned int frames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int channelStride)
+{
+	floatToRaw<AudioFormat>(dst, src, frames, channels, interleaved, kOneToOne, dstChannels, channelStride);
+}
+
+void SampleConversion::analogRawToFloat(float* dst, const uint16_t* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio)
+{
+	rawToFloat<AnalogFormat>(dst, src, rawFrames, channels, interleaved, ratio);
+}
+
+void SampleConversion::analogFloatToRaw(uint16_t* dst, const float* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio)
+{
+	floatToRaw<AnalogFormat>(dst, src, rawFrames, channels, interleaved, ratio, channels, 1);
+}
+
+void SampleConversion::analogFloatToAudioRaw(int16_t* dst, const float* src, unsigned int audioFrames, unsigned int analogFrames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int minCommonChannels)
+{
+	// the channel mapping is specific to the hardware and the channel
+	// count is small, so we don't bother vectorising this.
+	// currently sending to PRU all samples, despite the fact that when
+	// running analog at half sampling rate, we could actually
+	// interpolate/ZOH in the PRU and avoid extra memory copy
+	// TODO: no support here for running analogs at double sample rate
+	const unsigned int div = audioFrames == analogFrames ? 1 : 2;
+	for(unsigned int n = 0; n < audioFrames; ++n)
+	{
+		unsigned int analogN = n / div;
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = interleaved ? analogN * channels + c : c * analogFrames + analogN;
+			// we assume that there are two seralizers, with audio out on the first one and analog out on the second one
+			unsigned int audioOutC = c < minCommonChannels ? c * minCommonChannels + 1 : c + minCommonChannels;
+			dst[n * dstChannels + audioOutC] = toRaw<AnalogAsAudioFormat>(src[srcIdx]);
+		}
+	}
+}
+
+void SampleConversion::swapChannelHalves(float* buf, unsigned int frames, unsigned int channels, bool interleaved)
+{
+	const unsigned int half = channels / 2;
+	if(interleaved)
+	{
+		for(unsigned int f = 0; f < frames; ++f)
+			swapRegions(buf + f * channels, buf + f * channels + half, half);
+	} else
+		swapRegions(buf, buf + half * frames, half * frames);
+}
+
+void SampleConversion::Reference::audioRawToFloat(float* dst, const int16_t* src, unsigned int frames, unsigned int channels, bool interleaved)
+{
+	for(unsigned int f = 0; f < frames; ++f)
+	{
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = f * channels + c;
+			unsigned int dstIdx = interleaved ? srcIdx : c * frames + f;
+			dst[dstIdx] = (float)src[srcIdx] / 32768.0f;
+		}
+	}
+}
+
+void SampleConversion::Reference::audioFloatToRaw(int16_t* dst, const float* src, unsigned int frames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int channelStride)
+{
+	for(unsigned int f = 0; f < frames; ++f)
+	{
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = interleaved ? f * channels + c : c * frames + f;
+			unsigned int dstIdx = f * dstChannels + c * channelStride;
+			float out = src[srcIdx] * 32768.0f;
+			if(out < -32768) out = -32768;
+			else if(out > 32767) out = 32767;
+			dst[dstIdx] = (int)out;
+		}
+	}
+}
+
+void SampleConversion::Reference::analogRawToFloat(float* dst, const uint16_t* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio)
+{
+	const unsigned int dstFrames = kDuplicate == ratio ? rawFrames * 2 : (kDecimate == ratio ? rawFrames / 2 : rawFrames);
+	for(unsigned int f = 0; f < dstFrames; ++f)
+	{
+		unsigned int rf = kDuplicate == ratio ? f / 2 : (kDecimate == ratio ? f * 2 : f);
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = rf * channels + c;
+			unsigned int dstIdx = interleaved ? f * channels + c : c * dstFrames + f;
+			dst[dstIdx] = (float)src[srcIdx] / 65536.0f;
+		}
+	}
+}
+
+void SampleConversion::Reference::analogFloatToRaw(uint16_t* dst, const float* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio)
+{
+	const unsigned int srcFrames = kDuplicate == ratio ? rawFrames / 2 : (kDecimate == ratio ? rawFrames * 2 : rawFrames);
+	for(unsigned int f = 0; f < rawFrames; ++f)
+	{
+		unsigned int sf = kDuplicate == ratio ? f / 2 : (kDecimate == ratio ? f * 2 : f);
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx = interleaved ? sf * channels + c : c * srcFrames + sf;
+			float out = src[srcIdx] * 65536.0f;
+			if(out < 0) out = 0;
+			else if(out > 65535) out = 65535;
+			dst[f * channels + c] = (int)out;
+		}
+	}
+}
+
+void SampleConversion::Reference::swapChannelHalves(float* buf, unsigned int frames, unsigned int channels, bool interleaved)
+{
+	for(unsigned int f = 0; f < frames; ++f)
+	{
+		for(unsigned int c = 0; c < channels / 2; ++c)
+		{
+			size_t offset0;
+			size_t offset1;
+			if(interleaved)
+			{
+				offset0 = channels * f + c;
+				offset1 = channels * f + c + channels / 2;
+			} else {
+				offset0 = frames * c + f;
+				offset1 = frames * (c + channels / 2) + f;
+			}
+			float valueA = buf[offset1];
+			float valueB = buf[offset0];
+			buf[offset0] = valueA;
+			buf[offset1] = valueB;
+		}
+	}
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <vector>
+
+static float randomFloat(float min, float max)
+{
+	return min + rand() / (float)RAND_MAX * (max - min);
+}
+
+bool SampleConversion::test()
+{
+	const unsigned int maxFrames = 64;
+	const unsigned int maxChannels = 16;
+	const unsigned int maxSize = maxFrames * 2 * maxChannels;
+	std::vector<int16_t> audioRaw(maxSize);
+	std::vector<uint16_t> analogRaw(maxSize);
+	std::vector<float> floats(maxSize);
+	for(unsigned int n = 0; n < maxSize; ++n)
+	{
+		audioRaw[n] = rand();
+		analogRaw[n] = rand();
+	}
+	std::vector<float> outFloat(maxSize);
+	std::vector<float> refFloat(maxSize);
+	std::vector<int16_t> outAudio(maxSize);
+	std::vector<int16_t> refAudio(maxSize);
+	std::vector<uint16_t> outAnalog(maxSize);
+	std::vector<uint16_t> refAnalog(maxSize);
+	auto reset = [&]() {
+		// fill the outputs with the same garbage, so that we also
+		// check that nothing is written out of bounds
+		for(unsigned int n = 0; n < maxSize; ++n)
+		{
+			outFloat[n] = refFloat[n] = n;
+			outAudio[n] = refAudio[n] = n;
+			outAnalog[n] = refAnalog[n] = n;
+		}
+	};
+	auto check = [&]() {
+		assert(0 == memcmp(outFloat.data(), refFloat.data(), maxSize * sizeof(outFloat[0])));
+		assert(0 == memcmp(outAudio.data(), refAudio.data(), maxSize * sizeof(outAudio[0])));
+		assert(0 == memcmp(outAnalog.data(), refAnalog.data(), maxSize * sizeof(outAnalog[0])));
+	};
+	const unsigned int framesList[] = {1, 2, 3, 4, 7, 8, 16, 18, 32, 64};
+	const unsigned int channelsList[] = {1, 2, 3, 4, 6, 8, 10, 12, 16};
+	const FrameRatio ratios[] = {kOneToOne, kDuplicate, kDecimate};
+	for(auto frames : framesList)
+	{
+		for(auto channels : channelsList)
+		{
+			for(unsigned int in = 0; in < 2; ++in)
+			{
+				bool interleaved = in;
+				// audio, with values slightly out of range to check clipping
+				for(unsigned int n = 0; n < maxSize; ++n)
+					floats[n] = randomFloat(-1.2, 1.2);
+				reset();
+				audioRawToFloat(outFloat.data(), audioRaw.data(), frames, channels, interleaved);
+				Reference::audioRawToFloat(refFloat.data(), audioRaw.data(), frames, channels, interleaved);
+				check();
+				swapChannelHalves(outFloat.data(), frames, channels, interleaved);
+				Reference::swapChannelHalves(refFloat.data(), frames, channels, interleaved);
+				check();
+				for(unsigned int stride = 1; stride <= 2; ++stride)
+				{
+					reset();
+					audioFloatToRaw(outAudio.data(), floats.data(), frames, channels, interleaved, channels * stride, stride);
+					Reference::audioFloatToRaw(refAudio.data(), floats.data(), frames, channels, interleaved, channels * stride, stride);
+					check();
+				}
+				// analog
+				for(unsigned int n = 0; n < maxSize; ++n)
+					floats[n] = randomFloat(-0.2, 1.2);
+				for(auto ratio : ratios)
+				{
+					reset();
+					analogRawToFloat(outFloat.data(), analogRaw.data(), frames, channels, interleaved, ratio);
+					Reference::analogRawToFloat(refFloat.data(), analogRaw.data(), frames, channels, interleaved, ratio);
+					check();
+					reset();
+					analogFloatToRaw(outAnalog.data(), floats.data(), frames, channels, interleaved, ratio);
+					Reference::analogFloatToRaw(refAnalog.data(), floats.data(), frames, channels, interleaved, ratio);
+					check();
+				}
+			}
+		}
+	}
+	return true;
+}
@@ -42,7 +42,7 @@
 #include <vector>
 
 #if (defined(BELA_LIBPD_GUI) || defined(BELA_LIBPD_TRILL))
-#include <libraries/Pipe/Pipe.h>
+#include <libraries/MessageBus/MessageBus.h>
 template <typename T>
 int getIdxFromId(const char* id, std::vector<std::pair<std::string,T>>& db)
 {
@@ -59,7 +59,7 @@ int getIdxFromId(const char* id, std::vector<std::pair<std::string,T>>& db)
 #include <tuple>
 #include <libraries/Trill/Trill.h>
 AuxiliaryTask gTrillTask;
-Pipe gTrillPipe;
+MessageBus gTrillBus;
 
 static std::vector<std::string> gTrillAcks;
 static std::vector<std::pair<std::string,Trill*>> gTouchSensors;
@@ -79,7 +79,7 @@ void readTouchSensors(void*)
 			ret = touchSensor.readI2C();
 		if(!ret)
 		{
-			gTrillPipe.writeNonRt(n);
+			gTrillBus.write(0, n);
 		}
 	}
 }
@@ -88,7 +88,7 @@ void readTouchSensors(void*)
 #ifdef BELA_LIBPD_GUI
 #include <libraries/Gui/Gui.h>
 
-Pipe gGuiPipe;
+MessageBus gGuiBus;
 Gui gui;
 struct bufferDescription
 {
@@ -105,41 +105,43 @@ struct guiControlMessageHeader
 	uint32_t id;
 };
 
-bool guiControlDataCallback(JSONObject& root, void* arg)
+bool guiControlDataCallback(const JSONDocument::Value& root, void* arg)
 {
 	int ret = true;
 	for(unsigned int n = 0; n < gGuiControlBuffers.size(); ++n)
 	{
-		const auto& b = gGuiControlBuffers[n];
-		std::wstring key = JSON::s2ws(b);
-		if (root.end() != root.find(key))
+		JSONDocument::Value found = root[gGuiControlBuffers[n]];
+		if(found.isValid())
 		{
-			JSONValue* found = root[key];
 			struct guiControlMessageHeader header;
 			header.id = n;
-			char* array;
-			if(found->IsString())
+			float number;
+			const void* value;
+			if(found.isString())
 			{
-				std::string value = JSON::ws2s(found->AsString());
+				// the string stays in the document until we return
 				header.type = 's';
-				header.size = value.size();
-				array = (char*)alloca(header.size);
-				memcpy(array, value.c_str(), header.size);
-			} else if(found->IsNumber())
+				header.size = found.getStringLength();
+				value = found.asString();
+			} else if(found.isNumber())
 			{
-				float value = found->AsNumber();
+				number = found.asNumber();
 				header.type = 'f';
-				header.size = sizeof(value);
-				array = (char*)alloca(header.size);
-				memcpy(array, &value, header.size);
+				header.size = sizeof(number);
+				value = &number;
 			} else {
 				continue;
 			}
-			// do two separate reads: the pipe is datagram-based
-			// so it would be impossible to receive partial messages
-			// at the other end
-			gGuiPipe.writeNonRt(header);
-			gGuiPipe.writeNonRt(&array[0], header.size);
+			// header and value are sent as a single message. Strings
+			// are null-terminated
+			char* message = (char*)gGuiBus.reserve(0, sizeof(header) + header.size + 1);
+			if(message)
+			{
+				memcpy(message, &header, sizeof(header));
+				memcpy(message + sizeof(header), value, header.size);
+				message[sizeof(header) + header.size] = '\0';
+				gGuiBus.commit(message);
+			}
 			// we have successully parsed this message, so the
 			// default parser shouldn't when we return
 			// note: in practice there may be times when we'd want
@@ -156,10 +158,10 @@ bool guiControlDataCallback(JSONObject& root, void* arg)
 #endif // BELA_LIBPD_GUI
 #ifdef BELA_LIBPD_SERIAL
 #include <libraries/Serial/Serial.h>
-#include <libraries/Pipe/Pipe.h>
+#include <libraries/MessageBus/MessageBus.h>
 #include <string>
 
-Pipe gSerialPipe;
+MessageBus gSerialBus;
 Serial gSerial;
 std::string gSerialId;
 int gSerialEom;
@@ -177,6 +179,22 @@ struct serialMessageHeader
 	uint32_t dataSize;
 };
 
+// send the header, the ID and the data as a single message
+static void sendSerialMessage(const char* data, uint32_t dataSize)
+{
+	serialMessageHeader h = {
+		.idSize = uint32_t(strlen(gSerialId.c_str()) + 1),
+		.dataSize = dataSize,
+	};
+	char* message = (char*)gSerialBus.reserve(0, sizeof(h) + h.idSize + h.dataSize);
+	if(!message)
+		return;
+	memcpy(message, &h, sizeof(h));
+	memcpy(message + sizeof(h), gSerialId.c_str(), h.idSize);
+	memcpy(message + sizeof(h) + h.idSize, data, h.dataSize);
+	gSerialBus.commit(message);
+}
+
 void serialOutputLoop(void* arg) {
 	// TODO: implement
 }
@@ -184,9 +202,6 @@ void serialOutputLoop(void* arg) {
 void serialInputLoop(void* arg) {
 	char serialBuffer[10000];
 	unsigned int i = 0;
-	serialMessageHeader h = {
-		.idSize = strlen(gSerialId.c_str()) + 1,
-	};
 	while(!Bela_stopRequested())
 	{
 		// read from the serial port with a timeout of 100ms
@@ -194,11 +209,8 @@ void serialInputLoop(void* arg) {
 		if (ret > 0) {
 			if(gSerialEom < 0)
 			{
-				h.dataSize = ret;
 				// send everything immediately
-				gSerialPipe.writeNonRt(h);
-				gSerialPipe.writeNonRt(gSerialId.c_str(), h.idSize);
-				gSerialPipe.writeNonRt(serialBuffer, h.dataSize);
+				sendSerialMessage(serialBuffer, ret);
 			} else {
 				// find EOM in new data
 				unsigned int searchStart = i;
@@ -220,15 +232,11 @@ void serialInputLoop(void* arg) {
 					// if found, send all data till that point
 					if(found)
 					{
-						h.dataSize = n - lastSent;
-						if(h.dataSize)
-						{
-							gSerialPipe.writeNonRt(h);
-							gSerialPipe.writeNonRt(gSerialId.c_str(), h.idSize);
-							gSerialPipe.writeNonRt(serialBuffer + lastSent, h.dataSize);
-						}
+						unsigned int dataSize = n - lastSent;
+						if(dataSize)
+							sendSerialMessage(serialBuffer + lastSent, dataSize);
 						searchStart = n + 1;
-						lastSent += 1 + h.dataSize;
+						lastSent += 1 + dataSize;
 					}
 				}
 				while(found);
@@ -809,10 +817,10 @@ bool setup(BelaContext *context, void *userData)
 #ifdef BELA_LIBPD_GUI
 	gui.setup(context->projectName);
 	gui.setControlDataCallback(guiControlDataCallback, nullptr);
-	gGuiPipe.setup("guiControlPipe", 16384);
+	gGuiBus.setup(16384);
 #endif // BELA_LIBPD_GUI
 #ifdef BELA_LIBPD_SERIAL
-	gSerialPipe.setup("serialPipe", 16384);
+	gSerialBus.setup(16384);
 #endif // BELA_LIBPD_SERIAL
 	// Check Pd's version
 	int major, minor, bugfix;
@@ -997,7 +1005,7 @@ bool setup(BelaContext *context, void *userData)
 	dcm.setVerbose(false);
 #ifdef BELA_LIBPD_TRILL
 	gTrillTask = Bela_createAuxiliaryTask(readTouchSensors, 51, "touchSensorRead", NULL);
-	gTrillPipe.setup("trillPipe", 1024);
+	gTrillBus.setup(1024);
 #endif // BELA_LIBPD_TRILL
 	return true;
 }
@@ -1005,45 +1013,29 @@ bool setup(BelaContext *context, void *userData)
 void render(BelaContext *context, void *userData)
 {
 #ifdef BELA_LIBPD_GUI
-	while(gGuiControlBuffers.size()) // this won't change within the loop, but it's good not to have to use a separate flag
+	MessageBus::Message guiMessage;
+	while(gGuiBus.read(guiMessage))
 	{
-		static struct guiControlMessageHeader header;
-		static bool waitingForHeader = true;
-		if(waitingForHeader)
+		const struct guiControlMessageHeader& header = *guiMessage.as<guiControlMessageHeader>();
+		const char* payload = (const char*)(&header + 1);
+		const char* name = gGuiControlBuffers[header.id].c_str();
+		if('f' == header.type)
 		{
-			int ret = gGuiPipe.readRt(header);
-			if(1 != ret)
-				break;
-			else
-				waitingForHeader = false;
-		}
-		if(!waitingForHeader)
-		{
-			char payload[header.size];
-			int ret = gGuiPipe.readRt(&payload[0], header.size);
-			if(int(header.size) != ret)
+			if(header.size != sizeof(float))
 			{
-				break;
-			}
-			const char* name = gGuiControlBuffers[header.id].c_str();
-			if('f' == header.type)
-			{
-				if(header.size != sizeof(float))
-				{
-					rt_fprintf(stderr, "Unexpected message length for float: %u\n", header.size);
-					continue;
-				}
+				rt_fprintf(stderr, "Unexpected message length for float: %u\n", header.size);
+			} else {
 				float value = ((float*)payload)[0];
 				libpd_start_message(1);
 				libpd_add_float(value);
 				libpd_finish_message("bela_guiControl", name);
 			}
-			if('s' == header.type)
-			{
-				libpd_symbol(name, payload);
-			}
-			waitingForHeader = true;
 		}
+		if('s' == header.type)
+		{
+			libpd_symbol(name, payload);
+		}
+		gGuiBus.release(guiMessage);
 	}
 	for(auto& b : gGuiDataBuffers)
 	{
@@ -1072,106 +1064,67 @@ void render(BelaContext *context, void *userData)
 	}
 #endif // BELA_LIBPD_GUI
 #ifdef BELA_LIBPD_SERIAL
-	while(gSerialInputTask) // proxy for 'isEnabled. Using `while` so we can do early return
+	MessageBus::Message serialMessage;
+	while(gSerialInputTask && gSerialBus.read(serialMessage)) // gSerialInputTask is a proxy for 'isEnabled'
 	{
-		enum WaitingFor_t {
-			kHeader,
-			kId,
-			kData,
-		};
-		static struct serialMessageHeader h;
-		static enum WaitingFor_t waitingFor = kHeader;
-		static char id[100];
-		if(kHeader == waitingFor)
-		{
-			int ret = gSerialPipe.readRt(h);
-			if(ret <= 0)
-				break;
-			waitingFor = kId;
-		}
-		if(kId == waitingFor)
-		{
-			if(h.idSize > sizeof(id) - 1)
-				rt_fprintf(stderr, "Serial: ID too large\n");
-			else
-			{
-				int ret = gSerialPipe.readRt(id, h.idSize);
-				if(ret <= 0)
-					break;
-				if(int(h.idSize) != ret)
-				{
-					rt_fprintf(stderr, "Invalid number of bytes read from gSerialPipe. Expected: %u, got %u\n", h.idSize, ret);
-					break;
-				}
-				id[ret] = '\0'; // ensure it's null-terminated
-				waitingFor = kData;
-			}
-		}
-		if(kData == waitingFor)
+		const struct serialMessageHeader& h = *serialMessage.as<serialMessageHeader>();
+		const char* id = (const char*)(&h + 1); // null-terminated by the sender
+		// the data is modified below, so copy it out of the message
+		char data[h.dataSize + 1];
+		memcpy(data, id + h.idSize, h.dataSize);
+		data[h.dataSize] = '\0'; // ensure it's null-terminated
+		if(h.dataSize)
 		{
-			char data[h.dataSize + 1];
-			int ret = gSerialPipe.readRt(data, h.dataSize);
-			if(ret <= 0)
-				break;
-			if(int(h.dataSize) != ret)
+			const char* rec = "bela_serial";
+			if(kSerialSymbol == gSerialType)
 			{
-				rt_fprintf(stderr, "Invalid number of bytes read from gSerialPipe. Expected: %u, got %u\n", h.dataSize, ret);
-				break;
-			}
-			data[h.dataSize] = '\0'; // ensure it's null-terminated
-			if(h.dataSize)
-			{
-				const char* rec = "bela_serial";
-				if(kSerialSymbol == gSerialType)
+				libpd_symbol(rec, data);
+			} else {
+				unsigned int nTokens = 1;
+				const uint8_t separators[] = { ' ', '\0'};
+				// find number of delimiters
+				size_t start = 0;
+				for(size_t n = 0; n < sizeof(data); ++n)
 				{
-					libpd_symbol(rec, data);
-				} else {
-					unsigned int nTokens = 1;
-					const uint8_t separators[] = { ' ', '\0'};
-					// find number of delimiters
-					size_t start = 0;
-					for(size_t n = 0; n < sizeof(data); ++n)
+					for(size_t c = 0; c < sizeof(separators); ++c)
 					{
-						for(size_t c = 0; c < sizeof(separators); ++c)
+						if(separators[c] == data[n] && n != start) // exclude empty tokens
 						{
-							if(separators[c] == data[n] && n != start) // exclude empty tokens
-							{
-								start = n + 1;
-								nTokens++;
-							}
+							start = n + 1;
+							nTokens++;
 						}
 					}
-					libpd_start_message(nTokens);
-					start = 0;
-					for(size_t n = 0; n < sizeof(data); ++n)
+				}
+				libpd_start_message(nTokens);
+				start = 0;
+				for(size_t n = 0; n < sizeof(data); ++n)
+				{
+					bool end = false;
+					for(size_t c = 0; c < sizeof(separators); ++c)
 					{
-						bool end = false;
-						for(size_t c = 0; c < sizeof(separators); ++c)
+						if(separators[c] == data[n])
 						{
-							if(separators[c] == data[n])
-							{
-								if(start == n)
-									start++; // remove empty tokens
-								else
-									end = true;
-								break; // no need to check for more separators
-							}
-						}
-						if(end)
-						{
-							data[n] = '\0'; // ensure the string is null-terminated so the next line works
-							if(kSerialSymbols == gSerialType)
-								libpd_add_symbol(data + start);
-							else if (kSerialFloats == gSerialType)
-								libpd_add_float(atof(data + start));
-							start = n + 1;
+							if(start == n)
+								start++; // remove empty tokens
+							else
+								end = true;
+							break; // no need to check for more separators
 						}
 					}
-					libpd_finish_message("bela_serial", id);
+					if(end)
+					{
+						data[n] = '\0'; // ensure the string is null-terminated so the next line works
+						if(kSerialSymbols == gSerialType)
+							libpd_add_symbol(data + start);
+						else if (kSerialFloats == gSerialType)
+							libpd_add_float(atof(data + start));
+						start = n + 1;
+					}
 				}
+				libpd_finish_message("bela_serial", id);
 			}
-			waitingFor = kHeader;
 		}
+		gSerialBus.release(serialMessage);
 	}
 #endif // BELA_LIBPD_SERIAL
 #ifdef BELA_LIBPD_TRILL
@@ -1196,9 +1149,11 @@ void render(BelaContext *context, void *userData)
 	}
 	if(doTrill)
 	{
-		int idx;
-		while(gTrillPipe.readRt(idx) > 0)
+		MessageBus::Message trillMessage;
+		while(gTrillBus.read(trillMessage))
 		{
+			unsigned int idx = *trillMessage.as<unsigned int>();
+			gTrillBus.release(trillMessage);
 			Trill& touchSensor = *gTouchSensors[idx].second;
 			const char* sensorId = gTouchSensors[idx].first.c_str();
 			if(Trill::Device::NONE == touchSensor.deviceType())
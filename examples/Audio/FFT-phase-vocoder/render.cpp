@@ -13,17 +13,20 @@ Phase Vocoder
 -------------
 
 This sketch shows an implementation of a phase vocoder and builds on the previous FFT example.
-Again it uses the NE10 library, included at the top of the file.
+It uses the Fft library, which wraps the real-to-complex FFT of the NE10 library
+and provides helpers to window the input and to compute the magnitude of the
+whole spectrum at once.
 
 Read the documentation on the NE10 library [here](http://projectne10.github.io/Ne10/doc/annotated.html).
 */
 
 #include <Bela.h>
-#include <libraries/ne10/NE10.h> // NEON FFT library
+#include <libraries/Fft/Fft.h> // NEON FFT library
 #include "SampleData.h"
 #include <libraries/Midi/Midi.h>
 #include <cmath>
 #include <string.h>
+#include <vector>
 
 #define BUFFER_SIZE 16384
 
@@ -37,20 +40,17 @@ int gOutputBufferWritePointer = 0;
 int gOutputBufferReadPointer = 0;
 int gSampleCount = 0;
 
-float *gWindowBuffer;
+std::vector<float> gWindowBuffer;
 
 // -----------------------------------------------
 // These variables used internally in the example:
 int gFFTSize = 2048;
 int gHopSize = 512;
 int gPeriod = 512;
-float gFFTScaleFactor = 0;
 
 // FFT vars
-ne10_fft_cpx_float32_t* timeDomainIn;
-ne10_fft_cpx_float32_t* timeDomainOut;
-ne10_fft_cpx_float32_t* frequencyDomain;
-ne10_fft_cfg_float32_t cfg;
+Fft gFft;
+std::vector<float> gMagnitudes;
 
 // Sample info
 SampleData gSampleData;	// User defined structure to get complex data from main
@@ -130,15 +130,12 @@ bool setup(BelaContext* context, void* userData)
 	// Retrieve a parameter passed in from the initAudio() call
 	gSampleData = *(SampleData *)userData;
 
-	gFFTScaleFactor = 1.0f / (float)gFFTSize;
 	gOutputBufferWritePointer += gHopSize;
 
-	timeDomainIn = (ne10_fft_cpx_float32_t*) NE10_MALLOC (gFFTSize * sizeof (ne10_fft_cpx_float32_t));
-	timeDomainOut = (ne10_fft_cpx_float32_t*) NE10_MALLOC (gFFTSize * sizeof (ne10_fft_cpx_float32_t));
-	frequencyDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (gFFTSize * sizeof (ne10_fft_cpx_float32_t));
-	cfg = ne10_fft_alloc_c2c_float32_neon (gFFTSize);
+	if(gFft.setup(gFFTSize))
+		return false;
+	gMagnitudes.resize(gFft.getNumBins());
 
-	memset(timeDomainOut, 0, gFFTSize * sizeof (ne10_fft_cpx_float32_t));
 	memset(gOutputBuffer, 0, BUFFER_SIZE * sizeof(float));
 
 	// Allocate buffer to mirror and modify the input
@@ -146,15 +143,9 @@ bool setup(BelaContext* context, void* userData)
 	if(gInputAudio == 0)
 		return false;
 
-	// Allocate the window buffer based on the FFT size
-	gWindowBuffer = (float *)malloc(gFFTSize * sizeof(float));
-	if(gWindowBuffer == 0)
-		return false;
-
 	// Calculate a Hann window
-	for(int n = 0; n < gFFTSize; n++) {
-		gWindowBuffer[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(gFFTSize - 1)));
-	}
+	gWindowBuffer.resize(gFFTSize);
+	Fft::makeWindow(gWindowBuffer.data(), gFFTSize, Fft::kHann);
 
 	// Initialise auxiliary tasks
 	if((gFFTTask = Bela_createAuxiliaryTask(&process_fft_background, 90, "fft-calculation")) == 0)
@@ -173,35 +164,35 @@ bool setup(BelaContext* context, void* userData)
 // been assembled.
 void process_fft(float *inBuffer, int inWritePointer, float *outBuffer, int outWritePointer)
 {
-	// Copy buffer into FFT input
+	// Copy buffer into FFT input and apply the window. The input may wrap
+	// around the end of the circular buffer
 	int pointer = (inWritePointer - gFFTSize + BUFFER_SIZE) % BUFFER_SIZE;
-	for(int n = 0; n < gFFTSize; n++) {
-		timeDomainIn[n].r = (ne10_float32_t) inBuffer[pointer] * gWindowBuffer[n];
-		timeDomainIn[n].i = 0;
-
-		pointer++;
-		if(pointer >= BUFFER_SIZE)
-			pointer = 0;
-	}
+	int firstLength = std::min(gFFTSize, BUFFER_SIZE - pointer);
+	float* timeDomain = gFft.getTimeDomain();
+	Fft::applyWindow(timeDomain, inBuffer + pointer, gWindowBuffer.data(), firstLength);
+	Fft::applyWindow(timeDomain + firstLength, inBuffer, gWindowBuffer.data() + firstLength, gFFTSize - firstLength);
 
-	// Run the FFT
-	ne10_fft_c2c_1d_float32_neon (frequencyDomain, timeDomainIn, cfg, 0);
+	// Run the FFT. As the input is real, only the first half of the
+	// spectrum is computed: the rest is its complex conjugate
+	gFft.fft();
 
+	ne10_fft_cpx_float32_t* frequencyDomain = gFft.getFrequencyDomain();
+	unsigned int numBins = gFft.getNumBins();
 	switch (gEffect){
 		case kRobot :
 			// Robotise the output
-			for(int n = 0; n < gFFTSize; n++) {
-				float amplitude = sqrtf(frequencyDomain[n].r * frequencyDomain[n].r + frequencyDomain[n].i * frequencyDomain[n].i);
-				frequencyDomain[n].r = amplitude;
+			Fft::magnitude(gMagnitudes.data(), frequencyDomain, numBins);
+			for(unsigned int n = 0; n < numBins; n++) {
+				frequencyDomain[n].r = gMagnitudes[n];
 				frequencyDomain[n].i = 0;
 			}
 			break;
 		case kWhisper :
-			for(int n = 0; n < gFFTSize; n++) {
-				float amplitude = sqrtf(frequencyDomain[n].r * frequencyDomain[n].r + frequencyDomain[n].i * frequencyDomain[n].i);
+			Fft::magnitude(gMagnitudes.data(), frequencyDomain, numBins);
+			for(unsigned int n = 0; n < numBins; n++) {
 				float phase = rand()/(float)RAND_MAX * 2.f* M_PI;
-				frequencyDomain[n].r = cosf(phase) * amplitude;
-				frequencyDomain[n].i = sinf(phase) * amplitude;
+				frequencyDomain[n].r = cosf(phase) * gMagnitudes[n];
+				frequencyDomain[n].i = sinf(phase) * gMagnitudes[n];
 			}
 			break;
 		case kBypass:
@@ -210,11 +201,11 @@ void process_fft(float *inBuffer, int inWritePointer, float *outBuffer, int outW
 	}
 
 	// Run the inverse FFT
-	ne10_fft_c2c_1d_float32_neon (timeDomainOut, frequencyDomain, cfg, 1);
-	// Overlap-and-add timeDomainOut into the output buffer
+	gFft.ifft();
+	// Overlap-and-add the time-domain output into the output buffer
 	pointer = outWritePointer;
 	for(int n = 0; n < gFFTSize; n++) {
-		outBuffer[pointer] += (timeDomainOut[n].r) * gFFTScaleFactor;
+		outBuffer[pointer] += gFft.td(n);
 		if(std::isnan(outBuffer[pointer]))
 			rt_printf("outBuffer OLA\n");
 		pointer++;
@@ -281,10 +272,5 @@ void render(BelaContext* context, void* userData)
 
 void cleanup(BelaContext* context, void* userData)
 {
-	NE10_FREE(timeDomainIn);
-	NE10_FREE(timeDomainOut);
-	NE10_FREE(frequencyDomain);
-	NE10_FREE(cfg);
 	free(gInputAudio);
-	free(gWindowBuffer);
 }
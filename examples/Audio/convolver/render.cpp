@@ -12,7 +12,7 @@ http://bela.io
 Convolve a signal with an impulse response.
 ==========================================
 
-This project performs a time-domain convolution of a signal with an impulse
+This project performs a zero-latency convolution of a signal with an impulse
 response. Both the input signal and the inpulse response are loaded from audio
 files located in the project folder.
 By changing the global variable gProcessInput, you can decide to process through
@@ -34,15 +34,19 @@ const std::string gAudioFile = "longsample.wav";
 const bool gProcessInput = true; // set to true to process the live input instead
 const unsigned int gInputChannel = 0; // which channel to process in that case
 
-// max length of the impulse response. Values above 8000 will make the Bela IDE
-// responsive. The maximum value is around 12000, but it requires running the
-// program with --high-performance-mode. When the IDE becomes unresponsive, use
-// the button on the cape to stop the running program.
-const unsigned int gMaxIrLength = 5000;
+// max length of the impulse response. The convolver uses a partitioned FFT
+// convolution, so impulse responses several seconds long can be used. Pass
+// ConvolverChannel::kFir to convolver.setup() to use a plain time-domain
+// FIR filter instead: in that case, values above 8000 will make the Bela IDE
+// unresponsive. When the IDE becomes unresponsive, use the button on the cape
+// to stop the running program.
+const unsigned int gMaxIrLength = 0; // 0 means no limit
 
 bool setup(BelaContext *context, void *userData)
 {
-	convolver.setup(gIrFile, context->audioFrames, gMaxIrLength);
+	// the impulse response is converted to the sample rate of the context,
+	// if needed
+	convolver.setup(gIrFile, context->audioFrames, gMaxIrLength, ConvolverChannel::kPartitioned, context->audioSampleRate);
 	if(gProcessInput)
 		return true;
 
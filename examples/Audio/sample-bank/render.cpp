@@ -0,0 +1,102 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Audio/sample-bank/render.cpp
+
+Loading a bank of samples in the background
+-------------------------------------------
+
+This example loads a list of audio files on a pool of background threads using
+SampleLoader, from libraries/AudioFile/SampleLoader.h, so that the audio can
+start before all of them have been loaded.
+
+Files that are needed as soon as the program starts are marked as "critical":
+setup() waits for them to be loaded before returning. All the other ones are
+loaded while the audio is already running. In render() we check whether each
+of them is ready before playing it: this never blocks.
+
+Once all files have been loaded, a report with the time it took to load each of
+them is printed to the console.
+
+The same file appears several times in the list: it is only loaded and
+decoded once, and all the slots share the same samples. Files are converted to
+the sample rate of the audio as they are loaded, if needed.
+
+Getting the samples of a slot is cheap, but not free: we do it once when we
+start playing it, rather than for every sample.
+*/
+
+#include <Bela.h>
+#include <libraries/AudioFile/SampleLoader.h>
+#include <vector>
+
+SampleLoader gLoader;
+std::vector<unsigned int> gSlots;
+
+unsigned int gCurrentSlot = 0; // the slot being played
+const SampleFile* gFile = nullptr; // its samples, if it's ready
+std::vector<const float*> gChannels; // the channel of gFile for each output
+unsigned int gReadPtr = 0; // the position in the current slot
+float gGain = 0.5;
+
+// get the samples of the current slot, if it's ready
+void startSlot()
+{
+	gReadPtr = 0;
+	gFile = gLoader.getSlot(gSlots[gCurrentSlot]).get();
+	if(!gFile)
+		return;
+	for(unsigned int channel = 0; channel < gChannels.size(); channel++) {
+		// Wrap channel index in case there are more audio output channels than the file contains
+		gChannels[channel] = gFile->getChannel(channel % gFile->getNumChannels());
+		if(!gChannels[channel])
+			gFile = nullptr;
+	}
+}
+
+bool setup(BelaContext *context, void *userData)
+{
+	// the first file is played straight away: make it critical
+	gSlots.push_back(gLoader.add("sample.wav", true, context->audioSampleRate));
+	// the others can be loaded in the background
+	for(unsigned int n = 0; n < 3; ++n)
+	{
+		gSlots.push_back(gLoader.add("waves.wav", false, context->audioSampleRate));
+		gSlots.push_back(gLoader.add("sample.wav", false, context->audioSampleRate));
+	}
+	gLoader.setVerbose(true);
+	gLoader.start();
+	if(!gLoader.waitForCritical())
+		return false;
+	gChannels.resize(context->audioOutChannels);
+	startSlot();
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	for(unsigned int n = 0; n < context->audioFrames; n++) {
+		if(!gFile || gReadPtr >= gFile->getNumFrames()) {
+			// move on to the next slot. The ones that are not
+			// ready yet are skipped.
+			gCurrentSlot = (gCurrentSlot + 1) % gSlots.size();
+			startSlot();
+			for(unsigned int channel = 0; channel < context->audioOutChannels; channel++)
+				audioWrite(context, n, channel, 0);
+			continue;
+		}
+		for(unsigned int channel = 0; channel < context->audioOutChannels; channel++)
+			audioWrite(context, n, channel, gGain * gChannels[channel][gReadPtr]);
+		gReadPtr++;
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+}
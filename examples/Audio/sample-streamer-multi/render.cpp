@@ -16,6 +16,12 @@ This is an extension of the sampleStreamer example. Functionality of opening
 files, managing buffers, retrieving samples etc. is built into the `sampleStream`
 class, making it easier to have multiple playback streams at the same time.
 Streams can be paused/unpaused with the option of fading in/out the playback.
+
+Each `SampleStream` uses an `AudioFileReader` to stream its file from disk. The
+buffers of all the streams are filled in advance by a shared pool of threads,
+which is woken up only when a stream needs more data. If a stream runs out of
+data, it outputs silence and its underrun count is incremented: this is printed
+once per second and can be reduced by using larger buffers.
 */
 
 #include <Bela.h>
@@ -23,41 +29,35 @@ Streams can be paused/unpaused with the option of fading in/out the playback.
 #include <SampleStream.h>
 
 #define NUM_CHANNELS 2    // NUMBER OF CHANNELS IN THE FILE
-#define BUFFER_LEN 44100   // BUFFER LENGTH
+#define BUFFER_LEN 22050   // BUFFER LENGTH: AudioFileReader reads a few of these in advance
 #define NUM_STREAMS 20
 
 SampleStream *sampleStream[NUM_STREAMS];
-AuxiliaryTask gFillBuffersTask;
-int gStopThreads = 0;
-int gTaskStopped = 0;
 int gCount = 0;
 
-void fillBuffers(void*) {
-    for(int i=0;i<NUM_STREAMS;i++) {
-        if(sampleStream[i]->bufferNeedsFilled())
-            sampleStream[i]->fillBuffer();
-    }
-}
-
 bool setup(BelaContext *context, void *userData)
 {
 
     for(int i=0;i<NUM_STREAMS;i++) {
-        sampleStream[i] = new SampleStream("waves.wav",NUM_CHANNELS,BUFFER_LEN);
+        sampleStream[i] = new SampleStream("waves.wav",NUM_CHANNELS,BUFFER_LEN,context->audioSampleRate);
     }
 
-    // Initialise auxiliary tasks
-	if((gFillBuffersTask = Bela_createAuxiliaryTask(&fillBuffers, 90, "fill-buffer")) == 0)
-		return false;
-
 	return true;
 }
 
 void render(BelaContext *context, void *userData)
 {
 
-    // check if buffers need filling
-    Bela_scheduleAuxiliaryTask(gFillBuffersTask);
+    // print the total number of underruns once per second
+    gCount += context->audioFrames;
+    if(gCount >= context->audioSampleRate) {
+        gCount = 0;
+        int underruns = 0;
+        for(int i=0;i<NUM_STREAMS;i++)
+            underruns += sampleStream[i]->getUnderruns();
+        if(underruns)
+            rt_printf("underruns: %d\n", underruns);
+    }
 
     // ***** remove this -- it's just a demonstration
     // random playback toggling
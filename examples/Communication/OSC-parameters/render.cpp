@@ -0,0 +1,102 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Communication/OSC-parameters/render.cpp
+
+Routing OSC messages to handlers and to the audio thread
+--------------------------------------------------------
+
+This example plays a bank of sine oscillators whose frequencies and
+amplitudes are controlled via OSC, e.g.: from TouchOSC.
+
+Instead of passing all messages to a single callback and comparing their
+address to all the known ones, handlers are added to the OscReceiver for
+specific addresses before calling `setup()`. The addresses are stored in a
+tree, so that a message is routed to its handler without comparing it to all
+the others, and the arguments are read straight from the received packet.
+
+- `/osc/<n>/freq f` and `/osc/<n>/amp f` are forwarded to an OscParameter,
+which is read by render(). `oscReceiver.updateParameters()` applies the
+values received since the previous block, and each parameter ramps to its
+new value over `gRampMs` milliseconds to avoid clicks.
+- `/osc/<any>/freq` and `/osc/<any>/amp` for any other number are caught by
+a handler registered with a `*` component, which prints a warning.
+- `/print s` is only passed to its handler if it has a single string
+argument.
+
+Any other message is passed to the `on_receive()` callback.
+
+Send some messages from the board with, e.g.: `oscsend localhost 7562 /osc/0/amp f 0.3`
+*/
+
+#include <Bela.h>
+#include <libraries/OscReceiver/OscReceiver.h>
+#include <cmath>
+#include <string>
+
+OscReceiver oscReceiver;
+int localPort = 7562;
+
+const unsigned int gNumOscillators = 4;
+const float gRampMs = 20;
+OscParameter gFrequencies[gNumOscillators];
+OscParameter gAmplitudes[gNumOscillators];
+float gPhases[gNumOscillators];
+
+void on_receive(oscpkt::Message* msg, const char* addr, void* arg)
+{
+	printf("Unhandled message from %s: %s\n", addr, msg->addressPattern().c_str());
+}
+
+bool setup(BelaContext *context, void *userData)
+{
+	unsigned int rampFrames = gRampMs * 0.001 * context->audioSampleRate;
+	for(unsigned int n = 0; n < gNumOscillators; ++n)
+	{
+		gFrequencies[n].setup(220 * (n + 1), rampFrames);
+		gAmplitudes[n].setup(0, rampFrames);
+		std::string address = "/osc/" + std::to_string(n);
+		oscReceiver.addParameter(address + "/freq", gFrequencies[n]);
+		oscReceiver.addParameter(address + "/amp", gAmplitudes[n]);
+	}
+	// messages to the oscillators above are handled by the parameters,
+	// and these only receive the others
+	auto outOfRange = [](const OscMessageView& msg, void* arg) {
+		printf("%s: there are only %u oscillators\n", msg.getAddress(), gNumOscillators);
+	};
+	oscReceiver.addHandler("/osc/*/freq", outOfRange);
+	oscReceiver.addHandler("/osc/*/amp", outOfRange);
+	oscReceiver.addHandler("/print", [](const OscMessageView& msg, void* arg) {
+		printf("%s\n", msg.getString(0));
+	}, nullptr, "s");
+	oscReceiver.setup(localPort, on_receive);
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	oscReceiver.updateParameters();
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+	{
+		float out = 0;
+		for(unsigned int k = 0; k < gNumOscillators; ++k)
+		{
+			out += gAmplitudes[k].process() * sinf(gPhases[k]);
+			gPhases[k] += 2.f * (float)M_PI * gFrequencies[k].process() / context->audioSampleRate;
+			if(gPhases[k] > M_PI)
+				gPhases[k] -= 2.f * (float)M_PI;
+		}
+		for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
+			audioWrite(context, n, ch, out);
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+}
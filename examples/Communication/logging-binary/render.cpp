@@ -0,0 +1,84 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Communication/logging-binary/render.cpp
+
+Logging many channels for a long time
+-------------------------------------
+
+This sketch logs all the analog inputs, at the analog sample rate, to a binary
+file, using `BinaryFileWriter`. Compared to `WriteFile`, `BinaryFileWriter`
+only writes binary files, but it can sustain higher data rates for longer:
+data is written to disk in large blocks, only when enough of it is available,
+and the file is allocated on disk ahead of time as it grows.
+
+It is safe to call BinaryFileWriter::log() from the audio thread. If the disk
+cannot keep up, the buffer fills up and the frames that don't fit are dropped;
+their number is printed every few seconds. A larger `bufferSize` in
+`BinaryFileWriter::Settings` can absorb longer delays from the disk.
+
+Stop the program from the IDE or with ctrl-C, so that cleanup() is called and
+the end of the data is written to the file.
+
+The file can be opened, e.g.: in GNU Octave or Matlab, with
+
+```
+numChannels = 8; % the number of analog inputs
+fid = fopen('analog.bin', 'r');
+A = fread(fid, [numChannels, Inf], 'float')';
+fclose(fid);
+plot(A);
+```
+*/
+
+#include <Bela.h>
+#include <libraries/WriteFile/BinaryFileWriter.h>
+
+BinaryFileWriter gFile;
+unsigned int gPrintInterval;
+unsigned int gCount = 0;
+
+bool setup(BelaContext *context, void *userData)
+{
+	if(!(context->flags & BELA_FLAG_INTERLEAVED))
+	{
+		fprintf(stderr, "Error: this example requires that we use interleaved buffers\n");
+		return false;
+	}
+	if(!context->analogInChannels)
+	{
+		fprintf(stderr, "Error: this example requires analog inputs to be enabled\n");
+		return false;
+	}
+	BinaryFileWriter::Settings settings;
+	settings.bufferSize = 1 << 23; // about 6 seconds of 8 channels at 44.1kHz
+	if(gFile.setup("analog.bin", context->analogInChannels, false, settings))
+		return false;
+	printf("Logging %u channels to %s\n", gFile.getNumChannels(), gFile.getFilename().c_str());
+	gPrintInterval = 5 * context->analogSampleRate;
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	// the analog inputs are interleaved, so they can be logged directly
+	gFile.log(context->analogIn, context->analogFrames);
+	gCount += context->analogFrames;
+	if(gCount >= gPrintInterval)
+	{
+		gCount = 0;
+		rt_printf("buffer free: %.0f%%, dropped frames: %llu\n",
+			gFile.getBufferStatus() * 100, (unsigned long long)gFile.getDroppedFrames());
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+	gFile.cleanup();
+}
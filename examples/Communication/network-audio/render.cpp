@@ -0,0 +1,89 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Communication/network-audio/render.cpp
+
+Streaming audio over the network
+--------------------------------
+
+This example sends a sine tone and the first audio input to another board
+running the same example, and plays what it receives from it on the audio
+outputs.
+
+NetworkAudioSender turns each block into RTP packets, stamped with
+`context->audioFramesElapsed`, and sends them from a separate thread.
+NetworkAudioReceiver collects the packets on its own thread and plays them
+back with a delay that adapts to the jitter of the network, slightly
+resampling the stream to compensate for the difference between the clocks
+of the two boards. Packets that don't make it in time are concealed.
+
+Set `gRemoteHost` to the IP address of the other board. By default the
+example sends to itself, so that it can be tried on a single board, or on a
+computer with `--board Batch --codec-mode "e=2.9,t=10"`, where `e` paces the
+blocks roughly in real time and `t` stops the program after 10 seconds.
+
+Every second, the example prints the current latency of the stream, the
+ratio between the playback rate and the nominal rate, and the number of
+packets lost and of frames concealed so far.
+*/
+
+#include <Bela.h>
+#include <libraries/NetworkAudio/NetworkAudio.h>
+#include <cmath>
+#include <vector>
+
+const char* gRemoteHost = "127.0.0.1";
+const int gPort = 9999;
+const unsigned int gNumChannels = 2;
+
+NetworkAudioSender gSender;
+NetworkAudioReceiver gReceiver;
+std::vector<float> gBuffer;
+float gFrequency = 440;
+float gPhase;
+unsigned int gPrintCount;
+
+bool setup(BelaContext *context, void *userData)
+{
+	if(gReceiver.setup(gPort, gNumChannels, context->audioSampleRate))
+		return false;
+	if(gSender.setup(gRemoteHost, gPort, gNumChannels, NetworkAudio::kInt24, context->audioFrames))
+		return false;
+	gBuffer.resize(context->audioFrames * gNumChannels);
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	float* out = gBuffer.data();
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+	{
+		out[n * gNumChannels] = 0.5f * sinf(gPhase);
+		out[n * gNumChannels + 1] = context->audioInChannels ? audioRead(context, n, 0) : 0;
+		gPhase += 2.f * (float)M_PI * gFrequency / context->audioSampleRate;
+		if(gPhase > M_PI)
+			gPhase -= 2.f * (float)M_PI;
+	}
+	gSender.write(out, context->audioFrames, context->audioFramesElapsed);
+
+	gReceiver.readAudio(context);
+
+	gPrintCount += context->audioFrames;
+	if(gPrintCount >= context->audioSampleRate)
+	{
+		gPrintCount = 0;
+		rt_printf("latency: %.0f frames (target %.0f), ratio: %.6f, lost: %u, concealed: %u\n",
+			gReceiver.getLatency(), gReceiver.getTargetLatency(), gReceiver.getRatio(),
+			gReceiver.getNumLost(), gReceiver.getNumConcealed());
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+}
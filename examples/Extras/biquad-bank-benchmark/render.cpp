@@ -0,0 +1,156 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Extras/biquad-bank-benchmark/render.cpp
+
+Compare BiquadBank with individual Biquad filters
+-------------------------------------------------
+
+This program filters a number of channels through a cascade of `gNumStages`
+bandpass filters, first using one `Biquad` object per filter, then using a
+single `BiquadBank` object, and prints the average time it takes to process
+a block, also as a percentage of the duration of a block, and how much faster
+BiquadBank is.
+
+BiquadBank processes several channels at once with NEON, AVX or SSE
+intrinsics, depending on the target; the implementation in use is printed at
+startup.
+
+Run it in batch mode, so that it runs as fast as possible and isn't affected by
+dropouts:
+
+`--board Batch --codec-mode "s=1,i=20000"`
+
+and try different block sizes with `--period`.
+*/
+
+#include <Bela.h>
+#include <libraries/Biquad/Biquad.h>
+#include <libraries/Biquad/BiquadBank.h>
+#include <time.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+const unsigned int gNumChannels[] = {4, 8, 16, 32, 64};
+const unsigned int gNumStages = 2;
+const unsigned int gBlocksPerTest = 1000;
+
+struct Test {
+	unsigned int numChannels;
+	std::vector<Biquad> biquads; // gNumStages per channel
+	BiquadBank bank;
+	double biquadsTime;
+	double bankTime;
+};
+std::vector<Test> gTests;
+unsigned int gCurrentTest = 0;
+unsigned int gCurrentBlock = 0;
+double gBlockDuration;
+std::vector<std::vector<float>> gBuffers;
+std::vector<float*> gBufferPtrs;
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+bool setup(BelaContext *context, void *userData)
+{
+	gBlockDuration = context->audioFrames / context->audioSampleRate;
+	unsigned int maxChannels = 0;
+	for(auto numChannels : gNumChannels)
+	{
+		gTests.emplace_back();
+		Test& test = gTests.back();
+		test.numChannels = numChannels;
+		test.biquads.resize(numChannels * gNumStages);
+		test.bank.setup(numChannels, gNumStages);
+		for(unsigned int c = 0; c < numChannels; ++c)
+		{
+			BiquadCoeff::Settings s = {
+				.fs = context->audioSampleRate,
+				.type = BiquadCoeff::bandpass,
+				.cutoff = 50.0 * powf(1.1, c),
+				.q = 4,
+				.peakGainDb = 0,
+			};
+			for(unsigned int st = 0; st < gNumStages; ++st)
+			{
+				test.biquads[c * gNumStages + st].setup(s);
+				test.bank.getFilter(c, st).setup(s);
+			}
+		}
+		test.bank.update();
+		test.biquadsTime = 0;
+		test.bankTime = 0;
+		if(numChannels > maxChannels)
+			maxChannels = numChannels;
+	}
+	gBuffers.resize(maxChannels);
+	for(auto& b : gBuffers)
+	{
+		b.resize(context->audioFrames);
+		gBufferPtrs.push_back(b.data());
+	}
+	printf("implementation: %s, block size: %u, stages: %u\n", BiquadBank::getBackend(), context->audioFrames, gNumStages);
+	printf("%10s %14s %12s %14s %12s %8s\n", "channels", "Biquad (us)", "Biquad (%)", "BiquadBank (us)", "BiquadBank (%)", "speedup");
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	if(gCurrentTest >= gTests.size())
+		return;
+	Test& test = gTests[gCurrentTest];
+	for(unsigned int c = 0; c < test.numChannels; ++c)
+		for(unsigned int n = 0; n < context->audioFrames; ++n)
+			gBuffers[c][n] = 2.f * random() / RAND_MAX - 1.f;
+
+	double start = now();
+	for(unsigned int c = 0; c < test.numChannels; ++c)
+	{
+		float* buf = gBuffers[c].data();
+		for(unsigned int n = 0; n < context->audioFrames; ++n)
+		{
+			double x = buf[n];
+			for(unsigned int st = 0; st < gNumStages; ++st)
+				x = test.biquads[c * gNumStages + st].process(x);
+			buf[n] = x;
+		}
+	}
+	double middle = now();
+	test.bank.process(gBufferPtrs.data(), gBufferPtrs.data(), context->audioFrames);
+	double end = now();
+	test.biquadsTime += middle - start;
+	test.bankTime += end - middle;
+
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
+			audioWrite(context, n, ch, gBuffers[ch % test.numChannels][n]);
+
+	if(++gCurrentBlock == gBlocksPerTest)
+	{
+		double biquads = test.biquadsTime / gBlocksPerTest;
+		double bank = test.bankTime / gBlocksPerTest;
+		rt_printf("%10u %14.2f %12.2f %14.2f %12.2f %8.2f\n", test.numChannels,
+			biquads * 1000000, biquads / gBlockDuration * 100,
+			bank * 1000000, bank / gBlockDuration * 100,
+			biquads / bank);
+		gCurrentBlock = 0;
+		++gCurrentTest;
+		if(gCurrentTest == gTests.size())
+			Bela_requestStop();
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{}
@@ -0,0 +1,144 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Extras/convolver-benchmark/render.cpp
+
+Compare the CPU cost of the convolution types
+---------------------------------------------
+
+The Convolver library can compute a convolution as a single time-domain FIR
+filter (`ConvolverChannel::kFir`, the default) or as a partitioned FFT
+convolution, with its larger partitions computed either in the audio thread
+(`ConvolverChannel::kPartitionedInline`) or on background threads
+(`ConvolverChannel::kPartitioned`). None of them adds latency.
+
+This program runs each of them with random impulse responses of increasing
+length and prints the average and worst-case time spent in
+Convolver::process() for each block, also as a percentage of the duration of a
+block. The cost of the FIR filter grows linearly with the length of the
+impulse response, while that of the partitioned convolution grows much more
+slowly, so there is a length above which the latter becomes cheaper.
+For `kPartitionedInline` the average is the total cost of the convolution,
+while for `kPartitioned` it is only the part spent in the audio thread.
+
+Run it in batch mode, so that it runs as fast as possible and isn't affected by
+dropouts:
+
+`--board Batch --codec-mode "s=1,i=20000"`
+
+and try different block sizes with `--period`.
+*/
+
+#include <Bela.h>
+#include <libraries/Convolver/Convolver.h>
+#include <time.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+
+const unsigned int gIrLengths[] = {32, 128, 512, 2048, 8192, 32768, 131072};
+// longer FIR filters are too slow to be worth measuring
+const unsigned int gMaxFirLength = 32768;
+const ConvolverChannel::Type gTypes[] = {
+	ConvolverChannel::kFir,
+	ConvolverChannel::kPartitionedInline,
+	ConvolverChannel::kPartitioned,
+};
+const char* gTypeNames[] = {
+	"fir",
+	"partitioned-inline",
+	"partitioned",
+};
+const unsigned int gBlocksPerTest = 2000;
+
+struct Test {
+	unsigned int irLength;
+	unsigned int type;
+	std::unique_ptr<Convolver> convolver;
+	double totalTime;
+	double maxTime;
+};
+std::vector<Test> gTests;
+unsigned int gCurrentTest = 0;
+unsigned int gCurrentBlock = 0;
+double gBlockDuration;
+
+bool setup(BelaContext *context, void *userData)
+{
+	gBlockDuration = context->audioFrames / context->audioSampleRate;
+	for(auto irLength : gIrLengths)
+	{
+		std::vector<float> ir(irLength);
+		for(auto& v : ir)
+			v = rand() / (float)RAND_MAX * 2.f - 1.f;
+		for(unsigned int t = 0; t < sizeof(gTypes) / sizeof(gTypes[0]); ++t)
+		{
+			if(ConvolverChannel::kFir == gTypes[t] && irLength > gMaxFirLength)
+				continue;
+			gTests.emplace_back();
+			Test& test = gTests.back();
+			test.irLength = irLength;
+			test.type = t;
+			test.convolver.reset(new Convolver);
+			if(test.convolver->setup({ir}, context->audioFrames, gTypes[t]))
+			{
+				fprintf(stderr, "Unable to set up convolver\n");
+				return false;
+			}
+			test.totalTime = 0;
+			test.maxTime = 0;
+		}
+	}
+	printf("block size: %u\n", context->audioFrames);
+	printf("%10s %20s %12s %8s %12s %8s\n", "ir length", "type", "avg (us)", "avg (%)", "max (us)", "max (%)");
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	float in[context->audioFrames];
+	float out[context->audioFrames];
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		in[n] = context->audioInChannels ? audioRead(context, n, 0) : 0;
+	if(gCurrentTest < gTests.size())
+	{
+		Test& test = gTests[gCurrentTest];
+		struct timespec begin;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		test.convolver->process(out, in, context->audioFrames);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1000000000.0;
+		test.totalTime += elapsed;
+		if(elapsed > test.maxTime)
+			test.maxTime = elapsed;
+		if(++gCurrentBlock == gBlocksPerTest)
+		{
+			double avg = test.totalTime / gBlocksPerTest;
+			rt_printf("%10u %20s %12.2f %8.2f %12.2f %8.2f\n", test.irLength, gTypeNames[test.type],
+				avg * 1000000, avg / gBlockDuration * 100,
+				test.maxTime * 1000000, test.maxTime / gBlockDuration * 100);
+			gCurrentBlock = 0;
+			++gCurrentTest;
+			if(gCurrentTest == gTests.size())
+				Bela_requestStop();
+		}
+	} else {
+		for(unsigned int n = 0; n < context->audioFrames; ++n)
+			out[n] = 0;
+	}
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
+			audioWrite(context, n, ch, out[n]);
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+	gTests.clear();
+}
@@ -0,0 +1,176 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Extras/midi-parser-benchmark/render.cpp
+
+Compare MidiBatchParser with MidiParser
+---------------------------------------
+
+This program generates a dense stream of MIDI data, similar to what a
+controller with many faders or an MPE instrument would send: control changes,
+notes and pitch bends on several channels, interleaved with clock messages and
+the occasional sysex message. It then parses it in chunks of different sizes,
+as they would be returned by read() on the MIDI port, first feeding one byte at
+a time to a `MidiParser`, as `Midi` does when its parser is enabled, then
+passing each chunk to a `MidiBatchParser`. Messages are retrieved from
+MidiParser through its callback and from MidiBatchParser after each chunk. The throughput of each is printed, in
+thousands of messages per second, along with how much faster
+MidiBatchParser is.
+
+Run it in batch mode, so that it runs as fast as possible and isn't affected by
+dropouts:
+
+`--board Batch --codec-mode "s=1,i=20000"`
+*/
+
+#include <Bela.h>
+#include <libraries/Midi/Midi.h>
+#include <time.h>
+#include <stdlib.h>
+#include <vector>
+
+const unsigned int gChunkSizes[] = {1, 4, 16, 64, 256, 1024};
+const unsigned int gBlocksPerTest = 200;
+const unsigned int gBytesPerBlock = 4096;
+
+std::vector<midi_byte_t> gStream;
+unsigned int gNumMessages = 0;
+unsigned int gCurrentTest = 0;
+unsigned int gCurrentBlock = 0;
+unsigned int gStreamPtr = 0;
+double gParserTime;
+double gBatchTime;
+unsigned int gChecksum;
+MidiParser gParser;
+MidiBatchParser gBatchParser;
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static void parserCallback(MidiChannelMessage message, void* arg)
+{
+	gChecksum += message.getDataByte(0);
+}
+
+static void parserSysexCallback(midi_byte_t byte, void* arg)
+{
+	gChecksum += byte;
+}
+
+static void batchSysexCallback(const midi_byte_t* data, unsigned int length, bool last, void* arg)
+{
+	for(unsigned int n = 0; n < length; ++n)
+		gChecksum += data[n];
+}
+
+// append a message with its own status byte: MidiParser doesn't support
+// running status
+static void addMessage(midi_byte_t status, midi_byte_t data0, midi_byte_t data1, unsigned int numDataBytes)
+{
+	gStream.push_back(status);
+	gStream.push_back(data0 & 0x7f);
+	if(numDataBytes > 1)
+		gStream.push_back(data1 & 0x7f);
+	++gNumMessages;
+}
+
+bool setup(BelaContext *context, void *userData)
+{
+	srandom(0);
+	while(gStream.size() < gBytesPerBlock * 16)
+	{
+		unsigned int r = random() % 100;
+		midi_byte_t channel = random() % 16;
+		if(r < 60)
+			addMessage(0xB0 | channel, random() % 32, random(), 2);
+		else if(r < 80)
+			addMessage(0x90 | channel, random(), random(), 2);
+		else if(r < 95)
+			addMessage(0xE0 | channel, random(), random(), 2);
+		else if(r < 99)
+		{
+			gStream.push_back(0xF8);
+			++gNumMessages;
+		} else {
+			gStream.push_back(0xF0);
+			for(unsigned int n = 0; n < 32; ++n)
+				gStream.push_back(random() & 0x7f);
+			gStream.push_back(0xF7);
+		}
+	}
+	gParser.setCallback(parserCallback);
+	gParser.setSysexCallback(parserSysexCallback);
+	gBatchParser.setup(1024);
+	gBatchParser.setSysexCallback(batchSysexCallback);
+	printf("stream: %u bytes, %u messages\n", (unsigned int)gStream.size(), gNumMessages);
+	printf("%10s %18s %18s %8s\n", "chunk size", "MidiParser (k/s)", "BatchParser (k/s)", "speedup");
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	if(gCurrentTest >= sizeof(gChunkSizes) / sizeof(gChunkSizes[0]))
+		return;
+	unsigned int chunkSize = gChunkSizes[gCurrentTest];
+	unsigned int start = gStreamPtr;
+	unsigned int end = start + gBytesPerBlock;
+	gStreamPtr = end % gStream.size();
+
+	double t0 = now();
+	for(unsigned int n = start; n < end; n += chunkSize)
+	{
+		for(unsigned int k = n; k < n + chunkSize; ++k)
+		{
+			midi_byte_t byte = gStream[k % gStream.size()];
+			gParser.parse(&byte, 1);
+		}
+	}
+	double t1 = now();
+	for(unsigned int n = start; n < end; n += chunkSize)
+	{
+		// avoid wrapping within a chunk
+		unsigned int ptr = n % gStream.size();
+		unsigned int length = chunkSize;
+		if(ptr + length > gStream.size())
+			length = gStream.size() - ptr;
+		gBatchParser.parse(gStream.data() + ptr, length);
+		if(length < chunkSize)
+			gBatchParser.parse(gStream.data(), chunkSize - length);
+		MidiEvent event;
+		while(gBatchParser.pop(event))
+			gChecksum += event.data[0];
+	}
+	double t2 = now();
+	gParserTime += t1 - t0;
+	gBatchTime += t2 - t1;
+
+	if(++gCurrentBlock == gBlocksPerTest)
+	{
+		double messages = (double)gNumMessages * gBytesPerBlock * gBlocksPerTest / gStream.size();
+		rt_printf("%10u %18.0f %18.0f %8.2f\n", chunkSize,
+			messages / gParserTime / 1000, messages / gBatchTime / 1000,
+			gParserTime / gBatchTime);
+		gCurrentBlock = 0;
+		gParserTime = 0;
+		gBatchTime = 0;
+		++gCurrentTest;
+		if(gCurrentTest == sizeof(gChunkSizes) / sizeof(gChunkSizes[0]))
+		{
+			rt_printf("checksum: %u\n", gChecksum);
+			Bela_requestStop();
+		}
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{}
@@ -0,0 +1,159 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Extras/oscillator-bank-benchmark/render.cpp
+
+Measure the throughput of the oscillator bank
+---------------------------------------------
+
+This program runs OscillatorBank::process() with an increasing number of
+oscillators and prints the average and worst-case time it takes to compute a
+block, also as a percentage of the duration of a block, and the number of
+oscillators that a single core could compute in real time at the current
+block size and sample rate.
+
+The implementation in use is printed at startup: the NEON assembly routine on
+Bela, or the intrinsics implementation elsewhere (or when building with
+`-DOSCILLATOR_BANK_NO_ASM`).
+
+The same measurements are then repeated with a SparseOscillatorBank that can
+hold as many partials as the largest test, but only has the given number of
+them playing, each with an ongoing amplitude ramp. Its cost follows the
+number of partials that are playing, not the size of the bank.
+
+Run it in batch mode, so that it runs as fast as possible and isn't affected by
+dropouts:
+
+`--board Batch --codec-mode "s=1,i=20000"`
+
+and try different block sizes with `--period`.
+*/
+
+#include <Bela.h>
+#include <libraries/OscillatorBank/OscillatorBank.h>
+#include <libraries/OscillatorBank/SparseOscillatorBank.h>
+#include <time.h>
+#include <stdlib.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+const unsigned int gNumOscillators[] = {64, 128, 256, 512, 1024, 2048};
+const unsigned int gWavetableLength = 1024;
+const unsigned int gBlocksPerTest = 2000;
+
+struct Test {
+	unsigned int numOscillators;
+	std::unique_ptr<OscillatorBank> bank;
+	std::unique_ptr<SparseOscillatorBank> sparseBank;
+	double totalTime;
+	double maxTime;
+};
+std::vector<Test> gTests;
+unsigned int gCurrentTest = 0;
+unsigned int gCurrentBlock = 0;
+double gBlockDuration;
+
+bool setup(BelaContext *context, void *userData)
+{
+	gBlockDuration = context->audioFrames / context->audioSampleRate;
+	unsigned int numTests = sizeof(gNumOscillators) / sizeof(gNumOscillators[0]);
+	unsigned int maxPartials = gNumOscillators[numTests - 1];
+	for(unsigned int sparse = 0; sparse < 2; ++sparse)
+	{
+		for(auto numOscillators : gNumOscillators)
+		{
+			gTests.emplace_back();
+			Test& test = gTests.back();
+			test.numOscillators = numOscillators;
+			float* wavetable;
+			if(sparse)
+			{
+				test.sparseBank.reset(new SparseOscillatorBank);
+				if(test.sparseBank->setup(context->audioSampleRate, gWavetableLength, maxPartials))
+				{
+					fprintf(stderr, "Unable to set up sparse oscillator bank\n");
+					return false;
+				}
+				wavetable = test.sparseBank->getWavetable();
+				for(unsigned int n = 0; n < numOscillators; ++n)
+				{
+					int partial = test.sparseBank->start(20 + 8000 * (float)random() / (float)RAND_MAX, 0);
+					// a ramp that lasts for the whole test
+					test.sparseBank->rampAmplitude(partial, 1.f / numOscillators, gBlocksPerTest * context->audioFrames);
+				}
+			} else {
+				test.bank.reset(new OscillatorBank);
+				if(test.bank->setup(context->audioSampleRate, gWavetableLength, numOscillators))
+				{
+					fprintf(stderr, "Unable to set up oscillator bank\n");
+					return false;
+				}
+				wavetable = test.bank->getWavetable();
+				for(unsigned int n = 0; n < numOscillators; ++n)
+				{
+					test.bank->setFrequency(n, 20 + 8000 * (float)random() / (float)RAND_MAX);
+					test.bank->setAmplitude(n, 1.f / numOscillators);
+				}
+			}
+			for(unsigned int n = 0; n < gWavetableLength + 1; ++n)
+				wavetable[n] = sinf(2.0 * M_PI * (float)n / (float)gWavetableLength);
+			test.totalTime = 0;
+			test.maxTime = 0;
+		}
+	}
+	printf("implementation: %s, block size: %u\n", OscillatorBank::getBackend(), context->audioFrames);
+	printf("%12s %12s %12s %8s %12s %8s %16s\n", "bank", "oscillators", "avg (us)", "avg (%)", "max (us)", "max (%)", "oscillators/core");
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	float out[context->audioFrames];
+	if(gCurrentTest < gTests.size())
+	{
+		Test& test = gTests[gCurrentTest];
+		struct timespec begin;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		if(test.sparseBank)
+			test.sparseBank->process(context->audioFrames, out);
+		else
+			test.bank->process(context->audioFrames, out);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1000000000.0;
+		test.totalTime += elapsed;
+		if(elapsed > test.maxTime)
+			test.maxTime = elapsed;
+		if(++gCurrentBlock == gBlocksPerTest)
+		{
+			double avg = test.totalTime / gBlocksPerTest;
+			rt_printf("%12s %12u %12.2f %8.2f %12.2f %8.2f %16.0f\n",
+				test.sparseBank ? "sparse" : "dense", test.numOscillators,
+				avg * 1000000, avg / gBlockDuration * 100,
+				test.maxTime * 1000000, test.maxTime / gBlockDuration * 100,
+				test.numOscillators * gBlockDuration / avg);
+			gCurrentBlock = 0;
+			++gCurrentTest;
+			if(gCurrentTest == gTests.size())
+				Bela_requestStop();
+		}
+	} else {
+		for(unsigned int n = 0; n < context->audioFrames; ++n)
+			out[n] = 0;
+	}
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
+			audioWrite(context, n, ch, out[n]);
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+	gTests.clear();
+}
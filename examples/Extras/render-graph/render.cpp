@@ -0,0 +1,97 @@
+/*
+ ____  _____ _        _
+| __ )| ____| |      / \
+|  _ \|  _| | |     / _ \
+| |_) | |___| |___ / ___ \
+|____/|_____|_____/_/   \_\
+http://bela.io
+*/
+/**
+\example Extras/render-graph/render.cpp
+
+Split render() across several cores
+-----------------------------------
+
+On boards with more than one CPU core, RenderGraph allows to split the
+processing done in render() across a pool of real-time threads. Each node of
+the graph declares the channels it reads from and writes to, and nodes that do
+not depend on each other run in parallel. RenderGraph::process() returns once
+all the nodes have been processed, so there is no added latency.
+
+Here each audio input goes through its own (expensive) cascade of filters, in
+a node of its own. Another node per channel then mixes the filtered signal into
+the outputs. The graph figures out that all the filter nodes can run in
+parallel, while the mixing nodes have to wait for the filters to be done.
+
+To measure how processing scales with the number of threads, change
+`gNumThreads` and run the program in batch mode, which renders as fast as
+possible and prints CPU usage statistics at the end:
+
+`--board Batch --codec-mode "s=1,i=100000"`
+*/
+
+#include <Bela.h>
+#include <RenderGraph.h>
+#include <libraries/Biquad/Biquad.h>
+#include <vector>
+
+unsigned int gNumThreads = 0; // 0 means one thread per CPU core
+unsigned int gNumStages = 32;
+
+RenderGraph gGraph;
+std::vector<std::vector<Biquad>> gFilters;
+
+bool setup(BelaContext *context, void *userData)
+{
+	unsigned int numChannels = context->audioInChannels;
+	// one bus per input channel to hold the filtered signal
+	if(gGraph.setup(context, gNumThreads, numChannels))
+		return false;
+	gFilters.resize(numChannels);
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		for(unsigned int n = 0; n < gNumStages; ++n)
+		{
+			gFilters[c].push_back(Biquad({
+				.fs = context->audioSampleRate,
+				.type = BiquadCoeff::lowpass,
+				.cutoff = 200.0 + 100 * c,
+				.q = 0.707,
+				.peakGainDb = 0,
+			}));
+		}
+		gGraph.addNode("filter" + std::to_string(c), [c](const BelaContext* context, const float* const* in, float* const* out) {
+			for(unsigned int n = 0; n < context->audioFrames; ++n)
+			{
+				float sample = in[0][n];
+				for(auto& f : gFilters[c])
+					sample = f.process(sample);
+				out[0][n] = sample;
+			}
+		}, {gGraph.audioIn(c)}, {gGraph.bus(c)});
+	}
+	// mix all the filtered signals into each output
+	for(unsigned int c = 0; c < context->audioOutChannels; ++c)
+	{
+		std::vector<RenderGraph::Channel> buses;
+		for(unsigned int b = 0; b < numChannels; ++b)
+			buses.push_back(gGraph.bus(b));
+		gGraph.addNode("mix" + std::to_string(c), [](const BelaContext* context, const float* const* in, float* const* out) {
+			for(unsigned int b = 0; b < context->audioInChannels; ++b)
+				for(unsigned int n = 0; n < context->audioFrames; ++n)
+					out[0][n] += in[b][n];
+		}, buses, {gGraph.audioOut(c)});
+	}
+	printf("Running %u nodes in %u stages on %u threads\n", numChannels + context->audioOutChannels, gGraph.getNumStages(), gGraph.getNumThreads());
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	gGraph.process(context);
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+	gGraph.cleanup();
+}
@@ -95,12 +95,8 @@ bool guiCallback(JSONObject& json, void*)
 		ir[n] = analysisBiquad.process(0 == n ? 1 : 0);
 	}
 	fft.fft(ir);
-	float mx = -100000;
-	for(unsigned int n = 0; n < buf.size(); ++n)
-	{
-		buf[n] = fft.fda(n);
-		mx = mx < buf[n] ? buf[n] : mx;
-	}
+	// compute the magnitude of all the bins at once
+	Fft::magnitude(buf.data(), fft.getFrequencyDomain(), buf.size());
 	gui.sendBuffer(0, buf);
 	return false;
 }
@@ -162,7 +162,7 @@ typedef enum
 
 /** \cond PRIVATE */
 #define MAX_PRU_FILENAME_LENGTH 256
-#define MAX_UNUSED_LENGTH 224
+#define MAX_UNUSED_LENGTH 220
 #define MAX_PROJECTNAME_LENGTH 256
 /** \endcond */
 
@@ -538,6 +538,10 @@ typedef struct {
 	struct BelaChannelGainArray adcGains;
 	/// Level for the audio line level output
 	struct BelaChannelGainArray lineOutGains;
+	/// Whether to use a lock-free ring instead of message queues to
+	/// exchange data with the audio fifo thread, when the requested
+	/// period size requires one.
+	int lockFreeFifo;
 
 	char unused[MAX_UNUSED_LENGTH];
 
@@ -3,6 +3,9 @@
 #include <array>
 #include <BelaContextSplitter.h>
 #include <DataFifo.h>
+#include <SpscQueue.h>
+#include <atomic>
+#include <semaphore.h>
 
 class BelaContextFifo {
 public:
@@ -11,19 +14,29 @@ public:
 		kToShort,
 		kNumFifos,
 	} fifo_id_t;
+	typedef enum {
+		kBackendMqueue, ///< Exchange contexts via POSIX message queues
+		kBackendRing, ///< Exchange contexts via lock-free single-producer/single-consumer rings
+	} backend_t;
 	BelaContextFifo() {};
-	BelaContextFifo(const BelaContext* context, unsigned int factor){
-		setup(context, factor);
+	BelaContextFifo(const BelaContext* context, unsigned int factor, backend_t backend = kBackendMqueue){
+		setup(context, factor, backend);
 	}
+	~BelaContextFifo();
 	/**
 	 * Initialize the object.
 	 *
 	 * @param context a template of the input contexts that will be sent
 	 * with push()
 	 * @param factor the number of 
+	 * @param backend the mechanism used to exchange contexts between
+	 * threads. With #kBackendRing, contexts are preallocated and exchanged
+	 * by reference through a lock-free ring, so that push() and pop()
+	 * never enter the kernel, except for waking up a thread that is
+	 * blocked in pop().
 	 *
 	 */
-	BelaContext* setup(const BelaContext* context, unsigned int factor);
+	BelaContext* setup(const BelaContext* context, unsigned int factor, backend_t backend = kBackendMqueue);
 	/**
 	 * Send in a context.
 	 *
@@ -35,15 +48,45 @@ public:
 	 * Receive a context.
 	 *
 	 * @param fifoId the fifo to write tp
+	 * @param countUnderrun whether to count an underrun if no context is
+	 * ready. Pass false when polling again for a context that has
+	 * already been counted as late.
 	 * @return the context, or NULL if no context is ready to be retrieved.
 	 */
-	BelaContext* pop(fifo_id_t fifo, double timeoutMs = 100);
+	BelaContext* pop(fifo_id_t fifo, double timeoutMs = 100, bool countUnderrun = true);
+	/**
+	 * Get the number of times that pop() could not return a context
+	 * because none was ready, once per late context.
+	 *
+	 * @param fifo the fifo to query.
+	 */
+	unsigned int getUnderruns(fifo_id_t fifo) const { return underruns[fifo]; }
+	/**
+	 * Get the number of times that push() could not send a context
+	 * because the fifo was full.
+	 *
+	 * @param fifo the fifo to query.
+	 */
+	unsigned int getOverruns(fifo_id_t fifo) const { return overruns[fifo]; }
+	backend_t getBackend() const { return backend; }
 	static constexpr unsigned int kNumBuffers = 2;
 	static bool test();
+	static bool test(backend_t backend);
 private:
 	unsigned int getCurrentBuffer(fifo_id_t fifo);
+	int send(fifo_id_t fifo, const BelaContext* ctx);
+	BelaContext* receive(fifo_id_t fifo, double timeoutMs);
+	BelaContext* receiveRing(fifo_id_t fifo, double timeoutMs);
 	std::array<std::array<BelaContextSplitter, kNumBuffers>, kNumFifos> bcss;
 	std::array<DataFifo, kNumFifos> dfs;
+	std::array<SpscQueue<BelaContext*>, kNumFifos> rings;
+	std::array<sem_t, kNumFifos> sems;
+	std::array<std::atomic<bool>, kNumFifos> waiting;
+	std::array<bool, kNumFifos> blocking;
 	std::array<unsigned int, kNumFifos> counts;
+	std::array<unsigned int, kNumFifos> underruns;
+	std::array<unsigned int, kNumFifos> overruns;
 	unsigned int factor;
+	backend_t backend = kBackendMqueue;
+	bool semsInited = false;
 };
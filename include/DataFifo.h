@@ -55,7 +55,7 @@ public:
 	static bool test();
 
 private:
-	mqd_t queue;
+	mqd_t queue = -1;
 	size_t msgSize;
 	std::string qName;
 };
@@ -0,0 +1,165 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A UTF-8 JSON parser that doesn't allocate memory for each value.
+ *
+ * The text is copied into a buffer owned by the document and strings are
+ * unescaped and null-terminated in place, so that they can be accessed
+ * without copying them. Values are stored in a flat array of nodes. Both
+ * buffers are reused by the next call to parse(), so once they are large
+ * enough for the messages being received, parsing doesn't allocate.
+ *
+ * Values are accessed through Value, a lightweight handle which is only
+ * valid until the next call to parse().
+ *
+ * Example:
+ *
+ *     JSONDocument doc;
+ *     if(doc.parse(data, size) && doc.getRoot()["event"].equals("slider"))
+ *         float value = doc.getRoot()["value"].asNumber();
+ */
+class JSONDocument
+{
+public:
+	enum Type {
+		kInvalid, ///< a value that doesn't exist, e.g. a missing member
+		kNull,
+		kBool,
+		kNumber,
+		kString,
+		kArray,
+		kObject,
+	};
+	/// The maximum nesting of arrays and objects.
+	static constexpr unsigned int kMaxDepth = 32;
+private:
+	struct Node {
+		Type type;
+		uint32_t size; // length of the string, or number of children
+		uint32_t next; // index of the next sibling, or 0
+		uint32_t keySize;
+		const char* key; // the member name, if the parent is an object
+		union {
+			double number;
+			bool boolean;
+			const char* string;
+		};
+	};
+public:
+	class Value
+	{
+	public:
+		Value() {};
+		Type getType() const { return node ? node->type : kInvalid; }
+		bool isValid() const { return node; }
+		bool isNull() const { return kNull == getType(); }
+		bool isBool() const { return kBool == getType(); }
+		bool isNumber() const { return kNumber == getType(); }
+		bool isString() const { return kString == getType(); }
+		bool isArray() const { return kArray == getType(); }
+		bool isObject() const { return kObject == getType(); }
+		/**
+		 * Get the value of a number, or @p fallback if this is not a
+		 * number.
+		 */
+		double asNumber(double fallback = 0) const { return isNumber() ? node->number : fallback; }
+		/**
+		 * Get the value of a bool, or @p fallback if this is not a
+		 * bool.
+		 */
+		bool asBool(bool fallback = false) const { return isBool() ? node->boolean : fallback; }
+		/**
+		 * Get the null-terminated, UTF-8 content of a string, or an
+		 * empty string if this is not a string. Strings may contain
+		 * escaped null characters: use getStringLength() to get their
+		 * actual length.
+		 */
+		const char* asString() const { return isString() ? node->string : ""; }
+		std::string asStdString() const { return std::string(asString(), getStringLength()); }
+		size_t getStringLength() const { return isString() ? node->size : 0; }
+		/**
+		 * Whether this is a string equal to @p str.
+		 */
+		bool equals(const char* str) const;
+		/**
+		 * Get the number of elements of an array or of members of an
+		 * object.
+		 */
+		unsigned int size() const { return (isArray() || isObject()) ? node->size : 0; }
+		/**
+		 * Get a member of an object, or an invalid value if there is no
+		 * such member.
+		 */
+		Value operator[](const char* key) const;
+		Value operator[](const std::string& key) const { return (*this)[key.c_str()]; }
+		/**
+		 * Get an element of an array or a member of an object, or an
+		 * invalid value if @p n is out of range. This takes linear
+		 * time: use getFirst() and getNext() to iterate.
+		 */
+		Value operator[](unsigned int n) const;
+		Value operator[](int n) const { return (*this)[(unsigned int)n]; }
+		/**
+		 * Get the first element of an array or member of an object.
+		 */
+		Value getFirst() const;
+		/**
+		 * Get the element or member that follows this one in its
+		 * parent.
+		 */
+		Value getNext() const;
+		/**
+		 * Get the name of this value, if it is a member of an object.
+		 */
+		const char* getKey() const { return (node && node->key) ? node->key : ""; }
+		size_t getKeyLength() const { return node ? node->keySize : 0; }
+	private:
+		friend class JSONDocument;
+		Value(const Node* nodes, const Node* node) : nodes(nodes), node(node) {}
+		const Node* nodes = nullptr;
+		const Node* node = nullptr;
+	};
+	/**
+	 * @param maxSize the size of the largest message to preallocate the
+	 * buffers for.
+	 */
+	JSONDocument(size_t maxSize = 4096);
+	/**
+	 * Parse a UTF-8 JSON text. Any previous content of the document is
+	 * discarded.
+	 *
+	 * @param text the text to parse. It doesn't need to be
+	 * null-terminated.
+	 * @param size the length of @p text in bytes.
+	 *
+	 * @return true on success, false if @p text is not valid JSON.
+	 */
+	bool parse(const char* text, size_t size);
+	bool parse(const char* text);
+	/**
+	 * Get the value at the top of the document. This is invalid if the
+	 * last call to parse() failed.
+	 */
+	Value getRoot() const;
+	/**
+	 * Get the offset in the text where the last call to parse() failed.
+	 */
+	size_t getErrorOffset() const { return errorOffset; }
+private:
+	bool parseValue(unsigned int depth);
+	bool parseString(const char*& out, uint32_t& size);
+	bool parseNumber(double& out);
+	bool parseLiteral(const char* literal);
+	void skipSpace();
+	uint32_t addNode(Type type);
+	std::vector<char> text;
+	std::vector<Node> nodes;
+	char* ptr;
+	char* end;
+	size_t errorOffset = 0;
+	bool valid = false;
+};
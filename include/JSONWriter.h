@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Write UTF-8 JSON text into a reusable buffer.
+ *
+ * Commas and colons are added as needed. The buffer is kept across calls to
+ * clear(), so once it is large enough for the messages being written,
+ * writing doesn't allocate.
+ *
+ * Example:
+ *
+ *     JSONWriter writer;
+ *     writer.beginObject();
+ *     writer.key("event").value("set-slider-value");
+ *     writer.key("value").value(0.5);
+ *     writer.endObject();
+ *     send(writer.c_str(), writer.size());
+ */
+class JSONWriter
+{
+public:
+	/// The maximum nesting of arrays and objects.
+	static constexpr unsigned int kMaxDepth = 32;
+	/**
+	 * @param capacity the initial size of the buffer.
+	 */
+	JSONWriter(size_t capacity = 1024);
+	/**
+	 * Discard the text written so far, keeping the buffer.
+	 */
+	void clear();
+	JSONWriter& beginObject();
+	JSONWriter& endObject();
+	JSONWriter& beginArray();
+	JSONWriter& endArray();
+	/**
+	 * Write the name of the next member of an object.
+	 */
+	JSONWriter& key(const char* key);
+	JSONWriter& key(const char* key, size_t size);
+	JSONWriter& key(const std::string& key) { return this->key(key.c_str(), key.size()); }
+	/**
+	 * Write a UTF-8 string, escaping it as needed.
+	 */
+	JSONWriter& value(const char* str);
+	JSONWriter& value(const char* str, size_t size);
+	JSONWriter& value(const std::string& str) { return value(str.c_str(), str.size()); }
+	/**
+	 * Write a number. Infinite and NaN values are written as `null`.
+	 */
+	JSONWriter& value(double number);
+	JSONWriter& value(float number) { return value((double)number); }
+	JSONWriter& value(int number) { return value((double)number); }
+	JSONWriter& value(unsigned int number) { return value((double)number); }
+	JSONWriter& value(bool boolean);
+	JSONWriter& value(std::nullptr_t);
+	/**
+	 * Get the text written so far.
+	 */
+	const char* c_str() const { return text.c_str(); }
+	size_t size() const { return text.size(); }
+	const std::string& str() const { return text; }
+private:
+	void separate();
+	void writeString(const char* str, size_t size);
+	std::string text;
+	// whether the current array or object already has an element
+	bool hasElements[kMaxDepth + 1];
+	unsigned int depth = 0;
+	bool afterKey = false;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <Bela.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <semaphore.h>
+
+/**
+ * Split the processing done in render() across several threads.
+ *
+ * The user registers a number of nodes, each declaring which channels it
+ * reads from and which channels it writes to. Channels are
+ * non-interleaved buffers of `context->audioFrames` samples owned by the
+ * graph: they map to the audio inputs and outputs of the context, or to
+ * additional internal buses. Nodes that don't depend on each other are
+ * run in parallel on a pool of real-time worker threads, while the
+ * thread calling process() joins in the work. process() returns only
+ * once all the nodes have run, so that the whole graph completes within
+ * the same block.
+ *
+ * Dependencies are inferred from the registration order: a node runs
+ * after any previously registered node that writes to a channel it reads
+ * or writes, or that reads from a channel it writes.
+ *
+ * process() is meant to be called from render(), so it works the same
+ * regardless of whether the audio thread is the one started by
+ * Bela_startAudio(), Bela_runInSameThread() or the batch loop used by
+ * BelaHw_Batch.
+ */
+class RenderGraph
+{
+public:
+	/**
+	 * The index of a channel in the graph.
+	 */
+	typedef unsigned int Channel;
+	/**
+	 * The processing callback of a node.
+	 *
+	 * @param context the context passed to process(). Only read its
+	 * properties, as the audio buffers may be accessed concurrently by
+	 * other nodes.
+	 * @param in one pointer for each of the input channels declared in
+	 * addNode(), in the same order.
+	 * @param out one pointer for each of the output channels declared in
+	 * addNode(), in the same order. Output channels are cleared at the
+	 * beginning of each block. If more than one node writes to the same
+	 * channel, they are run one after the other in the order in which
+	 * they were added, so they can accumulate into it.
+	 */
+	typedef std::function<void(const BelaContext* context, const float* const* in, float* const* out)> Callback;
+	RenderGraph() {};
+	RenderGraph(const BelaContext* context, unsigned int numThreads = 0, unsigned int numBuses = 0, int priority = BELA_AUDIO_PRIORITY - 1)
+	{
+		setup(context, numThreads, numBuses, priority);
+	}
+	~RenderGraph();
+	/**
+	 * Initialise the graph. Call this from setup().
+	 *
+	 * @param context the context whose properties (number of frames and
+	 * channels) will be used by process().
+	 * @param numThreads the number of threads running the graph,
+	 * including the one calling process(). Pass 0 to use one thread per
+	 * available CPU core. It is limited to the number of CPU cores.
+	 * @param numBuses the number of internal buses to allocate, in
+	 * addition to the audio input and output channels.
+	 * @param priority the priority of the worker threads.
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(const BelaContext* context, unsigned int numThreads = 0, unsigned int numBuses = 0, int priority = BELA_AUDIO_PRIORITY - 1);
+	/**
+	 * Add a node to the graph. Call this from setup().
+	 *
+	 * @param name a name for the node, used for error messages.
+	 * @param callback the function that processes the node.
+	 * @param inputs the channels that the node reads from.
+	 * @param outputs the channels that the node writes to.
+	 * @return the index of the node on success, or a negative error code.
+	 */
+	int addNode(const std::string& name, Callback callback, const std::vector<Channel>& inputs, const std::vector<Channel>& outputs);
+	/**
+	 * Get the channel for a given audio input of the context.
+	 */
+	Channel audioIn(unsigned int channel) const { return channel; }
+	/**
+	 * Get the channel for a given audio output of the context.
+	 */
+	Channel audioOut(unsigned int channel) const { return numAudioIn + channel; }
+	/**
+	 * Get the channel for a given internal bus.
+	 */
+	Channel bus(unsigned int n) const { return numAudioIn + numAudioOut + n; }
+	/**
+	 * Process all the nodes in the graph. Call this from render(). The
+	 * audio inputs of the @p context are copied to the graph's input
+	 * channels before processing and the graph's output channels are
+	 * written to the audio outputs of the @p context afterwards.
+	 */
+	void process(BelaContext* context);
+	/**
+	 * Get the number of threads (including the caller of process())
+	 * running the graph.
+	 */
+	unsigned int getNumThreads() const { return workers.size() + 1; }
+	/**
+	 * Get the number of stages that the graph has been split into.
+	 * Nodes within a stage run in parallel, while stages run one after
+	 * the other.
+	 */
+	unsigned int getNumStages() const { return stages.size(); }
+	void cleanup();
+	static bool test();
+private:
+	struct Node {
+		std::string name;
+		Callback callback;
+		std::vector<Channel> inputs;
+		std::vector<Channel> outputs;
+		std::vector<const float*> inPtrs;
+		std::vector<float*> outPtrs;
+		unsigned int stage;
+	};
+	struct Worker {
+		RenderGraph* graph;
+		unsigned int index;
+		pthread_t thread;
+		sem_t start;
+		bool started;
+	};
+	// a thread waiting on the barrier after spinning for too long
+	struct Sleeper {
+		sem_t wake;
+		std::atomic<bool> sleeping{false};
+	};
+	static void* workerLoop(void* arg);
+	void runStages(unsigned int thread);
+	void barrier(unsigned int thread);
+	std::vector<Node> nodes;
+	std::vector<std::vector<unsigned int>> stages;
+	std::vector<std::atomic<unsigned int>> stageCursors;
+	std::vector<Worker> workers;
+	// one for each thread, the last one being the caller of process()
+	std::vector<Sleeper> sleepers;
+	std::vector<float> buffers;
+	const BelaContext* context = nullptr;
+	const BelaContext* processContext = nullptr;
+	unsigned int numAudioIn = 0;
+	unsigned int numAudioOut = 0;
+	unsigned int numChannels = 0;
+	unsigned int frames = 0;
+	std::atomic<unsigned int> barrierCount{0};
+	std::atomic<unsigned int> barrierGeneration{0};
+	volatile bool shouldStop = false;
+};
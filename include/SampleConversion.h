@@ -0,0 +1,121 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Conversion between the raw samples exchanged with the PRU and the float
+ * buffers of the BelaContext.
+ *
+ * Raw buffers are always interleaved. Float buffers can be interleaved
+ * or not. Where possible, the conversion and transposition are done with
+ * NEON (on ARM) or SSE2 (on x86) intrinsics, falling back to scalar code
+ * for the layouts that don't fit in vectors. The functions in the
+ * `Reference` namespace are plain scalar implementations producing the
+ * same bit-exact results, and are used to validate the others.
+ */
+namespace SampleConversion
+{
+	/**
+	 * How frames in the source buffer map to frames in the destination
+	 * buffer.
+	 */
+	typedef enum {
+		kOneToOne, ///< each source frame goes to one destination frame
+		kDuplicate, ///< each source frame goes to two consecutive destination frames
+		kDecimate, ///< every other source frame goes to a destination frame, the others are discarded
+	} FrameRatio;
+
+	/**
+	 * Convert raw audio samples to float in the -1 to 1 range.
+	 *
+	 * @param dst the destination buffer (`frames * channels` samples)
+	 * @param src the interleaved raw samples (`frames * channels` samples)
+	 * @param frames the number of frames
+	 * @param channels the number of channels
+	 * @param interleaved whether @p dst is interleaved
+	 */
+	void audioRawToFloat(float* dst, const int16_t* src, unsigned int frames, unsigned int channels, bool interleaved);
+	/**
+	 * Convert float audio samples in the -1 to 1 range to raw samples,
+	 * clipping them.
+	 *
+	 * @param dst the interleaved raw samples. Sample for frame `n` and
+	 * channel `c` is written at `n * dstChannels + c * channelStride`.
+	 * @param src the source buffer (`frames * channels` samples)
+	 * @param frames the number of frames
+	 * @param channels the number of channels in @p src
+	 * @param interleaved whether @p src is interleaved
+	 * @param dstChannels the number of channels in @p dst
+	 * @param channelStride the distance between consecutive channels in @p dst
+	 */
+	void audioFloatToRaw(int16_t* dst, const float* src, unsigned int frames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int channelStride = 1);
+	/**
+	 * Convert raw analog samples to float in the 0 to 1 range.
+	 *
+	 * @param dst the destination buffer.
+	 * @param src the interleaved raw samples (`rawFrames * channels` samples)
+	 * @param rawFrames the number of frames in @p src
+	 * @param channels the number of channels
+	 * @param interleaved whether @p dst is interleaved
+	 * @param ratio how the frames in @p src map to the frames in @p dst.
+	 * @p dst will contain `rawFrames`, `rawFrames * 2` or `rawFrames / 2`
+	 * frames accordingly.
+	 */
+	void analogRawToFloat(float* dst, const uint16_t* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio = kOneToOne);
+	/**
+	 * Convert float analog samples in the 0 to 1 range to raw samples,
+	 * clipping them.
+	 *
+	 * @param dst the interleaved raw samples (`rawFrames * channels` samples)
+	 * @param src the source buffer.
+	 * @param rawFrames the number of frames in @p dst
+	 * @param channels the number of channels
+	 * @param interleaved whether @p src is interleaved
+	 * @param ratio how the frames in @p src map to the frames in @p dst.
+	 * @p src should contain `rawFrames`, `rawFrames / 2` or `rawFrames * 2`
+	 * frames accordingly.
+	 */
+	void analogFloatToRaw(uint16_t* dst, const float* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio = kOneToOne);
+	/**
+	 * Convert float analog outputs to raw audio samples, for boards where
+	 * the analog outputs are on the second audio serialiser.
+	 *
+	 * @param dst the interleaved raw samples, with @p dstChannels channels
+	 * per frame.
+	 * @param src the analog output buffer
+	 * @param audioFrames the number of frames to write to @p dst
+	 * @param analogFrames the number of frames in @p src
+	 * @param channels the number of analog channels
+	 * @param interleaved whether @p src is interleaved
+	 * @param dstChannels the number of channels in @p dst
+	 * @param minCommonChannels the smallest of the number of audio and
+	 * analog output channels
+	 */
+	void analogFloatToAudioRaw(int16_t* dst, const float* src, unsigned int audioFrames, unsigned int analogFrames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int minCommonChannels);
+	/**
+	 * Swap the first half of the channels with the second half, in place.
+	 * This is used to reorder the channels of the CTAG codecs.
+	 *
+	 * @param buf the buffer
+	 * @param frames the number of frames
+	 * @param channels the number of channels
+	 * @param interleaved whether @p buf is interleaved
+	 */
+	void swapChannelHalves(float* buf, unsigned int frames, unsigned int channels, bool interleaved);
+
+	/**
+	 * Scalar implementations of the above, used for testing.
+	 */
+	namespace Reference
+	{
+		void audioRawToFloat(float* dst, const int16_t* src, unsigned int frames, unsigned int channels, bool interleaved);
+		void audioFloatToRaw(int16_t* dst, const float* src, unsigned int frames, unsigned int channels, bool interleaved, unsigned int dstChannels, unsigned int channelStride = 1);
+		void analogRawToFloat(float* dst, const uint16_t* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio = kOneToOne);
+		void analogFloatToRaw(uint16_t* dst, const float* src, unsigned int rawFrames, unsigned int channels, bool interleaved, FrameRatio ratio = kOneToOne);
+		void swapChannelHalves(float* buf, unsigned int frames, unsigned int channels, bool interleaved);
+	}
+	/**
+	 * Compare the optimised implementations against the reference ones
+	 * for all supported layouts.
+	 */
+	bool test();
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * A lock-free, fixed-capacity, single-producer/single-consumer queue.
+ *
+ * All memory is allocated in setup(), so that push() and pop() are
+ * RT-safe: they never allocate, block or enter the kernel.
+ * Exactly one thread may call push() and exactly one thread may call
+ * pop() at any given time. The producer and consumer can be different
+ * threads, running in any combination of primary and secondary mode.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	SpscQueue() {}
+	SpscQueue(size_t capacity)
+	{
+		setup(capacity);
+	}
+	/**
+	 * Allocate memory for the queue and reset it. Not thread safe.
+	 *
+	 * @param capacity the maximum number of items that can be held in
+	 * the queue at any time.
+	 * @return 0 on success, or an error code otherwise.
+	 */
+	int setup(size_t capacity)
+	{
+		if(!capacity)
+			return -1;
+		// one slot is always left empty to tell a full queue from an
+		// empty one
+		data.resize(capacity + 1);
+		clear();
+		return 0;
+	}
+	/**
+	 * Remove all items from the queue. Not thread safe.
+	 */
+	void clear()
+	{
+		writeIdx.store(0, std::memory_order_relaxed);
+		readIdx.store(0, std::memory_order_relaxed);
+	}
+	/**
+	 * Add an item at the end of the queue. Only call this from the
+	 * producer thread.
+	 *
+	 * @return `true` on success, `false` if the queue is full.
+	 */
+	bool push(const T& item)
+	{
+		size_t w = writeIdx.load(std::memory_order_relaxed);
+		size_t next = increment(w);
+		if(next == readIdx.load(std::memory_order_acquire))
+			return false;
+		data[w] = item;
+		writeIdx.store(next, std::memory_order_release);
+		return true;
+	}
+	/**
+	 * Retrieve the item at the front of the queue. Only call this from
+	 * the consumer thread.
+	 *
+	 * @return `true` on success, `false` if the queue is empty.
+	 */
+	bool pop(T& item)
+	{
+		size_t r = readIdx.load(std::memory_order_relaxed);
+		if(r == writeIdx.load(std::memory_order_acquire))
+			return false;
+		item = data[r];
+		readIdx.store(increment(r), std::memory_order_release);
+		return true;
+	}
+	/**
+	 * Get a pointer to the item at the front of the queue without
+	 * removing it. Only call this from the consumer thread.
+	 *
+	 * @return a pointer to the item, or `nullptr` if the queue is empty.
+	 * The pointer is valid until the next call to pop().
+	 */
+	T* front()
+	{
+		size_t r = readIdx.load(std::memory_order_relaxed);
+		if(r == writeIdx.load(std::memory_order_acquire))
+			return nullptr;
+		return &data[r];
+	}
+	/**
+	 * Get the number of items currently in the queue. When called from
+	 * a thread other than the producer or the consumer, the returned
+	 * value is only an estimate.
+	 */
+	size_t size() const
+	{
+		size_t w = writeIdx.load(std::memory_order_acquire);
+		size_t r = readIdx.load(std::memory_order_acquire);
+		return w >= r ? w - r : w + data.size() - r;
+	}
+	/**
+	 * Get the maximum number of items that the queue can hold.
+	 */
+	size_t capacity() const
+	{
+		return data.size() ? data.size() - 1 : 0;
+	}
+private:
+	size_t increment(size_t idx) const
+	{
+		++idx;
+		return idx == data.size() ? 0 : idx;
+	}
+	std::vector<T> data;
+	// keep the indices on separate cache lines, so that producer and
+	// consumer don't invalidate each other's cache at every access
+	char pad0[64];
+	std::atomic<size_t> writeIdx{0};
+	char pad1[64];
+	std::atomic<size_t> readIdx{0};
+	char pad2[64];
+};
@@ -1,91 +1,198 @@
 #include "AudioFile.h"
+#include <Bela.h>
 #include <unistd.h>
 #include <string.h>
+#include <mutex>
+#include <algorithm>
 
-std::vector<float>& AudioFile::getRtBuffer()
+constexpr unsigned int AudioFile::kDefaultPrefetch;
+
+// The I/O thread pool, shared by all the files
+static constexpr unsigned int kMaxIoThreads = 8;
+static unsigned int gNumIoThreads = 1;
+static AuxiliaryTask gIoTasks[kMaxIoThreads];
+static std::atomic<bool> gIoPending[kMaxIoThreads];
+static std::mutex gIoMutex;
+static std::vector<AudioFile*> gIoFiles;
+
+void AudioFile::setNumIoThreads(unsigned int numThreads)
 {
-	size_t idx;
-	if(ramOnly)
-		idx = 0;
-	else
-		idx = !ioBuffer;
-	return internalBuffers[idx];
+	std::lock_guard<std::mutex> lock(gIoMutex);
+	if(gIoTasks[0])
+	{
+		fprintf(stderr, "AudioFile: the I/O threads have already been started\n");
+		return;
+	}
+	gNumIoThreads = std::max(1u, std::min(numThreads, kMaxIoThreads));
 }
 
-int AudioFile::setup(const std::string& path, size_t bufferSize, Mode mode, size_t channels /* = 0 */, unsigned int sampleRate /* = 0 */)
+// Called from one of the I/O threads each time it is scheduled: give each
+// file that needs it a turn, unless another I/O thread is already on it.
+void AudioFile::ioThread(void* arg)
+{
+	uintptr_t n = (uintptr_t)arg;
+	// wakeIo() calls from now on will schedule us again
+	gIoPending[n].store(false, std::memory_order_release);
+	std::unique_lock<std::mutex> lock(gIoMutex);
+	for(size_t i = 0; i < gIoFiles.size(); ++i)
+	{
+		AudioFile* f = gIoFiles[i];
+		// while we hold the lock, cleanup() can't remove f
+		while(!f->ioBusy.exchange(true, std::memory_order_acquire))
+		{
+			bool needsIo = f->needsIo();
+			if(needsIo)
+			{
+				lock.unlock();
+				f->io();
+				lock.lock();
+			}
+			f->ioBusy.store(false, std::memory_order_release);
+			if(!needsIo)
+				break;
+		}
+	}
+}
+
+void AudioFile::wakeIo()
+{
+	// an I/O thread that is pending will service all the files once it
+	// runs, so there is no need to schedule another one
+	for(unsigned int n = 0; n < gNumIoThreads; ++n)
+	{
+		if(gIoPending[n].load(std::memory_order_relaxed))
+			return;
+	}
+	for(unsigned int n = 0; n < gNumIoThreads; ++n)
+	{
+		if(!gIoPending[n].exchange(true, std::memory_order_acq_rel))
+		{
+			Bela_scheduleAuxiliaryTask(gIoTasks[n]);
+			return;
+		}
+	}
+}
+
+// Atomically move one of the buffers from state `from` to state `to`.
+AudioFile::Buffer* AudioFile::claim(int from, int to)
+{
+	for(unsigned int n = 0; n < numBuffers; ++n)
+	{
+		int state = from;
+		if(buffers[n].state.compare_exchange_strong(state, to, std::memory_order_acq_rel))
+			return &buffers[n];
+	}
+	return nullptr;
+}
+
+int AudioFile::setup(const std::string& path, size_t bufferSize, Mode mode, size_t channels, unsigned int rate, unsigned int prefetch)
 {
 	cleanup();
 	int sf_mode;
 	switch(mode){
 	case kWrite:
 		sf_mode = SFM_WRITE;
-		sfinfo.samplerate = sampleRate;
+		sfinfo.samplerate = rate;
 		sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
 		sfinfo.channels = channels;
+		// one buffer in use by the audio thread, the others waiting
+		// to be written
+		numBuffers = prefetch + 1;
 		break;
 	case kRead:
+	default:
 		sfinfo.format = 0;
 		sf_mode = SFM_READ;
+		// one buffer in use by the audio thread, the others prefetched
+		// and a spare one, so that a seek() can be serviced even when
+		// all the others are full
+		numBuffers = prefetch + 2;
 		break;
 	}
+	if(!bufferSize)
+		return 1;
 	sndfile = sf_open(path.c_str(), sf_mode, &sfinfo);
 	if(!sndfile)
 		return 1;
+	length = sfinfo.frames;
+	sampleRate = sfinfo.samplerate;
+	resampler.reset();
+	if(kRead == mode && rate && rate != sampleRate)
+	{
+		resampler.reset(new Resampler);
+		if(resampler->setup(sampleRate, rate, getChannels()))
+		{
+			cleanup();
+			return 1;
+		}
+		length = resampler->getOutputFrames(length);
+		sampleRate = rate;
+	}
 	rtIdx = 0;
+	rtBuffer = nullptr;
+	xruns = 0;
+	ioBusy = false;
 	ramOnly = false;
-	ioBuffer = 0;
-	size_t numSamples = getLength() * getChannels();
-	if(kRead == mode && bufferSize * kNumBufs >= numSamples)
+	if(kRead == mode && bufferSize * numBuffers >= getLength())
 	{
+		// use a single buffer with the actual audio content
 		ramOnly = true;
-		// empty other buffers, we will only use the first one
-		for(unsigned int n = 1; n < internalBuffers.size(); ++n)
-			internalBuffers[n].clear();
-		// the actual audio content
-		internalBuffers[0].resize(numSamples);
-	} else {
-		for(auto& b : internalBuffers)
-			b.resize(bufferSize * getChannels());
+		numBuffers = 1;
 	}
-	ioBufferOld = ioBuffer;
-	if(kRead == mode)
+	buffers.reset(new Buffer[numBuffers]);
+	for(unsigned int n = 0; n < numBuffers; ++n)
 	{
-		// fill up the first buffer
-		io(internalBuffers[ioBuffer]);
-		// signal threadLoop() to start filling in the next buffer
-		scheduleIo();
-	}
-	if(!ramOnly)
-	{
-		stop = false;
-		diskIo = std::thread(&AudioFile::threadLoop, this);
+		Buffer& b = buffers[n];
+		b.data.resize(ramOnly ? getLength() * getChannels() : bufferSize * getChannels());
+		b.state = kFree;
+		b.generation = 0;
+		b.seq = 0;
+		b.startFrame = 0;
+		b.samples = 0;
 	}
 	return 0;
 }
 
-void AudioFile::cleanup()
-{
-	stop = true;
-	if(diskIo.joinable())
-		diskIo.join();
-	sf_close(sndfile);
-}
-
-void AudioFile::scheduleIo()
+// Start servicing the file from the I/O threads
+void AudioFile::startIo()
 {
-	// schedule thread
-	// TODO: detect underrun
-	ioBuffer = !ioBuffer;
+	std::lock_guard<std::mutex> lock(gIoMutex);
+	if(!gIoTasks[0])
+	{
+		for(unsigned int n = 0; n < gNumIoThreads; ++n)
+		{
+			std::string name = "AudioFileIo" + std::to_string(n);
+			gIoTasks[n] = Bela_createAuxiliaryTask(AudioFile::ioThread, 90, name.c_str(), (void*)(uintptr_t)n);
+		}
+	}
+	gIoFiles.push_back(this);
+	ioRegistered = true;
 }
 
-void AudioFile::threadLoop()
+void AudioFile::cleanup()
 {
-	while(!stop)
+	if(ioRegistered)
 	{
-		if(ioBuffer != ioBufferOld)
-			io(internalBuffers[ioBuffer]);
-		ioBufferOld = ioBuffer;
-		usleep(100000);
+		// wait for the I/O threads to be done with us
+		while(1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(gIoMutex);
+				if(!ioBusy.load(std::memory_order_acquire))
+				{
+					gIoFiles.erase(std::remove(gIoFiles.begin(), gIoFiles.end(), this), gIoFiles.end());
+					break;
+				}
+			}
+			usleep(1000);
+		}
+		ioRegistered = false;
+	}
+	if(sndfile)
+	{
+		finish();
+		sf_close(sndfile);
+		sndfile = NULL;
 	}
 }
 
@@ -94,10 +201,56 @@ AudioFile::~AudioFile()
 	cleanup();
 }
 
-int AudioFileReader::setup(const std::string& path, size_t bufferSize)
+int AudioFileReader::setup(const std::string& path, size_t bufferSize, unsigned int prefetch, unsigned int sampleRate)
 {
+	loopSeq = 0;
 	loop = false;
-	return AudioFile::setup(path, bufferSize, kRead);
+	loopStart = 0;
+	loopStop = 0;
+	int ret = AudioFile::setup(path, bufferSize, kRead, 0, sampleRate, prefetch);
+	if(ret)
+		return ret;
+	seekGeneration = 0;
+	seekFrame = 0;
+	rtGeneration = 0;
+	rtSeq = 0;
+	rtFrame = 0;
+	ioGeneration = 0;
+	ioSeq = 0;
+	ioFrame = 0;
+	ioOutFrame = 0;
+	ioInPos = 0;
+	ioInFrames = 0;
+	if(ramOnly)
+	{
+		Buffer& b = buffers[0];
+		if(resampler)
+		{
+			// convert the whole file now
+			std::vector<float> in(sfinfo.frames * getChannels());
+			sf_count_t count = sf_read_float(sndfile, in.data(), in.size());
+			memset(in.data() + count, 0, (in.size() - count) * sizeof(in[0]));
+			std::vector<float> out;
+			Resampler::process(out, in.data(), sfinfo.frames, getChannels(), getFileSampleRate(), getSampleRate());
+			out.resize(b.data.size());
+			b.data.swap(out);
+		} else {
+			b.samples = sf_read_float(sndfile, b.data.data(), b.data.size());
+			memset(b.data.data() + b.samples, 0, (b.data.size() - b.samples) * sizeof(b.data[0]));
+		}
+		b.samples = b.data.size();
+		rtBuffer = &b;
+	} else {
+		if(resampler)
+		{
+			ioIn.resize(1024 * getChannels());
+			resampler->reset(0);
+		}
+		// fill up the buffers before we start
+		io();
+		startIo();
+	}
+	return 0;
 }
 
 int AudioFileReader::setLoop(bool doLoop)
@@ -107,63 +260,229 @@ int AudioFileReader::setLoop(bool doLoop)
 
 int AudioFileReader::setLoop(size_t start, size_t end)
 {
-	if(start == end)
+	if(start != end && (start > getLength() || end > getLength() || end < start))
+		return 1;
+	// the I/O thread retries if it sees loopSeq change while it reads
+	loopSeq.fetch_add(1, std::memory_order_acq_rel);
+	loop.store(start != end, std::memory_order_relaxed);
+	loopStart.store(start, std::memory_order_relaxed);
+	loopStop.store(end, std::memory_order_relaxed);
+	loopSeq.fetch_add(1, std::memory_order_release);
+	return 0;
+}
+
+void AudioFileReader::getLoop(bool& doLoop, size_t& start, size_t& stop)
+{
+	unsigned int seq;
+	do {
+		seq = loopSeq.load(std::memory_order_acquire);
+		doLoop = loop.load(std::memory_order_relaxed);
+		start = loopStart.load(std::memory_order_relaxed);
+		stop = loopStop.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while((seq & 1) || seq != loopSeq.load(std::memory_order_relaxed));
+}
+
+int AudioFileReader::seek(size_t frame)
+{
+	if(frame > getLength())
+		return 1;
+	if(ramOnly)
 	{
-		this->loop = false;
+		rtIdx = frame * getChannels();
 		return 0;
 	}
-	if(start > getLength() || end > getLength() || end < start)
-		return 1;
-	this->loop = true;
-	loopStart = start;
-	loopStop = end;
+	seekFrame.store(frame, std::memory_order_relaxed);
+	seekGeneration.fetch_add(1, std::memory_order_release);
+	wakeIo();
 	return 0;
 }
 
-void AudioFileReader::io(std::vector<float>& buffer)
+size_t AudioFileReader::getIdx()
+{
+	size_t frame = ramOnly ? rtIdx / getChannels() : rtFrame;
+	bool doLoop;
+	size_t start, stop;
+	getLoop(doLoop, start, stop);
+	// the buffer may have wrapped around the loop point
+	if(doLoop && frame >= stop && stop > start)
+		frame = start + (frame - stop) % (stop - start);
+	return frame;
+}
+
+// Read the next count samples of the file into dst, following the loop
+// points.
+void AudioFileReader::read(float* dst, size_t count)
 {
-	size_t count = buffer.size();
+	bool doLoop;
+	size_t start, stop;
+	getLoop(doLoop, start, stop);
+	start = toFileFrame(start);
+	stop = toFileFrame(stop);
+	size_t channels = getChannels();
 	size_t dstPtr = 0;
-	int readcount = 0;
+	bool rewound = false;
 	while(count)
 	{
 		size_t toRead = count;
-		if(loop)
+		if(doLoop)
 		{
-			size_t stop = loopStop * getChannels();
-			if(stop > idx)
-			{
-				size_t toEndOfLoop = stop - idx;
-				if(toRead > toEndOfLoop)
-					toRead = toEndOfLoop;
-			} else {
-				// force to return 0 and trigger a loop rewind
+			if(stop > ioFrame)
+				toRead = std::min(toRead, (stop - ioFrame) * channels);
+			else // force to return 0 and trigger a loop rewind
 				toRead = 0;
-			}
 		}
-		int readcount = sf_read_float(sndfile, buffer.data() + dstPtr, toRead);
-		idx += readcount;
+		sf_count_t readcount = toRead ? sf_read_float(sndfile, dst + dstPtr, toRead) : 0;
+		if(readcount > 0)
+			rewound = false;
+		ioFrame += readcount / channels;
 		dstPtr += readcount;
 		count -= readcount;
 		if(count)
 		{
 			// end of file or of loop section:
-			if(loop)
+			if(doLoop && !rewound)
 			{
 				// rewind and try again
-				sf_seek(sndfile, loopStart, SEEK_SET);
-				idx = loopStart;
-			}
-			else
-			{
+				sf_seek(sndfile, start, SEEK_SET);
+				ioFrame = start;
+				rewound = true;
+			} else {
 				// fill the rest with zeros
-				memset(buffer.data() + dstPtr, 0, count * sizeof(buffer[0]));
+				memset(dst + dstPtr, 0, count * sizeof(dst[0]));
+				ioFrame += count / channels;
 				count = 0;
 			}
 		}
 	}
 }
 
+// Fill the buffer with the next part of the stream, converting its
+// sample rate if needed.
+void AudioFileReader::fill(Buffer& buffer)
+{
+	if(!resampler)
+	{
+		buffer.startFrame = ioFrame;
+		read(buffer.data.data(), buffer.data.size());
+		buffer.samples = buffer.data.size();
+		return;
+	}
+	size_t channels = getChannels();
+	size_t frames = buffer.data.size() / channels;
+	size_t done = 0;
+	buffer.startFrame = ioOutFrame;
+	while(done < frames)
+	{
+		if(ioInPos == ioInFrames)
+		{
+			read(ioIn.data(), ioIn.size());
+			ioInPos = 0;
+			ioInFrames = ioIn.size() / channels;
+		}
+		unsigned int used;
+		done += resampler->process(buffer.data.data() + done * channels, frames - done, ioIn.data() + ioInPos * channels, ioInFrames - ioInPos, used);
+		ioInPos += used;
+	}
+	buffer.samples = buffer.data.size();
+	// keep track of the position at the output rate, for getIdx()
+	bool doLoop;
+	size_t start, stop;
+	getLoop(doLoop, start, stop);
+	ioOutFrame += frames;
+	if(doLoop && stop > start && ioOutFrame >= stop)
+		ioOutFrame = start + (ioOutFrame - stop) % (stop - start);
+}
+
+// Get a buffer to read into: a free one, or one with data that is never
+// going to be played because another seek() has been requested since.
+// Returns nullptr if the maximum number of buffers have already been read
+// ahead. If dryRun is true, the buffer is not claimed.
+AudioFile::Buffer* AudioFileReader::claimForFill(bool dryRun)
+{
+	unsigned int playing = rtGeneration.load(std::memory_order_acquire);
+	unsigned int queued = 0;
+	Buffer* free = nullptr;
+	Buffer* stale = nullptr;
+	for(unsigned int n = 0; n < numBuffers; ++n)
+	{
+		Buffer& b = buffers[n];
+		int state = b.state.load(std::memory_order_acquire);
+		if(kFree == state)
+			free = &b;
+		else if(b.generation == ioGeneration)
+			++queued;
+		else if(kReady == state && b.generation != playing)
+			stale = &b;
+	}
+	// keep the spare buffer for seeks
+	if(queued >= numBuffers - 1)
+		return nullptr;
+	Buffer* b = free ? free : stale;
+	if(!b || dryRun)
+		return b;
+	int state = free ? kFree : kReady;
+	// if the audio thread has taken it in the meantime, try again later
+	if(!b->state.compare_exchange_strong(state, kIo, std::memory_order_acq_rel))
+		return nullptr;
+	return b;
+}
+
+bool AudioFileReader::needsIo()
+{
+	if(ioGeneration != seekGeneration.load(std::memory_order_acquire))
+		return true;
+	return claimForFill(true);
+}
+
+void AudioFileReader::io()
+{
+	while(1)
+	{
+		unsigned int generation = seekGeneration.load(std::memory_order_acquire);
+		if(generation != ioGeneration)
+		{
+			size_t frame = seekFrame.load(std::memory_order_relaxed);
+			if(resampler)
+			{
+				// start reading a little earlier, to give the filter
+				// some history
+				ioOutFrame = frame;
+				frame = resampler->reset(frame);
+				ioInPos = 0;
+				ioInFrames = 0;
+			}
+			sf_seek(sndfile, frame, SEEK_SET);
+			ioFrame = frame;
+			ioGeneration = generation;
+			ioSeq = 0;
+		}
+		Buffer* b = claimForFill(false);
+		if(!b)
+			break;
+		fill(*b);
+		b->generation = generation;
+		b->seq = ioSeq++;
+		b->state.store(kReady, std::memory_order_release);
+	}
+}
+
+AudioFile::Buffer* AudioFileReader::findReady(unsigned int generation, size_t seq)
+{
+	for(unsigned int n = 0; n < numBuffers; ++n)
+	{
+		Buffer& b = buffers[n];
+		if(kReady != b.state.load(std::memory_order_acquire))
+			continue;
+		if(b.generation != generation || b.seq != seq)
+			continue;
+		int state = kReady;
+		if(b.state.compare_exchange_strong(state, kRt, std::memory_order_acq_rel))
+			return &b;
+	}
+	return nullptr;
+}
+
 void AudioFileReader::getSamples(std::vector<float>& outBuf)
 {
 	return getSamples(outBuf.data(), outBuf.size());
@@ -171,44 +490,106 @@ void AudioFileReader::getSamples(std::vector<float>& outBuf)
 
 void AudioFileReader::getSamples(float* dst, size_t samplesCount)
 {
-	size_t n = 0;
-	while(n < samplesCount)
+	if(!sndfile)
 	{
-		auto& inBuf = getRtBuffer();
-		size_t inBufEnd = ramOnly ?
-			(loop ? loopStop * getChannels() : inBuf.size())
-			: inBuf.size();
-		bool done = false;
-		for(; n < samplesCount && rtIdx < inBufEnd; ++n)
-		{
-			done = true;
-			dst[n] = inBuf[rtIdx++];
-		}
-		if(rtIdx == inBufEnd)
+		memset(dst, 0, samplesCount * sizeof(dst[0]));
+		return;
+	}
+	if(ramOnly)
+	{
+		bool doLoop;
+		size_t start, stop;
+		getLoop(doLoop, start, stop);
+		const std::vector<float>& inBuf = buffers[0].data;
+		size_t inBufEnd = doLoop ? stop * getChannels() : inBuf.size();
+		size_t n = 0;
+		while(n < samplesCount)
 		{
-			if(ramOnly)
+			for(; n < samplesCount && rtIdx < inBufEnd; ++n)
+				dst[n] = inBuf[rtIdx++];
+			if(rtIdx >= inBufEnd)
 			{
-				if(loop)
-					rtIdx = loopStart;
+				if(doLoop)
+					rtIdx = start * getChannels();
 				else {
 					memset(dst + n, 0, (samplesCount - n) * sizeof(dst[0]));
 					n = samplesCount;
-					done = true;
 				}
-			} else {
-				rtIdx = 0;
-				scheduleIo(); // this should give us a new inBuf
 			}
 		}
-		if(!done){
-			break;
+		return;
+	}
+	// jump as soon as the data for the last seek() is ready
+	unsigned int generation = seekGeneration.load(std::memory_order_relaxed);
+	if(generation != rtGeneration)
+	{
+		Buffer* b = findReady(generation, 0);
+		if(b)
+		{
+			if(rtBuffer)
+				rtBuffer->state.store(kFree, std::memory_order_release);
+			// release the data read ahead before the seek
+			for(unsigned int n = 0; n < numBuffers; ++n)
+			{
+				Buffer& old = buffers[n];
+				int state = kReady;
+				if(&old != b && old.generation != generation)
+					old.state.compare_exchange_strong(state, kFree, std::memory_order_acq_rel);
+			}
+			rtBuffer = b;
+			rtIdx = 0;
+			rtFrame = b->startFrame;
+			rtGeneration.store(generation, std::memory_order_release);
+			rtSeq = 1;
+			wakeIo();
+		}
+	}
+	size_t n = 0;
+	while(n < samplesCount)
+	{
+		if(!rtBuffer)
+		{
+			rtBuffer = findReady(rtGeneration, rtSeq);
+			if(!rtBuffer)
+			{
+				// underrun: try again at the next call
+				memset(dst + n, 0, (samplesCount - n) * sizeof(dst[0]));
+				xruns.fetch_add(1, std::memory_order_relaxed);
+				wakeIo();
+				return;
+			}
+			++rtSeq;
+			rtIdx = 0;
+		}
+		const std::vector<float>& inBuf = rtBuffer->data;
+		size_t toCopy = std::min(samplesCount - n, rtBuffer->samples - rtIdx);
+		memcpy(dst + n, inBuf.data() + rtIdx, toCopy * sizeof(dst[0]));
+		n += toCopy;
+		rtIdx += toCopy;
+		rtFrame = rtBuffer->startFrame + rtIdx / getChannels();
+		if(rtIdx == rtBuffer->samples)
+		{
+			rtBuffer->state.store(kFree, std::memory_order_release);
+			rtBuffer = nullptr;
+			wakeIo();
 		}
 	}
 }
 
-int AudioFileWriter::setup(const std::string& path, size_t bufferSize, size_t channels, unsigned int sampleRate)
+AudioFileReader::~AudioFileReader()
 {
-	return AudioFile::setup(path, bufferSize, kWrite, channels, sampleRate);
+	cleanup();
+}
+
+int AudioFileWriter::setup(const std::string& path, size_t bufferSize, size_t channels, unsigned int sampleRate, unsigned int prefetch)
+{
+	int ret = AudioFile::setup(path, bufferSize, kWrite, channels, sampleRate, prefetch);
+	if(ret)
+		return ret;
+	rtSeq = 0;
+	ioSeq = 0;
+	startIo();
+	return 0;
 }
 
 void AudioFileWriter::setSamples(std::vector<float>& buffer)
@@ -218,31 +599,232 @@ void AudioFileWriter::setSamples(std::vector<float>& buffer)
 
 void AudioFileWriter::setSamples(float const * src, size_t samplesCount)
 {
+	if(!sndfile)
+		return;
 	size_t n = 0;
 	while(n < samplesCount)
 	{
-		auto& outBuf = getRtBuffer();
-		bool done = false;
-		for(; n < samplesCount && rtIdx < outBuf.size(); ++n)
+		if(!rtBuffer)
 		{
-			done = true;
-			outBuf[rtIdx++] = src[n];
+			rtBuffer = claim(kFree, kRt);
+			if(!rtBuffer)
+			{
+				// overrun: drop the samples
+				xruns.fetch_add(1, std::memory_order_relaxed);
+				wakeIo();
+				return;
+			}
+			rtBuffer->seq = rtSeq++;
+			rtIdx = 0;
 		}
+		std::vector<float>& outBuf = rtBuffer->data;
+		size_t toCopy = std::min(samplesCount - n, outBuf.size() - rtIdx);
+		memcpy(outBuf.data() + rtIdx, src + n, toCopy * sizeof(src[0]));
+		n += toCopy;
+		rtIdx += toCopy;
 		if(rtIdx == outBuf.size())
 		{
-			rtIdx = 0;
-			scheduleIo(); // this should give us a new outBuf
+			rtBuffer->samples = rtIdx;
+			rtBuffer->state.store(kReady, std::memory_order_release);
+			rtBuffer = nullptr;
+			wakeIo();
 		}
-		if(!done){
-			break;
+	}
+}
+
+bool AudioFileWriter::needsIo()
+{
+	for(unsigned int n = 0; n < numBuffers; ++n)
+	{
+		if(kReady == buffers[n].state.load(std::memory_order_acquire))
+			return true;
+	}
+	return false;
+}
+
+void AudioFileWriter::io()
+{
+	// write the buffers in the order in which they were filled
+	bool found = true;
+	while(found)
+	{
+		found = false;
+		for(unsigned int n = 0; n < numBuffers; ++n)
+		{
+			Buffer& b = buffers[n];
+			if(kReady != b.state.load(std::memory_order_acquire) || b.seq != ioSeq)
+				continue;
+			b.state.store(kIo, std::memory_order_relaxed);
+			sf_count_t ret = sf_write_float(sndfile, b.data.data(), b.samples);
+			if(ret != sf_count_t(b.samples))
+				fprintf(stderr, "Error while writing to file: %lld\n", (long long)ret);
+			b.state.store(kFree, std::memory_order_release);
+			++ioSeq;
+			found = true;
+		}
+	}
+}
+
+void AudioFileWriter::finish()
+{
+	// write the partially filled buffer
+	if(rtBuffer)
+	{
+		rtBuffer->samples = rtIdx;
+		rtBuffer->state.store(kReady, std::memory_order_release);
+		rtBuffer = nullptr;
+	}
+	io();
+}
+
+AudioFileWriter::~AudioFileWriter()
+{
+	cleanup();
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+
+// a unique value for each frame, which survives 16-bit quantisation
+static float testValue(size_t frame, unsigned int channel)
+{
+	if(0 == channel)
+		return (frame % 10000) / 10000.f - 0.5f;
+	return (frame / 10000) / 10.f - 0.5f;
+}
+static const float kTolerance = 1.f / 40000;
+
+// Read consecutive blocks, checking that each frame follows the previous
+// one, as given by next(). Returns the last frame read.
+template <typename Next>
+static size_t checkStream(AudioFileReader& r, size_t frame, unsigned int blocks, Next next)
+{
+	const unsigned int kFrames = 16;
+	unsigned int channels = r.getChannels();
+	std::vector<float> buf(kFrames * channels);
+	for(unsigned int b = 0; b < blocks; ++b)
+	{
+		r.getSamples(buf);
+		for(unsigned int n = 0; n < kFrames; ++n)
+		{
+			size_t expected = next(frame);
+			// find which frame it is, if not the expected one
+			if(fabsf(buf[n * channels] - testValue(expected, 0)) > kTolerance
+				|| fabsf(buf[n * channels + 1] - testValue(expected, 1)) > kTolerance)
+			{
+				for(expected = 0; expected < r.getLength(); ++expected)
+					if(fabsf(buf[n * channels] - testValue(expected, 0)) < kTolerance
+						&& fabsf(buf[n * channels + 1] - testValue(expected, 1)) < kTolerance)
+						break;
+			}
+			for(unsigned int c = 0; c < channels; ++c)
+				assert(fabsf(buf[n * channels + c] - testValue(expected, c)) < kTolerance);
+			frame = expected;
 		}
+		// give the I/O thread time to keep up
+		usleep(200);
 	}
+	assert(0 == r.getUnderruns());
+	return frame;
 }
 
-void AudioFileWriter::io(std::vector<float>& buffer)
+bool AudioFileTest()
 {
-	size_t count = buffer.size();
-	sf_count_t ret = sf_write_float(sndfile, buffer.data(), buffer.size());
-	if(ret != sf_count_t(buffer.size()))
-		fprintf(stderr, "Error while writing to file: %lld\n", ret);
+	const char* path = "/tmp/AudioFileTest.wav";
+	const size_t kLength = 20000;
+	const unsigned int kChannels = 2;
+	{
+		AudioFileWriter w;
+		assert(0 == w.setup(path, 256, kChannels, 44100));
+		std::vector<float> buf(37 * kChannels);
+		for(size_t frame = 0; frame < kLength; )
+		{
+			size_t frames = std::min(buf.size() / kChannels, kLength - frame);
+			for(unsigned int n = 0; n < frames; ++n)
+				for(unsigned int c = 0; c < kChannels; ++c)
+					buf[n * kChannels + c] = testValue(frame + n, c);
+			w.setSamples(buf.data(), frames * kChannels);
+			frame += frames;
+			usleep(200);
+		}
+		assert(0 == w.getOverruns());
+		// the last, partial buffer is written on destruction
+	}
+	AudioFileReader r;
+	assert(0 == r.setup(path, 256));
+	assert(kLength == r.getLength());
+	assert(kChannels == r.getChannels());
+	// plain streaming, with no jumps
+	size_t frame = checkStream(r, -1, 100, [](size_t f) { return f + 1; });
+	assert(1599 == frame);
+	assert(1600 == r.getIdx());
+	// and on a buffer boundary (13 * 256), where the buffer has just
+	// been released
+	frame = checkStream(r, frame, 108, [](size_t f) { return f + 1; });
+	assert(3327 == frame);
+	assert(3328 == r.getIdx());
+	// the seek happens once the new data is ready: until then, the old
+	// data plays on
+	assert(0 == r.seek(15000));
+	bool jumped = false;
+	frame = checkStream(r, frame, 100, [&](size_t f) {
+		if(f + 1 != 15000 && f < 15000 && jumped)
+			assert(0);
+		jumped |= f + 1 >= 15000;
+		return f + 1;
+	});
+	assert(frame > 15000 && frame < 15000 + 1600);
+	// loop, jumping into the loop region straight away
+	r.setLoop(1000, 1500);
+	r.seek(1000);
+	frame = checkStream(r, frame, 200, [](size_t f) { return f + 1 == 1500 ? 1000 : f + 1; });
+	assert(frame >= 1000 && frame < 1500);
+	size_t idx = r.getIdx();
+	assert(idx == frame + 1 || (1500 == frame + 1 && 1000 == idx));
+
+	// the whole file fits in memory
+	assert(0 == r.setup(path, kLength));
+	frame = checkStream(r, -1, 10, [](size_t f) { return f + 1; });
+	r.setLoop(100, 200);
+	r.seek(150);
+	frame = checkStream(r, 149, 20, [](size_t f) { return f + 1 == 200 ? 100 : f + 1; });
+
+	// sample-rate conversion, both while streaming and in memory, gives
+	// the same result as converting the whole file at once
+	std::vector<float> original(kLength * kChannels);
+	for(size_t n = 0; n < kLength; ++n)
+		for(unsigned int c = 0; c < kChannels; ++c)
+			original[n * kChannels + c] = testValue(n, c);
+	std::vector<float> converted;
+	assert(0 == Resampler::process(converted, original.data(), kLength, kChannels, 44100, 48000));
+	for(size_t bufferSize : {size_t(256), kLength * 2})
+	{
+		assert(0 == r.setup(path, bufferSize, AudioFile::kDefaultPrefetch, 48000));
+		assert(48000 == r.getSampleRate() && 44100 == r.getFileSampleRate());
+		assert(converted.size() == r.getLength() * kChannels);
+		std::vector<float> buf(16 * kChannels);
+		for(size_t n = 0; n < 1600; n += 16)
+		{
+			r.getSamples(buf);
+			for(size_t k = 0; k < buf.size(); ++k)
+				assert(fabsf(buf[k] - converted[n * kChannels + k]) < 1e-4);
+			usleep(200);
+		}
+		assert(0 == r.getUnderruns());
+		// positions are at the converted rate
+		const size_t kTarget = 15000;
+		r.seek(kTarget);
+		do {
+			usleep(1000);
+			r.getSamples(buf);
+		} while(r.getIdx() != kTarget + 16);
+		for(size_t k = 0; k < buf.size(); ++k)
+			assert(fabsf(buf[k] - converted[kTarget * kChannels + k]) < 1e-4);
+	}
+	unlink(path);
+	printf("AudioFileTest successful\n");
+	return true;
 }
+#endif
@@ -65,6 +65,11 @@ namespace AudioFileUtilities {
 	 * @param start the first sample to load.
 	 *
 	 * @return a vector containing one vector of data per channel.
+	 *
+	 * This returns a copy of the samples. To share them between several
+	 * users without copying them, use SampleCache::get() instead.
+	 * To load many files without delaying the start of the audio, use
+	 * SampleLoader.
 	 */
 	std::vector<std::vector<float> > load(const std::string& filename, int maxCount = -1, unsigned int start = 0);
 	/**
@@ -77,9 +82,20 @@ namespace AudioFileUtilities {
 };
 
 #include <libraries/sndfile/sndfile.h>
-#include <thread>
-#include <array>
+#include <libraries/Resampler/Resampler.h>
+#include <atomic>
+#include <memory>
 
+/**
+ * Stream audio from or to a file on disk, see AudioFileReader and
+ * AudioFileWriter.
+ *
+ * The audio thread and the disk exchange data through a number of
+ * buffers, so that the disk can work ahead of the audio thread. The
+ * buffers of all the files are serviced by a shared pool of I/O threads
+ * (see setNumIoThreads()), which are woken up by the audio thread when
+ * there is work to do.
+ */
 class AudioFile
 {
 protected:
@@ -87,32 +103,83 @@ protected:
 		kRead,
 		kWrite,
 	} Mode;
-	enum { kNumBufs = 2};
-protected:
-	int setup(const std::string& path, size_t bufferSize, Mode mode, size_t channels = 0, unsigned int sampleRate = 0);
+	int setup(const std::string& path, size_t bufferSize, Mode mode, size_t channels, unsigned int sampleRate, unsigned int prefetch);
 public:
-	size_t getLength() const { return sfinfo.frames; };
+	/// The default number of buffers that are filled in advance, or
+	/// waiting to be written.
+	static constexpr unsigned int kDefaultPrefetch = 2;
+	/**
+	 * Get the number of frames in the file, at the rate returned by
+	 * getSampleRate().
+	 */
+	size_t getLength() const { return length; };
 	size_t getChannels() const { return sfinfo.channels; };
-	int getSampleRate() const { return sfinfo.samplerate; };
+	/**
+	 * Get the sample rate of the data. For an AudioFileReader that
+	 * converts the sample rate, this is the rate it converts to.
+	 */
+	int getSampleRate() const { return sampleRate; };
+	/**
+	 * Get the sample rate of the file on disk.
+	 */
+	int getFileSampleRate() const { return sfinfo.samplerate; };
+	/**
+	 * Set the number of threads that perform disk I/O for all the
+	 * files. This has to be called before the first call to setup() of
+	 * any object. The default is 1.
+	 */
+	static void setNumIoThreads(unsigned int numThreads);
 	virtual ~AudioFile();
-private:
-	void cleanup();
-protected:
-	volatile size_t ioBuffer;
-	size_t ioBufferOld;
 protected:
-	void scheduleIo();
-	std::vector<float>& getRtBuffer();
-	std::array<std::vector<float>,kNumBufs> internalBuffers;
-	void threadLoop();
-	virtual void io(std::vector<float>& buffer) = 0;
-	std::thread diskIo;
-	size_t size;
-	volatile bool stop;
-	bool ramOnly;
+	enum State {
+		kFree, ///< available
+		kIo, ///< owned by the I/O thread
+		kReady, ///< waiting for the audio thread (reader) or for the I/O thread (writer)
+		kRt, ///< owned by the audio thread
+	};
+	struct Buffer
+	{
+		std::vector<float> data;
+		std::atomic<int> state;
+		// these two are also read by the thread that doesn't own the
+		// buffer, to decide whether to claim it
+		std::atomic<unsigned int> generation; ///< the seek() that it belongs to
+		std::atomic<size_t> seq; ///< position in the stream, from 0
+		size_t startFrame; ///< the file frame of the first sample
+		size_t samples; ///< the number of valid samples
+	};
+	void cleanup();
+	void startIo();
+	Buffer* claim(int from, int to);
+	void wakeIo();
+	/**
+	 * Perform I/O on whichever buffers are ready for it. Called from an
+	 * I/O thread.
+	 */
+	virtual void io() = 0;
+	/**
+	 * Whether there is any work for io().
+	 */
+	virtual bool needsIo() = 0;
+	/**
+	 * Called by cleanup() after I/O has stopped.
+	 */
+	virtual void finish() {}
+	static void ioThread(void* arg);
+	std::unique_ptr<Buffer[]> buffers;
+	unsigned int numBuffers;
+	std::atomic<size_t> xruns;
+	Buffer* rtBuffer;
 	size_t rtIdx;
+	bool ramOnly;
+	bool ioRegistered = false;
+	std::atomic<bool> ioBusy;
 	SNDFILE* sndfile = NULL;
 	SF_INFO sfinfo = { 0 };
+	size_t length = 0;
+	unsigned int sampleRate = 0;
+	// converts from the file's sample rate, if needed
+	std::unique_ptr<Resampler> resampler;
 };
 
 class AudioFileReader : public AudioFile
@@ -122,11 +189,20 @@ public:
 	 * Open a file and prepare to stream it from disk.
 	 *
 	 * @param path Path to the file
-	 * @param bufferSize the size of the internal buffer. If this is larger
-	 * than the file itself, the whole file will be loaded in memory, otherwise
-	 * the file will be read from disk from a separate thread.
+	 * @param bufferSize the size in frames of each of the internal
+	 * buffers. If all the buffers together are larger than the file
+	 * itself, the whole file will be loaded in memory, otherwise the file
+	 * will be read from disk by the I/O threads.
+	 * @param prefetch the number of buffers that are read in advance.
+	 * Larger values make underruns less likely, at the expense of memory.
+	 * @param sampleRate the sample rate to convert the file to, usually
+	 * `context->audioSampleRate`. The conversion happens when loading
+	 * the file in memory or on the I/O threads, never on the audio
+	 * thread. All frame positions, such as those passed to seek() and
+	 * setLoop(), are then at this rate. Pass 0 to play the file at its
+	 * own rate.
 	 */
-	int setup(const std::string& path, size_t bufferSize);
+	int setup(const std::string& path, size_t bufferSize, unsigned int prefetch = kDefaultPrefetch, unsigned int sampleRate = 0);
 	/**
 	 * Write interleaved samples from the file to the destination.
 	 *
@@ -135,21 +211,81 @@ public:
 	 */void getSamples(std::vector<float>& buffer);
 	/**
 	 * Write interleaved samples from the file to the destination.
+	 * If the data has not been read from disk in time, the missing
+	 * samples are set to zero and getUnderruns() is incremented.
 	 *
 	 * @param dst the destination buffer
 	 * @param samplesCount The number of samples to write.
 	 * This has to be a multiple of getChannels().
 	 */
 	void getSamples(float* dst, size_t samplesCount);
+	/**
+	 * Enable or disable looping of the whole file. This can be called
+	 * from the audio thread. The data that has already been read from
+	 * disk is played first.
+	 */
 	int setLoop(bool loop);
+	/**
+	 * Loop between frames @p start and @p end. This can be called from
+	 * the audio thread. The loop points are prefetched like any other
+	 * part of the file, so that looping doesn't cause glitches.
+	 */
 	int setLoop(size_t start, size_t end);
+	/**
+	 * Jump to the specified frame. This can be called from the audio
+	 * thread.
+	 *
+	 * The jump happens once the data at the new position has been read
+	 * from disk: until then, getSamples() keeps returning data from the
+	 * old position, so that there are no dropouts.
+	 *
+	 * @return 0 on success, an error code if @p frame is out of range.
+	 */
+	int seek(size_t frame);
+	/**
+	 * Get the frame that is going to be returned next by getSamples().
+	 */
 	size_t getIdx();
+	/**
+	 * Get the number of times that getSamples() couldn't return data
+	 * because it had not been read from disk in time.
+	 */
+	size_t getUnderruns() { return xruns.load(std::memory_order_relaxed); }
+	~AudioFileReader();
 private:
-	void io(std::vector<float>& buffer) override;
-	bool loop;
-	size_t loopStart;
-	size_t loopStop;
-	size_t idx;
+	void io() override;
+	bool needsIo() override;
+	void fill(Buffer& buffer);
+	void read(float* dst, size_t count);
+	size_t toFileFrame(size_t frame) { return resampler ? resampler->getInputFrame(frame) : frame; }
+	void getLoop(bool& loop, size_t& start, size_t& stop);
+	Buffer* findReady(unsigned int generation, size_t seq);
+	Buffer* claimForFill(bool dryRun);
+	// the loop points, written by the audio thread. loopSeq is odd while
+	// they are being changed.
+	std::atomic<unsigned int> loopSeq;
+	std::atomic<bool> loop;
+	std::atomic<size_t> loopStart;
+	std::atomic<size_t> loopStop;
+	// seek requests from the audio thread
+	std::atomic<unsigned int> seekGeneration;
+	std::atomic<size_t> seekFrame;
+	// the generation being played, written by the audio thread
+	std::atomic<unsigned int> rtGeneration;
+	// only accessed by the audio thread
+	size_t rtSeq;
+	// the frame after the last one returned by getSamples(), which
+	// remains valid once rtBuffer has been released
+	size_t rtFrame;
+	// only accessed by the I/O thread
+	unsigned int ioGeneration;
+	size_t ioSeq;
+	size_t ioFrame; ///< in the file
+	size_t ioOutFrame; ///< after sample-rate conversion
+	// file data waiting to be converted
+	std::vector<float> ioIn;
+	size_t ioInPos;
+	size_t ioInFrames;
 };
 
 class AudioFileWriter : public AudioFile
@@ -159,10 +295,14 @@ public:
 	 * Open a file and prepare to write to it.
 	 *
 	 * @param path Path to the file
-	 * @param bufferSize the size of the internal buffer.
+	 * @param bufferSize the size in frames of each of the internal
+	 * buffers.
 	 * @param channels the number of channels
+	 * @param sampleRate the sample rate
+	 * @param prefetch the number of buffers that can be waiting to be
+	 * written to disk.
 	 */
-	int setup(const std::string& path, size_t bufferSize, size_t channels, unsigned int sampleRate);
+	int setup(const std::string& path, size_t bufferSize, size_t channels, unsigned int sampleRate, unsigned int prefetch = kDefaultPrefetch);
 	/**
 	 * Push interleaved samples to the file for writing
 	 *
@@ -170,7 +310,22 @@ public:
 	 * of getChannels().
 	 */
 	void setSamples(std::vector<float>& buffer);
+	/**
+	 * Push interleaved samples to the file for writing. If all the
+	 * buffers are waiting to be written, the samples are dropped and
+	 * getOverruns() is incremented.
+	 */
 	void setSamples(float const * src, size_t samplesCount);
+	/**
+	 * Get the number of times that setSamples() had to drop samples
+	 * because the data had not been written to disk in time.
+	 */
+	size_t getOverruns() { return xruns.load(std::memory_order_relaxed); }
+	~AudioFileWriter();
 private:
-	void io(std::vector<float>& buffer) override;
+	void io() override;
+	bool needsIo() override;
+	void finish() override;
+	size_t rtSeq;
+	size_t ioSeq;
 };
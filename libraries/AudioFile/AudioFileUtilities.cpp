@@ -1,13 +1,39 @@
-#include <libraries/sndfile/sndfile.h> // to load audio files
+#include <libraries/sndfile/sndfile.h> // to read and write audio files
 #include "AudioFile.h"
+#include "SampleCache.h"
 #include <unistd.h> //for sync
 #include <cstdlib>
 #include <iostream>
+#include <algorithm>
 
 namespace AudioFileUtilities {
 
 int getSamples(const std::string& file, float *buf, unsigned int channel, unsigned int startFrame, unsigned int endFrame)
 {
+	// if the file is in use elsewhere, its samples may be decoded already
+	std::shared_ptr<const SampleFile> samples = SampleCache::find(file);
+	if(samples)
+	{
+		if(samples->getNumChannels() < channel+1)
+		{
+			std::cerr << "Error: " << file << " doesn't contain requested channel" << std::endl;
+			return 1;
+		}
+		if(endFrame <= startFrame || endFrame > samples->getNumFrames())
+		{
+			std::cerr << "Error: " << file << " invalid frame range requested" << std::endl;
+			return 1;
+		}
+		const float* data = samples->getFrames(channel, startFrame, endFrame);
+		if(data)
+		{
+			std::copy(data, data + endFrame - startFrame, buf);
+			return 0;
+		}
+	}
+	// otherwise, only read the range requested. Loading the whole file
+	// here would be wasted as soon as it is released, which is what
+	// happens when a file is streamed a few blocks at a time.
 	SNDFILE *sndfile ;
 	SF_INFO sfinfo ;
 	sfinfo.format = 0;
@@ -17,7 +43,7 @@ int getSamples(const std::string& file, float *buf, unsigned int channel, unsign
 		return 1;
 	}
 
-	int numChannelsInFile = sfinfo.channels;
+	unsigned int numChannelsInFile = sfinfo.channels;
 	if(numChannelsInFile < channel+1)
 	{
 		std::cerr << "Error: " << file << " doesn't contain requested channel" << std::endl;
@@ -35,15 +61,15 @@ int getSamples(const std::string& file, float *buf, unsigned int channel, unsign
 
 	sf_seek(sndfile,startFrame,SEEK_SET);
 
-	float* tempBuf = new float[frameLen*numChannelsInFile];
-	int readcount = sf_read_float(sndfile, tempBuf, frameLen*numChannelsInFile); //FIXME
+	std::vector<float> tempBuf(frameLen*numChannelsInFile);
+	sf_count_t readcount = sf_read_float(sndfile, tempBuf.data(), tempBuf.size());
 	// Pad with zeros in case we couldn't read whole file
-	for(int k = readcount; k <frameLen*numChannelsInFile; k++)
-		tempBuf[k] = 0;
+	if(readcount < 0)
+		readcount = 0;
+	std::fill(tempBuf.begin() + readcount, tempBuf.end(), 0);
 
-	for(int n=0;n<frameLen;n++)
+	for(unsigned int n=0;n<frameLen;n++)
 		buf[n] = tempBuf[n*numChannelsInFile+channel];
-	delete[] tempBuf;
 
 	sf_close(sndfile);
 
@@ -51,29 +77,21 @@ int getSamples(const std::string& file, float *buf, unsigned int channel, unsign
 }
 
 int getNumChannels(const std::string& file) {
-	SNDFILE *sndfile ;
-	SF_INFO sfinfo ;
-	sfinfo.format = 0;
-	if (!(sndfile = sf_open (file.c_str(), SFM_READ, &sfinfo))) {
-		std::cerr << "Couldn't open file " << file << ": " << sf_strerror(sndfile) << std::endl;
+	std::shared_ptr<const SampleFile> samples = SampleCache::get(file);
+	if(!samples) {
+		std::cerr << "Couldn't open file " << file << std::endl;
 		return -1;
 	}
-	sf_close(sndfile);
-
-	return sfinfo.channels;
+	return samples->getNumChannels();
 }
 
 int getNumFrames(const std::string& file) {
-	SNDFILE *sndfile ;
-	SF_INFO sfinfo ;
-	sfinfo.format = 0;
-	if (!(sndfile = sf_open (file.c_str(), SFM_READ, &sfinfo))) {
-		std::cerr << "Couldn't open file " << file << ": " << sf_strerror(sndfile) << std::endl;
+	std::shared_ptr<const SampleFile> samples = SampleCache::get(file);
+	if(!samples) {
+		std::cerr << "Couldn't open file " << file << std::endl;
 		return -1;
 	}
-	sf_close(sndfile);
-
-	return sfinfo.frames;
+	return samples->getNumFrames();
 }
 
 int write(const std::string& file, float *buf, unsigned int channels, unsigned int frames, unsigned int samplerate)
@@ -135,11 +153,12 @@ int write(const std::string& file, const std::vector<std::vector<float> >& dataI
 std::vector<std::vector<float> > load(const std::string& file, int maxCount, unsigned int start)
 {
 	std::vector<std::vector<float> > out;
-	int numChannels = getNumChannels(file);
-	if(numChannels <= 0)
+	// open and parse the file once for all channels
+	std::shared_ptr<const SampleFile> samples = SampleCache::get(file);
+	if(!samples)
 		return out;
-	out.resize(numChannels);
-	unsigned int numFrames = getNumFrames(file);
+	out.resize(samples->getNumChannels());
+	unsigned int numFrames = samples->getNumFrames();
 	if(start > numFrames)
 		return out;
 	numFrames -= start;
@@ -147,9 +166,11 @@ std::vector<std::vector<float> > load(const std::string& file, int maxCount, uns
 		numFrames = maxCount < numFrames ? maxCount : numFrames;
 	for(unsigned int n = 0; n < out.size(); ++n)
 	{
-		auto& ch = out[n];
-		ch.resize(numFrames);
-		getSamples(file, ch.data(), n, start, start + numFrames);
+		const float* data = samples->getFrames(n, start, start + numFrames);
+		if(data)
+			out[n].assign(data, data + numFrames);
+		else
+			out[n].resize(numFrames);
 	}
 	return out;
 }
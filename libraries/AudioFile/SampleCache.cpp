@@ -0,0 +1,569 @@
+#include "SampleCache.h"
+#include <libraries/sndfile/sndfile.h>
+#include <libraries/Resampler/Resampler.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+
+constexpr unsigned int SampleFile::kPageFrames;
+
+static uint16_t readLe16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLe32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+SampleFile::~SampleFile()
+{
+	for(auto& c : channels)
+	{
+		if(c)
+			munmap(c, channelSize);
+	}
+	if(map)
+		munmap((void*)map, mapSize);
+}
+
+int SampleFile::open(const std::string& newPath, struct stat& st)
+{
+	path = newPath;
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+	if(fstat(fd, &st))
+	{
+		int ret = -errno;
+		::close(fd);
+		return ret;
+	}
+	if(st.st_size)
+	{
+		void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(MAP_FAILED != m)
+		{
+			map = (const uint8_t*)m;
+			mapSize = st.st_size;
+			if(!parseWav())
+			{
+				munmap(m, mapSize);
+				map = nullptr;
+			}
+		}
+	}
+	::close(fd);
+	if(!map)
+	{
+		// anything else goes through libsndfile. We only read the
+		// header for now.
+		SF_INFO sfinfo = {};
+		SNDFILE* sndfile = sf_open(path.c_str(), SFM_READ, &sfinfo);
+		if(!sndfile)
+			return -EINVAL;
+		sf_close(sndfile);
+		if(sfinfo.channels <= 0 || sfinfo.frames < 0 || sfinfo.frames > 0x7fffffff)
+			return -EINVAL;
+		numChannels = sfinfo.channels;
+		numFrames = sfinfo.frames;
+		sampleRate = sfinfo.samplerate;
+	}
+	return allocate();
+}
+
+// Set up the per-page flags and reserve the memory for the decoded samples.
+int SampleFile::allocate()
+{
+	numPages = (numFrames + kPageFrames - 1) / kPageFrames;
+	decoded.reset(new std::atomic<bool>[numChannels * numPages]);
+	for(unsigned int n = 0; n < numChannels * numPages; ++n)
+		decoded[n] = false;
+	pagesToDecode = numChannels * numPages;
+	// Reserve the address space for the decoded samples. Physical memory
+	// is only committed for the pages that are actually decoded.
+	long pageSize = sysconf(_SC_PAGESIZE);
+	channelSize = (numFrames * sizeof(float) + pageSize - 1) / pageSize * pageSize;
+	channels.resize(numChannels, nullptr);
+	if(!channelSize)
+		return 0;
+	for(auto& c : channels)
+	{
+		void* m = mmap(nullptr, channelSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(MAP_FAILED == m)
+			return -ENOMEM;
+		c = (float*)m;
+	}
+	return 0;
+}
+
+int SampleFile::resample(const SampleFile& source, unsigned int newRate)
+{
+	if(!source.decodeAll())
+		return -EINVAL;
+	std::vector<float> in(size_t(source.numFrames) * source.numChannels);
+	for(unsigned int c = 0; c < source.numChannels; ++c)
+	{
+		const float* src = source.channels[c];
+		for(unsigned int n = 0; n < source.numFrames; ++n)
+			in[size_t(n) * source.numChannels + c] = src[n];
+	}
+	std::vector<float> out;
+	if(Resampler::process(out, in.data(), source.numFrames, source.numChannels, source.sampleRate, newRate))
+		return -EINVAL;
+	in = std::vector<float>();
+	if(out.size() / source.numChannels > 0x7fffffff)
+		return -EINVAL;
+	path = source.path;
+	numChannels = source.numChannels;
+	numFrames = out.size() / numChannels;
+	sampleRate = newRate;
+	int ret = allocate();
+	if(ret)
+		return ret;
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		float* dest = channels[c];
+		for(unsigned int n = 0; n < numFrames; ++n)
+			dest[n] = out[size_t(n) * numChannels + c];
+	}
+	for(unsigned int n = 0; n < numChannels * numPages; ++n)
+		decoded[n] = true;
+	pagesToDecode = 0;
+	return 0;
+}
+
+// Find the format and the data of an uncompressed WAV file in the mapping.
+// Returns false for anything that should be left to libsndfile.
+bool SampleFile::parseWav()
+{
+	if(mapSize < 12 || memcmp(map, "RIFF", 4) || memcmp(map + 8, "WAVE", 4))
+		return false;
+	unsigned int format = 0;
+	unsigned int bits = 0;
+	unsigned int blockAlign = 0;
+	size_t pos = 12;
+	while(pos + 8 <= mapSize)
+	{
+		const uint8_t* id = map + pos;
+		size_t size = readLe32(map + pos + 4);
+		pos += 8;
+		if(!memcmp(id, "fmt ", 4) && size >= 16 && pos + size <= mapSize)
+		{
+			const uint8_t* fmt = map + pos;
+			format = readLe16(fmt);
+			numChannels = readLe16(fmt + 2);
+			sampleRate = readLe32(fmt + 4);
+			blockAlign = readLe16(fmt + 12);
+			bits = readLe16(fmt + 14);
+			// WAVE_FORMAT_EXTENSIBLE: the format is at the start
+			// of the sub-format GUID
+			if(0xfffe == format && size >= 40)
+				format = readLe16(fmt + 24);
+		}
+		if(!memcmp(id, "data", 4))
+		{
+			if(!numChannels || !format)
+				return false;
+			// the file may have been truncated
+			size_t dataSize = std::min(size, mapSize - pos);
+			if(1 == format) {
+				switch(bits) {
+				case 8: encoding = kUint8; break;
+				case 16: encoding = kInt16; break;
+				case 24: encoding = kInt24; break;
+				case 32: encoding = kInt32; break;
+				default: return false;
+				}
+			} else if(3 == format) {
+				switch(bits) {
+				case 32: encoding = kFloat32; break;
+				case 64: encoding = kFloat64; break;
+				default: return false;
+				}
+			} else
+				return false;
+			bytesPerSample = bits / 8;
+			bytesPerFrame = numChannels * bytesPerSample;
+			if(blockAlign != bytesPerFrame || dataSize / bytesPerFrame > 0x7fffffff)
+				return false;
+			pcm = map + pos;
+			numFrames = dataSize / bytesPerFrame;
+			return true;
+		}
+		pos += size + (size & 1);
+	}
+	return false;
+}
+
+const float* SampleFile::getFrames(unsigned int channel, unsigned int startFrame, unsigned int endFrame) const
+{
+	static const float kEmpty = 0;
+	if(channel >= numChannels || startFrame > endFrame || endFrame > numFrames)
+		return nullptr;
+	if(startFrame == endFrame)
+		return channels[channel] ? channels[channel] + startFrame : &kEmpty;
+	unsigned int firstPage = startFrame / kPageFrames;
+	unsigned int lastPage = (endFrame - 1) / kPageFrames;
+	for(unsigned int p = firstPage; p <= lastPage; ++p)
+	{
+		if(!decoded[channel * numPages + p].load(std::memory_order_acquire))
+		{
+			if(!decodePages(channel, p, lastPage))
+				return nullptr;
+			break;
+		}
+	}
+	return channels[channel] + startFrame;
+}
+
+bool SampleFile::decodeAll() const
+{
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		if(!getChannel(c))
+			return false;
+	}
+	return true;
+}
+
+inline float SampleFile::convert(const uint8_t* p, Encoding encoding)
+{
+	switch(encoding)
+	{
+	case kUint8:
+		return (int(p[0]) - 128) * (1.f / 128);
+	case kInt16: {
+		int16_t v = readLe16(p);
+		return v * (1.f / 32768);
+	}
+	case kInt24: {
+		int32_t v = int32_t((uint32_t(p[0]) << 8) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 24)) >> 8;
+		return v * (1.f / 8388608);
+	}
+	case kInt32: {
+		int32_t v = readLe32(p);
+		return v * (1.f / 2147483648.f);
+	}
+	case kFloat32: {
+		uint32_t i = readLe32(p);
+		float v;
+		memcpy(&v, &i, sizeof(v));
+		return v;
+	}
+	case kFloat64:
+	default: {
+		uint64_t i = readLe32(p) | (uint64_t(readLe32(p + 4)) << 32);
+		double v;
+		memcpy(&v, &i, sizeof(v));
+		return v;
+	}
+	}
+}
+
+bool SampleFile::decodePages(unsigned int channel, unsigned int firstPage, unsigned int lastPage) const
+{
+	if(!map)
+		return decodeSndfile();
+	std::lock_guard<std::mutex> lock(decodeMutex);
+	float* dest = channels[channel];
+	for(unsigned int p = firstPage; p <= lastPage; ++p)
+	{
+		std::atomic<bool>& flag = decoded[channel * numPages + p];
+		// someone else may have done it in the meantime
+		if(flag.load(std::memory_order_relaxed))
+			continue;
+		unsigned int start = p * kPageFrames;
+		unsigned int end = std::min(start + kPageFrames, numFrames);
+		const uint8_t* src = pcm + size_t(start) * bytesPerFrame + channel * bytesPerSample;
+		for(unsigned int n = start; n < end; ++n)
+		{
+			dest[n] = convert(src, encoding);
+			src += bytesPerFrame;
+		}
+		flag.store(true, std::memory_order_release);
+		--pagesToDecode;
+	}
+	// once everything is decoded, the file is not needed any more: let
+	// the kernel reclaim its pages
+	if(!pagesToDecode)
+		madvise((void*)map, mapSize, MADV_DONTNEED);
+	return true;
+}
+
+bool SampleFile::decodeSndfile() const
+{
+	std::lock_guard<std::mutex> lock(decodeMutex);
+	if(!pagesToDecode)
+		return true;
+	SF_INFO sfinfo = {};
+	SNDFILE* sndfile = sf_open(path.c_str(), SFM_READ, &sfinfo);
+	if(!sndfile)
+	{
+		fprintf(stderr, "SampleFile: couldn't open %s: %s\n", path.c_str(), sf_strerror(sndfile));
+		return false;
+	}
+	if(unsigned(sfinfo.channels) != numChannels)
+	{
+		fprintf(stderr, "SampleFile: %s has changed on disk\n", path.c_str());
+		sf_close(sndfile);
+		return false;
+	}
+	std::vector<float> buffer(kPageFrames * numChannels);
+	for(unsigned int start = 0; start < numFrames; start += kPageFrames)
+	{
+		unsigned int frames = std::min(kPageFrames, numFrames - start);
+		sf_count_t count = sf_read_float(sndfile, buffer.data(), frames * numChannels);
+		// pad with zeros in case we couldn't read the whole file
+		if(count < 0)
+			count = 0;
+		for(unsigned int k = count; k < frames * numChannels; ++k)
+			buffer[k] = 0;
+		for(unsigned int c = 0; c < numChannels; ++c)
+		{
+			float* dest = channels[c] + start;
+			for(unsigned int n = 0; n < frames; ++n)
+				dest[n] = buffer[n * numChannels + c];
+		}
+	}
+	sf_close(sndfile);
+	for(unsigned int n = 0; n < numChannels * numPages; ++n)
+		decoded[n].store(true, std::memory_order_release);
+	pagesToDecode = 0;
+	return true;
+}
+
+namespace {
+struct CacheEntry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	std::weak_ptr<const SampleFile> file;
+};
+}
+
+static std::mutex gCacheMutex;
+// keyed by path and by sample rate, 0 being the rate of the file
+static std::map<std::pair<std::string, unsigned int>, CacheEntry> gCache;
+
+static bool isSameFile(const CacheEntry& e, const struct stat& st)
+{
+	return e.dev == st.st_dev && e.ino == st.st_ino && e.size == st.st_size
+		&& e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// these are called with gCacheMutex held
+static std::shared_ptr<const SampleFile> findFile(const std::pair<std::string, unsigned int>& key, const struct stat& st)
+{
+	auto it = gCache.find(key);
+	if(it != gCache.end() && isSameFile(it->second, st))
+		return it->second.file.lock();
+	return nullptr;
+}
+
+static void storeFile(const std::pair<std::string, unsigned int>& key, const struct stat& st, const std::shared_ptr<const SampleFile>& file)
+{
+	// drop the entries nobody uses any more
+	for(auto e = gCache.begin(); e != gCache.end();)
+	{
+		if(e->second.file.expired())
+			e = gCache.erase(e);
+		else
+			++e;
+	}
+	gCache[key] = CacheEntry{st.st_dev, st.st_ino, st.st_size, st.st_mtim, file};
+}
+
+std::shared_ptr<const SampleFile> SampleCache::get(const std::string& path, unsigned int sampleRate)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st))
+	{
+		fprintf(stderr, "SampleCache: couldn't open %s: %s\n", path.c_str(), strerror(errno));
+		return nullptr;
+	}
+	std::shared_ptr<const SampleFile> original;
+	{
+		// the lock is held while opening, so that concurrent requests
+		// for the same file don't open it twice. This only reads the
+		// header.
+		std::lock_guard<std::mutex> lock(gCacheMutex);
+		if(sampleRate)
+		{
+			if(std::shared_ptr<const SampleFile> file = findFile({path, sampleRate}, st))
+				return file;
+		}
+		original = findFile({path, 0}, st);
+		if(!original)
+		{
+			std::shared_ptr<SampleFile> file(new SampleFile);
+			int ret = file->open(path, st);
+			if(ret)
+			{
+				fprintf(stderr, "SampleCache: couldn't open %s: %s\n", path.c_str(), strerror(-ret));
+				return nullptr;
+			}
+			storeFile({path, 0}, st, file);
+			original = file;
+		}
+		if(!sampleRate || original->getSampleRate() == sampleRate)
+			return original;
+	}
+	// converting takes a while: don't hold the lock in the meantime
+	std::shared_ptr<SampleFile> file(new SampleFile);
+	int ret = file->resample(*original, sampleRate);
+	if(ret)
+	{
+		fprintf(stderr, "SampleCache: couldn't convert %s to %u Hz: %s\n", path.c_str(), sampleRate, strerror(-ret));
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(gCacheMutex);
+	// someone else may have done it in the meantime
+	if(std::shared_ptr<const SampleFile> other = findFile({path, sampleRate}, st))
+		return other;
+	storeFile({path, sampleRate}, st, file);
+	return file;
+}
+
+std::shared_ptr<const SampleFile> SampleCache::find(const std::string& path)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st))
+		return nullptr;
+	std::lock_guard<std::mutex> lock(gCacheMutex);
+	return findFile({path, 0}, st);
+}
+
+unsigned int SampleCache::getNumFiles()
+{
+	std::lock_guard<std::mutex> lock(gCacheMutex);
+	unsigned int count = 0;
+	for(auto& e : gCache)
+		count += !e.second.file.expired();
+	return count;
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+static void writeWav(const char* path, unsigned int format, unsigned int bits, unsigned int numChannels, const std::vector<float>& interleaved)
+{
+	FILE* f = fopen(path, "w");
+	assert(f);
+	unsigned int bytes = bits / 8;
+	uint32_t dataSize = interleaved.size() * bytes;
+	auto w32 = [f](uint32_t v) { fwrite(&v, 4, 1, f); };
+	auto w16 = [f](uint16_t v) { fwrite(&v, 2, 1, f); };
+	fwrite("RIFF", 4, 1, f); w32(36 + 10 + dataSize); fwrite("WAVE", 4, 1, f);
+	// an odd-sized chunk to skip before the format
+	fwrite("junk", 4, 1, f); w32(1); fwrite("\0\0", 2, 1, f);
+	fwrite("fmt ", 4, 1, f); w32(16); w16(format); w16(numChannels);
+	w32(44100); w32(44100 * numChannels * bytes); w16(numChannels * bytes); w16(bits);
+	fwrite("data", 4, 1, f); w32(dataSize);
+	for(float v : interleaved)
+	{
+		if(3 == format) {
+			fwrite(&v, 4, 1, f);
+		} else if(16 == bits) {
+			w16(int16_t(lrintf(v * 32767)));
+		} else if(24 == bits) {
+			int32_t i = lrintf(v * 8388607);
+			fwrite(&i, 3, 1, f);
+		}
+	}
+	fclose(f);
+}
+
+bool SampleCacheTest()
+{
+	const unsigned int kFrames = 5000;
+	const unsigned int kChannels = 3;
+	std::vector<float> interleaved(kFrames * kChannels);
+	for(unsigned int n = 0; n < kFrames; ++n)
+		for(unsigned int c = 0; c < kChannels; ++c)
+			interleaved[n * kChannels + c] = sinf(n * 0.01f * (c + 1)) * 0.9f;
+	const struct { unsigned int format; unsigned int bits; float tolerance; } formats[] = {
+		{ 1, 16, 1.f / 16384 },
+		{ 1, 24, 1.f / 4194304 },
+		{ 3, 32, 0 },
+	};
+	const char* path = "/tmp/SampleCacheTest.wav";
+	for(auto& fmt : formats)
+	{
+		writeWav(path, fmt.format, fmt.bits, kChannels, interleaved);
+		std::shared_ptr<const SampleFile> file = SampleCache::get(path);
+		assert(file && file->isMapped());
+		assert(kChannels == file->getNumChannels() && kFrames == file->getNumFrames() && 44100 == file->getSampleRate());
+		// a range that straddles pages is decoded on its own
+		const float* p = file->getFrames(1, 1000, 2100);
+		assert(p);
+		for(unsigned int n = 1000; n < 2100; ++n)
+			assert(fabsf(p[n - 1000] - interleaved[n * kChannels + 1]) <= fmt.tolerance);
+		assert(!file->getFrames(1, 0, kFrames + 1));
+		assert(!file->getFrames(kChannels, 0, 1));
+		// the same object is handed out while in use ...
+		assert(SampleCache::get(path) == file);
+		assert(file->decodeAll());
+		for(unsigned int c = 0; c < kChannels; ++c)
+		{
+			const float* ch = file->getChannel(c);
+			for(unsigned int n = 0; n < kFrames; ++n)
+				assert(fabsf(ch[n] - interleaved[n * kChannels + c]) <= fmt.tolerance);
+		}
+		// ... and the file is reloaded once it changes on disk
+		usleep(10000);
+		std::vector<float> other(interleaved.size(), 0.5f);
+		writeWav(path, fmt.format, fmt.bits, kChannels, other);
+		std::shared_ptr<const SampleFile> newFile = SampleCache::get(path);
+		assert(newFile && newFile != file);
+		assert(fabsf(newFile->getFrames(2, 10, 11)[0] - 0.5f) <= fmt.tolerance);
+		file.reset();
+		newFile.reset();
+		assert(0 == SampleCache::getNumFiles());
+	}
+	// mono float files are copied out of the mapping too, so that the
+	// samples don't depend on the file once they are decoded
+	std::vector<float> mono(interleaved.begin(), interleaved.begin() + kFrames);
+	writeWav(path, 3, 32, 1, mono);
+	std::shared_ptr<const SampleFile> file = SampleCache::get(path);
+	assert(file && kFrames == file->getNumFrames());
+	assert(file->decodeAll());
+	const float* samples = file->getChannel(0);
+	// find() only returns files that are in use and unchanged
+	assert(SampleCache::find(path) == file);
+	// reading from a truncated mapping would raise SIGBUS
+	truncate(path, 0);
+	assert(0 == memcmp(samples, mono.data(), kFrames * sizeof(float)));
+	assert(!SampleCache::find(path));
+	file.reset();
+	// files can be converted to another sample rate, and the converted
+	// samples are shared as well
+	writeWav(path, 3, 32, kChannels, interleaved);
+	file = SampleCache::get(path, 48000);
+	assert(file && kChannels == file->getNumChannels() && 48000 == file->getSampleRate());
+	assert((kFrames * 48000 + 44099) / 44100 == file->getNumFrames());
+	assert(SampleCache::get(path, 48000) == file);
+	assert(SampleCache::get(path, 44100) == SampleCache::get(path));
+	for(unsigned int c = 0; c < kChannels; ++c)
+	{
+		const float* ch = file->getChannel(c);
+		// away from the edges, where the filter runs out of input
+		for(unsigned int n = 100; n < file->getNumFrames() - 100; ++n)
+			assert(fabsf(ch[n] - sinf(n * (44100.f / 48000) * 0.01f * (c + 1)) * 0.9f) < 0.001f);
+	}
+	file.reset();
+	unlink(path);
+	assert(!SampleCache::get(path));
+	printf("SampleCacheTest successful\n");
+	return true;
+}
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct stat;
+
+/**
+ * The samples of an audio file, decoded to `float` and shared read-only by
+ * all of its users. Get one from SampleCache::get().
+ *
+ * Uncompressed WAV files are memory-mapped and only the pages that are
+ * actually accessed are converted, one channel at a time, into anonymous
+ * memory. Other formats are decoded in full with libsndfile the first time
+ * their samples are accessed.
+ *
+ * Decoding happens in the thread that accesses the samples. Call
+ * decodeAll() from setup() if you need to access them from the audio thread:
+ * after that, the samples no longer depend on the file.
+ *
+ * Until then, the samples are decoded from the live mapping of the file.
+ * Don't truncate or rewrite a file in place while it is being decoded,
+ * e.g. by uploading it again: reading the part of the mapping that is gone
+ * raises SIGBUS. Replacing the file with a new one, e.g. by writing to a
+ * temporary file and renaming it, is safe.
+ * Files converted to a different sample rate are decoded and converted as a
+ * whole when they are loaded.
+ */
+class SampleFile
+{
+public:
+	static constexpr unsigned int kPageFrames = 1024;
+	SampleFile(const SampleFile&) = delete;
+	SampleFile& operator=(const SampleFile&) = delete;
+	~SampleFile();
+	unsigned int getNumChannels() const { return numChannels; }
+	unsigned int getNumFrames() const { return numFrames; }
+	unsigned int getSampleRate() const { return sampleRate; }
+	const std::string& getPath() const { return path; }
+	/**
+	 * Get frames between @p startFrame and @p endFrame of @p channel,
+	 * decoding them first if they haven't been yet.
+	 *
+	 * @return a pointer to `endFrame - startFrame` values, which is valid
+	 * as long as this object exists, or `nullptr` if the arguments are
+	 * invalid or the file cannot be decoded.
+	 */
+	const float* getFrames(unsigned int channel, unsigned int startFrame, unsigned int endFrame) const;
+	/**
+	 * Get all the frames of @p channel. See getFrames().
+	 */
+	const float* getChannel(unsigned int channel) const { return getFrames(channel, 0, numFrames); }
+	/**
+	 * Decode all the frames of all channels, so that any later access is
+	 * real-time safe.
+	 *
+	 * @return true on success, false if the file cannot be decoded.
+	 */
+	bool decodeAll() const;
+	/**
+	 * Whether the samples are read from a memory-mapped file, as opposed
+	 * to being decoded with libsndfile.
+	 */
+	bool isMapped() const { return nullptr != map; }
+private:
+	friend class SampleCache;
+	enum Encoding {
+		kUint8,
+		kInt16,
+		kInt24,
+		kInt32,
+		kFloat32,
+		kFloat64,
+	};
+	SampleFile() {};
+	int open(const std::string& path, struct stat& st);
+	int allocate();
+	int resample(const SampleFile& source, unsigned int newRate);
+	bool parseWav();
+	bool decodePages(unsigned int channel, unsigned int firstPage, unsigned int lastPage) const;
+	bool decodeSndfile() const;
+	static float convert(const uint8_t* p, Encoding encoding);
+	std::string path;
+	unsigned int numChannels = 0;
+	unsigned int numFrames = 0;
+	unsigned int sampleRate = 0;
+	// memory-mapped WAV file
+	const uint8_t* map = nullptr;
+	size_t mapSize = 0;
+	const uint8_t* pcm = nullptr;
+	Encoding encoding;
+	unsigned int bytesPerFrame = 0;
+	unsigned int bytesPerSample = 0;
+	// decoded samples, one lazily-committed mapping per channel
+	std::vector<float*> channels;
+	size_t channelSize = 0;
+	// per channel and per page: whether it has been decoded
+	std::unique_ptr<std::atomic<bool>[]> decoded;
+	unsigned int numPages = 0;
+	mutable unsigned int pagesToDecode = 0;
+	mutable std::mutex decodeMutex;
+};
+
+/**
+ * A process-wide cache of decoded audio files.
+ *
+ * Any number of callers asking for the same file get the same SampleFile,
+ * as long as at least one of them is holding on to it and the file hasn't
+ * been modified on disk in the meantime. The same goes for the versions of a
+ * file converted to other sample rates.
+ */
+class SampleCache
+{
+public:
+	/**
+	 * Get the samples of @p path. This does not decode any sample: see
+	 * SampleFile.
+	 *
+	 * @param path the file to open.
+	 * @param sampleRate the sample rate to convert the file to. If it's 0
+	 * or the file already has this rate, the file is used as it is.
+	 * Otherwise, it is decoded and converted in full before this returns.
+	 *
+	 * @return the samples, or `nullptr` if the file cannot be opened.
+	 */
+	static std::shared_ptr<const SampleFile> get(const std::string& path, unsigned int sampleRate = 0);
+	/**
+	 * Get the samples of @p path if someone is already using them. This
+	 * never opens the file.
+	 *
+	 * @return the samples, or `nullptr` if the file is not in use or it
+	 * has changed on disk since it was opened.
+	 */
+	static std::shared_ptr<const SampleFile> find(const std::string& path);
+	/**
+	 * Get the number of files currently in use.
+	 */
+	static unsigned int getNumFiles();
+};
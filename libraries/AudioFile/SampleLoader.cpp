@@ -0,0 +1,264 @@
+#include "SampleLoader.h"
+#include <algorithm>
+#include <stdio.h>
+#include <time.h>
+
+static double nowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+SampleLoader::~SampleLoader()
+{
+	// skip whatever hasn't started loading yet
+	next = order.size();
+	for(auto& t : threads)
+		t.join();
+}
+
+unsigned int SampleLoader::add(const std::string& path, bool critical, unsigned int sampleRate)
+{
+	slots.emplace_back();
+	Slot& slot = slots.back();
+	slot.path = path;
+	slot.critical = critical;
+	slot.sampleRate = sampleRate;
+	slot.stats.name = path;
+	return slots.size() - 1;
+}
+
+unsigned int SampleLoader::add(std::function<bool()> job, const std::string& name, bool critical)
+{
+	unsigned int n = add(name, critical);
+	slots[n].job = job;
+	return n;
+}
+
+std::shared_future<bool> SampleLoader::start(unsigned int numThreads)
+{
+	if(doneFuture.valid())
+		return doneFuture;
+	criticalFuture = criticalPromise.get_future().share();
+	doneFuture = donePromise.get_future().share();
+	order.clear();
+	unsigned int numCritical = 0;
+	for(unsigned int n = 0; n < slots.size(); ++n)
+	{
+		if(slots[n].critical)
+		{
+			order.push_back(n);
+			++numCritical;
+		}
+	}
+	for(unsigned int n = 0; n < slots.size(); ++n)
+	{
+		if(!slots[n].critical)
+			order.push_back(n);
+	}
+	numCriticalPending = numCritical;
+	numPending = slots.size();
+	startTime = nowMs();
+	totalMs = 0;
+	if(!numCritical)
+		criticalPromise.set_value(true);
+	if(slots.empty())
+	{
+		donePromise.set_value(true);
+		return doneFuture;
+	}
+	if(!numThreads)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::min(numThreads, (unsigned int)slots.size());
+	for(unsigned int n = 0; n < numThreads; ++n)
+		threads.emplace_back(&SampleLoader::work, this);
+	return doneFuture;
+}
+
+bool SampleLoader::waitForCritical()
+{
+	if(!criticalFuture.valid())
+		start();
+	return criticalFuture.get();
+}
+
+bool SampleLoader::wait()
+{
+	if(!doneFuture.valid())
+		start();
+	bool ret = doneFuture.get();
+	for(auto& t : threads)
+		t.join();
+	threads.clear();
+	return ret;
+}
+
+void SampleLoader::work()
+{
+	unsigned int n;
+	while((n = next.fetch_add(1)) < order.size())
+		load(slots[order[n]]);
+}
+
+void SampleLoader::load(Slot& slot)
+{
+	Stats& stats = slot.stats;
+	double begin = nowMs();
+	stats.waitMs = begin - startTime;
+	stats.critical = slot.critical;
+	stats.numChannels = 0;
+	stats.numFrames = 0;
+	bool ok;
+	if(slot.job)
+	{
+		ok = slot.job();
+		if(!ok)
+			fprintf(stderr, "SampleLoader: %s failed\n", slot.path.c_str());
+	} else {
+		slot.file = SampleCache::get(slot.path, slot.sampleRate);
+		// decode everything now, so that the audio thread doesn't
+		// have to
+		ok = slot.file && slot.file->decodeAll();
+		if(ok)
+		{
+			stats.numChannels = slot.file->getNumChannels();
+			stats.numFrames = slot.file->getNumFrames();
+		} else {
+			slot.file = nullptr;
+		}
+	}
+	stats.loadMs = nowMs() - begin;
+	stats.ok = ok;
+	if(!ok)
+	{
+		allOk = false;
+		if(slot.critical)
+			criticalOk = false;
+	}
+	slot.state.store(ok ? Slot::kReady : Slot::kFailed, std::memory_order_release);
+	numDone.fetch_add(1, std::memory_order_release);
+	if(slot.critical && 1 == numCriticalPending.fetch_sub(1))
+		criticalPromise.set_value(criticalOk);
+	if(1 == numPending.fetch_sub(1))
+	{
+		totalMs = nowMs() - startTime;
+		if(verbose)
+			printReport();
+		donePromise.set_value(allOk);
+	}
+}
+
+std::vector<SampleLoader::Stats> SampleLoader::getStats() const
+{
+	std::vector<Stats> stats;
+	for(auto& slot : slots)
+	{
+		if(Slot::kPending != slot.state.load(std::memory_order_acquire))
+			stats.push_back(slot.stats);
+	}
+	return stats;
+}
+
+void SampleLoader::printReport() const
+{
+	std::vector<Stats> stats = getStats();
+	double sumMs = 0;
+	unsigned int failed = 0;
+	for(auto& s : stats)
+	{
+		printf("SampleLoader: %s %s: ", s.critical ? "[critical]" : "          ", s.name.c_str());
+		if(s.ok)
+		{
+			if(s.numChannels)
+				printf("%u channels, %u frames, ", s.numChannels, s.numFrames);
+			printf("waited %.1f ms, loaded in %.1f ms\n", s.waitMs, s.loadMs);
+		} else
+			printf("failed\n");
+		sumMs += s.loadMs;
+		failed += !s.ok;
+	}
+	if(stats.size() < slots.size())
+	{
+		printf("SampleLoader: %u of %u slots loaded so far (%u failed)\n", (unsigned int)stats.size(), getNumSlots(), failed);
+		return;
+	}
+	printf("SampleLoader: %u slots loaded in %.1f ms (%.1f ms if loaded one after the other), %u failed\n", getNumSlots(), totalMs, sumMs, failed);
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+static void writeWav(const std::string& path, unsigned int frames)
+{
+	FILE* f = fopen(path.c_str(), "w");
+	assert(f);
+	uint32_t dataSize = frames * 2;
+	auto w32 = [f](uint32_t v) { fwrite(&v, 4, 1, f); };
+	auto w16 = [f](uint16_t v) { fwrite(&v, 2, 1, f); };
+	fwrite("RIFF", 4, 1, f); w32(36 + dataSize); fwrite("WAVE", 4, 1, f);
+	fwrite("fmt ", 4, 1, f); w32(16); w16(1); w16(1); w32(44100); w32(88200); w16(2); w16(16);
+	fwrite("data", 4, 1, f); w32(dataSize);
+	for(unsigned int n = 0; n < frames; ++n)
+		w16(n);
+	fclose(f);
+}
+
+bool SampleLoaderTest()
+{
+	const unsigned int kNumFiles = 8;
+	std::vector<std::string> paths;
+	for(unsigned int n = 0; n < kNumFiles; ++n)
+	{
+		paths.push_back("/tmp/SampleLoaderTest" + std::to_string(n) + ".wav");
+		writeWav(paths.back(), 1000 * (n + 1));
+	}
+	SampleLoader loader;
+	std::atomic<bool> release(false);
+	// non-critical slots first: the critical ones are still loaded
+	// first
+	unsigned int slow = loader.add([&release]() {
+		while(!release)
+			usleep(1000);
+		return true;
+	}, "slow job", false);
+	for(unsigned int n = 0; n < kNumFiles; ++n)
+		loader.add(paths[n], n < 2);
+	unsigned int missing = loader.add("/tmp/SampleLoaderTest-missing.wav", false);
+	unsigned int converted = loader.add(paths[0], false, 48000);
+	assert(kNumFiles + 3 == loader.getNumSlots());
+	std::shared_future<bool> done = loader.start(3);
+	assert(loader.waitForCritical());
+	for(unsigned int n = 0; n < 2; ++n)
+	{
+		const SampleFile* file = loader.getSlot(n + 1).get();
+		assert(file && 1000 * (n + 1) == file->getNumFrames());
+		// it has been decoded already
+		assert(file->getChannel(0)[999] == 999 / 32768.f);
+	}
+	// everything else completes while the slow job is running
+	while(loader.getNumDone() < kNumFiles + 2)
+		usleep(1000);
+	assert(!loader.getSlot(slow).isReady());
+	assert(loader.getSlot(missing).hasFailed() && !loader.getSlot(missing).get());
+	const SampleFile* file = loader.getSlot(converted).get();
+	assert(file && 48000 == file->getSampleRate() && (1000 * 48000 + 44099) / 44100 == file->getNumFrames());
+	assert(loader.getSlot(1).get()->getSampleRate() == 44100);
+	assert(std::future_status::timeout == done.wait_for(std::chrono::milliseconds(0)));
+	release = true;
+	assert(!loader.wait());
+	assert(!done.get());
+	assert(loader.getSlot(slow).isReady() && !loader.getSlot(slow).get());
+	std::vector<SampleLoader::Stats> stats = loader.getStats();
+	assert(kNumFiles + 3 == stats.size());
+	for(auto& s : stats)
+		assert(s.ok == (s.name != "/tmp/SampleLoaderTest-missing.wav"));
+	loader.printReport();
+	for(auto& p : paths)
+		unlink(p.c_str());
+	printf("SampleLoaderTest successful\n");
+	return true;
+}
+#endif
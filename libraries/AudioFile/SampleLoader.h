@@ -0,0 +1,185 @@
+#pragma once
+#include "SampleCache.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Load a list of audio files in the background, on a pool of worker
+ * threads, so that setup() doesn't have to wait for all of them.
+ *
+ * Add the files with add(), then call start(). Files marked as critical
+ * are loaded first: call waitForCritical() before returning from setup(),
+ * and the audio can start while the others are still loading. The render
+ * thread can check whether a slot is ready with Slot::isReady(), which
+ * never blocks.
+ *
+ * Files are decoded through SampleCache, so the same file added several
+ * times, or already in use elsewhere, is only decoded once. They can be
+ * converted to the sample rate of the audio as they are loaded.
+ *
+ * Example:
+ *
+ *     SampleLoader gLoader;
+ *     bool setup(BelaContext* context, void*)
+ *     {
+ *         gLoader.add("kick.wav", true, context->audioSampleRate);
+ *         for(auto& name : gOtherFiles)
+ *             gLoader.add(name, false, context->audioSampleRate);
+ *         gLoader.start();
+ *         return gLoader.waitForCritical();
+ *     }
+ *     void render(BelaContext* context, void*)
+ *     {
+ *         if(!gSamples && (gFile = gLoader.getSlot(n).get()))
+ *             gSamples = gFile->getChannel(0); // once, not for every frame
+ *         if(gSamples)
+ *             // play gSamples[0] to gSamples[gFile->getNumFrames() - 1]
+ *     }
+ */
+class SampleLoader
+{
+public:
+	/**
+	 * How long it took to load one slot.
+	 */
+	struct Stats
+	{
+		std::string name;
+		bool critical;
+		bool ok;
+		/// time between start() and the start of the loading, in ms
+		double waitMs;
+		/// time spent loading, in ms
+		double loadMs;
+		unsigned int numChannels;
+		unsigned int numFrames;
+	};
+	/**
+	 * One of the files or jobs being loaded. The methods of this class
+	 * can be called from the audio thread.
+	 */
+	class Slot
+	{
+	public:
+		bool isReady() const { return kReady == state.load(std::memory_order_acquire); }
+		bool hasFailed() const { return kFailed == state.load(std::memory_order_acquire); }
+		/**
+		 * Get the samples of the file, or `nullptr` if it's not ready
+		 * yet. The samples are fully decoded and can be accessed from
+		 * the audio thread.
+		 */
+		const SampleFile* get() const { return isReady() ? file.get() : nullptr; }
+	private:
+		friend class SampleLoader;
+		enum State {
+			kPending,
+			kReady,
+			kFailed,
+		};
+		std::string path;
+		std::function<bool()> job;
+		bool critical;
+		unsigned int sampleRate;
+		std::shared_ptr<const SampleFile> file;
+		std::atomic<int> state {kPending};
+		Stats stats;
+	};
+	SampleLoader() {};
+	~SampleLoader();
+	SampleLoader(const SampleLoader&) = delete;
+	SampleLoader& operator=(const SampleLoader&) = delete;
+	/**
+	 * Add a file to be loaded. Call this before start().
+	 *
+	 * @param path the file to load.
+	 * @param critical whether waitForCritical() should wait for this
+	 * file.
+	 * @param sampleRate the sample rate to convert the file to, or 0 to
+	 * keep the sample rate of the file.
+	 *
+	 * @return the index of the slot that will hold the file.
+	 */
+	unsigned int add(const std::string& path, bool critical = true, unsigned int sampleRate = 0);
+	/**
+	 * Add a generic loading job, e.g. the setup() of an AudioFileReader.
+	 * The slot's get() will always return `nullptr`, but isReady() tells
+	 * when the job has completed successfully.
+	 *
+	 * @param job the function to run. It returns false on failure.
+	 * @param name a name for the job, used in the stats.
+	 * @param critical whether waitForCritical() should wait for this
+	 * job.
+	 *
+	 * @return the index of the slot.
+	 */
+	unsigned int add(std::function<bool()> job, const std::string& name, bool critical = true);
+	/**
+	 * Start loading.
+	 *
+	 * @param numThreads the number of worker threads. Pass 0 to use one
+	 * per CPU core.
+	 *
+	 * @return a future that becomes ready once all slots have been
+	 * loaded. Its value is true if all of them were loaded successfully.
+	 */
+	std::shared_future<bool> start(unsigned int numThreads = 0);
+	/**
+	 * Wait for all the critical slots to be loaded.
+	 *
+	 * @return true if all of them were loaded successfully.
+	 */
+	bool waitForCritical();
+	/**
+	 * Wait for all the slots to be loaded and stop the worker threads.
+	 *
+	 * @return true if all of them were loaded successfully.
+	 */
+	bool wait();
+	/**
+	 * Whether to print a report of the loading times once all the slots
+	 * have been loaded.
+	 */
+	void setVerbose(bool verbose) { this->verbose = verbose; }
+	unsigned int getNumSlots() const { return slots.size(); }
+	const Slot& getSlot(unsigned int n) const { return slots[n]; }
+	/**
+	 * Get the number of slots that have finished loading, successfully or
+	 * not. This can be called from the audio thread.
+	 */
+	unsigned int getNumDone() const { return numDone.load(std::memory_order_acquire); }
+	/**
+	 * Get the timings of the slots. Only the slots that have finished
+	 * loading are included.
+	 */
+	std::vector<Stats> getStats() const;
+	/**
+	 * Print the timings of all the slots, and how long it took in total.
+	 */
+	void printReport() const;
+private:
+	void work();
+	void load(Slot& slot);
+	std::deque<Slot> slots;
+	// the order in which the slots are loaded: critical ones first
+	std::vector<unsigned int> order;
+	std::vector<std::thread> threads;
+	std::atomic<unsigned int> next {0};
+	std::atomic<unsigned int> numDone {0};
+	std::atomic<unsigned int> numCriticalPending {0};
+	std::atomic<unsigned int> numPending {0};
+	std::atomic<bool> allOk {true};
+	std::atomic<bool> criticalOk {true};
+	std::promise<bool> criticalPromise;
+	std::promise<bool> donePromise;
+	std::shared_future<bool> criticalFuture;
+	std::shared_future<bool> doneFuture;
+	double startTime;
+	double totalMs;
+	bool verbose = false;
+};
@@ -17,7 +17,9 @@
 //
 
 #include "Biquad.h"
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
 #include "QuadBiquad.h"
+#endif
 
 #include <math.h>
 // this implementation lives here in order not to require math.h in the public header
@@ -118,6 +120,9 @@ void BiquadCoeffT<T>::calc()
 	return;
 }
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+// QuadBiquad is only available where NEON is. See BiquadBank for a
+// portable alternative
 #include <string.h>
 int QuadBiquad::setup(const BiquadCoeff::Settings& settings)
 {
@@ -142,6 +147,7 @@ void QuadBiquad::update()
 	QUADBIQUAD_UPDATE(b1,-);
 	QUADBIQUAD_UPDATE(b2,-);
 }
+#endif
 
 template class BiquadCoeffT<double>; // for Biquad
 template class BiquadCoeffT<float>; // for QuadBiquad
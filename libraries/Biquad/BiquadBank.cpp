@@ -0,0 +1,371 @@
+#include "BiquadBank.h"
+#include <string.h>
+#include <algorithm>
+
+// Each vector type below holds the same coefficient or state of kLanes
+// adjacent channels and provides the few operations needed by
+// processStage().
+
+template <typename T, unsigned int N>
+struct ScalarVector
+{
+	typedef T sample_t;
+	static constexpr unsigned int kLanes = N;
+	T v[N];
+	static ScalarVector load(const T* p) { ScalarVector r; for(unsigned int n = 0; n < N; ++n) r.v[n] = p[n]; return r; }
+	static void store(T* p, const ScalarVector& a) { for(unsigned int n = 0; n < N; ++n) p[n] = a.v[n]; }
+	static ScalarVector mul(const ScalarVector& a, const ScalarVector& b) { ScalarVector r; for(unsigned int n = 0; n < N; ++n) r.v[n] = a.v[n] * b.v[n]; return r; }
+	// acc + a * b
+	static ScalarVector mla(const ScalarVector& acc, const ScalarVector& a, const ScalarVector& b) { ScalarVector r; for(unsigned int n = 0; n < N; ++n) r.v[n] = acc.v[n] + a.v[n] * b.v[n]; return r; }
+};
+
+// Two vectors processed together, as two independent dependency chains
+template <typename V>
+struct VectorPair
+{
+	static constexpr unsigned int kLanes = 2 * V::kLanes;
+	V lo;
+	V hi;
+	typedef typename V::sample_t sample_t;
+	static VectorPair load(const sample_t* p) { return {V::load(p), V::load(p + V::kLanes)}; }
+	static void store(sample_t* p, const VectorPair& a) { V::store(p, a.lo); V::store(p + V::kLanes, a.hi); }
+	static VectorPair mul(const VectorPair& a, const VectorPair& b) { return {V::mul(a.lo, b.lo), V::mul(a.hi, b.hi)}; }
+	static VectorPair mla(const VectorPair& acc, const VectorPair& a, const VectorPair& b) { return {V::mla(acc.lo, a.lo, b.lo), V::mla(acc.hi, a.hi, b.hi)}; }
+};
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+static const char* kBiquadBankBackend = "neon";
+struct Float4
+{
+	static constexpr unsigned int kLanes = 4;
+	typedef float sample_t;
+	float32x4_t v;
+	static Float4 load(const float* p) { return {vld1q_f32(p)}; }
+	static void store(float* p, const Float4& a) { vst1q_f32(p, a.v); }
+	static Float4 mul(const Float4& a, const Float4& b) { return {vmulq_f32(a.v, b.v)}; }
+	static Float4 mla(const Float4& acc, const Float4& a, const Float4& b) { return {vmlaq_f32(acc.v, a.v, b.v)}; }
+};
+typedef VectorPair<Float4> Float8;
+#elif defined(__SSE2__)
+#ifdef __AVX__
+#include <immintrin.h>
+static const char* kBiquadBankBackend = "avx";
+#else
+#include <emmintrin.h>
+static const char* kBiquadBankBackend = "sse2";
+#endif
+struct Float4
+{
+	static constexpr unsigned int kLanes = 4;
+	typedef float sample_t;
+	__m128 v;
+	static Float4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+	static void store(float* p, const Float4& a) { _mm_storeu_ps(p, a.v); }
+	static Float4 mul(const Float4& a, const Float4& b) { return {_mm_mul_ps(a.v, b.v)}; }
+	static Float4 mla(const Float4& acc, const Float4& a, const Float4& b) { return {_mm_add_ps(acc.v, _mm_mul_ps(a.v, b.v))}; }
+};
+#ifdef __AVX__
+struct Float8
+{
+	typedef float sample_t;
+	static constexpr unsigned int kLanes = 8;
+	__m256 v;
+	static Float8 load(const float* p) { return {_mm256_loadu_ps(p)}; }
+	static void store(float* p, const Float8& a) { _mm256_storeu_ps(p, a.v); }
+	static Float8 mul(const Float8& a, const Float8& b) { return {_mm256_mul_ps(a.v, b.v)}; }
+	static Float8 mla(const Float8& acc, const Float8& a, const Float8& b) { return {_mm256_add_ps(acc.v, _mm256_mul_ps(a.v, b.v))}; }
+};
+#else // __AVX__
+typedef VectorPair<Float4> Float8;
+#endif // __AVX__
+#else
+static const char* kBiquadBankBackend = "scalar";
+typedef ScalarVector<float, 4> Float4;
+typedef ScalarVector<float, 8> Float8;
+#endif
+
+template <typename T>
+struct BiquadBankVectors
+{
+	typedef ScalarVector<T, 4> V4;
+	typedef ScalarVector<T, 8> V8;
+	static const char* getBackend() { return "scalar"; }
+};
+
+template <>
+struct BiquadBankVectors<float>
+{
+	typedef Float4 V4;
+	typedef Float8 V8;
+	static const char* getBackend() { return kBiquadBankBackend; }
+};
+
+// Channels are padded to a multiple of this
+static constexpr unsigned int kPadding = 4;
+// The widest group of channels processed at once
+static constexpr unsigned int kMaxLanes = 8;
+// The number of frames processed at once, through all the stages
+static constexpr unsigned int kChunkFrames = 32;
+enum { kA0, kA1, kA2, kB1, kB2, kNumCoefficients };
+
+// Process V::kLanes channels of one stage. data holds V::kLanes
+// interleaved samples per frame. coefficients and states point to the
+// first channel in the stage's arrays, which are stride samples apart.
+template <typename V, typename T>
+static void processStage(T* data, unsigned int frames, const T* coefficients, T* states, unsigned int stride)
+{
+	constexpr unsigned int L = V::kLanes;
+	V a0 = V::load(coefficients + kA0 * stride);
+	V a1 = V::load(coefficients + kA1 * stride);
+	V a2 = V::load(coefficients + kA2 * stride);
+	V b1 = V::load(coefficients + kB1 * stride);
+	V b2 = V::load(coefficients + kB2 * stride);
+	V z1 = V::load(states);
+	V z2 = V::load(states + stride);
+	for(unsigned int n = 0; n < frames; ++n)
+	{
+		// same as Biquad::process(), with b1 and b2 negated in
+		// update() so that we only need multiply-accumulate
+		V in = V::load(data + n * L);
+		V out = V::mla(z1, in, a0);
+		z1 = V::mla(z2, in, a1);
+		z2 = V::mul(in, a2);
+		V::store(data + n * L, out);
+		z1 = V::mla(z1, b1, out);
+		z2 = V::mla(z2, b2, out);
+	}
+	V::store(states, z1);
+	V::store(states + stride, z2);
+}
+
+template <typename T>
+int BiquadBankT<T>::setup(unsigned int newNumChannels, unsigned int newNumStages)
+{
+	numChannels = newNumChannels;
+	numStages = newNumStages;
+	paddedChannels = (numChannels + kPadding - 1) / kPadding * kPadding;
+	BiquadCoeffT<T> passThrough;
+	passThrough.a0 = 1;
+	passThrough.a1 = passThrough.a2 = passThrough.b1 = passThrough.b2 = 0;
+	filters.assign(numChannels * numStages, passThrough);
+	coefficients.assign(numStages * kNumCoefficients * paddedChannels, 0);
+	states.resize(numStages * 2 * paddedChannels);
+	outPtrs.resize(numChannels);
+	inPtrs.resize(numChannels);
+	update();
+	clean();
+	return 0;
+}
+
+template <typename T>
+int BiquadBankT<T>::setup(unsigned int numChannels, unsigned int numStages, const BiquadCoeff::Settings& settings)
+{
+	int ret = setup(numChannels, numStages);
+	for(auto& f : filters)
+		ret |= f.setup(settings);
+	update();
+	return ret;
+}
+
+template <typename T>
+void BiquadBankT<T>::update()
+{
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		for(unsigned int s = 0; s < numStages; ++s)
+		{
+			const BiquadCoeffT<T>& f = getFilter(c, s);
+			T* coeffs = coefficients.data() + s * kNumCoefficients * paddedChannels + c;
+			coeffs[kA0 * paddedChannels] = f.a0;
+			coeffs[kA1 * paddedChannels] = f.a1;
+			coeffs[kA2 * paddedChannels] = f.a2;
+			coeffs[kB1 * paddedChannels] = -f.b1;
+			coeffs[kB2 * paddedChannels] = -f.b2;
+		}
+	}
+}
+
+template <typename T>
+void BiquadBankT<T>::clean()
+{
+	std::fill(states.begin(), states.end(), 0);
+}
+
+template <typename T>
+void BiquadBankT<T>::process(T* const* out, const T* const* in, unsigned int frames)
+{
+	processWindows(out, in, 1, frames);
+}
+
+template <typename T>
+void BiquadBankT<T>::processInterleaved(T* out, const T* in, unsigned int frames)
+{
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		outPtrs[c] = out + c;
+		inPtrs[c] = in + c;
+	}
+	processWindows(outPtrs.data(), inPtrs.data(), numChannels, frames);
+}
+
+template <typename T>
+void BiquadBankT<T>::processWindows(T* const* out, const T* const* in, unsigned int frameStride, unsigned int frames)
+{
+	typedef typename BiquadBankVectors<T>::V4 V4;
+	typedef typename BiquadBankVectors<T>::V8 V8;
+	T data[kChunkFrames * kMaxLanes];
+	// groups of 8 channels (or 4 for the last one) go through all the
+	// stages one chunk at a time, transposed in data so that each frame
+	// is a vector
+	for(unsigned int first = 0; first < paddedChannels; )
+	{
+		unsigned int lanes = paddedChannels - first >= 8 ? 8 : 4;
+		unsigned int channels = numChannels - first < lanes ? numChannels - first : lanes;
+		for(unsigned int start = 0; start < frames; start += kChunkFrames)
+		{
+			unsigned int count = frames - start < kChunkFrames ? frames - start : kChunkFrames;
+			if(channels < lanes)
+				memset(data, 0, sizeof(data));
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				const T* src = in[first + c] + start * frameStride;
+				for(unsigned int n = 0; n < count; ++n)
+					data[n * lanes + c] = src[n * frameStride];
+			}
+			for(unsigned int s = 0; s < numStages; ++s)
+			{
+				const T* coeffs = coefficients.data() + s * kNumCoefficients * paddedChannels + first;
+				T* z = states.data() + s * 2 * paddedChannels + first;
+				if(8 == lanes)
+					processStage<V8>(data, count, coeffs, z, paddedChannels);
+				else
+					processStage<V4>(data, count, coeffs, z, paddedChannels);
+			}
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				T* dst = out[first + c] + start * frameStride;
+				for(unsigned int n = 0; n < count; ++n)
+					dst[n * frameStride] = data[n * lanes + c];
+			}
+		}
+		first += lanes;
+	}
+}
+
+template <typename T>
+const char* BiquadBankT<T>::getBackend()
+{
+	return BiquadBankVectors<T>::getBackend();
+}
+
+template class BiquadBankT<float>;
+template class BiquadBankT<double>;
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+template <typename T>
+static bool testBiquadBank(unsigned int numChannels, unsigned int numStages, bool interleaved, bool filterbank)
+{
+	const unsigned int frames = 300;
+	const unsigned int blockSizes[] = {1, 16, 45, 128};
+	BiquadBankT<T> bank(numChannels, numStages);
+	std::vector<Biquad> ref(numChannels * numStages);
+	BiquadCoeff::Type types[] = {BiquadCoeff::lowpass, BiquadCoeff::highpass, BiquadCoeff::bandpass, BiquadCoeff::peak};
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		for(unsigned int s = 0; s < numStages; ++s)
+		{
+			BiquadCoeff::Settings settings = {
+				.fs = 44100,
+				.type = types[(c + s) % 4],
+				.cutoff = 100.0 + 15000.0 * rand() / RAND_MAX,
+				.q = 0.5 + 2.0 * rand() / RAND_MAX,
+				.peakGainDb = 6,
+			};
+			bank.getFilter(c, s).setup(settings);
+			ref[c * numStages + s].setup(settings);
+		}
+	}
+	bank.update();
+	std::vector<T> in(numChannels * frames);
+	for(auto& i : in)
+		i = 2.0 * rand() / RAND_MAX - 1;
+	if(filterbank)
+		for(unsigned int n = 0; n < frames; ++n)
+			for(unsigned int c = 1; c < numChannels; ++c)
+				in[c * frames + n] = in[n];
+	std::vector<T> out(numChannels * frames);
+	std::vector<T> inter(numChannels * frames);
+	unsigned int done = 0;
+	for(unsigned int b = 0; done < frames; ++b)
+	{
+		unsigned int count = blockSizes[b % 4];
+		if(count > frames - done)
+			count = frames - done;
+		if(interleaved)
+		{
+			// in place
+			for(unsigned int c = 0; c < numChannels; ++c)
+				for(unsigned int n = 0; n < count; ++n)
+					inter[n * numChannels + c] = in[c * frames + done + n];
+			bank.processInterleaved(inter.data(), inter.data(), count);
+			for(unsigned int c = 0; c < numChannels; ++c)
+				for(unsigned int n = 0; n < count; ++n)
+					out[c * frames + done + n] = inter[n * numChannels + c];
+		} else {
+			std::vector<T*> outs(numChannels);
+			std::vector<const T*> ins(numChannels);
+			for(unsigned int c = 0; c < numChannels; ++c)
+			{
+				outs[c] = out.data() + c * frames + done;
+				ins[c] = in.data() + (filterbank ? 0 : c * frames) + done;
+			}
+			bank.process(outs.data(), ins.data(), count);
+		}
+		done += count;
+	}
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		for(unsigned int n = 0; n < frames; ++n)
+		{
+			double expected = in[c * frames + n];
+			for(unsigned int s = 0; s < numStages; ++s)
+				expected = ref[c * numStages + s].process(expected);
+			double tolerance = sizeof(T) == sizeof(float) ? 1e-4 * (1 + fabs(expected)) : 1e-10;
+			assert(fabs(out[c * frames + n] - expected) <= tolerance);
+		}
+	}
+	return true;
+}
+
+bool BiquadBankTest()
+{
+	const unsigned int channelCounts[] = {1, 3, 4, 5, 8, 12, 13, 64};
+	for(auto channels : channelCounts)
+	{
+		for(unsigned int stages = 1; stages <= 3; ++stages)
+		{
+			for(unsigned int interleaved = 0; interleaved < 2; ++interleaved)
+			{
+				testBiquadBank<float>(channels, stages, interleaved, !interleaved && (channels & 1));
+				testBiquadBank<double>(channels, stages, interleaved, false);
+			}
+		}
+	}
+	// the object has no alignment requirements
+	std::vector<BiquadBank> banks(3, BiquadBank(5, 2));
+	for(auto& b : banks)
+	{
+		float buf[10] = {1};
+		b.processInterleaved(buf, buf, 2);
+		assert(1 == buf[0]);
+	}
+	printf("BiquadBankTest successful (%s)\n", BiquadBank::getBackend());
+	return true;
+}
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+#include <vector>
+#include "Biquad.h"
+
+/**
+ * A class which processes any number of channels of biquad filters in
+ * parallel, each channel consisting of one or more biquad filters in
+ * series.
+ *
+ * Unlike QuadBiquad, this works with any number of channels, processes a
+ * whole block of samples per call and has no alignment requirements, so it
+ * can be stored in STL containers. Channels are processed several at a
+ * time using NEON, AVX or SSE intrinsics, depending on the target, falling
+ * back to plain C++. For `double` only the plain C++ implementation is
+ * available.
+ *
+ * For a filterbank, where several bands filter the same signal, pass the
+ * same input pointer for all channels.
+ */
+template <typename T>
+class BiquadBankT
+{
+public:
+	typedef T sample_t;
+	BiquadBankT() {};
+	BiquadBankT(unsigned int numChannels, unsigned int numStages = 1) { setup(numChannels, numStages); }
+	/**
+	 * Allocate the filters. All the filters are initialised to let the
+	 * signal through unchanged.
+	 *
+	 * Set their parameters with getFilter() and then call update().
+	 *
+	 * @param numChannels the number of channels processed in parallel.
+	 * @param numStages the number of filters in series on each channel.
+	 *
+	 * @return 0 upon success, a negative value otherwise.
+	 */
+	int setup(unsigned int numChannels, unsigned int numStages = 1);
+	/**
+	 * Allocate the filters and set all of them to @p settings.
+	 */
+	int setup(unsigned int numChannels, unsigned int numStages, const BiquadCoeff::Settings& settings);
+	/**
+	 * Get one of the filters. You can set the filtering characteristics
+	 * of each filter separately: call setup() on the returned object
+	 * before using its other setters, then call update() before calling
+	 * process().
+	 *
+	 * @param channel the channel the filter belongs to.
+	 * @param stage the position of the filter in the series, with 0
+	 * being the first to process the input.
+	 */
+	BiquadCoeffT<T>& getFilter(unsigned int channel, unsigned int stage = 0)
+	{
+		return filters[channel * numStages + stage];
+	}
+	/**
+	 * Call this after changing the parameters of one or more filters
+	 * and before calling process().
+	 */
+	void update();
+	/**
+	 * Reset the internal state of all the filters to 0.
+	 */
+	void clean();
+	/**
+	 * Process a block of non-interleaved samples. Each channel can be
+	 * processed in place, as long as its buffer is not also the input of
+	 * another channel.
+	 *
+	 * @param out an array of getNumChannels() pointers, each to a buffer
+	 * of @p frames output samples.
+	 * @param in an array of getNumChannels() pointers, each to a buffer
+	 * of @p frames input samples.
+	 * @param frames the number of frames to process.
+	 */
+	void process(T* const* out, const T* const* in, unsigned int frames);
+	/**
+	 * Process a block of interleaved samples, with getNumChannels()
+	 * samples per frame. @p out and @p in may point to the same buffer.
+	 */
+	void processInterleaved(T* out, const T* in, unsigned int frames);
+	unsigned int getNumChannels() { return numChannels; }
+	unsigned int getNumStages() { return numStages; }
+	/**
+	 * Get the name of the implementation used by process().
+	 */
+	static const char* getBackend();
+private:
+	void processWindows(T* const* out, const T* const* in, unsigned int frameStride, unsigned int frames);
+	std::vector<BiquadCoeffT<T>> filters;
+	// the coefficients in the layout used by process(): for each stage,
+	// a0, a1, a2, -b1, -b2, each for all the channels, padded to a
+	// multiple of the vector size
+	std::vector<T> coefficients;
+	// z1 and z2 for each stage, in the same layout as coefficients
+	std::vector<T> states;
+	std::vector<T*> outPtrs;
+	std::vector<const T*> inPtrs;
+	unsigned int numChannels = 0;
+	unsigned int numStages = 0;
+	unsigned int paddedChannels = 0;
+};
+
+typedef BiquadBankT<float> BiquadBank;
+extern template class BiquadBankT<float>;
+extern template class BiquadBankT<double>;
@@ -10,7 +10,8 @@
  * A class which processes four biquad filters in parallel in an optimised way.
  *
  * These filters use `float` data types internally and the process() routine
- * uses NEON intrinsics.
+ * uses NEON intrinsics. See BiquadBank for any number of filters, processing
+ * whole blocks, on any target.
  */
 class QuadBiquad
 {
@@ -1,68 +1,558 @@
 #include "Convolver.h"
+#include <Bela.h>
 #include <string.h>
-int ConvolverChannel::setup(const std::vector<float>& ir, unsigned int blockSize)
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <libraries/AudioFile/SampleCache.h>
+#include <libraries/Resampler/Resampler.h>
+#include "../include/xenomai_wraps.h"
+
+static bool isPowerOfTwo(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+constexpr unsigned int ConvolverChannel::kMaxPartitionSize;
+// the smallest FFT size we want to use is twice this
+static const unsigned int kMinPartitionSize = 16;
+
+int ConvolverIrs::setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize, bool partitioned)
 {
-	cleanup();
 	this->blockSize = blockSize;
-	firFilterCoeff = (ne10_float32_t *) NE10_MALLOC (ir.size() * sizeof (ne10_float32_t));
-	firFilterState = (ne10_float32_t *) NE10_MALLOC ((ir.size() + blockSize - 1) * sizeof (ne10_float32_t));
-	if(!firFilterState || !firFilterCoeff)
+	firCoeffs.clear();
+	segments.clear();
+	if(!blockSize)
 		return -1;
-	for(unsigned int n = 0; n < ir.size(); ++n)
+	if(!isPowerOfTwo(blockSize))
+		partitioned = false;
+	unsigned int length = 0;
+	for(auto& ir : irs)
+		length = std::max(length, (unsigned int)ir.size());
+	const unsigned int firstPartitionSize = std::max(blockSize, kMinPartitionSize);
+	const unsigned int maxPartitionSize = std::max(firstPartitionSize, ConvolverChannel::kMaxPartitionSize);
+	// the FIR head covers the part of the impulse response that comes
+	// before the first partition
+	unsigned int firLength = partitioned ? std::min(length, 2 * firstPartitionSize - blockSize) : length;
+	firCoeffs.resize(irs.size());
+	for(unsigned int c = 0; c < irs.size(); ++c)
+	{
+		firCoeffs[c].resize(firLength);
+		for(unsigned int n = 0; n < firLength; ++n)
+		{
+			// the filter coefficients are the time-inverse of the impulse response
+			unsigned int idx = firLength - 1 - n;
+			firCoeffs[c][n] = idx < irs[c].size() ? irs[c][idx] : 0;
+		}
+	}
+	// then we have two partitions of each size, doubling the size each
+	// time, so that the offset of each segment is always
+	// 2 * partitionSize - blockSize. Once we reach maxPartitionSize, the
+	// last segment covers the rest of the impulse response.
+	unsigned int partitionSize = firstPartitionSize;
+	unsigned int offset = firLength;
+	std::vector<float> fftIn;
+	std::vector<float> fftOut;
+	while(offset < length)
 	{
-		// the filter coefficients are the time-inverse of the impulse response
-		firFilterCoeff[n] = ir.data()[ir.size() - 1 - n];
+		unsigned int segmentLength = length - offset;
+		if(partitionSize < maxPartitionSize)
+			segmentLength = std::min(segmentLength, 2 * partitionSize);
+		segments.emplace_back();
+		Segment& s = segments.back();
+		s.offset = offset;
+		s.partitionSize = partitionSize;
+		s.numPartitions = (segmentLength + partitionSize - 1) / partitionSize;
+		const unsigned int fftSize = 2 * partitionSize;
+		const unsigned int numBins = partitionSize + 1;
+		ne10_fft_r2c_cfg_float32_t cfg = ne10_fft_alloc_r2c_float32(fftSize);
+		if(!cfg)
+			return -1;
+		fftIn.resize(fftSize);
+		fftOut.resize(fftSize);
+		s.spectra.resize(irs.size() * s.numPartitions * numBins);
+		// measure the gain of a forward+inverse transform, so that we
+		// can compensate for it in the partitions' spectra, without
+		// relying on whether or not the inverse transform is normalised
+		std::fill(fftIn.begin(), fftIn.end(), 0);
+		fftIn[0] = 1;
+		ne10_fft_r2c_1d_float32_neon(s.spectra.data(), fftIn.data(), cfg);
+		ne10_fft_c2r_1d_float32_neon(fftOut.data(), s.spectra.data(), cfg);
+		const float scale = 1.f / fftOut[0];
+		for(unsigned int c = 0; c < irs.size(); ++c)
+		{
+			for(unsigned int k = 0; k < s.numPartitions; ++k)
+			{
+				// each partition is zero-padded to fftSize
+				std::fill(fftIn.begin(), fftIn.end(), 0);
+				for(unsigned int n = 0; n < partitionSize; ++n)
+				{
+					unsigned int idx = k * partitionSize + n;
+					if(idx < segmentLength && offset + idx < irs[c].size())
+						fftIn[n] = irs[c][offset + idx] * scale;
+				}
+				ne10_fft_r2c_1d_float32_neon(s.spectra.data() + (c * s.numPartitions + k) * numBins, fftIn.data(), cfg);
+			}
+		}
+		ne10_fft_destroy_r2c_float32(cfg);
+		offset += segmentLength;
+		if(partitionSize < maxPartitionSize)
+			partitionSize *= 2;
 	}
-	ne10_fir_init_float(&firFilter, ir.size(), firFilterCoeff, firFilterState, blockSize);
 	return 0;
 }
 
-void ConvolverChannel::process(ne10_float32_t* filterOut, const ne10_float32_t* filterIn)
+std::shared_ptr<const ConvolverIrs> ConvolverIrs::load(const std::string& filename, unsigned int blockSize, unsigned int maxLength, bool partitioned, unsigned int sampleRate)
 {
-	ne10_fir_float_neon(&firFilter, (float*)filterIn, filterOut, blockSize);
+	static std::mutex mutex;
+	static std::map<std::string, std::weak_ptr<const ConvolverIrs>> cache;
+	// as in SampleCache, a file that has been modified since it was
+	// loaded is loaded again
+	struct stat st;
+	if(stat(filename.c_str(), &st))
+	{
+		fprintf(stderr, "Unable to open %s\n", filename.c_str());
+		return nullptr;
+	}
+	std::string key = filename + ":" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino)
+		+ ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec)
+		+ ":" + std::to_string(blockSize) + ":" + std::to_string(maxLength) + ":" + std::to_string(partitioned) + ":" + std::to_string(sampleRate);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = cache.find(key);
+	if(it != cache.end())
+	{
+		if(std::shared_ptr<const ConvolverIrs> irs = it->second.lock())
+			return irs;
+	}
+	// forget about the objects that are no longer in use
+	for(auto it = cache.begin(); it != cache.end(); )
+	{
+		if(it->second.expired())
+			it = cache.erase(it);
+		else
+			++it;
+	}
+	std::shared_ptr<const SampleFile> file = SampleCache::get(filename);
+	if(!file)
+	{
+		fprintf(stderr, "Unable to open %s\n", filename.c_str());
+		return nullptr;
+	}
+	unsigned int numFrames = file->getNumFrames();
+	bool resample = sampleRate && sampleRate != file->getSampleRate();
+	// only read what's needed to produce maxLength frames
+	if(maxLength && !resample && numFrames > maxLength)
+		numFrames = maxLength;
+	else if(maxLength && resample)
+	{
+		Resampler r(file->getSampleRate(), sampleRate, 1);
+		numFrames = std::min<uint64_t>(numFrames, r.getInputFrame(maxLength) + r.getNumTaps());
+	}
+	std::vector<std::vector<float>> data(file->getNumChannels());
+	for(unsigned int n = 0; n < data.size(); ++n)
+	{
+		const float* ir = file->getFrames(n, 0, numFrames);
+		if(!ir)
+		{
+			fprintf(stderr, "Unable to read data from %s\n", filename.c_str());
+			return nullptr;
+		}
+		if(resample)
+		{
+			if(Resampler::process(data[n], ir, numFrames, 1, file->getSampleRate(), sampleRate))
+			{
+				fprintf(stderr, "Unable to convert %s from %uHz to %uHz\n", filename.c_str(), file->getSampleRate(), sampleRate);
+				return nullptr;
+			}
+			if(maxLength && data[n].size() > maxLength)
+				data[n].resize(maxLength);
+		} else
+			data[n].assign(ir, ir + numFrames);
+	}
+	std::shared_ptr<ConvolverIrs> irs = std::make_shared<ConvolverIrs>();
+	if(irs->setup(data, blockSize, partitioned))
+		return nullptr;
+	cache[key] = irs;
+	return irs;
 }
 
-void ConvolverChannel::cleanup()
+int ConvolverSegment::setup(const ConvolverIrs& irs, unsigned int segment, const std::vector<std::vector<int>>& routing, unsigned int numInputs, int priority)
+{
+	cleanup();
+	if(segment >= irs.segments.size())
+		return -1;
+	const ConvolverIrs::Segment& s = irs.segments[segment];
+	partitionSize = s.partitionSize;
+	numPartitions = s.numPartitions;
+	blockSize = irs.blockSize;
+	if(!blockSize || partitionSize % blockSize)
+		return -1;
+	const unsigned int fftSize = 2 * partitionSize;
+	const unsigned int numBins = partitionSize + 1;
+	cfg = ne10_fft_alloc_r2c_float32(fftSize);
+	if(!cfg)
+		return -1;
+	fftIn.resize(fftSize);
+	fftOut.resize(fftSize);
+	accumulator.resize(numBins);
+	inputs.resize(numInputs);
+	for(auto& in : inputs)
+	{
+		in.window.assign(fftSize, 0);
+		in.fdl.assign(numPartitions * numBins, ne10_fft_cpx_float32_t());
+		for(auto& b : in.buffers)
+			b.assign(partitionSize, 0);
+	}
+	outputs.resize(routing.size());
+	for(unsigned int o = 0; o < outputs.size(); ++o)
+	{
+		Output& out = outputs[o];
+		for(auto& b : out.buffers)
+			b.assign(partitionSize, 0);
+		out.sources.clear();
+		for(unsigned int i = 0; i < numInputs && i < routing[o].size(); ++i)
+		{
+			int ir = routing[o][i];
+			if(ir < 0)
+				continue;
+			if(ir >= (int)irs.getNumIrs())
+				return -1;
+			out.sources.push_back({i, s.spectra.data() + ir * numPartitions * numBins});
+		}
+	}
+	fdlPos = 0;
+	fill = 0;
+	fillBuf = 0;
+	jobIn = 0;
+	jobOut = 0;
+	readBuf = 1;
+	jobPending = false;
+	shouldStop = false;
+	if(priority >= 0)
+	{
+		if(__wrap_sem_init(&start, 0, 0))
+		{
+			fprintf(stderr, "Convolver: unable to create semaphore: %d %s\n", errno, strerror(errno));
+			return -1;
+		}
+		if(__wrap_sem_init(&done, 0, 0))
+		{
+			fprintf(stderr, "Convolver: unable to create semaphore: %d %s\n", errno, strerror(errno));
+			__wrap_sem_destroy(&start);
+			return -1;
+		}
+		static std::atomic<unsigned int> threadCount{0};
+		std::string name = "bela-convolver-" + std::to_string(threadCount++);
+		if(int ret = create_and_start_thread(&thread, name.c_str(), priority, 0, (pthread_callback_t*)threadLoop, this))
+		{
+			fprintf(stderr, "Convolver: unable to start thread %s: %d %s\n", name.c_str(), ret, strerror(ret));
+			__wrap_sem_destroy(&start);
+			__wrap_sem_destroy(&done);
+			return -1;
+		}
+		threadStarted = true;
+	}
+	return 0;
+}
+
+void ConvolverSegment::process(float* const* outs, const float* const* ins)
 {
-	NE10_FREE(firFilterState);
-	NE10_FREE(firFilterCoeff);
-	firFilterCoeff = nullptr;
-	firFilterState = nullptr;
+	for(unsigned int i = 0; i < inputs.size(); ++i)
+		memcpy(inputs[i].buffers[fillBuf].data() + fill, ins[i], blockSize * sizeof(ins[i][0]));
+	fill += blockSize;
+	if(partitionSize == fill)
+	{
+		fill = 0;
+		if(jobPending)
+		{
+			// the output of the previous job is due now. This
+			// only blocks if the thread is running late.
+			while(__wrap_sem_wait(&done) && EINTR == errno)
+				;
+			jobPending = false;
+		}
+		// the output of the previous job becomes readable and a new
+		// job is started on the input we just filled
+		readBuf = jobOut;
+		jobOut = !jobOut;
+		jobIn = fillBuf;
+		fillBuf = !fillBuf;
+		if(threadStarted)
+		{
+			jobPending = true;
+			__wrap_sem_post(&start);
+		} else
+			compute();
+	}
+	for(unsigned int o = 0; o < outputs.size(); ++o)
+	{
+		const float* output = outputs[o].buffers[readBuf].data() + fill;
+		for(unsigned int n = 0; n < blockSize; ++n)
+			outs[o][n] += output[n];
+	}
 }
 
-#include <stdio.h>
-#include <libraries/AudioFile/AudioFile.h>
-using namespace AudioFileUtilities;
+void ConvolverSegment::compute()
+{
+	const unsigned int numBins = partitionSize + 1;
+	// the newest spectrum goes at fdlPos, older ones follow it
+	fdlPos = (fdlPos + numPartitions - 1) % numPartitions;
+	// transform each input only once
+	for(auto& in : inputs)
+	{
+		// slide the input window and append the new input
+		memmove(in.window.data(), in.window.data() + partitionSize, partitionSize * sizeof(in.window[0]));
+		memcpy(in.window.data() + partitionSize, in.buffers[jobIn].data(), partitionSize * sizeof(in.window[0]));
+		memcpy(fftIn.data(), in.window.data(), in.window.size() * sizeof(in.window[0]));
+		ne10_fft_r2c_1d_float32_neon(in.fdl.data() + fdlPos * numBins, fftIn.data(), cfg);
+	}
+	ne10_fft_cpx_float32_t* acc = accumulator.data();
+	for(auto& out : outputs)
+	{
+		memset(acc, 0, accumulator.size() * sizeof(accumulator[0]));
+		for(auto& source : out.sources)
+		{
+			const ne10_fft_cpx_float32_t* fdl = inputs[source.input].fdl.data();
+			for(unsigned int k = 0; k < numPartitions; ++k)
+			{
+				const ne10_fft_cpx_float32_t* x = fdl + ((fdlPos + k) % numPartitions) * numBins;
+				const ne10_fft_cpx_float32_t* h = source.spectra + k * numBins;
+				for(unsigned int n = 0; n < numBins; ++n)
+				{
+					acc[n].r += x[n].r * h[n].r - x[n].i * h[n].i;
+					acc[n].i += x[n].r * h[n].i + x[n].i * h[n].r;
+				}
+			}
+		}
+		ne10_fft_c2r_1d_float32_neon(fftOut.data(), acc, cfg);
+		// overlap-save: only the second half is free from time-aliasing
+		memcpy(out.buffers[jobOut].data(), fftOut.data() + partitionSize, partitionSize * sizeof(fftOut[0]));
+	}
+}
 
-int Convolver::setup(const std::string& filename, unsigned int blockSize, unsigned int maxLength)
+void* ConvolverSegment::threadLoop(void* arg)
 {
-	int numChannels = getNumChannels(filename);
-	int numFrames = getNumFrames(filename);
-	if(maxLength && numFrames > maxLength)
-		numFrames = maxLength;
-	std::vector<std::vector<float>> irs;
-	for(unsigned int n = 0; n < numChannels; ++n)
+	ConvolverSegment* that = (ConvolverSegment*)arg;
+	while(1)
 	{
-		std::vector<float> ir(numFrames);
-		if(getSamples(filename, ir.data(), n, 0, ir.size()))
+		if(__wrap_sem_wait(&that->start))
 		{
-			fprintf(stderr, "Unable to read data from %s\n", filename.c_str());
+			if(EINTR == errno)
+				continue;
+			break;
+		}
+		if(that->shouldStop)
+			break;
+		that->compute();
+		__wrap_sem_post(&that->done);
+	}
+	return NULL;
+}
+
+void ConvolverSegment::cleanup()
+{
+	if(threadStarted)
+	{
+		// let the thread complete any pending job before stopping it
+		if(jobPending)
+		{
+			while(__wrap_sem_wait(&done) && EINTR == errno)
+				;
+			jobPending = false;
+		}
+		shouldStop = true;
+		__wrap_sem_post(&start);
+		__wrap_pthread_join(thread, NULL);
+		__wrap_sem_destroy(&start);
+		__wrap_sem_destroy(&done);
+		threadStarted = false;
+	}
+	if(cfg)
+		ne10_fft_destroy_r2c_float32(cfg);
+	cfg = nullptr;
+}
+
+int ConvolverChannel::setup(const std::vector<float>& ir, unsigned int blockSize, Type type)
+{
+	std::shared_ptr<ConvolverIrs> irs = std::make_shared<ConvolverIrs>();
+	if(irs->setup({ir}, blockSize, kFir != type))
+		return -1;
+	return setup(irs, {{0}}, 1, kPartitioned == type);
+}
+
+int ConvolverChannel::setup(std::shared_ptr<const ConvolverIrs> irs, const std::vector<std::vector<int>>& routing, unsigned int numInputs, bool background)
+{
+	cleanup();
+	if(!irs)
+		return -1;
+	this->irs = irs;
+	blockSize = irs->blockSize;
+	this->numInputs = numInputs;
+	numOutputs = routing.size();
+	firOut.resize(blockSize);
+	// one FIR filter for the head of each impulse response in use
+	unsigned int firLength = irs->getNumIrs() ? irs->firCoeffs[0].size() : 0;
+	for(unsigned int o = 0; o < numOutputs && firLength; ++o)
+	{
+		for(unsigned int i = 0; i < numInputs && i < routing[o].size(); ++i)
+		{
+			int ir = routing[o][i];
+			if(ir < 0)
+				continue;
+			if(ir >= (int)irs->getNumIrs())
+			{
+				cleanup();
+				return -1;
+			}
+			firs.emplace_back();
+			Fir& fir = firs.back();
+			fir.input = i;
+			fir.output = o;
+			fir.state.resize(firLength + blockSize - 1);
+		}
+	}
+	// initialise the filters once the vector won't be resized any more,
+	// as they hold pointers to their state
+	unsigned int n = 0;
+	for(unsigned int o = 0; o < numOutputs && firLength; ++o)
+	{
+		for(unsigned int i = 0; i < numInputs && i < routing[o].size(); ++i)
+		{
+			int ir = routing[o][i];
+			if(ir < 0)
+				continue;
+			Fir& fir = firs[n++];
+			// Ne10 doesn't modify the coefficients
+			ne10_fir_init_float(&fir.filter, firLength, (ne10_float32_t*)irs->firCoeffs[ir].data(), fir.state.data(), blockSize);
+		}
+	}
+	for(unsigned int s = 0; s < irs->segments.size(); ++s)
+	{
+		// the smallest partitions are cheap enough to be computed
+		// in the audio thread. Larger partitions get lower priorities
+		// as their deadline is further away.
+		int priority = -1;
+		if(background && irs->segments[s].partitionSize != blockSize)
+			priority = std::max(1, BELA_AUDIO_PRIORITY - 1 - (int)s);
+		segments.emplace_back(new ConvolverSegment);
+		if(segments.back()->setup(*irs, s, routing, numInputs, priority))
+		{
+			cleanup();
 			return -1;
 		}
-		irs.push_back(ir);
 	}
-	return setup(irs, blockSize);
+	return 0;
+}
+
+void ConvolverChannel::process(ne10_float32_t* filterOut, const ne10_float32_t* filterIn)
+{
+	process(&filterOut, &filterIn);
+}
+
+void ConvolverChannel::process(float* const* outs, const float* const* ins)
+{
+	for(unsigned int o = 0; o < numOutputs; ++o)
+		memset(outs[o], 0, blockSize * sizeof(outs[o][0]));
+	for(auto& fir : firs)
+	{
+		ne10_fir_float_neon(&fir.filter, (ne10_float32_t*)ins[fir.input], firOut.data(), blockSize);
+		float* out = outs[fir.output];
+		for(unsigned int n = 0; n < blockSize; ++n)
+			out[n] += firOut[n];
+	}
+	for(auto& segment : segments)
+		segment->process(outs, ins);
+}
+
+void ConvolverChannel::cleanup()
+{
+	segments.clear();
+	firs.clear();
+	irs = nullptr;
+	numInputs = 0;
+	numOutputs = 0;
 }
 
-int Convolver::setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize)
+int Convolver::setup(const std::string& filename, unsigned int blockSize, unsigned int maxLength, ConvolverChannel::Type type, unsigned int sampleRate)
 {
+	return setupChannels(ConvolverIrs::load(filename, blockSize, maxLength, ConvolverChannel::kFir != type, sampleRate), type);
+}
+
+int Convolver::setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize, ConvolverChannel::Type type)
+{
+	std::shared_ptr<ConvolverIrs> convolverIrs = std::make_shared<ConvolverIrs>();
+	if(convolverIrs->setup(irs, blockSize, ConvolverChannel::kFir != type))
+		return -1;
+	return setupChannels(convolverIrs, type);
+}
+
+int Convolver::setupChannels(std::shared_ptr<const ConvolverIrs> irs, ConvolverChannel::Type type)
+{
+	cleanup();
+	if(!irs)
+		return -1;
+	unsigned int blockSize = irs->blockSize;
 	filterIn = (ne10_float32_t *) NE10_MALLOC (blockSize * sizeof (ne10_float32_t));
 	filterOut = (ne10_float32_t *) NE10_MALLOC (blockSize * sizeof (ne10_float32_t));
-	convolverChannels.clear();
-	for(auto& ir : irs)
+	for(unsigned int c = 0; c < irs->getNumIrs(); ++c)
+	{
+		convolverChannels.emplace_back(new ConvolverChannel);
+		if(convolverChannels.back()->setup(irs, {{(int)c}}, 1, ConvolverChannel::kPartitioned == type))
+		{
+			fprintf(stderr, "Convolver: unable to set up convolution channel %u\n", c);
+			cleanup();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int Convolver::setupMatrix(const std::string& filename, unsigned int numInputs, unsigned int blockSize, unsigned int maxLength, ConvolverChannel::Type type, unsigned int sampleRate)
+{
+	return setupMatrix(ConvolverIrs::load(filename, blockSize, maxLength, ConvolverChannel::kFir != type, sampleRate), numInputs, type);
+}
+
+int Convolver::setupMatrix(const std::vector<std::vector<float>>& irs, unsigned int numInputs, unsigned int blockSize, ConvolverChannel::Type type)
+{
+	std::shared_ptr<ConvolverIrs> convolverIrs = std::make_shared<ConvolverIrs>();
+	if(convolverIrs->setup(irs, blockSize, ConvolverChannel::kFir != type))
+		return -1;
+	return setupMatrix(convolverIrs, numInputs, type);
+}
+
+int Convolver::setupMatrix(std::shared_ptr<const ConvolverIrs> irs, unsigned int numInputs, ConvolverChannel::Type type)
+{
+	cleanup();
+	if(!irs || !numInputs)
+		return -1;
+	unsigned int numOutputs = irs->getNumIrs() / numInputs;
+	if(!numOutputs || numOutputs * numInputs != irs->getNumIrs())
 	{
-		convolverChannels.emplace_back(ir, blockSize);
+		fprintf(stderr, "Convolver: the number of impulse responses (%u) is not a multiple of the number of inputs (%u)\n", irs->getNumIrs(), numInputs);
+		return -1;
+	}
+	std::vector<std::vector<int>> routing(numOutputs, std::vector<int>(numInputs));
+	for(unsigned int o = 0; o < numOutputs; ++o)
+		for(unsigned int i = 0; i < numInputs; ++i)
+			routing[o][i] = o * numInputs + i;
+	matrix.reset(new ConvolverChannel);
+	if(matrix->setup(irs, routing, numInputs, ConvolverChannel::kPartitioned == type))
+	{
+		cleanup();
+		return -1;
 	}
+	unsigned int blockSize = irs->blockSize;
+	matrixBlockSize = blockSize;
+	matrixIn.resize(numInputs * blockSize);
+	matrixOut.resize(numOutputs * blockSize);
+	matrixInPtrs.resize(numInputs);
+	matrixOutPtrs.resize(numOutputs);
+	for(unsigned int i = 0; i < numInputs; ++i)
+		matrixInPtrs[i] = matrixIn.data() + i * blockSize;
+	for(unsigned int o = 0; o < numOutputs; ++o)
+		matrixOutPtrs[o] = matrixOut.data() + o * blockSize;
 	return 0;
 }
 
@@ -73,12 +563,49 @@ void Convolver::process(float* out, const float* in, unsigned int frames, unsign
 
 void Convolver::processInterleaved(float* out, const float* in, unsigned int frames, unsigned int outChannels, unsigned int inChannels)
 {
+	if(matrix)
+	{
+		const unsigned int numInputs = matrix->getNumInputs();
+		const unsigned int numOutputs = matrix->getNumOutputs();
+		const unsigned int blockSize = matrixBlockSize;
+		if(frames % blockSize)
+		{
+			memset(out, 0, frames * outChannels * sizeof(out[0]));
+			return;
+		}
+		// the matrix always processes blockSize frames at a time
+		for(unsigned int start = 0; start < frames; start += blockSize)
+		{
+			const float* blockIn = in + start * inChannels;
+			float* blockOut = out + start * outChannels;
+			for(unsigned int i = 0; i < numInputs; ++i)
+			{
+				float* dst = matrixInPtrs[i];
+				if(i < inChannels)
+				{
+					for(unsigned int n = 0; n < blockSize; ++n)
+						dst[n] = blockIn[inChannels * n + i];
+				} else
+					memset(dst, 0, blockSize * sizeof(dst[0]));
+			}
+			matrix->process(matrixOutPtrs.data(), matrixInPtrs.data());
+			for(unsigned int o = 0; o < numOutputs && o < outChannels; ++o)
+			{
+				const float* src = matrixOutPtrs[o];
+				for(unsigned int n = 0; n < blockSize; ++n)
+					blockOut[outChannels * n + o] = src[n];
+			}
+		}
+		return;
+	}
 	for(unsigned int channel = 0; channel < convolverChannels.size() && channel < outChannels && channel < inChannels; ++channel)
 		doProcessInterleaved(out, in, frames, outChannels, inChannels, channel);
 }
 
 void Convolver::cleanup()
 {
+	convolverChannels.clear();
+	matrix.reset();
 	NE10_FREE(filterOut);
 	NE10_FREE(filterIn);
 	filterOut = nullptr;
@@ -95,7 +622,7 @@ void Convolver::doProcessInterleaved(float* out, const float* in, unsigned int f
 		for(unsigned int n = 0; n < frames; ++n)
 			filterIn[n] = in[inChannels * n  + channel];
 	}
-	convolverChannels[channel].process(filterOut, filterIn);
+	convolverChannels[channel]->process(filterOut, filterIn);
 	if(1 == outChannels) { // fake inteleaving, cheaper
 		memcpy(out, filterOut, frames * sizeof(out[0]));
 	} else { // actual interleaving
@@ -107,6 +634,9 @@ void Convolver::doProcessInterleaved(float* out, const float* in, unsigned int f
 #if 0
 #undef NDEBUG
 #include <assert.h>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
 bool ConvolverTest()
 {
 	std::vector<std::vector<float>> irs(2);
@@ -142,10 +672,10 @@ bool ConvolverTest()
 				float out[blockSize];
 				float in[blockSize];
 				for(unsigned int k = 0; k < blockSize; ++k)
-					in[k] = ins[numFrames + k * inChannels + i];
+					in[k] = ins[inOffset + k * inChannels + i];
 				d.process(out, in, blockSize, i);
 				for(unsigned int k = 0; k < blockSize; ++k)
-					outs[numFrames + k * inChannels + i] = out[k];
+					douts[outOffset + k * outChannels + i] = out[k];
 			}
 		}
 		for(unsigned int n = 0; n < numFrames; ++n)
@@ -157,8 +687,9 @@ bool ConvolverTest()
 				else
 					expected = 0;
 				float out = outs[n * outChannels + i];
-				float dout = outs[n * outChannels + i];
-				if(out != expected || dout != expected) {
+				float dout = douts[n * outChannels + i];
+				// the partitioned convolution is only exact to within rounding errors
+				if(std::abs(out - expected) > 1e-5 || std::abs(dout - expected) > 1e-5) {
 					fprintf(stderr, "error at n: %d, ch: %d. inChannels: %d, inVal: %f, expected: %f, got: %f, dgot: %f\n", n, i, inChannels, ins[n * inChannels +i], expected, out, dout);
 					assert(false);
 				}
@@ -167,4 +698,134 @@ bool ConvolverTest()
 	}
 	return true;
 }
+
+#include <stdlib.h>
+bool ConvolverPartitionedTest()
+{
+	// compare all types of convolution against a naive one, for lengths
+	// that cover the FIR head, one or more partitions of each size and
+	// the uniformly partitioned tail
+	const unsigned int lengths[] = {1, 7, 64, 300, 5000, 20000};
+	const unsigned int blockSizes[] = {2, 16, 64};
+	const ConvolverChannel::Type types[] = {ConvolverChannel::kFir, ConvolverChannel::kPartitioned, ConvolverChannel::kPartitionedInline};
+	for(auto len : lengths)
+	{
+		std::vector<float> ir(len);
+		for(auto& v : ir)
+			v = rand() / (float)RAND_MAX - 0.5f;
+		for(auto blockSize : blockSizes)
+		{
+			const unsigned int numFrames = std::max(4 * len, 40000u) / blockSize * blockSize;
+			std::vector<float> in(numFrames);
+			for(auto& v : in)
+				v = rand() / (float)RAND_MAX - 0.5f;
+			std::vector<double> expected(numFrames);
+			for(unsigned int n = 0; n < numFrames; ++n)
+				for(unsigned int k = 0; k < len && k <= n; ++k)
+					expected[n] += ir[k] * in[n - k];
+			for(auto type : types)
+			{
+				Convolver c;
+				assert(0 == c.setup({ir}, blockSize, type));
+				std::vector<float> out(numFrames);
+				for(unsigned int n = 0; n < numFrames; n += blockSize)
+					c.process(out.data() + n, in.data() + n, blockSize);
+				for(unsigned int n = 0; n < numFrames; ++n)
+				{
+					if(std::abs(out[n] - expected[n]) > 1e-4 * (1 + std::sqrt(len)))
+					{
+						fprintf(stderr, "error at n: %d, len: %d, blockSize: %d, type: %d, expected: %f, got: %f\n", n, len, blockSize, type, expected[n], out[n]);
+						assert(false);
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+bool ConvolverMatrixTest()
+{
+	// compare a 3x2 matrix against naive sums of convolutions
+	const unsigned int numInputs = 3;
+	const unsigned int numOutputs = 2;
+	const unsigned int blockSize = 32;
+	const unsigned int lengths[] = {3000, 100, 0, 2500, 1, 6000};
+	std::vector<std::vector<float>> irs;
+	for(auto len : lengths)
+	{
+		irs.emplace_back(len);
+		for(auto& v : irs.back())
+			v = rand() / (float)RAND_MAX - 0.5f;
+	}
+	const unsigned int numFrames = 20000;
+	std::vector<float> ins(numFrames * numInputs);
+	for(auto& v : ins)
+		v = rand() / (float)RAND_MAX - 0.5f;
+	std::vector<double> expected(numFrames * numOutputs);
+	for(unsigned int o = 0; o < numOutputs; ++o)
+		for(unsigned int i = 0; i < numInputs; ++i)
+		{
+			const std::vector<float>& ir = irs[o * numInputs + i];
+			for(unsigned int n = 0; n < numFrames; ++n)
+				for(unsigned int k = 0; k < ir.size() && k <= n; ++k)
+					expected[n * numOutputs + o] += ir[k] * ins[(n - k) * numInputs + i];
+		}
+	Convolver c;
+	assert(0 == c.setupMatrix(irs, numInputs, blockSize, ConvolverChannel::kPartitioned));
+	assert(numOutputs == c.getChannels());
+	assert(numInputs == c.getMatrixInputs());
+	std::vector<float> outs(numFrames * numOutputs);
+	// any multiple of blockSize can be passed at once
+	for(unsigned int n = 0, k = 0; n < numFrames; ++k)
+	{
+		unsigned int frames = std::min((k % 3 + 1) * blockSize, numFrames - n);
+		c.processInterleaved(outs.data() + n * numOutputs, ins.data() + n * numInputs, frames, numOutputs, numInputs);
+		n += frames;
+	}
+	for(unsigned int n = 0; n < outs.size(); ++n)
+	{
+		if(std::abs(outs[n] - expected[n]) > 1e-2)
+		{
+			fprintf(stderr, "error at n: %d, expected: %f, got: %f\n", n, expected[n], outs[n]);
+			assert(false);
+		}
+	}
+	// anything else is silenced
+	c.processInterleaved(outs.data(), ins.data(), blockSize + 1, numOutputs, numInputs);
+	for(unsigned int n = 0; n < (blockSize + 1) * numOutputs; ++n)
+		assert(0 == outs[n]);
+	return true;
+}
+
+static void writeIr(const char* path, float value, time_t mtime)
+{
+	FILE* f = fopen(path, "w");
+	assert(f);
+	auto w32 = [f](uint32_t v) { fwrite(&v, 4, 1, f); };
+	auto w16 = [f](uint16_t v) { fwrite(&v, 2, 1, f); };
+	fwrite("RIFF", 4, 1, f); w32(36 + 4); fwrite("WAVE", 4, 1, f);
+	fwrite("fmt ", 4, 1, f); w32(16); w16(3); w16(1);
+	w32(44100); w32(44100 * 4); w16(4); w16(32);
+	fwrite("data", 4, 1, f); w32(4);
+	fwrite(&value, 4, 1, f);
+	fclose(f);
+	struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+	utimensat(AT_FDCWD, path, times, 0);
+}
+
+bool ConvolverLoadTest()
+{
+	// the same file is loaded only once, unless it is modified
+	const char* path = "/tmp/ConvolverLoadTest.wav";
+	writeIr(path, 0.5, 1000);
+	std::shared_ptr<const ConvolverIrs> a = ConvolverIrs::load(path, 16, 0, false);
+	assert(a && 0.5 == a->firCoeffs[0][0]);
+	assert(a == ConvolverIrs::load(path, 16, 0, false));
+	// same size, different content and modification time
+	writeIr(path, 0.25, 2000);
+	std::shared_ptr<const ConvolverIrs> b = ConvolverIrs::load(path, 16, 0, false);
+	assert(b && b != a && 0.25 == b->firCoeffs[0][0]);
+	unlink(path);
+	return true;
+}
 #endif
@@ -2,25 +2,233 @@
 #define ENABLE_NE10_FIR_FLOAT_NEON // Define needed for Ne10 library
 #include <libraries/ne10/NE10.h> // neon library
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <pthread.h>
+#include <semaphore.h>
+
+/**
+ * A set of impulse responses, pre-processed for a given block size.
+ *
+ * Each impulse response is split into a direct-form FIR head and, if
+ * `partitioned`, a number of segments, each made of uniformly sized
+ * partitions whose spectra are computed here. Once set up, objects of
+ * this class are not modified, so they can be shared between any number
+ * of ConvolverChannel objects.
+ */
+class ConvolverIrs
+{
+public:
+	struct Segment {
+		unsigned int offset; ///< the first sample of the impulse responses covered by the segment
+		unsigned int partitionSize; ///< the size of each partition
+		unsigned int numPartitions; ///< the number of partitions in the segment
+		/**
+		 * The spectra of the partitions (`partitionSize + 1` bins each),
+		 * for each impulse response in turn.
+		 */
+		std::vector<ne10_fft_cpx_float32_t> spectra;
+	};
+	/**
+	 * @param irs the impulse responses.
+	 * @param blockSize the number of frames that will be passed to
+	 * ConvolverChannel::process()
+	 * @param partitioned whether to use FFT partitions. If this is
+	 * `false` or @p blockSize is not a power of two, the whole impulse
+	 * responses are computed as FIR filters.
+	 */
+	int setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize, bool partitioned);
+	/**
+	 * Load impulse responses from an audio file, one per channel. If the
+	 * same file has already been loaded with the same parameters and is
+	 * still in use, the same object is returned instead of loading it
+	 * again.
+	 *
+	 * If @p sampleRate is not 0 and the file has a different sample
+	 * rate, the impulse responses are converted to @p sampleRate, before
+	 * being truncated to @p maxLength.
+	 *
+	 * @return the impulse responses, or `nullptr` on error.
+	 */
+	static std::shared_ptr<const ConvolverIrs> load(const std::string& filename, unsigned int blockSize, unsigned int maxLength, bool partitioned, unsigned int sampleRate = 0);
+	unsigned int getNumIrs() const { return firCoeffs.size(); }
+	unsigned int blockSize;
+	/**
+	 * The coefficients of the FIR head of each impulse response, in
+	 * reverse order.
+	 */
+	std::vector<std::vector<ne10_float32_t>> firCoeffs;
+	std::vector<Segment> segments;
+};
+
+/**
+ * A uniformly-partitioned overlap-save convolution of one segment of a
+ * set of impulse responses, from one or more inputs to one or more
+ * outputs. This is used internally by ConvolverChannel.
+ *
+ * Every `partitionSize` input samples, the last `2 * partitionSize`
+ * samples of each input are transformed, multiplied in the frequency
+ * domain with the spectra of the partitions of each impulse response
+ * that connects that input to an output, and each output is transformed
+ * back. The segment starts at `2 * partitionSize - blockSize` samples
+ * into the impulse response, so that the result is not needed until
+ * `partitionSize` samples later and the computation can be spread across
+ * several blocks on a separate thread, while still adding no latency.
+ */
+class ConvolverSegment
+{
+public:
+	ConvolverSegment() {};
+	~ConvolverSegment() { cleanup(); };
+	/**
+	 * @param irs the impulse responses.
+	 * @param segment the index of the segment in @p irs
+	 * @param routing see ConvolverChannel::setup()
+	 * @param numInputs the number of inputs
+	 * @param priority the priority of the thread computing the segment,
+	 * or a negative value to compute it in the thread calling process().
+	 */
+	int setup(const ConvolverIrs& irs, unsigned int segment, const std::vector<std::vector<int>>& routing, unsigned int numInputs, int priority);
+	/**
+	 * Process a block of `blockSize` samples for each input, adding
+	 * the result to the outputs.
+	 */
+	void process(float* const* outs, const float* const* ins);
+	void cleanup();
+private:
+	struct Input {
+		std::vector<float> window;
+		std::vector<float> buffers[2];
+		std::vector<ne10_fft_cpx_float32_t> fdl; // frequency-domain delay line
+	};
+	struct Source {
+		unsigned int input;
+		const ne10_fft_cpx_float32_t* spectra;
+	};
+	struct Output {
+		std::vector<float> buffers[2];
+		std::vector<Source> sources;
+	};
+	void compute();
+	static void* threadLoop(void* arg);
+	std::vector<Input> inputs;
+	std::vector<Output> outputs;
+	std::vector<ne10_fft_cpx_float32_t> accumulator;
+	std::vector<float> fftIn;
+	std::vector<float> fftOut;
+	ne10_fft_r2c_cfg_float32_t cfg = nullptr;
+	unsigned int partitionSize;
+	unsigned int numPartitions;
+	unsigned int blockSize;
+	unsigned int fdlPos;
+	unsigned int fill;
+	unsigned int fillBuf;
+	unsigned int jobIn;
+	unsigned int jobOut;
+	unsigned int readBuf;
+	pthread_t thread;
+	sem_t start;
+	sem_t done;
+	bool threadStarted = false;
+	bool jobPending;
+	std::atomic<bool> shouldStop{false};
+};
 
+/**
+ * A zero-latency convolution engine, from one or more inputs to one or
+ * more outputs.
+ */
 class ConvolverChannel
 {
 public:
-	ConvolverChannel(const std::vector<float>& ir, unsigned int blockSize) {setup(ir, blockSize);};
-	int setup(const std::vector<float>& ir, unsigned int blockSize);
+	typedef enum {
+		kFir, ///< A single direct-form FIR filter, computed in the thread calling process().
+		kPartitioned, ///< A short direct-form FIR head followed by FFT partitions of increasing size, the larger of which are computed on background threads. Adds no latency.
+		kPartitionedInline, ///< Same as kPartitioned, but all the partitions are computed in the thread calling process(). Useful for offline processing.
+	} Type;
+	ConvolverChannel() {};
+	ConvolverChannel(const std::vector<float>& ir, unsigned int blockSize, Type type = kFir) {setup(ir, blockSize, type);};
+	~ConvolverChannel() { cleanup(); };
+	/**
+	 * Set up a single-input, single-output convolution.
+	 */
+	int setup(const std::vector<float>& ir, unsigned int blockSize, Type type = kFir);
+	/**
+	 * Set up a convolution from @p numInputs inputs to `routing.size()`
+	 * outputs.
+	 *
+	 * @param irs the impulse responses to use. These can be shared with
+	 * other objects.
+	 * @param routing `routing[o][i]` is the index in @p irs of the
+	 * impulse response that connects input `i` to output `o`, or a
+	 * negative value if they are not connected. The spectrum of each
+	 * input is computed only once, regardless of how many outputs it is
+	 * connected to.
+	 * @param numInputs the number of inputs
+	 * @param background whether the larger partitions should be computed
+	 * on background threads.
+	 */
+	int setup(std::shared_ptr<const ConvolverIrs> irs, const std::vector<std::vector<int>>& routing, unsigned int numInputs, bool background = true);
+	/**
+	 * Process a block of `blockSize` samples for a single-input,
+	 * single-output convolution.
+	 */
 	void process(ne10_float32_t* filterOut, const ne10_float32_t* filterIn);
+	/**
+	 * Process a block of `blockSize` samples for each of the inputs and
+	 * outputs.
+	 *
+	 * @param outs one non-interleaved buffer for each output
+	 * @param ins one non-interleaved buffer for each input
+	 */
+	void process(float* const* outs, const float* const* ins);
 	void cleanup();
+	unsigned int getNumInputs() const { return numInputs; }
+	unsigned int getNumOutputs() const { return numOutputs; }
+	/**
+	 * The largest partition size used by the partitioned convolution.
+	 */
+	static constexpr unsigned int kMaxPartitionSize = 4096;
 private:
-	ne10_fir_instance_f32_t firFilter;
+	struct Fir {
+		ne10_fir_instance_f32_t filter;
+		std::vector<ne10_float32_t> state;
+		unsigned int input;
+		unsigned int output;
+	};
+	std::shared_ptr<const ConvolverIrs> irs;
+	std::vector<Fir> firs;
+	std::vector<ne10_float32_t> firOut;
 	unsigned int blockSize;
-	ne10_float32_t* firFilterCoeff = nullptr;
-	ne10_float32_t* firFilterState = nullptr;
+	unsigned int numInputs = 0;
+	unsigned int numOutputs = 0;
+	std::vector<std::unique_ptr<ConvolverSegment>> segments;
 };
 
-#include <string>
 /**
  *
- * Convolve a monophonic input signal with one or more impulse responses.
+ * Convolve one or more input signals with one or more impulse responses.
+ *
+ * By default, the convolution is computed as a time-domain FIR filter.
+ * With ConvolverChannel::kPartitioned, it is instead split between a
+ * short FIR filter for the beginning of the impulse response and a
+ * non-uniformly partitioned FFT convolution for the rest of it, which
+ * makes long impulse responses (e.g.: reverbs) affordable without adding
+ * latency, at the cost of a few background threads for each channel. See
+ * ConvolverChannel::Type for the available options.
+ *
+ * The convolver works in one of two modes:
+ * - after setup(), each input channel is convolved with the impulse
+ *   response of the same index and written to the output channel of the
+ *   same index.
+ * - after setupMatrix(), each output channel is the sum of all the input
+ *   channels, each convolved with its own impulse response (e.g.: for
+ *   ambisonic decoders or room matrices).
+ *
+ * Impulse responses loaded from file are shared between all the
+ * Convolver objects that load the same file with the same parameters, as
+ * long as the file is not modified in the meantime.
  */
 class Convolver
 {
@@ -32,23 +240,61 @@ public:
 	 * channel in the audio file corresponds to a convolution channel.
 	 *
 	 * @param path to the audio file to use as an impulse response
-	 * @param blockSize the maximum number of frames passed to process...()
+	 * @param blockSize the number of frames passed to process...()
 	 * @param maxLength the max length of the impulse response. If @p
 	 * filename contains more than @p maxLength frames, it will be
 	 * truncated.
+	 * @param type the type of convolution to use. If @p blockSize is not
+	 * a power of two, ConvolverChannel::kFir is always used.
+	 * @param sampleRate the sample rate of the signal to be processed,
+	 * usually `context->audioSampleRate`. If the file has a different
+	 * sample rate, the impulse response is converted when loading it.
+	 * Pass 0 to use the file as it is.
 	 */
-	int setup(const std::string& filename, unsigned int blockSize, unsigned int maxLength = 0);
+	int setup(const std::string& filename, unsigned int blockSize, unsigned int maxLength = 0, ConvolverChannel::Type type = ConvolverChannel::kFir, unsigned int sampleRate = 0);
 	/**
 	 * Use this to set up a multi-channel impulse response from memory.
 	 *
 	 * @param irs a vector of vectors, each of which correponds to the
 	 * impulse response for one channel. The length of @p irs is the
 	 * maximum number of input channels to be passed to process...().
-	 * @param blockSize the maximum number of frames passed to process...()
+	 * @param blockSize the number of frames passed to process...()
+	 * @param type the type of convolution to use. If @p blockSize is not
+	 * a power of two, ConvolverChannel::kFir is always used.
+	 */
+	int setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize, ConvolverChannel::Type type = ConvolverChannel::kFir);
+	/**
+	 * Use this to load a matrix of impulse responses from an audio file.
+	 * The file has to contain `numInputs` channels for each output: the
+	 * impulse response from input `i` to output `o` is in channel
+	 * `o * numInputs + i`.
+	 *
+	 * @param filename the audio file
+	 * @param numInputs the number of inputs
+	 * @param blockSize the number of frames passed to processInterleaved()
+	 * @param maxLength the max length of the impulse responses, or 0 for
+	 * no limit.
+	 * @param type the type of convolution to use.
+	 * @param sampleRate the sample rate to convert the file to, or 0.
+	 * See setup().
+	 */
+	int setupMatrix(const std::string& filename, unsigned int numInputs, unsigned int blockSize, unsigned int maxLength = 0, ConvolverChannel::Type type = ConvolverChannel::kFir, unsigned int sampleRate = 0);
+	/**
+	 * Use this to set up a matrix of impulse responses from memory.
+	 *
+	 * @param irs the impulse responses. The impulse response from input
+	 * `i` to output `o` is `irs[o * numInputs + i]`.
+	 * @param numInputs the number of inputs
+	 * @param blockSize the number of frames passed to processInterleaved()
+	 * @param type the type of convolution to use. With
+	 * ConvolverChannel::kPartitioned, the whole matrix shares one
+	 * background thread per segment, regardless of the number of inputs
+	 * and outputs.
 	 */
-	int setup(const std::vector<std::vector<float>>& irs, unsigned int blockSize);
+	int setupMatrix(const std::vector<std::vector<float>>& irs, unsigned int numInputs, unsigned int blockSize, ConvolverChannel::Type type = ConvolverChannel::kFir);
 	/**
-	 * Process a block of samples through the specified convolution channel.
+	 * Process a block of samples through the specified convolution
+	 * channel. This does nothing after setupMatrix().
 	 *
 	 * @param out pointer to the output buffer.
 	 * @param in pointer to the input buffer.
@@ -57,25 +303,43 @@ public:
 	 */
 	void process(float* out, const float* in, unsigned int frames, unsigned int channel = 0);
 	/**
-	 * Process a block of interleaved samples. Each input channel is
-	 * processed through the convolver channels, and the output of each
-	 * convolution is written into the respective channel of @p out.
+	 * Process a block of interleaved samples. After setup(), each input
+	 * channel is processed through the convolver channels, and the output
+	 * of each convolution is written into the respective channel of @p
+	 * out. After setupMatrix(), each channel of @p out receives the sum
+	 * of all the inputs convolved with the respective impulse responses.
 	 *
 	 * @param out pointer to the output buffer.
 	 * @param in pointer to the input buffer.
-	 * @param frames the number of frames to process.
+	 * @param frames the number of frames to process. After setupMatrix(),
+	 * this has to be a multiple of its `blockSize`: otherwise, @p out is
+	 * filled with silence.
 	 * @param outChannels the number of channels in @p out.
 	 * @param inChannels the number of input channels in @p in.
 	 */
 	void processInterleaved(float* out, const float* in, unsigned int frames, unsigned int outChannels, unsigned int inChannels);
 	void cleanup();
 	/**
-	 * Return the number of channels in the convolver.
+	 * Return the number of channels in the convolver. After
+	 * setupMatrix(), this is the number of outputs.
+	 */
+	unsigned int getChannels() { return matrix ? matrix->getNumOutputs() : convolverChannels.size(); }
+	/**
+	 * Return the number of inputs of the convolution matrix, or 0 if
+	 * not set up with setupMatrix().
 	 */
-	unsigned int getChannels() { return convolverChannels.size(); }
+	unsigned int getMatrixInputs() { return matrix ? matrix->getNumInputs() : 0; }
 private:
+	int setupChannels(std::shared_ptr<const ConvolverIrs> irs, ConvolverChannel::Type type);
+	int setupMatrix(std::shared_ptr<const ConvolverIrs> irs, unsigned int numInputs, ConvolverChannel::Type type);
 	void doProcessInterleaved(float* out, const float* in, unsigned int frames, unsigned int outChannels, unsigned int inChannels, unsigned int channel);
-	std::vector<ConvolverChannel> convolverChannels;
+	std::vector<std::unique_ptr<ConvolverChannel>> convolverChannels;
+	std::unique_ptr<ConvolverChannel> matrix;
+	std::vector<float> matrixIn;
+	std::vector<float> matrixOut;
+	std::vector<float*> matrixInPtrs;
+	std::vector<float*> matrixOutPtrs;
+	unsigned int matrixBlockSize = 0;
 	ne10_float32_t* filterIn = nullptr;
 	ne10_float32_t* filterOut = nullptr;
 };
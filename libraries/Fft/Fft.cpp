@@ -1,4 +1,129 @@
 #include "Fft.h"
+#include <string.h>
+#include <map>
+#include <mutex>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FFT_SIMD
+typedef float32x4_t v4f;
+typedef uint32x4_t v4m;
+static inline v4f vLoad(const float* p) { return vld1q_f32(p); }
+static inline void vStore(float* p, v4f v) { vst1q_f32(p, v); }
+// load 4 bins, separating real and imaginary parts
+static inline void vLoadCpx(const ne10_fft_cpx_float32_t* p, v4f& re, v4f& im)
+{
+	float32x4x2_t v = vld2q_f32((const float*)p);
+	re = v.val[0];
+	im = v.val[1];
+}
+static inline v4f vSet(float f) { return vdupq_n_f32(f); }
+static inline v4f vAdd(v4f a, v4f b) { return vaddq_f32(a, b); }
+static inline v4f vSub(v4f a, v4f b) { return vsubq_f32(a, b); }
+static inline v4f vMul(v4f a, v4f b) { return vmulq_f32(a, b); }
+static inline v4f vMin(v4f a, v4f b) { return vminq_f32(a, b); }
+static inline v4f vMax(v4f a, v4f b) { return vmaxq_f32(a, b); }
+static inline v4f vAbs(v4f a) { return vabsq_f32(a); }
+static inline v4m vGreater(v4f a, v4f b) { return vcgtq_f32(a, b); }
+static inline v4m vLess(v4f a, v4f b) { return vcltq_f32(a, b); }
+// mask ? a : b
+static inline v4f vSelect(v4m mask, v4f a, v4f b) { return vbslq_f32(mask, a, b); }
+static inline v4f vDiv(v4f a, v4f b)
+{
+	// reciprocal estimate refined with two Newton-Raphson steps
+	v4f r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+}
+static inline v4f vSqrt(v4f a)
+{
+	// reciprocal square root estimate refined with two Newton-Raphson
+	// steps, then sqrt(a) = a / sqrt(a). Zeroes are handled separately,
+	// as their estimate is infinite.
+	v4f r = vrsqrteq_f32(a);
+	r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+	r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+	return vSelect(vGreater(a, vSet(0)), vmulq_f32(a, r), vSet(0));
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FFT_SIMD
+typedef __m128 v4f;
+typedef __m128 v4m;
+static inline v4f vLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void vStore(float* p, v4f v) { _mm_storeu_ps(p, v); }
+static inline void vLoadCpx(const ne10_fft_cpx_float32_t* p, v4f& re, v4f& im)
+{
+	v4f a = _mm_loadu_ps((const float*)p);
+	v4f b = _mm_loadu_ps((const float*)p + 4);
+	re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+static inline v4f vSet(float f) { return _mm_set1_ps(f); }
+static inline v4f vAdd(v4f a, v4f b) { return _mm_add_ps(a, b); }
+static inline v4f vSub(v4f a, v4f b) { return _mm_sub_ps(a, b); }
+static inline v4f vMul(v4f a, v4f b) { return _mm_mul_ps(a, b); }
+static inline v4f vMin(v4f a, v4f b) { return _mm_min_ps(a, b); }
+static inline v4f vMax(v4f a, v4f b) { return _mm_max_ps(a, b); }
+static inline v4f vAbs(v4f a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+static inline v4m vGreater(v4f a, v4f b) { return _mm_cmpgt_ps(a, b); }
+static inline v4m vLess(v4f a, v4f b) { return _mm_cmplt_ps(a, b); }
+static inline v4f vSelect(v4m mask, v4f a, v4f b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline v4f vDiv(v4f a, v4f b) { return _mm_div_ps(a, b); }
+static inline v4f vSqrt(v4f a) { return _mm_sqrt_ps(a); }
+#endif
+
+#ifdef FFT_SIMD
+static inline v4f vAtan2(v4f y, v4f x)
+{
+	// reduce to the first octant, where atan() is approximated with a
+	// minimax polynomial, then map the result back
+	v4f ax = vAbs(x);
+	v4f ay = vAbs(y);
+	v4f num = vMin(ax, ay);
+	v4f den = vMax(vMax(ax, ay), vSet(1e-30f));
+	v4f a = vDiv(num, den);
+	v4f s = vMul(a, a);
+	v4f p = vSet(-0.0117212f);
+	p = vAdd(vMul(p, s), vSet(0.05265332f));
+	p = vAdd(vMul(p, s), vSet(-0.11643287f));
+	p = vAdd(vMul(p, s), vSet(0.19354346f));
+	p = vAdd(vMul(p, s), vSet(-0.33262347f));
+	p = vAdd(vMul(p, s), vSet(0.99997726f));
+	v4f r = vMul(p, a);
+	r = vSelect(vGreater(ay, ax), vSub(vSet(M_PI_2), r), r);
+	r = vSelect(vLess(x, vSet(0)), vSub(vSet(M_PI), r), r);
+	r = vSelect(vLess(y, vSet(0)), vSub(vSet(0), r), r);
+	return r;
+}
+#endif // FFT_SIMD
+
+// The twiddle factors and factorisation for a given length. The scratch
+// buffer in cfg is not used, as each Fft object has its own.
+struct Fft::Plan {
+	ne10_fft_r2c_cfg_float32_t cfg = nullptr;
+	~Plan() { ne10_fft_destroy_r2c_float32(cfg); }
+};
+
+std::shared_ptr<Fft::Plan> Fft::getPlan(unsigned int length)
+{
+	// plans are never released, so that repeatedly setting up an Fft of
+	// the same length doesn't repeatedly compute the twiddles.
+	static std::mutex mutex;
+	static std::map<unsigned int, std::shared_ptr<Plan>> plans;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Plan>& plan = plans[length];
+	if(!plan)
+	{
+		std::shared_ptr<Plan> newPlan = std::make_shared<Plan>();
+		newPlan->cfg = ne10_fft_alloc_r2c_float32(length);
+		if(!newPlan->cfg)
+			return nullptr;
+		plan = newPlan;
+	}
+	return plan;
+}
 
 unsigned int Fft::roundUpToPowerOfTwo(unsigned int n)
 {
@@ -34,12 +159,16 @@ int Fft::setup(unsigned int length)
 	this->length = length;
 	timeDomain = (ne10_float32_t*) NE10_MALLOC (length * sizeof (ne10_float32_t));
 	frequencyDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (length * sizeof (ne10_fft_cpx_float32_t));
-	cfg = ne10_fft_alloc_r2c_float32 (length);
-	if(!cfg || !timeDomain || !frequencyDomain)
+	// Ne10 uses up to `length` complex values of scratch memory
+	scratch = (ne10_fft_cpx_float32_t*) NE10_MALLOC (length * sizeof (ne10_fft_cpx_float32_t));
+	plan = getPlan(length);
+	if(!plan || !timeDomain || !frequencyDomain || !scratch)
 	{
 		cleanup();
 		return -1;
 	}
+	state = *plan->cfg;
+	state.buffer = scratch;
 	return 0;
 }
 
@@ -49,16 +178,16 @@ void Fft::cleanup()
 	timeDomain = nullptr;
 	NE10_FREE(frequencyDomain);
 	frequencyDomain = nullptr;
-	ne10_fft_destroy_r2c_float32(cfg);
-	cfg = nullptr;
+	NE10_FREE(scratch);
+	scratch = nullptr;
+	plan = nullptr;
 }
 
 void Fft::fft()
 {
-	ne10_fft_r2c_1d_float32_neon(frequencyDomain, timeDomain, cfg);
+	ne10_fft_r2c_1d_float32_neon(frequencyDomain, timeDomain, &state);
 }
 
-#include <string.h>
 void Fft::fft(const std::vector<float>& input)
 {
 	if(input.size() != length)
@@ -67,9 +196,17 @@ void Fft::fft(const std::vector<float>& input)
 	fft();
 }
 
+void Fft::fft(ne10_fft_cpx_float32_t* out, const float* in, unsigned int count)
+{
+	const unsigned int numBins = getNumBins();
+	// Ne10 doesn't modify the input
+	for(unsigned int n = 0; n < count; ++n)
+		ne10_fft_r2c_1d_float32_neon(out + n * numBins, (ne10_float32_t*)in + n * length, &state);
+}
+
 void Fft::ifft()
 {
-	ne10_fft_c2r_1d_float32_neon(timeDomain, frequencyDomain, cfg);
+	ne10_fft_c2r_1d_float32_neon(timeDomain, frequencyDomain, &state);
 }
 
 void Fft::ifft(const std::vector<float>& reInput, const std::vector<float>& imInput)
@@ -83,12 +220,103 @@ void Fft::ifft(const std::vector<float>& reInput, const std::vector<float>& imIn
 	ifft();
 }
 
+void Fft::ifft(float* out, const ne10_fft_cpx_float32_t* in, unsigned int count)
+{
+	const unsigned int numBins = getNumBins();
+	// Ne10 doesn't modify the input
+	for(unsigned int n = 0; n < count; ++n)
+		ne10_fft_c2r_1d_float32_neon(out + n * length, (ne10_fft_cpx_float32_t*)in + n * numBins, &state);
+}
+
+void Fft::makeWindow(float* out, unsigned int length, WindowType type, bool periodic)
+{
+	if(!length)
+		return;
+	double den = periodic ? length : length - 1;
+	if(!den)
+		den = 1;
+	for(unsigned int n = 0; n < length; ++n)
+	{
+		double ph = 2 * M_PI * n / den;
+		switch(type)
+		{
+		case kHann:
+			out[n] = 0.5 - 0.5 * cos(ph);
+			break;
+		case kBlackman:
+			out[n] = 0.42 - 0.5 * cos(ph) + 0.08 * cos(2 * ph);
+			break;
+		case kRectangular:
+		default:
+			out[n] = 1;
+			break;
+		}
+	}
+}
+
+void Fft::applyWindow(float* out, const float* in, const float* window, unsigned int length)
+{
+	unsigned int n = 0;
+#ifdef FFT_SIMD
+	for(; n + 4 <= length; n += 4)
+		vStore(out + n, vMul(vLoad(in + n), vLoad(window + n)));
+#endif // FFT_SIMD
+	for(; n < length; ++n)
+		out[n] = in[n] * window[n];
+}
+
+void Fft::magnitude(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins)
+{
+	unsigned int n = 0;
+#ifdef FFT_SIMD
+	for(; n + 4 <= numBins; n += 4)
+	{
+		v4f re, im;
+		vLoadCpx(in + n, re, im);
+		vStore(out + n, vSqrt(vAdd(vMul(re, re), vMul(im, im))));
+	}
+#endif // FFT_SIMD
+	for(; n < numBins; ++n)
+		out[n] = sqrtf(in[n].r * in[n].r + in[n].i * in[n].i);
+}
+
+void Fft::phase(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins)
+{
+	unsigned int n = 0;
+#ifdef FFT_SIMD
+	for(; n + 4 <= numBins; n += 4)
+	{
+		v4f re, im;
+		vLoadCpx(in + n, re, im);
+		vStore(out + n, vAtan2(im, re));
+	}
+#endif // FFT_SIMD
+	for(; n < numBins; ++n)
+		out[n] = atan2f(in[n].i, in[n].r);
+}
+
+void Fft::power(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins)
+{
+	unsigned int n = 0;
+#ifdef FFT_SIMD
+	for(; n + 4 <= numBins; n += 4)
+	{
+		v4f re, im;
+		vLoadCpx(in + n, re, im);
+		vStore(out + n, vAdd(vMul(re, re), vMul(im, im)));
+	}
+#endif // FFT_SIMD
+	for(; n < numBins; ++n)
+		out[n] = in[n].r * in[n].r + in[n].i * in[n].i;
+}
+
 #if 0
 #include <stdio.h>
 #include <array>
 #undef NDEBUG
 #include <assert.h>
 #include <cmath>
+#include <stdlib.h>
 #define ALMOST_EQUAL(a,b) (abs(a-b)<0.00001)
 bool FftTest()
 {
@@ -151,4 +379,71 @@ bool FftTest()
 	printf("FftTest successful\n");
 	return true;
 }
+bool FftKernelsTest()
+{
+	const unsigned int length = 1024;
+	const unsigned int count = 3;
+	Fft a(length);
+	Fft b(length);
+	std::vector<float> in(length * count);
+	for(auto& v : in)
+		v = rand() / (float)RAND_MAX - 0.5f;
+	// the batched transform matches individual ones
+	std::vector<ne10_fft_cpx_float32_t> spectra(a.getNumBins() * count);
+	a.fft(spectra.data(), in.data(), count);
+	for(unsigned int c = 0; c < count; ++c)
+	{
+		memcpy(b.getTimeDomain(), in.data() + c * length, length * sizeof(in[0]));
+		b.fft();
+		for(unsigned int n = 0; n < b.getNumBins(); ++n)
+		{
+			assert(spectra[c * b.getNumBins() + n].r == b.fdr(n));
+			assert(spectra[c * b.getNumBins() + n].i == b.fdi(n));
+		}
+	}
+	std::vector<float> out(length * count);
+	a.ifft(out.data(), spectra.data(), count);
+	for(unsigned int n = 0; n < out.size(); ++n)
+		assert(ALMOST_EQUAL(out[n], in[n]));
+	// add some values on the axes and zeros
+	spectra[0] = {0, 0};
+	spectra[1] = {-1, 0};
+	spectra[2] = {0, -1};
+	spectra[3] = {0, 1};
+	spectra[4] = {1, 0};
+	std::vector<float> mag(spectra.size());
+	std::vector<float> ph(spectra.size());
+	std::vector<float> pow(spectra.size());
+	Fft::magnitude(mag.data(), spectra.data(), spectra.size());
+	Fft::phase(ph.data(), spectra.data(), spectra.size());
+	Fft::power(pow.data(), spectra.data(), spectra.size());
+	for(unsigned int n = 0; n < spectra.size(); ++n)
+	{
+		float re = spectra[n].r;
+		float im = spectra[n].i;
+		float m = sqrtf(re * re + im * im);
+		assert(std::abs(mag[n] - m) <= 1e-5 * (1 + m));
+		assert(std::abs(pow[n] - m * m) <= 1e-5 * (1 + m * m));
+		assert(std::abs(ph[n] - atan2f(im, re)) < 1e-4);
+	}
+	// windows
+	std::vector<float> window(length + 1);
+	std::vector<float> windowed(length + 1);
+	Fft::makeWindow(window.data(), window.size(), Fft::kHann);
+	assert(ALMOST_EQUAL(window[0], 0));
+	assert(ALMOST_EQUAL(window[length / 2], 1));
+	assert(ALMOST_EQUAL(window[length], 0));
+	Fft::makeWindow(window.data(), length, Fft::kHann, true);
+	// a periodic Hann window overlapped by half its length adds up to 1
+	for(unsigned int n = 0; n < length / 2; ++n)
+		assert(ALMOST_EQUAL(window[n] + window[n + length / 2], 1));
+	Fft::makeWindow(window.data(), window.size(), Fft::kBlackman);
+	assert(ALMOST_EQUAL(window[0], 0));
+	assert(ALMOST_EQUAL(window[length / 2], 1));
+	Fft::applyWindow(windowed.data(), in.data(), window.data(), windowed.size());
+	for(unsigned int n = 0; n < windowed.size(); ++n)
+		assert(windowed[n] == in[n] * window[n]);
+	printf("FftKernelsTest successful\n");
+	return true;
+}
 #endif
@@ -1,16 +1,32 @@
 #pragma once
 #include <libraries/ne10/NE10.h>
 #include <vector>
+#include <memory>
 #include <cmath>
 #include <libraries/math_neon/math_neon.h>
 
 /**
  * A real-to-complex FFT and complex-to-real IFFT. This is a wrapper for the libne10 FFT.
+ *
+ * The twiddle factors for each FFT length are computed only once per
+ * process and shared between all the Fft objects of that length, so
+ * calling setup() for a length that is already in use is cheap.
+ * Each object has its own scratch and I/O buffers, so different objects
+ * can be used concurrently from different threads.
+ *
+ * The static methods provide vectorised helpers to window the input and
+ * to compute magnitude, phase and power spectra into caller-provided
+ * buffers, so that callers don't need to loop over individual bins.
 */
 
 class Fft
 {
 public:
+	typedef enum {
+		kRectangular, ///< All ones
+		kHann, ///< Raised cosine
+		kBlackman, ///< Three-term Blackman
+	} WindowType;
 	Fft(){};
 	Fft(unsigned int length){ setup(length); };
 	~Fft(){ cleanup(); };
@@ -24,6 +40,16 @@ public:
 	 * Perform the FFT of the signal whose time-domain representation is passed as an argument.
 	 */
 	void fft(const std::vector<float>& input);
+	/**
+	 * Perform the FFT of @p count signals in one call.
+	 *
+	 * @param out `count * getNumBins()` bins: the spectrum of each signal
+	 * follows that of the previous one.
+	 * @param in `count * getLength()` samples: each signal follows the
+	 * previous one.
+	 * @param count the number of signals to transform.
+	 */
+	void fft(ne10_fft_cpx_float32_t* out, const float* in, unsigned int count = 1);
 	/**
 	 * Perform the IFFT of the internal frequency-domain signal.
 	 */
@@ -33,6 +59,16 @@ public:
 	 * is passed as arguments.
 	 */
 	void ifft(const std::vector<float>& reInput, const std::vector<float>& imInput);
+	/**
+	 * Perform the IFFT of @p count spectra in one call.
+	 *
+	 * @param out `count * getLength()` samples, laid out as the `in`
+	 * argument of fft(ne10_fft_cpx_float32_t*, const float*, unsigned int).
+	 * @param in `count * getNumBins()` bins, laid out as the `out`
+	 * argument of fft(ne10_fft_cpx_float32_t*, const float*, unsigned int).
+	 * @param count the number of spectra to transform.
+	 */
+	void ifft(float* out, const ne10_fft_cpx_float32_t* in, unsigned int count = 1);
 	/**
 	 * Get the real part of the frequency-domain representation at index `n`.
 	 */
@@ -44,17 +80,68 @@ public:
 	/**
 	 * Get the absolute value of the frequency-domain representation at index `n`.
 	 * The value is computed on the fly at each call and is not cached.
+	 * Use magnitude() to compute the whole spectrum at once.
 	 */
 	float fda(unsigned int n) { return sqrtf_neon(fdr(n) * fdr(n) + fdi(n) * fdi(n)); };
 	/**
 	 * Get the time-domain representation at index `n`.
 	 */
 	float& td(unsigned int n) { return timeDomain[n]; };
+	/**
+	 * Get the internal time-domain buffer (getLength() samples).
+	 */
+	float* getTimeDomain() { return timeDomain; };
+	/**
+	 * Get the internal frequency-domain buffer (getNumBins() bins).
+	 */
+	ne10_fft_cpx_float32_t* getFrequencyDomain() { return frequencyDomain; };
+	/**
+	 * Get the length of the FFT.
+	 */
+	unsigned int getLength() { return length; };
+	/**
+	 * Get the number of non-redundant bins in the spectrum, i.e.:
+	 * `getLength() / 2 + 1`.
+	 */
+	unsigned int getNumBins() { return length / 2 + 1; };
 	static bool isPowerOfTwo(unsigned int n);
 	static unsigned int roundUpToPowerOfTwo(unsigned int n);
+	/**
+	 * Compute a window.
+	 *
+	 * @param out the buffer to write @p length samples to.
+	 * @param length the length of the window.
+	 * @param type the type of window.
+	 * @param periodic if `true`, compute a periodic window (i.e.: one
+	 * suitable for overlap-add) instead of a symmetric one.
+	 */
+	static void makeWindow(float* out, unsigned int length, WindowType type, bool periodic = false);
+	/**
+	 * Multiply @p length samples of @p in by @p window. @p out can be
+	 * the same as @p in.
+	 */
+	static void applyWindow(float* out, const float* in, const float* window, unsigned int length);
+	/**
+	 * Compute the magnitude of @p numBins bins.
+	 */
+	static void magnitude(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins);
+	/**
+	 * Compute the phase of @p numBins bins, in the -pi to pi range.
+	 * This is accurate to about 1e-5 radians.
+	 */
+	static void phase(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins);
+	/**
+	 * Compute the power (squared magnitude) of @p numBins bins.
+	 */
+	static void power(float* out, const ne10_fft_cpx_float32_t* in, unsigned int numBins);
 private:
+	struct Plan;
+	static std::shared_ptr<Plan> getPlan(unsigned int length);
+	std::shared_ptr<Plan> plan;
+	// a copy of the shared configuration, pointing to our own scratch buffer
+	ne10_fft_r2c_state_float32_t state;
+	ne10_fft_cpx_float32_t* scratch = nullptr;
 	ne10_float32_t* timeDomain = nullptr;
 	ne10_fft_cpx_float32_t* frequencyDomain = nullptr;
-	ne10_fft_r2c_cfg_float32_t cfg = nullptr;
-	unsigned int length;
+	unsigned int length = 0;
 };
@@ -25,6 +25,9 @@ int Gui::setup(unsigned int port, std::string address)
 			ws_onData((const char*) buf, size);
 		},
 	 nullptr, nullptr, true);
+	// several buffers sent in the same block can go in one message, as
+	// each of them has a header
+	ws_server->setCoalescing(_addressData, true);
 
 	ws_server->addAddress(_addressControl,
 		// onData()
@@ -48,7 +51,7 @@ int Gui::setup(unsigned int port, std::string address)
 
 int Gui::setup(std::string projectName, unsigned int port, std::string address)
 {
-	_projectName = std::wstring(projectName.begin(), projectName.end());
+	_projectName = projectName;
 	setup(port, address);
 	return 0;
 }
@@ -61,16 +64,16 @@ int Gui::setup(std::string projectName, unsigned int port, std::string address)
 void Gui::ws_connect()
 {
 	// send connection JSON
-	JSONObject root;
-	root[L"event"] = new JSONValue(L"connection");
+	JSONWriter json;
+	json.beginObject();
+	json.key("event").value("connection");
 	if(!_projectName.empty())
-		root[L"projectName"] = new JSONValue(_projectName);
+		json.key("projectName").value(_projectName);
 
 	// Parse whatever needs to be parsed on connection
 
-	JSONValue *value = new JSONValue(root);
-	sendControl(value);
-	delete value;
+	json.endObject();
+	sendControl(json);
 }
 
 /*
@@ -88,26 +91,30 @@ void Gui::ws_disconnect()
  */
 void Gui::ws_onControlData(const char* data, unsigned int size)
 {
-	// parse the data into a JSONValue
-	JSONValue *value = JSON::Parse(data);
-	if (value == NULL || !value->IsObject()){
+	// parse the data into controlDocument, reusing its memory
+	if(!controlDocument.parse(data, size) || !controlDocument.getRoot().isObject()){
 		fprintf(stderr, "Could not parse JSON:\n%s\n", data);
 		return;
 	}
-	// look for the "event" key
-	JSONObject root = value->AsObject();
+	JSONDocument::Value root = controlDocument.getRoot();
 	if(customOnControlData && !customOnControlData(root, controlCallbackArg))
-	{
-		delete value;
 		return;
+	if(customOnControlDataLegacy)
+	{
+		JSONValue *value = JSON::Parse(data);
+		if(value && value->IsObject())
+		{
+			JSONObject object = value->AsObject();
+			bool ret = customOnControlDataLegacy(object, controlCallbackArg);
+			delete value;
+			if(!ret)
+				return;
+		} else
+			delete value;
 	}
-	if (root.find(L"event") != root.end() && root[L"event"]->IsString()){
-		std::wstring event = root[L"event"]->AsString();
-		if (event.compare(L"connection-reply") == 0){
-			wsIsConnected = true;
-		}
-	}
-	delete value;
+	// look for the "event" key
+	if(root["event"].equals("connection-reply"))
+		wsIsConnected = true;
 	return;
 }
 
@@ -181,13 +188,18 @@ int Gui::sendControl(JSONValue* root) {
     return ws_server->sendNonRt(_addressControl.c_str(), str.c_str());
 }
 
+int Gui::sendControl(const JSONWriter& json) {
+	return ws_server->sendNonRt(_addressControl.c_str(), json.c_str());
+}
+
 int Gui::doSendBuffer(const char* type, unsigned int bufferId, const void* data, size_t size)
 {
-	std::string idTypeStr = std::to_string(bufferId) + "/" + std::string(type);
+	// header: id, type, size of the payload in bytes and a reserved field.
+	// The payload is padded to a multiple of 8 bytes by ws_server
+	uint32_t header[4] = {bufferId, (uint32_t)type[0], (uint32_t)size, 0};
 	int ret;
-	if(0 == (ret = ws_server->sendRt(_addressData.c_str(), idTypeStr.c_str())))
-                    if(0 == (ret = ws_server->sendRt(_addressData.c_str(), (void*)data, size)))
-                            return 0;
+	if(0 == (ret = ws_server->sendRt(_addressData.c_str(), header, sizeof(header), data, size)))
+		return 0;
 	rt_fprintf(stderr, "You are sending messages to the GUI too fast. Please slow down\n");
 	return ret;
 }
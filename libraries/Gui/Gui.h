@@ -4,6 +4,8 @@
 #include <string>
 #include <functional>
 #include <JSON.h>
+#include <JSONDocument.h>
+#include <JSONWriter.h>
 #include <typeinfo> // for types in templates
 #include <memory>
 #include <DataBuffer.h>
@@ -29,10 +31,13 @@ class Gui
 		unsigned int _port;
 		std::string _addressControl;
 		std::string _addressData;
-		std::wstring _projectName;
+		std::string _projectName;
+		JSONDocument controlDocument;
 
 		// User defined functions
-		std::function<bool(JSONObject&, void*)> customOnControlData;
+		std::function<bool(const JSONDocument::Value&, void*)> customOnControlData;
+		// for callbacks that use the legacy JSONObject
+		std::function<bool(JSONObject&, void*)> customOnControlDataLegacy;
 		std::function<bool(const char*, unsigned int, void*)> customOnData;
 
 		void* controlCallbackArg = nullptr;
@@ -77,8 +82,10 @@ class Gui
 		 *
 		 * @param callback Callback to be called whenever new control
 		 * data is received.
-		 * The callback takes a JSONObject, and an opaque pointer, which is
-		 * passed at the moment of registering the callback.
+		 * The callback takes the root of the parsed JSON document, and an
+		 * opaque pointer, which is passed at the moment of registering the
+		 * callback. The document is only valid for the duration of the
+		 * callback.
 		 * The callback should return `true` if the default callback should
 		 * be called afterward or `false` otherwise.
 		 *
@@ -87,8 +94,18 @@ class Gui
 		 * @param callbackArg an opaque pointer that will be passed to the
 		 * callback
 		 **/
-		void setControlDataCallback(std::function<bool(JSONObject&, void*)> callback, void* callbackArg=nullptr){
+		void setControlDataCallback(std::function<bool(const JSONDocument::Value&, void*)> callback, void* callbackArg=nullptr){
 			customOnControlData = callback;
+			customOnControlDataLegacy = nullptr;
+			controlCallbackArg = callbackArg;
+		};
+		/**
+		 * Same as above, for callbacks that take a JSONObject. This is
+		 * slower, as each message is parsed again into a JSONObject.
+		 **/
+		void setControlDataCallback(std::function<bool(JSONObject&, void*)> callback, void* callbackArg=nullptr){
+			customOnControlDataLegacy = callback;
+			customOnControlData = nullptr;
 			controlCallbackArg = callbackArg;
 		};
 
@@ -115,6 +132,10 @@ class Gui
 		 * @returns 0 on success, or an error code otherwise.
 		 * */
 		int sendControl(JSONValue* root);
+		/** Sends the JSON text in @p json to the control websocket.
+		 * @returns 0 on success, or an error code otherwise.
+		 * */
+		int sendControl(const JSONWriter& json);
 
 		/**
 		 * Sends a buffer (a vector) through the web-socket to the client with a given ID.
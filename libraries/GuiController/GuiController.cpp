@@ -1,5 +1,15 @@
 #include "GuiController.h"
 #include <iostream>
+#include <JSONWriter.h>
+
+// reused across calls from the same thread, so that sending doesn't
+// allocate once the buffer is large enough
+static JSONWriter& getWriter()
+{
+	static thread_local JSONWriter writer;
+	writer.clear();
+	return writer;
+}
 
 GuiController::GuiController()
 {
@@ -14,7 +24,6 @@ int GuiController::setup(Gui* gui, std::string name)
 {
 	_gui = gui;
 	_name = name;
-	_wname = std::wstring(name.begin(), name.end());
 	_gui->setControlDataCallback(controlCallback, this);
 	int ret = sendController();
 	return ret;
@@ -22,11 +31,12 @@ int GuiController::setup(Gui* gui, std::string name)
 
 int GuiController::sendController()
 {
-	JSONObject root;
-	root[L"event"] = new JSONValue(L"set-controller");
-	root[L"name"] = new JSONValue(_wname);
-	JSONValue json(root);
-	return _gui->sendControl(&json);
+	JSONWriter& json = getWriter();
+	json.beginObject();
+	json.key("event").value("set-controller");
+	json.key("name").value(_name);
+	json.endObject();
+	return _gui->sendControl(json);
 }
 
 void GuiController::cleanup()
@@ -38,13 +48,13 @@ GuiController::~GuiController()
 	cleanup();
 }
 
-bool GuiController::controlCallback(JSONObject &root, void* param)
+bool GuiController::controlCallback(const JSONDocument::Value& root, void* param)
 {
 	GuiController* controller = (GuiController*)param;
-	if (root.find(L"event") != root.end() && root[L"event"]->IsString())
+	JSONDocument::Value event = root["event"];
+	if (event.isString())
 	{
-		std::wstring event = root[L"event"]->AsString();
-		if (event.compare(L"connection-reply") == 0)
+		if (event.equals("connection-reply"))
 		{
 			controller->sendController();
 			if(controller->getNumSliders() != 0)
@@ -53,15 +63,15 @@ bool GuiController::controlCallback(JSONObject &root, void* param)
 					controller->sendSlider(slider);
 			}
 		}
-		else if (event.compare(L"slider") == 0)
+		else if (event.equals("slider"))
 		{
 			int sliderIndex = -1;
 			float sliderValue = 0.0f;
-			if (root.find(L"slider") != root.end() && root[L"slider"]->IsNumber())
-				sliderIndex = (int)root[L"slider"]->AsNumber();
-			if (root.find(L"value") != root.end() && root[L"value"]->IsNumber())
+			if (root["slider"].isNumber())
+				sliderIndex = (int)root["slider"].asNumber();
+			if (root["value"].isNumber())
 			{
-				sliderValue = (float)root[L"value"]->AsNumber();
+				sliderValue = (float)root["value"].asNumber();
 				controller->_sliders.at(sliderIndex).setValue(sliderValue);
 			}
 		}
@@ -72,24 +82,27 @@ bool GuiController::controlCallback(JSONObject &root, void* param)
 
 int GuiController::sendSlider(const GuiSlider& slider)
 {
-	JSONObject root = slider.getParametersAsJSON();
-	root[L"event"] = new JSONValue(L"set-slider");
-	root[L"controller"] = new JSONValue(_wname);
-	JSONValue json(root);
-	return _gui->sendControl(&json);
+	JSONWriter& json = getWriter();
+	json.beginObject();
+	slider.writeParameters(json);
+	json.key("event").value("set-slider");
+	json.key("controller").value(_name);
+	json.endObject();
+	return _gui->sendControl(json);
 }
 
 int GuiController::sendSliderValue(int sliderIndex)
 {
 	auto& slider = _sliders.at(sliderIndex);
-	JSONObject root;
-	root[L"event"] = new JSONValue(L"set-slider-value");
-	root[L"controller"] = new JSONValue(_wname);
-	root[L"index"] = new JSONValue(slider.getIndex());
-	root[L"name"] = new JSONValue(slider.getNameW());
-	root[L"value"] = new JSONValue(slider.getValue());
-	JSONValue json = JSONValue(root);
-	return _gui->sendControl(&json);
+	JSONWriter& json = getWriter();
+	json.beginObject();
+	json.key("event").value("set-slider-value");
+	json.key("controller").value(_name);
+	json.key("index").value(slider.getIndex());
+	json.key("name").value(slider.getName());
+	json.key("value").value(slider.getValue());
+	json.endObject();
+	return _gui->sendControl(json);
 }
 
 int GuiController::addSlider(std::string name, float value, float min, float max, float step)
@@ -4,7 +4,7 @@
 #include <string>
 #include <libraries/Gui/Gui.h>
 #include "GuiSlider.h"
-#include <JSON.h>
+#include <JSONDocument.h>
 
 // Forward declarations
 class Gui;
@@ -14,7 +14,6 @@ class GuiController {
 		std::vector<GuiSlider> _sliders;
 		Gui *_gui;
 		std::string _name;
-		std::wstring _wname;
 
 		int sendController();
 		int sendSlider(const GuiSlider& slider);
@@ -40,5 +39,5 @@ class GuiController {
 
 		int getNumSliders() { return _sliders.size(); };
 
-		static bool controlCallback(JSONObject &root, void* param);
+		static bool controlCallback(const JSONDocument::Value& root, void* param);
 };
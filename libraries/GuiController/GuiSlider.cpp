@@ -80,6 +80,16 @@ JSONObject GuiSlider::getParametersAsJSON() const
 	return obj;
 }
 
+void GuiSlider::writeParameters(JSONWriter& json) const
+{
+	json.key("name").value(_name);
+	json.key("index").value(_index);
+	json.key("value").value(_value);
+	json.key("min").value(_range[0]);
+	json.key("max").value(_range[1]);
+	json.key("step").value(_step);
+}
+
 GuiSlider::~GuiSlider()
 {
 	cleanup();
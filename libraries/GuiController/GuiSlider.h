@@ -2,6 +2,7 @@
 
 #include <string>
 #include <JSON.h>
+#include <JSONWriter.h>
 
 class GuiSlider {
 	private:
@@ -40,4 +41,9 @@ class GuiSlider {
 		int setIndex(int index) { return (index < 0) ? -1 : _index=index; };
 
 		JSONObject getParametersAsJSON() const;
+		/**
+		 * Write the parameters of the slider as members of the object
+		 * that is currently open in @p json.
+		 */
+		void writeParameters(JSONWriter& json) const;
 };
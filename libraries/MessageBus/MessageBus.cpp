@@ -0,0 +1,316 @@
+#include "MessageBus.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// Each record starts with a header. Its first word holds the size of the
+// whole record (a multiple of kAlignment) and, in the low bits, its state.
+// Released records are cleared, so that the free part of the buffer is
+// all zeros and a record that has been reserved but not committed is seen
+// as kFree wherever it starts.
+enum {
+	kFree = 0,
+	kCommitted = 1,
+	kPadding = 2, // fills the end of the buffer when a record doesn't fit
+	kReleased = 3,
+	kStateMask = 3,
+};
+static constexpr uint32_t kAlignment = 16;
+
+struct MessageBus::Header
+{
+	std::atomic<uint32_t> word;
+	uint32_t channel;
+	uint32_t size;
+	uint32_t unused;
+};
+
+MessageBus::MessageBus(size_t capacity)
+{
+	if(!setup(capacity))
+		throw std::bad_alloc();
+}
+
+bool MessageBus::setup(size_t newCapacity)
+{
+	static_assert(sizeof(Header) <= kAlignment, "MessageBus header does not fit the alignment");
+	cleanup();
+	// the positions are 32-bit and their differences must not overflow
+	if(newCapacity > (1u << 31))
+		return false;
+	capacity = kAlignment * 2;
+	while(capacity < newCapacity)
+		capacity *= 2;
+	if(posix_memalign((void**)&buffer, kAlignment, capacity))
+	{
+		buffer = nullptr;
+		capacity = 0;
+		return false;
+	}
+	memset(buffer, 0, capacity);
+	writeHead = 0;
+	readHead = 0;
+	freeTail = 0;
+	reclaiming = false;
+	return true;
+}
+
+void MessageBus::cleanup()
+{
+	free(buffer);
+	buffer = nullptr;
+	capacity = 0;
+}
+
+MessageBus::Header* MessageBus::getHeader(uint32_t position)
+{
+	return (Header*)(buffer + (position & (capacity - 1)));
+}
+
+void* MessageBus::reserve(uint32_t channel, size_t size)
+{
+	if(!buffer || size > capacity)
+		return nullptr;
+	uint32_t recordSize = (sizeof(Header) + size + kAlignment - 1) & ~(kAlignment - 1);
+	uint32_t head;
+	uint32_t padding;
+	bool reclaimed = false;
+	while(1)
+	{
+		head = writeHead.load(std::memory_order_relaxed);
+		uint32_t tail = freeTail.load(std::memory_order_acquire);
+		uint32_t offset = head & (capacity - 1);
+		// records are contiguous: if it doesn't fit before the end of
+		// the buffer, skip to the beginning
+		padding = offset + recordSize > capacity ? capacity - offset : 0;
+		if(head + padding + recordSize - tail > capacity)
+		{
+			// full. Try to free up records that have been
+			// released and retry once
+			if(reclaimed)
+				return nullptr;
+			reclaim();
+			reclaimed = true;
+			continue;
+		}
+		if(writeHead.compare_exchange_weak(head, head + padding + recordSize, std::memory_order_acq_rel, std::memory_order_relaxed))
+			break;
+	}
+	if(padding)
+	{
+		getHeader(head)->word.store(padding | kPadding, std::memory_order_release);
+		head += padding;
+	}
+	Header* header = getHeader(head);
+	header->channel = channel;
+	header->size = size;
+	// the state stays kFree until commit()
+	header->word.store(recordSize | kFree, std::memory_order_relaxed);
+	return header + 1;
+}
+
+void MessageBus::commit(void* payload)
+{
+	Header* header = (Header*)payload - 1;
+	uint32_t word = header->word.load(std::memory_order_relaxed);
+	header->word.store((word & ~kStateMask) | kCommitted, std::memory_order_release);
+}
+
+bool MessageBus::write(uint32_t channel, const void* data, size_t size)
+{
+	void* payload = reserve(channel, size);
+	if(!payload)
+		return false;
+	memcpy(payload, data, size);
+	commit(payload);
+	return true;
+}
+
+bool MessageBus::read(Message& message)
+{
+	if(!buffer)
+		return false;
+	while(1)
+	{
+		uint32_t head = readHead.load(std::memory_order_acquire);
+		if(head == writeHead.load(std::memory_order_acquire))
+			return false;
+		Header* header = getHeader(head);
+		uint32_t word = header->word.load(std::memory_order_acquire);
+		uint32_t state = word & kStateMask;
+		uint32_t recordSize = word & ~kStateMask;
+		if(kPadding != state && kCommitted != state)
+		{
+			// another reader has taken this record in the meantime
+			if(readHead.load(std::memory_order_acquire) != head)
+				continue;
+			// not committed yet
+			return false;
+		}
+		if(!readHead.compare_exchange_weak(head, head + recordSize, std::memory_order_acq_rel, std::memory_order_relaxed))
+			continue;
+		if(kPadding == state)
+			continue;
+		message.channel = header->channel;
+		message.size = header->size;
+		message.data = header + 1;
+		return true;
+	}
+}
+
+void MessageBus::release(const Message& message)
+{
+	Header* header = (Header*)message.data - 1;
+	uint32_t word = header->word.load(std::memory_order_relaxed);
+	header->word.store((word & ~kStateMask) | kReleased, std::memory_order_release);
+	reclaim();
+}
+
+// Advance freeTail past the records that have been released, clearing
+// them. Only one thread does this at a time: the others return at once, and
+// whatever they released will be reclaimed by the next call.
+void MessageBus::reclaim()
+{
+	if(reclaiming.exchange(true, std::memory_order_acquire))
+		return;
+	uint32_t tail = freeTail.load(std::memory_order_relaxed);
+	uint32_t end = readHead.load(std::memory_order_acquire);
+	while(tail != end)
+	{
+		Header* header = getHeader(tail);
+		uint32_t word = header->word.load(std::memory_order_acquire);
+		uint32_t state = word & kStateMask;
+		if(kReleased != state && kPadding != state)
+			break;
+		uint32_t recordSize = word & ~kStateMask;
+		memset((void*)header, 0, recordSize);
+		tail += recordSize;
+	}
+	freeTail.store(tail, std::memory_order_release);
+	reclaiming.store(false, std::memory_order_release);
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static bool testMessageBusSingleThread()
+{
+	MessageBus bus(256);
+	assert(256 == bus.getCapacity());
+	MessageBus::Message m;
+	assert(!bus.read(m));
+	// uncommitted records block the ones after them
+	char* a = (char*)bus.reserve(1, 10);
+	assert(a);
+	assert(bus.write(2, 1234));
+	assert(!bus.read(m));
+	memcpy(a, "123456789", 10);
+	bus.commit(a);
+	assert(bus.read(m) && 1 == m.channel && 10 == m.size && !strcmp("123456789", (const char*)m.data));
+	// messages can be read before the previous ones are released
+	MessageBus::Message m2;
+	assert(bus.read(m2) && 2 == m2.channel && 1234 == *m2.as<int>());
+	assert(!m2.as<double>());
+	assert(!bus.read(m));
+	bus.release(m);
+	bus.release(m2);
+	// wrap around many times with sizes that don't divide the capacity
+	for(unsigned int n = 0; n < 1000; ++n)
+	{
+		unsigned int size = n % 70;
+		char* p = (char*)bus.reserve(n, size);
+		assert(p);
+		assert(0 == ((size_t)p & 15));
+		for(unsigned int k = 0; k < size; ++k)
+			p[k] = n + k;
+		bus.commit(p);
+		assert(bus.read(m) && n == m.channel && size == m.size);
+		for(unsigned int k = 0; k < size; ++k)
+			assert(char(n + k) == ((const char*)m.data)[k]);
+		bus.release(m);
+	}
+	// fill it up
+	unsigned int count = 0;
+	while(bus.write(0, count))
+		++count;
+	assert(count == 256 / 32 || count == 256 / 32 - 1);
+	assert(!bus.reserve(0, 300));
+	for(unsigned int n = 0; n < count; ++n)
+	{
+		assert(bus.read(m) && n == *m.as<unsigned int>());
+		bus.release(m);
+	}
+	assert(!bus.read(m));
+	assert(bus.write(0, count));
+	return true;
+}
+
+static bool testMessageBusThreads()
+{
+	const unsigned int kWriters = 4;
+	const unsigned int kReaders = 3;
+	const unsigned int kMessages = 200000;
+	MessageBus bus(4096);
+	std::atomic<unsigned int> received(0);
+	std::atomic<uint64_t> sum(0);
+	std::vector<std::thread> threads;
+	for(unsigned int w = 0; w < kWriters; ++w)
+	{
+		threads.emplace_back([&bus, w]() {
+			for(unsigned int n = 0; n < kMessages; ++n)
+			{
+				unsigned int size = sizeof(uint32_t) * (1 + n % 13);
+				uint32_t* p;
+				while(!(p = (uint32_t*)bus.reserve(w, size)))
+					std::this_thread::yield();
+				for(unsigned int k = 0; k < size / sizeof(uint32_t); ++k)
+					p[k] = n + k;
+				bus.commit(p);
+			}
+		});
+	}
+	for(unsigned int r = 0; r < kReaders; ++r)
+	{
+		threads.emplace_back([&]() {
+			std::vector<uint32_t> last(kWriters, 0);
+			while(received < kWriters * kMessages)
+			{
+				MessageBus::Message m;
+				if(!bus.read(m))
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				const uint32_t* p = (const uint32_t*)m.data;
+				assert(m.channel < kWriters);
+				assert(m.size == sizeof(uint32_t) * (1 + p[0] % 13));
+				for(unsigned int k = 0; k < m.size / sizeof(uint32_t); ++k)
+					assert(p[k] == p[0] + k);
+				// each reader sees the messages of each writer in order
+				assert(p[0] >= last[m.channel]);
+				last[m.channel] = p[0];
+				sum += p[0];
+				bus.release(m);
+				++received;
+			}
+		});
+	}
+	for(auto& t : threads)
+		t.join();
+	assert(kWriters * kMessages == received);
+	assert(uint64_t(kWriters) * kMessages * (kMessages - 1) / 2 == sum);
+	return true;
+}
+
+bool MessageBusTest()
+{
+	testMessageBusSingleThread();
+	testMessageBusThreads();
+	printf("MessageBusTest successful\n");
+	return true;
+}
+#endif
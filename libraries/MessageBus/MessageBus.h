@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A lock-free queue of variable-length messages between threads of the
+ * same process.
+ *
+ * Messages are stored as records in a preallocated ring buffer. A writer
+ * reserves space for a whole record, fills it in place and commits it, so
+ * that a header and its payload are always delivered together. A reader
+ * gets a pointer to a committed record, without copying it, and releases it
+ * when done. Any number of threads can write and read at the same time;
+ * records are delivered in the order in which they were reserved.
+ *
+ * None of the methods allocates memory or makes system calls after
+ * setup(), so they are safe to use from the audio thread.
+ *
+ * Each message carries a channel number, which can be used to tell apart
+ * messages of different types on the same bus.
+ */
+class MessageBus
+{
+public:
+	/**
+	 * A message obtained from read().
+	 */
+	struct Message
+	{
+		uint32_t channel; ///< The channel the message was written to
+		uint32_t size; ///< The size of the payload in bytes
+		const void* data; ///< The payload
+		/**
+		 * Get the payload as a @p T, or `nullptr` if the payload is
+		 * too small.
+		 */
+		template <typename T> const T* as() const
+		{
+			return size >= sizeof(T) ? (const T*)data : nullptr;
+		}
+	};
+	MessageBus() {};
+	/**
+	 * Construct and call setup(). Throws `std::bad_alloc` on failure.
+	 */
+	MessageBus(size_t capacity);
+	~MessageBus() { cleanup(); }
+	MessageBus(const MessageBus&) = delete;
+	MessageBus& operator=(const MessageBus&) = delete;
+	/**
+	 * Allocate the memory for the records.
+	 *
+	 * @param capacity the size of the buffer in bytes. This is rounded up
+	 * to a power of two. Each record takes its payload size plus up to
+	 * 31 bytes of header and padding.
+	 * @return true on success, false otherwise
+	 */
+	bool setup(size_t capacity);
+	void cleanup();
+	/**
+	 * Reserve space for a message. Fill it in and then call commit().
+	 * Messages committed later by other writers are not delivered until
+	 * this one is committed, so keep the time between the two calls short.
+	 *
+	 * @param channel the channel of the message.
+	 * @param size the size of the payload in bytes.
+	 * @return a pointer to @p size bytes, aligned to 16 bytes, or
+	 * `nullptr` if there is not enough space.
+	 */
+	void* reserve(uint32_t channel, size_t size);
+	/**
+	 * Make a message obtained from reserve() available to readers.
+	 */
+	void commit(void* payload);
+	/**
+	 * Copy @p size bytes into a new message.
+	 *
+	 * @return true on success, false if there is not enough space.
+	 */
+	bool write(uint32_t channel, const void* data, size_t size);
+	/**
+	 * Copy @p data into a new message.
+	 */
+	template <typename T> bool write(uint32_t channel, const T& data)
+	{
+		return write(channel, &data, sizeof(data));
+	}
+	/**
+	 * Get the oldest message, if it has been committed. The message
+	 * stays in the buffer until it is passed to release().
+	 *
+	 * @return true if @p message was filled in, false if there was no
+	 * message available.
+	 */
+	bool read(Message& message);
+	/**
+	 * Release a message obtained from read().
+	 */
+	void release(const Message& message);
+	/**
+	 * Get the size of the buffer in bytes.
+	 */
+	size_t getCapacity() { return capacity; }
+private:
+	struct Header;
+	Header* getHeader(uint32_t position);
+	void reclaim();
+	char* buffer = nullptr;
+	uint32_t capacity = 0;
+	// monotonic positions in bytes, wrapped to the buffer by masking
+	// writeHead: the end of the records that have been reserved
+	// readHead: the end of the records that have been read
+	// freeTail: the end of the records that have been released and
+	// cleared, and can therefore be written again
+	std::atomic<uint32_t> writeHead;
+	std::atomic<uint32_t> readHead;
+	std::atomic<uint32_t> freeTail;
+	std::atomic<bool> reclaiming;
+};
@@ -11,10 +11,23 @@
 #include <glob.h>
 #include "../include/xenomai_wraps.h"
 #include <alsa/asoundlib.h>
+#include <algorithm>
+#include <cmath>
 
 #define kMidiInput 0
 #define kMidiOutput 1
 
+constexpr double MidiClock::kBandwidth;
+constexpr unsigned int Midi::kMaxScheduledBytes;
+
+// Each packet sent through the output pipe starts with the time at which
+// its content should be written, or 0 to write it straight away.
+typedef uint64_t OutputHeader;
+// the maximum number of bytes in each packet after the header
+static const unsigned int kMaxOutputChunk = 256;
+// the maximum number of scheduled messages waiting to be written
+static const unsigned int kMaxPendingOutput = 256;
+
 static int   is_input                  (snd_ctl_t *ctl, int card, int device, int sub);
 static int   is_output                 (snd_ctl_t *ctl, int card, int device, int sub);
 static void  error                     (const char *format, ...);
@@ -99,6 +112,235 @@ int MidiParser::parse(midi_byte_t* input, unsigned int length){
 	return consumedBytes;
 };
 
+void MidiEvent::toChannelMessage(MidiChannelMessage& message) const
+{
+	message.setType(getType());
+	message.setChannel(getChannel());
+	message.setDataByte(0, data[0]);
+	message.setDataByte(1, data[1]);
+}
+
+int MidiBatchParser::setup(unsigned int queueSize)
+{
+	status = 0;
+	elapsedDataBytes = 0;
+	receivingSysex = false;
+	dropped = 0;
+	return events.setup(queueSize);
+}
+
+void MidiBatchParser::push(uint64_t timeNs)
+{
+	MidiEvent event;
+	event.timeNs = timeNs;
+	event.status = status;
+	event.data[0] = data[0];
+	event.data[1] = data[1];
+	event.numDataBytes = numDataBytes;
+	if(!events.push(event))
+		dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MidiBatchParser::sysex(const midi_byte_t* data, unsigned int length, bool last)
+{
+	if(sysexCallback && (length || last))
+		sysexCallback(data, length, last, sysexCallbackArg);
+}
+
+void MidiBatchParser::parse(const midi_byte_t* input, unsigned int length, uint64_t timeNs)
+{
+	// the start of the sysex span in the current buffer
+	unsigned int sysexStart = 0;
+	for(unsigned int n = 0; n < length; ++n)
+	{
+		midi_byte_t byte = input[n];
+		if(byte < 0x80)
+		{
+			// data byte
+			if(receivingSysex || !status)
+				continue;
+			data[elapsedDataBytes++] = byte;
+			if(elapsedDataBytes == numDataBytes)
+			{
+				push(timeNs);
+				elapsedDataBytes = 0;
+				// running status only applies to channel messages
+				if(status >= 0xF0)
+					status = 0;
+			}
+			continue;
+		}
+		if(byte >= 0xF8)
+		{
+			// real-time messages can appear anywhere and don't
+			// affect the message being parsed
+			if(receivingSysex)
+			{
+				sysex(input + sysexStart, n - sysexStart, false);
+				sysexStart = n + 1;
+			}
+			MidiEvent event;
+			event.timeNs = timeNs;
+			event.status = byte;
+			event.data[0] = event.data[1] = 0;
+			event.numDataBytes = 0;
+			if(!events.push(event))
+				dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		// any other status byte ends a sysex message
+		if(receivingSysex)
+		{
+			bool end = (0xF7 == byte);
+			sysex(input + sysexStart, n - sysexStart + end, true);
+			receivingSysex = false;
+			if(end)
+				continue;
+		}
+		elapsedDataBytes = 0;
+		data[0] = data[1] = 0;
+		if(0xF0 == byte)
+		{
+			receivingSysex = true;
+			sysexStart = n;
+			status = 0;
+			continue;
+		}
+		status = byte;
+		if(byte < 0xF0)
+			numDataBytes = midiMessageNumDataBytes[(byte >> 4) - 8];
+		else if(0xF2 == byte)
+			numDataBytes = 2; // song position
+		else if(0xF1 == byte || 0xF3 == byte)
+			numDataBytes = 1; // time code quarter frame, song select
+		else
+			numDataBytes = 0;
+		if(!numDataBytes)
+		{
+			push(timeNs);
+			status = 0;
+		}
+	}
+	if(receivingSysex)
+		sysex(input + sysexStart, length - sysexStart, false);
+}
+
+uint64_t MidiClock::getTimeNs()
+{
+	struct timespec ts;
+	__wrap_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MidiClock::update(uint64_t framesElapsed, unsigned int frames, float sampleRate, uint64_t timeNs)
+{
+	if(valid && framesElapsed == lastFramesElapsed)
+		return;
+	double now = timeNs;
+	// restart the loop if a block was skipped or if the error is too
+	// large, e.g.: because of a dropout
+	if(!valid || framesElapsed != lastFramesElapsed + this->frames || frames != this->frames || std::abs(now - next) > period)
+	{
+		period = frames * 1000000000.0 / sampleRate;
+		double omega = 2 * M_PI * kBandwidth * period / 1000000000.0;
+		b = std::sqrt(2) * omega;
+		c = omega * omega;
+		prev = now - period;
+		current = now;
+		next = now + period;
+		this->frames = frames;
+		valid = true;
+	} else {
+		double e = now - next;
+		prev = current;
+		current = next;
+		next += b * e + period;
+		period += c * e;
+	}
+	lastFramesElapsed = framesElapsed;
+}
+
+unsigned int MidiClock::getInputFrame(uint64_t timeNs) const
+{
+	double t = timeNs;
+	if(t >= current)
+		return frames;
+	if(t <= prev)
+		return 0;
+	unsigned int frame = (t - prev) / (current - prev) * frames;
+	return std::min(frame, frames - 1);
+}
+
+uint64_t MidiClock::getOutputTime(unsigned int frame) const
+{
+	return next + frame * (next - current) / frames;
+}
+
+void Midi::enableBatchParser(bool enable, unsigned int queueSize)
+{
+	if(enable)
+		batchParser.setup(queueSize);
+	batchParserEnabled = enable;
+}
+
+MidiBatchParser* Midi::getBatchParser()
+{
+	return batchParserEnabled ? &batchParser : nullptr;
+}
+
+void Midi::enableTimedInput(bool enable, unsigned int queueSize)
+{
+	enableBatchParser(enable, queueSize);
+}
+
+void Midi::updateClock(BelaContext* context)
+{
+	clock.update(context->audioFramesElapsed, context->audioFrames, context->audioSampleRate, MidiClock::getTimeNs());
+}
+
+unsigned int Midi::getMessagesForBlock(BelaContext* context, MidiTimedMessage* messages, unsigned int maxMessages)
+{
+	updateClock(context);
+	unsigned int n = 0;
+	MidiEvent* event;
+	while(n < maxMessages && (event = batchParser.front()))
+	{
+		if(event->status >= 0xF0)
+		{
+			// system messages (e.g.: clock) are not channel messages
+			batchParser.pop(*event);
+			continue;
+		}
+		unsigned int frame = clock.getInputFrame(event->timeNs);
+		if(frame >= context->audioFrames)
+			break; // leave it for the next block
+		event->toChannelMessage(messages[n].message);
+		messages[n].timeNs = event->timeNs;
+		messages[n].frame = frame;
+		batchParser.pop(*event);
+		++n;
+	}
+	return n;
+}
+
+int Midi::scheduleMessage(BelaContext* context, unsigned int frame, const midi_byte_t* bytes, unsigned int length)
+{
+	if(length > kMaxScheduledBytes)
+		return -1;
+	updateClock(context);
+	return writeOutput(clock.getOutputTime(frame), bytes, length);
+}
+
+int Midi::scheduleMessage(BelaContext* context, unsigned int frame, const MidiChannelMessage& msg)
+{
+	unsigned int len = 1 + msg.getNumDataBytes();
+	midi_byte_t bytes[3];
+	bytes[0] = msg.getStatusByte();
+	bytes[1] = msg.getDataByte(0);
+	bytes[2] = msg.getDataByte(1);
+	return scheduleMessage(context, frame, bytes, len);
+}
+
 
 Midi::Midi() : 
 alsaIn(NULL), alsaOut(NULL),
@@ -152,6 +394,7 @@ void Midi::enableParser(bool enable){
 		parserEnabled = true;
 	} else {
 		delete inputParser;
+		inputParser = nullptr;
 		parserEnabled = false;
 	}
 }
@@ -216,6 +459,12 @@ void Midi::readInputLoop(void* obj){
 				}
 				continue;
 			}
+			if(that->batchParserEnabled){
+				// parse everything we just read in one go, straight
+				// from where it was read into
+				that->batchParser.parse(&that->inputBytes[that->inputBytesWritePointer], ret, MidiClock::getTimeNs());
+				continue;
+			}
 			that->inputBytesWritePointer += ret;
 			if(that->inputBytesWritePointer == that->inputBytes.size()){ //wrap pointer around
 				that->inputBytesWritePointer = 0;
@@ -252,6 +501,13 @@ int Midi::attemptRecoveryWrite()
 	return -1;
 }
 
+struct PendingOutput {
+	uint64_t timeNs;
+	unsigned int length;
+	midi_byte_t bytes[Midi::kMaxScheduledBytes];
+	bool operator<(const PendingOutput& other) const { return timeNs < other.timeNs; }
+};
+
 void Midi::writeOutputLoop(void* obj){
 	Midi* that = (Midi*)obj;
 	//printf("Opening outPipe %s\n", that->outPipeName);
@@ -260,7 +516,10 @@ void Midi::writeOutputLoop(void* obj){
 		fprintf(stderr, "could not open out pipe %s: %s\n", that->outPipeName, strerror(-pipe_fd));
 		return;
 	}
-	void* data = &that->outputBytes.front();
+	midi_byte_t* data = that->outputBytes.data();
+	// scheduled messages, sorted by time
+	std::vector<PendingOutput> pending;
+	pending.reserve(kMaxPendingOutput);
 	while(!Bela_stopRequested()){
 		struct pollfd fds = {
 			pipe_fd,
@@ -268,9 +527,27 @@ void Midi::writeOutputLoop(void* obj){
 			0
 		}; 
 		while(!Bela_stopRequested()){
-			//TODO: C++11 would allow to use outputBytes.data() instead of &outputBytes.front()
+			int ret;
 			int timeout = 50; //ms
-			int ret = poll(&fds, 1, timeout);
+			if(pending.size()){
+				uint64_t now = MidiClock::getTimeNs();
+				if(pending.front().timeNs <= now){
+					// it's time to write the oldest scheduled message
+					ret = snd_rawmidi_write(that->alsaOut, pending.front().bytes, pending.front().length);
+					pending.erase(pending.begin());
+					if(ret < 0)
+						break;
+					continue;
+				}
+				uint64_t wait = pending.front().timeNs - now;
+				if(wait < 2000000){
+					// poll() is not accurate enough for this
+					task_sleep_ns(wait);
+					continue;
+				}
+				timeout = std::min(timeout, int(wait / 1000000) - 1);
+			}
+			ret = poll(&fds, 1, timeout);
 			unsigned int revents = fds.revents;
 			if (revents & (POLLERR | POLLHUP))
 				break;
@@ -280,10 +557,23 @@ void Midi::writeOutputLoop(void* obj){
 			if(revents & POLLIN){
 				// there is data available
 				ret = read(pipe_fd, data, that->outputBytes.size());
-				if(ret > 0){
-					//printf("obtained %d bytes: writing\n", ret);
+				if(ret > (int)sizeof(OutputHeader)){
+					OutputHeader timeNs;
+					memcpy(&timeNs, data, sizeof(timeNs));
+					midi_byte_t* bytes = data + sizeof(timeNs);
+					unsigned int length = ret - sizeof(timeNs);
+					if(timeNs && length <= kMaxScheduledBytes && pending.size() < kMaxPendingOutput){
+						// hold on to it until it's due
+						PendingOutput p;
+						p.timeNs = timeNs;
+						p.length = length;
+						memcpy(p.bytes, bytes, length);
+						pending.insert(std::upper_bound(pending.begin(), pending.end(), p), p);
+						continue;
+					}
+					//printf("obtained %d bytes: writing\n", length);
 					// write the received message to the output
-					ret = snd_rawmidi_write(that->alsaOut, data, ret);
+					ret = snd_rawmidi_write(that->alsaOut, bytes, length);
 					if(ret < 0)
 						break;
 					// make sure it is written
@@ -478,26 +768,35 @@ int Midi::writeOutput(midi_byte_t byte){
 }
 
 int Midi::writeOutput(midi_byte_t* bytes, unsigned int length){
+	return writeOutput(0, bytes, length);
+}
+
+int Midi::writeOutput(uint64_t timeNs, const midi_byte_t* bytes, unsigned int length){
 	if(!outputEnabled){
 		return 0;
 	}
+	midi_byte_t packet[sizeof(OutputHeader) + kMaxOutputChunk];
+	memcpy(packet, &timeNs, sizeof(OutputHeader));
 	do {
-		// we make sure the message length does not exceed outputBytes.size(), 
+		// we make sure the message length does not exceed kMaxOutputChunk,
 		// which would result in incomplete messages being retrieved at
 		// the other end of the pipe.
-		ssize_t size = length < outputBytes.size() ? length : outputBytes.size();
+		unsigned int chunk = length < kMaxOutputChunk ? length : kMaxOutputChunk;
+		memcpy(packet + sizeof(OutputHeader), bytes, chunk);
+		ssize_t size = sizeof(OutputHeader) + chunk;
 #ifdef XENOMAI_SKIN_native
-		int ret = rt_pipe_write(&outPipe, bytes, size, P_NORMAL);
+		int ret = rt_pipe_write(&outPipe, packet, size, P_NORMAL);
 		if(ret < 0){
 #endif
 #ifdef XENOMAI_SKIN_posix
-		int ret = __wrap_sendto(sock, bytes, size, 0, NULL, 0);
+		int ret = __wrap_sendto(sock, packet, size, 0, NULL, 0);
 		if (ret != size){
 #endif
 			rt_fprintf(stderr, "Error while streaming to pipe %s: %s\n", outPipeName, strerror(-ret));
 			return -1;
 		} else {
-			length -= ret;
+			length -= chunk;
+			bytes += chunk;
 		}
 	} while (length > 0);
 	return 1;
@@ -866,4 +1165,92 @@ static void error(const char *format, ...) {
    putc('\n', stderr);
 }
 
+#if 0
+#undef NDEBUG
+#include <assert.h>
+bool MidiClockTest()
+{
+	MidiClock clock;
+	const unsigned int frames = 128;
+	const float sampleRate = 44100;
+	const double period = frames * 1000000000.0 / sampleRate;
+	uint64_t start = 1000000000;
+	uint64_t t = start;
+	// render() is called with up to 200us of jitter
+	for(unsigned int n = 0; n < 2000; ++n)
+	{
+		t = start + n * period + (n * 7919 % 200) * 1000;
+		clock.update(n * frames, frames, sampleRate, t);
+		// a second call in the same block is ignored
+		clock.update(n * frames, frames, sampleRate, t + 1000000);
+	}
+	assert(clock.isValid());
+	// the block started at most 200us after its nominal start
+	uint64_t nominal = start + 1999 * period;
+	// an event halfway through the previous block
+	unsigned int frame = clock.getInputFrame(nominal - period / 2);
+	assert(frame > frames / 2 - 10 && frame < frames / 2 + 10);
+	assert(0 == clock.getInputFrame(nominal - 2 * period));
+	assert(frames == clock.getInputFrame(t + 300000));
+	// output of the current block starts at the next block
+	uint64_t out = clock.getOutputTime(0);
+	assert(out > nominal + period - 300000 && out < nominal + period + 300000);
+	assert(clock.getOutputTime(frames / 2) - out > period / 2 - 1000);
+	// skipping a block restarts the loop
+	clock.update(2001 * frames, frames, sampleRate, t + 2 * period);
+	assert(frames - 1 == clock.getInputFrame(t + 2 * period - 1));
+	printf("MidiClockTest successful\n");
+	return true;
+}
 
+static unsigned int sysexBytes;
+static unsigned int sysexMessages;
+static void sysexCallback(const midi_byte_t* data, unsigned int length, bool last, void* arg)
+{
+	for(unsigned int n = 0; n < length; ++n)
+		assert(data[n] < 0xF8);
+	sysexBytes += length;
+	sysexMessages += last;
+}
+
+bool MidiBatchParserTest()
+{
+	MidiBatchParser parser(64);
+	parser.setSysexCallback(sysexCallback);
+	const midi_byte_t input[] = {
+		0xB3, 1, 2, 3, 0xF8, 4, // CC with running status and interleaved clock
+		5, // stray data byte (running status incomplete)
+		0xF0, 0x7E, 0x01, 0xF8, 0x02, 0xF7, // sysex split by a clock
+		0x10, // stray data byte
+		0xE0, 0x00, 0x40, // pitch bend
+		0xC1, 7, 8, // program change with running status
+		0xF2, 1, 2, 3, // song position, then a stray byte
+	};
+	// parse in two chunks, splitting a message
+	parser.parse(input, 9, 1);
+	parser.parse(input + 9, sizeof(input) - 9, 2);
+	struct { midi_byte_t status, data0, data1; } expected[] = {
+		{0xB3, 1, 2}, {0xF8, 0, 0}, {0xB3, 3, 4}, {0xF8, 0, 0}, {0xE0, 0, 0x40},
+		{0xC1, 7, 0}, {0xC1, 8, 0}, {0xF2, 1, 2},
+	};
+	MidiEvent event;
+	for(auto& e : expected)
+	{
+		assert(parser.pop(event));
+		assert(e.status == event.status && e.data0 == event.data[0]);
+		if(event.numDataBytes > 1)
+			assert(e.data1 == event.data[1]);
+	}
+	assert(!parser.pop(event));
+	assert(1 == sysexMessages && 5 == sysexBytes);
+	MidiChannelMessage message;
+	MidiEvent{0, 0x93, {60, 100}, 2}.toChannelMessage(message);
+	assert(kmmNoteOn == message.getType() && 3 == message.getChannel() && 60 == message.getDataByte(0) && 100 == message.getDataByte(1));
+	// overflowing the queue drops messages
+	for(unsigned int n = 0; n < 100; ++n)
+		parser.parse(input, 4);
+	assert(parser.getNumDropped() > 0);
+	printf("MidiBatchParserTest successful\n");
+	return true;
+}
+#endif
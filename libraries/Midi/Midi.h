@@ -2,6 +2,8 @@
 #include <Bela.h>
 #include <vector>
 #include <string>
+#include <SpscQueue.h>
+#include <atomic>
 #ifdef XENOMAI_SKIN_native
 #include <native/pipe.h>
 #endif
@@ -278,6 +280,186 @@ public:
 };
 
 
+/**
+ * A MIDI message, as produced by MidiBatchParser. This is a plain struct,
+ * so that it can be copied through a lock-free queue cheaply.
+ */
+struct MidiEvent {
+	/// when the bytes containing the message were read, in ns on the
+	/// monotonic clock
+	uint64_t timeNs;
+	/// the status byte, including the channel
+	midi_byte_t status;
+	midi_byte_t data[2];
+	/// the number of data bytes
+	midi_byte_t numDataBytes;
+	MidiMessageType getType() const {
+		return status < 0xF0 ? (MidiMessageType)((status >> 4) - 8) : kmmSystem;
+	}
+	int getChannel() const {
+		return status & 0xF;
+	}
+	/**
+	 * Fill in @p message with the content of this event.
+	 */
+	void toChannelMessage(MidiChannelMessage& message) const;
+};
+
+/**
+ * A MIDI parser that parses a whole buffer of bytes in one pass and stores
+ * the messages in a lock-free queue.
+ *
+ * parse() is meant to be called on the thread that reads the input,
+ * and the messages can be retrieved with pop() from one other thread,
+ * e.g.: the audio thread. Nothing is allocated after setup().
+ *
+ * Running status is supported, and system real-time messages are
+ * returned as soon as they are received, also when they are interleaved
+ * with other messages. Sysex messages are passed to the sysex callback as
+ * spans of the input buffer, without copying them.
+ */
+class MidiBatchParser {
+public:
+	/**
+	 * The type of the sysex callback.
+	 *
+	 * @param data a span of a sysex message. The first span of a message
+	 * starts with 0xF0.
+	 * @param length the length of the span.
+	 * @param last whether this is the last span of the message. If so,
+	 * it ends with 0xF7, unless the message was interrupted by another
+	 * status byte.
+	 * @param arg the argument passed to setSysexCallback().
+	 */
+	typedef void (*SysexCallback)(const midi_byte_t* data, unsigned int length, bool last, void* arg);
+	MidiBatchParser() {};
+	MidiBatchParser(unsigned int queueSize) { setup(queueSize); }
+	/**
+	 * Allocate the queue and reset the parser.
+	 *
+	 * @param queueSize the maximum number of messages waiting to be
+	 * retrieved.
+	 */
+	int setup(unsigned int queueSize = 1024);
+	/**
+	 * Parse some bytes. Incomplete messages are completed by the next
+	 * call.
+	 *
+	 * @param input the bytes to parse.
+	 * @param length the number of bytes in @p input.
+	 * @param timeNs the time the bytes were received at.
+	 */
+	void parse(const midi_byte_t* input, unsigned int length, uint64_t timeNs = 0);
+	/**
+	 * Retrieve the oldest message.
+	 *
+	 * @return true if a message was available, false otherwise.
+	 */
+	bool pop(MidiEvent& event) { return events.pop(event); }
+	/**
+	 * Get the oldest message without removing it, or `nullptr` if there
+	 * is none.
+	 */
+	MidiEvent* front() { return events.front(); }
+	unsigned int numAvailableMessages() const { return events.size(); }
+	/**
+	 * Get the number of messages that have been dropped because the
+	 * queue was full.
+	 */
+	unsigned int getNumDropped() const { return dropped.load(std::memory_order_relaxed); }
+	/**
+	 * Set the callback that receives sysex messages. It is called from
+	 * within parse(). Without a callback, sysex messages are discarded.
+	 */
+	void setSysexCallback(SysexCallback callback, void* arg = nullptr) {
+		sysexCallback = callback;
+		sysexCallbackArg = arg;
+	}
+private:
+	void push(uint64_t timeNs);
+	void sysex(const midi_byte_t* data, unsigned int length, bool last);
+	SpscQueue<MidiEvent> events;
+	std::atomic<unsigned int> dropped {0};
+	SysexCallback sysexCallback = nullptr;
+	void* sysexCallbackArg = nullptr;
+	// the message being parsed
+	midi_byte_t status = 0;
+	midi_byte_t data[2];
+	unsigned int numDataBytes = 0;
+	unsigned int elapsedDataBytes = 0;
+	bool receivingSysex = false;
+};
+
+/**
+ * A channel message with the time at which it was received.
+ */
+struct MidiTimedMessage {
+	MidiChannelMessage message;
+	/// when the message was received, in ns on the monotonic clock
+	uint64_t timeNs;
+	/// the frame of the current block at which the message should be
+	/// applied. This is set by Midi::getMessagesForBlock().
+	unsigned int frame;
+};
+
+/**
+ * Maps between the monotonic clock and the frames of the audio thread.
+ *
+ * The time at which each block is processed is affected by scheduling
+ * jitter. It is filtered by a delay-locked loop, so that the estimated
+ * start times of the blocks follow the rate of the audio clock.
+ */
+class MidiClock {
+public:
+	/// the bandwidth of the loop filter
+	static constexpr double kBandwidth = 1;
+	/**
+	 * Update the estimate. Call this once per block, from the audio
+	 * thread. Further calls in the same block are ignored.
+	 *
+	 * @param framesElapsed the number of frames elapsed before the
+	 * current block.
+	 * @param frames the number of frames in a block.
+	 * @param sampleRate the sample rate.
+	 * @param timeNs the current time.
+	 */
+	void update(uint64_t framesElapsed, unsigned int frames, float sampleRate, uint64_t timeNs);
+	/**
+	 * Get the frame of the current block that corresponds to an event
+	 * received at @p timeNs during the previous block. Events are
+	 * delayed by one block, so that they all get a constant latency.
+	 *
+	 * @return the frame, or `frames` if the event was received during
+	 * the current block. Events received before the previous block
+	 * return 0.
+	 */
+	unsigned int getInputFrame(uint64_t timeNs) const;
+	/**
+	 * Get the time at which frame @p frame of the current block will be
+	 * played, assuming that the output of the current block starts when
+	 * the next block is processed.
+	 */
+	uint64_t getOutputTime(unsigned int frame) const;
+	bool isValid() const { return valid; }
+	/**
+	 * Get the current time of the clock used for timestamps. This is
+	 * RT-safe.
+	 */
+	static uint64_t getTimeNs();
+private:
+	uint64_t lastFramesElapsed = 0;
+	unsigned int frames = 0;
+	// the estimated times of the previous, current and next block
+	double prev;
+	double current;
+	double next;
+	// the estimated duration of a block
+	double period;
+	double b;
+	double c;
+	bool valid = false;
+};
+
 typedef struct _snd_rawmidi snd_rawmidi_t;
 class Midi {
 public:
@@ -316,6 +498,82 @@ public:
 		getParser()->setCallback(callback, arg);
 	}
 
+	/**
+	 * Enable the batch parser. In this mode, the input is parsed by a
+	 * MidiBatchParser as soon as it is read, and the messages are
+	 * retrieved from getBatchParser(). The MidiParser and getInput() are
+	 * not fed. Call this from setup().
+	 *
+	 * @param enable whether to enable the batch parser.
+	 * @param queueSize the maximum number of messages waiting to be
+	 * retrieved.
+	 */
+	void enableBatchParser(bool enable, unsigned int queueSize = 1024);
+
+	/**
+	 * Get the batch parser, if it is enabled.
+	 *
+	 * @return a pointer to the batch parser, or `nullptr` if it is not
+	 * enabled.
+	 */
+	MidiBatchParser* getBatchParser();
+
+	/**
+	 * Enable sample-accurate input. Incoming channel messages are stamped
+	 * with the time they are received at, and they can be retrieved with
+	 * getMessagesForBlock().
+	 *
+	 * This enables the batch parser: messages should not be retrieved
+	 * from getBatchParser() in this mode, and the MidiParser and
+	 * getInput() are no longer fed. System messages (e.g.: clock and song
+	 * position) are discarded. Call this from setup().
+	 *
+	 * @param enable whether to enable timed input.
+	 * @param queueSize the maximum number of messages waiting to be
+	 * retrieved.
+	 */
+	void enableTimedInput(bool enable, unsigned int queueSize = 512);
+
+	/**
+	 * Retrieve the channel messages to be applied during the current
+	 * block, i.e.: those received during the previous block. Each of
+	 * them is assigned the frame that corresponds to the time when it
+	 * was received, so that the timing between them is preserved, at
+	 * the cost of one block of latency. Messages received during the
+	 * current block are left in the queue for the next one.
+	 *
+	 * Call this once per block from render(). It requires
+	 * enableTimedInput().
+	 *
+	 * @param context the context passed to render().
+	 * @param messages an array where the messages are stored.
+	 * @param maxMessages the size of @p messages.
+	 *
+	 * @return the number of messages stored in @p messages, in the order
+	 * they have been received.
+	 */
+	unsigned int getMessagesForBlock(BelaContext* context, MidiTimedMessage* messages, unsigned int maxMessages);
+
+	/**
+	 * Schedule a message to be written to the output port at the time
+	 * when frame @p frame of the current block is played.
+	 *
+	 * This can be called from render(). Scheduled messages should be
+	 * short messages, e.g.: channel messages, and they are written in
+	 * the order of their time.
+	 *
+	 * @param context the context passed to render().
+	 * @param frame the frame within the current block.
+	 * @param bytes the message.
+	 * @param length the length of the message. This can be at most
+	 * kMaxScheduledBytes.
+	 *
+	 * @return 1 on success, 0 if output is not enabled, -1 on error
+	 */
+	int scheduleMessage(BelaContext* context, unsigned int frame, const midi_byte_t* bytes, unsigned int length);
+	int scheduleMessage(BelaContext* context, unsigned int frame, const MidiChannelMessage& message);
+	static constexpr unsigned int kMaxScheduledBytes = 3;
+
 	/**
 	 * Open the specified input Midi port and start reading from it.
 	 * @param port Midi port to open
@@ -394,6 +652,8 @@ private:
 	int _getInput();
 	int attemptRecoveryRead();
 	static void readInputLoop(void* obj);
+	void updateClock(BelaContext* context);
+	int writeOutput(uint64_t timeNs, const midi_byte_t* bytes, unsigned int length);
 	int attemptRecoveryWrite();
 	static void writeOutputLoop(void* obj);
 	snd_rawmidi_t *alsaIn,*alsaOut;
@@ -402,6 +662,9 @@ private:
 	unsigned int inputBytesReadPointer;
 	std::vector<midi_byte_t> outputBytes;
 	MidiParser* inputParser;
+	MidiBatchParser batchParser;
+	MidiClock clock;
+	bool batchParserEnabled = false;
 	bool parserEnabled;
 	bool inputEnabled;
 	bool outputEnabled;
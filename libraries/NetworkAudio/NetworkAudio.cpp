@@ -0,0 +1,753 @@
+#include "NetworkAudio.h"
+#include <math.h>
+#include <random>
+#include <string.h>
+#include <time.h>
+
+constexpr uint8_t NetworkAudio::kPayloadType;
+constexpr unsigned int NetworkAudio::kHeaderSize;
+constexpr unsigned int NetworkAudio::kMaxPacketSize;
+constexpr unsigned int NetworkAudioReceiver::kDefaultMinLatency;
+constexpr unsigned int NetworkAudioReceiver::kDefaultMaxLatency;
+constexpr double NetworkAudioReceiver::kMaxRatioDeviation;
+
+// how long it takes for a stream to fade in after playback skips
+static constexpr unsigned int kFadeFrames = 64;
+// the number of packets the receiving thread reads at once
+static constexpr unsigned int kReceiveBatch = 32;
+// the time constants of the rate control, in seconds
+static constexpr double kLatencyAveragingTime = 0.5;
+static constexpr double kProportionalTime = 2;
+static constexpr double kIntegralTime = 10;
+static constexpr double kTargetDecreaseTime = 10;
+
+static inline void writeBe16(uint8_t* p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static inline void writeBe32(uint8_t* p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline uint16_t readBe16(const uint8_t* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t readBe32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline int32_t toInt(float x, float scale)
+{
+	if(x >= 1)
+		x = 1;
+	if(x < -1)
+		x = -1;
+	int32_t v = lrintf(x * scale);
+	// +1 maps to the largest positive value
+	return v > scale - 1 ? scale - 1 : v;
+}
+
+unsigned int NetworkAudio::getBytesPerSample(Format format)
+{
+	switch(format)
+	{
+	case kInt16:
+		return 2;
+	case kInt24:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+void NetworkAudio::encode(Format format, const float* in, unsigned int count, uint8_t* out)
+{
+	switch(format)
+	{
+	case kInt16:
+		for(unsigned int n = 0; n < count; ++n, out += 2)
+			writeBe16(out, toInt(in[n], 32768));
+		break;
+	case kInt24:
+		for(unsigned int n = 0; n < count; ++n, out += 3)
+		{
+			int32_t v = toInt(in[n], 8388608);
+			out[0] = v >> 16;
+			out[1] = v >> 8;
+			out[2] = v;
+		}
+		break;
+	default:
+		for(unsigned int n = 0; n < count; ++n, out += 4)
+		{
+			uint32_t v;
+			memcpy(&v, &in[n], sizeof(v));
+			writeBe32(out, v);
+		}
+		break;
+	}
+}
+
+void NetworkAudio::decode(Format format, const uint8_t* in, unsigned int count, float* out)
+{
+	switch(format)
+	{
+	case kInt16:
+		for(unsigned int n = 0; n < count; ++n, in += 2)
+			out[n] = (int16_t)readBe16(in) * (1.f / 32768);
+		break;
+	case kInt24:
+		for(unsigned int n = 0; n < count; ++n, in += 3)
+		{
+			// sign-extend from 24 bits
+			int32_t v = (int32_t)(((uint32_t)in[0] << 24) | (in[1] << 16) | (in[2] << 8)) >> 8;
+			out[n] = v * (1.f / 8388608);
+		}
+		break;
+	default:
+		for(unsigned int n = 0; n < count; ++n, in += 4)
+		{
+			uint32_t v = readBe32(in);
+			memcpy(&out[n], &v, sizeof(v));
+		}
+		break;
+	}
+}
+
+NetworkAudioSender::~NetworkAudioSender() {}
+
+int NetworkAudioSender::setup(const std::string& host, int port, unsigned int numChannels, NetworkAudio::Format format, unsigned int maxFrames)
+{
+	if(!numChannels || (unsigned int)format >= NetworkAudio::kNumFormats)
+		return -1;
+	this->numChannels = numChannels;
+	this->format = format;
+	framesPerPacket = (NetworkAudio::kMaxPacketSize - NetworkAudio::kHeaderSize) / (NetworkAudio::getBytesPerSample(format) * numChannels);
+	if(!framesPerPacket)
+	{
+		fprintf(stderr, "NetworkAudioSender: too many channels\n");
+		return -1;
+	}
+	interleavedBuffer.resize(maxFrames * numChannels);
+	socket = std::unique_ptr<UdpClient>(new UdpClient());
+	if(!socket->setup(port, host.c_str()))
+	{
+		fprintf(stderr, "NetworkAudioSender: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
+		return -1;
+	}
+	// room for a few blocks of the largest size, in case the sending
+	// thread is held up
+	unsigned int numPackets = (maxFrames + framesPerPacket - 1) / framesPerPacket;
+	bus = std::unique_ptr<MessageBus>(new MessageBus());
+	if(!bus->setup(16 * numPackets * (NetworkAudio::kMaxPacketSize + 32)))
+		return -1;
+	std::random_device rd;
+	ssrc = rd();
+	sequence = rd();
+	sendTask = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
+	sendTask->create(std::string("NetworkAudioSender_") + host + "_" + std::to_string(port), [this](){ flush(); });
+	return 0;
+}
+
+int NetworkAudioSender::write(const float* interleaved, unsigned int frames, uint64_t framesElapsed)
+{
+	if(!bus)
+		return -1;
+	int ret = 0;
+	unsigned int bytesPerFrame = NetworkAudio::getBytesPerSample(format) * numChannels;
+	for(unsigned int start = 0; start < frames; start += framesPerPacket)
+	{
+		unsigned int count = frames - start < framesPerPacket ? frames - start : framesPerPacket;
+		uint8_t* packet = (uint8_t*)bus->reserve(0, NetworkAudio::kHeaderSize + count * bytesPerFrame);
+		// the sequence number still advances, so that the receiver can
+		// tell that a packet is missing
+		uint16_t seq = sequence++;
+		if(!packet)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			ret = -1;
+			continue;
+		}
+		packet[0] = 0x80; // version 2, no padding, no extension, no CSRC
+		packet[1] = NetworkAudio::kPayloadType + format;
+		writeBe16(packet + 2, seq);
+		writeBe32(packet + 4, framesElapsed + start);
+		writeBe32(packet + 8, ssrc);
+		NetworkAudio::encode(format, interleaved + start * numChannels, count * numChannels, packet + NetworkAudio::kHeaderSize);
+		bus->commit(packet);
+	}
+	// wake up sendTask, unless it's already due to run
+	if(!sendPending.exchange(true))
+		sendTask->schedule();
+	return ret;
+}
+
+int NetworkAudioSender::writeAudio(BelaContext* context, unsigned int startChannel)
+{
+	if(context->audioFrames * numChannels > interleavedBuffer.size())
+		return -1;
+	float* dest = interleavedBuffer.data();
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+	{
+		for(unsigned int c = 0; c < numChannels; ++c)
+		{
+			unsigned int ch = startChannel + c;
+			*dest++ = ch < context->audioInChannels ? audioRead(context, n, ch) : 0;
+		}
+	}
+	return write(interleavedBuffer.data(), context->audioFrames, context->audioFramesElapsed);
+}
+
+// Send all the packets written so far, passing several of them to each
+// system call. This runs on sendTask.
+void NetworkAudioSender::flush()
+{
+	sendPending = false;
+	MessageBus::Message messages[UdpClient::kMaxBatch];
+	const void* data[UdpClient::kMaxBatch];
+	unsigned int sizes[UdpClient::kMaxBatch];
+	bool more = true;
+	while(more)
+	{
+		unsigned int n = 0;
+		while(n < UdpClient::kMaxBatch && (more = bus->read(messages[n])))
+		{
+			data[n] = messages[n].data;
+			sizes[n] = messages[n].size;
+			++n;
+		}
+		if(!n)
+			break;
+		socket->sendBatch(data, sizes, n);
+		for(unsigned int k = 0; k < n; ++k)
+			bus->release(messages[k]);
+	}
+}
+
+NetworkAudioReceiver::~NetworkAudioReceiver()
+{
+	shouldStop = true;
+	if(receiveThread.joinable())
+		receiveThread.join();
+}
+
+int NetworkAudioReceiver::setup(int port, unsigned int numChannels, float sampleRate, unsigned int minLatency, unsigned int maxLatency)
+{
+	if(!numChannels || sampleRate <= 0 || !minLatency || maxLatency < minLatency)
+		return -1;
+	this->numChannels = numChannels;
+	this->sampleRate = sampleRate;
+	this->minLatency = minLatency;
+	this->maxLatency = maxLatency;
+	// leave room for the latency, a few packets and the interpolation
+	capacity = 1;
+	while(capacity < 2 * (maxLatency + NetworkAudio::kMaxPacketSize))
+		capacity *= 2;
+	samples.assign(capacity * numChannels, 0);
+	stamps.reset(new std::atomic<uint32_t>[capacity]);
+	for(unsigned int n = 0; n < capacity; ++n)
+		stamps[n] = 0;
+	window.assign(4 * numChannels, 0);
+	historyFrames = sampleRate * 0.005;
+	if(!historyFrames)
+		historyFrames = 1;
+	history.assign(historyFrames * numChannels, 0);
+	concealFrames = sampleRate * 0.02;
+	targetLatency = minLatency;
+	latency = minLatency;
+
+	socket = std::unique_ptr<UdpServer>(new UdpServer());
+	if(!socket->setup(port))
+	{
+		fprintf(stderr, "NetworkAudioReceiver: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
+		return -1;
+	}
+	if(socket->setupBatch(kReceiveBatch, NetworkAudio::kMaxPacketSize + 64))
+		return -1;
+	socket->enableTimestamps(true);
+	socket->setReceiveBufferSize(1 << 18);
+	receiveThread = std::thread(&NetworkAudioReceiver::receiveLoop, this);
+	return 0;
+}
+
+void NetworkAudioReceiver::receiveLoop()
+{
+	while(!shouldStop)
+	{
+		int ret = socket->readBatch(50);
+		if(ret < 0)
+		{
+			if(EINTR == errno)
+				continue;
+			fprintf(stderr, "NetworkAudioReceiver: Error reading UDP socket: %d %s\n", errno, strerror(errno));
+			break;
+		}
+		for(int n = 0; n < ret; ++n)
+		{
+			const UdpServer::Packet& packet = socket->getPacket(n);
+			if(!packet.truncated)
+				handlePacket((const uint8_t*)packet.data, packet.size, packet.timestampNs);
+		}
+	}
+}
+
+void NetworkAudioReceiver::handlePacket(const uint8_t* data, unsigned int size, uint64_t timestampNs)
+{
+	if(size < NetworkAudio::kHeaderSize || 0x80 != (data[0] & 0xC0))
+		return;
+	unsigned int headerSize = NetworkAudio::kHeaderSize + 4 * (data[0] & 0x0F);
+	if(data[0] & 0x10)
+	{
+		// skip the header extension
+		if(size < headerSize + 4)
+			return;
+		headerSize += 4 + 4 * readBe16(data + headerSize + 2);
+	}
+	if(data[0] & 0x20)
+	{
+		// remove the padding
+		if(data[size - 1] > size)
+			return;
+		size -= data[size - 1];
+	}
+	if(size <= headerSize)
+		return;
+	unsigned int payloadType = data[1] & 0x7F;
+	if(payloadType < NetworkAudio::kPayloadType || payloadType >= NetworkAudio::kPayloadType + NetworkAudio::kNumFormats)
+		return;
+	NetworkAudio::Format format = (NetworkAudio::Format)(payloadType - NetworkAudio::kPayloadType);
+	unsigned int bytesPerFrame = NetworkAudio::getBytesPerSample(format) * numChannels;
+	unsigned int payloadSize = size - headerSize;
+	if(payloadSize % bytesPerFrame)
+		return; // wrong number of channels
+	uint32_t frames = payloadSize / bytesPerFrame;
+	const uint8_t* payload = data + headerSize;
+	uint16_t sequence = readBe16(data + 2);
+	uint32_t rtpTimestamp = readBe32(data + 4);
+	uint32_t packetSsrc = readBe32(data + 8);
+
+	bool first = !started.load(std::memory_order_relaxed);
+	bool newStream = first || packetSsrc != ssrc;
+	if(newStream)
+	{
+		// the sender has (re)started: continue the timeline from the
+		// end of the previous stream, if any
+		ssrc = packetSsrc;
+		timestampOffset = writeEnd.load(std::memory_order_relaxed) - rtpTimestamp;
+		expectedSequence = sequence;
+	}
+	uint32_t timestamp = rtpTimestamp + timestampOffset;
+
+	int16_t gap = sequence - expectedSequence;
+	if(gap > 0)
+		numLost.fetch_add(gap, std::memory_order_relaxed);
+	else if(gap < 0 && numLost.load(std::memory_order_relaxed))
+		numLost.fetch_sub(1, std::memory_order_relaxed); // it was reordered, not lost
+	numReceived.fetch_add(1, std::memory_order_relaxed);
+
+	// interarrival jitter, as in RFC 3550
+	if(!timestampNs)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		timestampNs = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+	double arrival = timestampNs * (sampleRate / 1000000000.0);
+	if(gap >= 0)
+	{
+		if(!newStream)
+		{
+			double d = (arrival - lastArrival) - (int32_t)(timestamp - lastTimestamp);
+			float j = jitter.load(std::memory_order_relaxed);
+			jitter.store(j + (fabs(d) - j) / 16, std::memory_order_relaxed);
+		}
+		lastArrival = arrival;
+		lastTimestamp = timestamp;
+		expectedSequence = sequence + 1;
+	}
+	packetFrames.store(frames, std::memory_order_relaxed);
+
+	if(first)
+		readStart.store(timestamp, std::memory_order_relaxed);
+	// the end is updated even if the packet is late, so that the reader
+	// notices if the whole stream is behind it and skips back
+	uint32_t end = timestamp + frames;
+	if(first || (int32_t)(end - writeEnd.load(std::memory_order_relaxed)) > 0)
+		writeEnd.store(end, std::memory_order_release);
+	if(first)
+		started.store(true, std::memory_order_release);
+	int32_t start = timestamp - readStart.load(std::memory_order_acquire);
+	if(start + (int32_t)frames <= 0)
+	{
+		numLate.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	// if it's too far ahead, the reader is about to skip ahead: don't write
+	// it, but let the reader know where the stream is
+	if(start + frames <= capacity)
+	{
+		uint32_t skip = start < 0 ? -start : 0;
+		for(uint32_t f = skip; f < frames; ++f)
+		{
+			uint32_t t = timestamp + f;
+			uint32_t idx = t & (capacity - 1);
+			if(t + 1 == stamps[idx].load(std::memory_order_relaxed))
+				continue; // a duplicate
+			// invalidate the frame before overwriting it, so that
+			// fetchFrame() can tell if it changed while it was
+			// reading it
+			stamps[idx].store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			NetworkAudio::decode(format, payload + f * bytesPerFrame, numChannels, &samples[idx * numChannels]);
+			stamps[idx].store(t + 1, std::memory_order_release);
+		}
+	}
+}
+
+void NetworkAudioReceiver::fetchFrame(uint64_t frame, float* out)
+{
+	uint32_t idx = frame & (capacity - 1);
+	uint32_t stamp = (uint32_t)frame + 1;
+	bool valid = false;
+	if(stamp == stamps[idx].load(std::memory_order_acquire))
+	{
+		memcpy(out, &samples[idx * numChannels], numChannels * sizeof(float));
+		// readStart normally keeps the writer away from this frame, but
+		// after resync() moves it back the writer may still be using an
+		// older bound. It invalidates the stamp before writing, so if
+		// it's unchanged the frame wasn't overwritten while we were
+		// copying it
+		std::atomic_thread_fence(std::memory_order_acquire);
+		valid = (stamp == stamps[idx].load(std::memory_order_relaxed));
+	}
+	if(valid)
+	{
+		float* h = &history[historyPos * numChannels];
+		memcpy(h, out, numChannels * sizeof(float));
+		if(++historyPos == historyFrames)
+			historyPos = 0;
+		if(lossFrames)
+		{
+			// crossfade from the concealment
+			crossfade = kFadeFrames;
+			lossFrames = 0;
+		}
+		if(crossfade)
+		{
+			float gain = (float)crossfade / kFadeFrames;
+			const float* c = &history[concealPos * numChannels];
+			for(unsigned int ch = 0; ch < numChannels; ++ch)
+				out[ch] += (c[ch] * concealGain - out[ch]) * gain;
+			if(++concealPos == historyFrames)
+				concealPos = 0;
+			--crossfade;
+		}
+		if(fadeIn)
+		{
+			float gain = 1 - (float)fadeIn / kFadeFrames;
+			for(unsigned int ch = 0; ch < numChannels; ++ch)
+				out[ch] *= gain;
+			--fadeIn;
+		}
+		return;
+	}
+	// repeat the last frames received, fading out
+	if(!lossFrames && !crossfade)
+		concealPos = historyPos;
+	crossfade = 0;
+	concealGain = lossFrames < concealFrames ? 1 - (float)lossFrames / concealFrames : 0;
+	const float* c = &history[concealPos * numChannels];
+	for(unsigned int ch = 0; ch < numChannels; ++ch)
+		out[ch] = c[ch] * concealGain;
+	if(++concealPos == historyFrames)
+		concealPos = 0;
+	++lossFrames;
+	++numConcealed;
+}
+
+void NetworkAudioReceiver::resync(uint64_t end)
+{
+	if(playing)
+		++numResyncs;
+	fetchPos = end - (uint64_t)targetLatency + 3;
+	frac = 0;
+	readStart.store((uint32_t)(fetchPos - 4), std::memory_order_release);
+	fadeIn = kFadeFrames;
+	for(unsigned int k = 0; k < 4; ++k)
+		fetchFrame(fetchPos - 4 + k, &window[k * numChannels]);
+	latency = targetLatency;
+}
+
+void NetworkAudioReceiver::updateRate(uint64_t end, unsigned int frames)
+{
+	// the distance between the most recent frame received and window[1]
+	double level = (double)(int64_t)(end - fetchPos) + 3 - frac;
+	bool received = ((uint32_t)end != lastEnd);
+	lastEnd = (uint32_t)end;
+	if(received && (level < 0 || level > maxLatency))
+	{
+		// the stream stopped and restarted, or a burst of packets
+		// arrived after a stall: skip
+		resync(end);
+		return;
+	}
+	// the latency needs to accommodate a packet, a block and the jitter.
+	// It increases as soon as needed and decreases slowly.
+	float wanted = packetFrames.load(std::memory_order_relaxed) + frames + 4 * jitter.load(std::memory_order_relaxed);
+	if(wanted < minLatency)
+		wanted = minLatency;
+	if(wanted > maxLatency)
+		wanted = maxLatency;
+	double blockTime = frames / sampleRate;
+	if(wanted > targetLatency)
+		targetLatency = wanted;
+	else
+		targetLatency += (wanted - targetLatency) * blockTime / kTargetDecreaseTime;
+	float alpha = blockTime / kLatencyAveragingTime;
+	latency += (level - latency) * (alpha < 1 ? alpha : 1);
+	// a PI controller: the proportional term brings the latency back to
+	// the target, the integral term tracks the drift between the clocks
+	double error = (latency - targetLatency) / sampleRate / kProportionalTime;
+	drift += error * blockTime / kIntegralTime;
+	if(drift > kMaxRatioDeviation)
+		drift = kMaxRatioDeviation;
+	if(drift < -kMaxRatioDeviation)
+		drift = -kMaxRatioDeviation;
+	double deviation = error + drift;
+	if(deviation > kMaxRatioDeviation)
+		deviation = kMaxRatioDeviation;
+	if(deviation < -kMaxRatioDeviation)
+		deviation = -kMaxRatioDeviation;
+	ratio = 1 + deviation;
+}
+
+void NetworkAudioReceiver::read(float* interleaved, unsigned int frames)
+{
+	if(!started.load(std::memory_order_acquire))
+	{
+		memset(interleaved, 0, frames * numChannels * sizeof(float));
+		return;
+	}
+	uint32_t end32 = writeEnd.load(std::memory_order_acquire);
+	if(!playing)
+	{
+		// keep well away from 0, so that the timeline can go backwards
+		resync(((uint64_t)1 << 32) | end32);
+		lastEnd = end32;
+		playing = true;
+	}
+	uint64_t end = fetchPos + (int32_t)(end32 - (uint32_t)fetchPos);
+	const unsigned int ch = numChannels;
+	for(unsigned int n = 0; n < frames; ++n)
+	{
+		// 4-point Hermite interpolation between window[1] and window[2]
+		float t = frac;
+		const float* y0 = &window[0];
+		const float* y1 = &window[ch];
+		const float* y2 = &window[2 * ch];
+		const float* y3 = &window[3 * ch];
+		for(unsigned int c = 0; c < ch; ++c)
+		{
+			float c1 = 0.5f * (y2[c] - y0[c]);
+			float c2 = y0[c] - 2.5f * y1[c] + 2.f * y2[c] - 0.5f * y3[c];
+			float c3 = 0.5f * (y3[c] - y0[c]) + 1.5f * (y1[c] - y2[c]);
+			interleaved[n * ch + c] = ((c3 * t + c2) * t + c1) * t + y1[c];
+		}
+		frac += ratio;
+		while(frac >= 1)
+		{
+			frac -= 1;
+			memmove(&window[0], &window[ch], 3 * ch * sizeof(float));
+			fetchFrame(fetchPos, &window[3 * ch]);
+			++fetchPos;
+		}
+	}
+	readStart.store((uint32_t)fetchPos, std::memory_order_release);
+	updateRate(end, frames);
+}
+
+void NetworkAudioReceiver::readAudio(BelaContext* context, unsigned int startChannel)
+{
+	float buffer[1024];
+	unsigned int chunk = sizeof(buffer) / sizeof(buffer[0]) / numChannels;
+	for(unsigned int start = 0; start < context->audioFrames; start += chunk)
+	{
+		unsigned int frames = context->audioFrames - start < chunk ? context->audioFrames - start : chunk;
+		read(buffer, frames);
+		for(unsigned int n = 0; n < frames; ++n)
+		{
+			for(unsigned int c = 0; c < numChannels; ++c)
+			{
+				unsigned int ch = startChannel + c;
+				if(ch < context->audioOutChannels)
+					audioWrite(context, start + n, ch, buffer[n * numChannels + c]);
+			}
+		}
+	}
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+bool NetworkAudioTest()
+{
+	const float in[] = { 0, 0.5, -0.5, -1, 1, 2, -2, 1.f / 8388608 };
+	const unsigned int count = sizeof(in) / sizeof(in[0]);
+	uint8_t buf[count * 4];
+	float out[count];
+	for(unsigned int f = 0; f < NetworkAudio::kNumFormats; ++f)
+	{
+		NetworkAudio::Format format = (NetworkAudio::Format)f;
+		NetworkAudio::encode(format, in, count, buf);
+		NetworkAudio::decode(format, buf, count, out);
+		assert(out[0] == 0 && out[1] == 0.5 && out[2] == -0.5 && out[3] == -1);
+		if(NetworkAudio::kFloat == format)
+		{
+			assert(!memcmp(in, out, sizeof(in)));
+			continue;
+		}
+		// out of range values are clipped
+		float max = 1 - 1.f / (NetworkAudio::kInt16 == format ? 32768 : 8388608);
+		assert(out[4] == max && out[5] == max && out[6] == -1);
+		assert(out[7] == (NetworkAudio::kInt24 == format ? in[7] : 0));
+	}
+	// network byte order
+	NetworkAudio::encode(NetworkAudio::kInt24, &in[1], 1, buf);
+	assert(0x40 == buf[0] && 0 == buf[1] && 0 == buf[2]);
+	printf("NetworkAudioTest successful\n");
+	return true;
+}
+
+// Feed the receiver with packets from a simulated sender whose clock is
+// faster than the receiver's, delivered through a simulated network.
+bool NetworkAudioReceiverTest()
+{
+	const float sampleRate = 44100;
+	const unsigned int packetFrames = 64;
+	const unsigned int blockFrames = 64;
+	const double skew = 1.0005;
+	const float value = 0.5;
+	NetworkAudioReceiver receiver;
+	assert(0 == receiver.setup(9997, 1, sampleRate));
+	struct Packet {
+		double arrival;
+		std::vector<uint8_t> data;
+	};
+	std::vector<Packet> network;
+	std::vector<float> in(packetFrames, value);
+	std::vector<float> out(blockFrames);
+	uint64_t sent = 0; // in the sender's frames
+	uint64_t now = sampleRate; // in the receiver's frames
+	uint16_t sequence = 0;
+	std::mt19937 rng(1);
+	// the extra delay of each packet, in frames. Negative to drop it
+	std::function<double(uint16_t)> delay = [](uint16_t) { return 0.; };
+	// run for a number of seconds. Returns the lowest output
+	auto run = [&](double seconds) {
+		float lowest = 1;
+		for(uint64_t stop = now + seconds * sampleRate; now < stop; now += blockFrames)
+		{
+			while(sent / skew < now + blockFrames)
+			{
+				Packet p;
+				p.data.resize(NetworkAudio::kHeaderSize + packetFrames * 4);
+				uint8_t* d = p.data.data();
+				d[0] = 0x80;
+				d[1] = NetworkAudio::kPayloadType + NetworkAudio::kFloat;
+				writeBe16(d + 2, sequence);
+				writeBe32(d + 4, sent);
+				writeBe32(d + 8, 1234);
+				NetworkAudio::encode(NetworkAudio::kFloat, in.data(), packetFrames, d + NetworkAudio::kHeaderSize);
+				double extra = delay(sequence);
+				// a packet is sent once its last frame is available
+				p.arrival = (sent + packetFrames) / skew + extra;
+				if(extra >= 0)
+					network.push_back(p);
+				++sequence;
+				sent += packetFrames;
+			}
+			std::stable_sort(network.begin(), network.end(), [](const Packet& a, const Packet& b) {
+				return a.arrival < b.arrival;
+			});
+			unsigned int n = 0;
+			for(; n < network.size() && network[n].arrival <= now; ++n)
+				receiver.handlePacket(network[n].data.data(), network[n].data.size(), network[n].arrival * (1000000000.0 / sampleRate));
+			network.erase(network.begin(), network.begin() + n);
+			receiver.read(out.data(), blockFrames);
+			assert(fabs(receiver.getRatio() - 1) <= NetworkAudioReceiver::kMaxRatioDeviation + 1e-9);
+			for(auto o : out)
+			{
+				// the interpolation may overshoot a little around a loss
+				assert(o > -0.01 && o < value + 0.01);
+				if(o < lowest)
+					lowest = o;
+			}
+		}
+		return lowest;
+	};
+
+	// the rate control tracks the drift without concealing anything
+	run(60);
+	assert(fabs(receiver.getRatio() - skew) < 0.0001);
+	assert(fabs(receiver.getLatency() - receiver.getTargetLatency()) < 16);
+	unsigned int concealed = receiver.getNumConcealed();
+	unsigned int resyncs = receiver.getNumResyncs();
+	assert(fabs(run(5) - value) < 1e-6);
+	assert(concealed == receiver.getNumConcealed());
+	assert(!receiver.getNumLost() && !receiver.getNumLate());
+
+	// a packet overtaken by the next one is still played
+	uint16_t target = sequence + 10;
+	delay = [&](uint16_t s) { return s == target ? packetFrames * 1.5 : 0; };
+	assert(fabs(run(1) - value) < 1e-6);
+	assert(concealed == receiver.getNumConcealed());
+	assert(!receiver.getNumLost() && !receiver.getNumLate());
+
+	// a lost packet is concealed, fading out, and then crossfaded back
+	target = sequence + 10;
+	delay = [&](uint16_t s) { return s == target ? -1 : 0; };
+	float lowest = run(1);
+	assert(lowest > 0 && lowest < value);
+	unsigned int lost = receiver.getNumConcealed() - concealed;
+	assert(lost >= packetFrames - 1 && lost <= packetFrames + 1);
+	assert(1 == receiver.getNumLost() && !receiver.getNumLate());
+	concealed = receiver.getNumConcealed();
+	assert(fabs(run(1) - value) < 1e-6);
+
+	// a packet that arrives after its time is counted as late rather than
+	// lost, and concealed
+	target = sequence + 10;
+	delay = [&](uint16_t s) { return s == target ? 2000 : 0; };
+	run(1);
+	assert(1 == receiver.getNumLost() && 1 == receiver.getNumLate());
+	assert(receiver.getNumConcealed() > concealed);
+	assert(resyncs == receiver.getNumResyncs());
+
+	// with a jittery network, the latency grows to accommodate the jitter
+	// and playback eventually stops concealing
+	float targetLatency = receiver.getTargetLatency();
+	std::uniform_real_distribution<double> dist(0, 300);
+	delay = [&](uint16_t) { return dist(rng); };
+	run(30);
+	assert(receiver.getJitter() > 20);
+	assert(receiver.getTargetLatency() > targetLatency + 100);
+	concealed = receiver.getNumConcealed();
+	assert(fabs(run(5) - value) < 1e-6);
+	assert(concealed == receiver.getNumConcealed());
+	assert(resyncs == receiver.getNumResyncs());
+	printf("NetworkAudioReceiverTest successful\n");
+	return true;
+}
+#endif
@@ -0,0 +1,281 @@
+#pragma once
+#include <Bela.h>
+#include <AuxTaskNonRT.h>
+#include <libraries/UdpClient/UdpClient.h>
+#include <libraries/UdpServer/UdpServer.h>
+#include <libraries/MessageBus/MessageBus.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Common definitions for NetworkAudioSender and NetworkAudioReceiver.
+ *
+ * Audio is sent over UDP as RTP packets (RFC 3550) of interleaved samples
+ * in network byte order. Each format has its own dynamic payload type,
+ * starting from kPayloadType. The RTP timestamp of a packet is the
+ * `audioFramesElapsed` of its first frame at the sender, so that the
+ * receiver can place it in time regardless of packets that are lost or
+ * reordered. The number of channels is not part of the stream: the sender
+ * and the receiver have to agree on it.
+ */
+class NetworkAudio
+{
+public:
+	enum Format {
+		kInt16, ///< 16-bit integers (L16)
+		kInt24, ///< 24-bit integers (L24)
+		kFloat, ///< 32-bit IEEE floats
+		kNumFormats,
+	};
+	/// The payload type of kInt16. The other formats follow.
+	static constexpr uint8_t kPayloadType = 96;
+	/// The size of the RTP header.
+	static constexpr unsigned int kHeaderSize = 12;
+	/// The maximum size of a packet, so that it fits in an Ethernet frame.
+	static constexpr unsigned int kMaxPacketSize = 1472;
+	static unsigned int getBytesPerSample(Format format);
+	/**
+	 * Convert samples to @p format, clipping them to [-1, 1) if needed.
+	 */
+	static void encode(Format format, const float* in, unsigned int count, uint8_t* out);
+	/**
+	 * Convert samples from @p format.
+	 */
+	static void decode(Format format, const uint8_t* in, unsigned int count, float* out);
+};
+
+/**
+ * Send audio to a NetworkAudioReceiver.
+ *
+ * write() converts the samples into packets on the caller's thread, without
+ * allocating memory or making system calls, and queues them on a lock-free
+ * buffer. The packets are sent by a separate thread.
+ */
+class NetworkAudioSender
+{
+public:
+	NetworkAudioSender() {};
+	NetworkAudioSender(const std::string& host, int port, unsigned int numChannels, NetworkAudio::Format format = NetworkAudio::kInt24, unsigned int maxFrames = 4096)
+	{
+		setup(host, port, numChannels, format, maxFrames);
+	}
+	~NetworkAudioSender();
+	/**
+	 * @param host the IP address of the receiver.
+	 * @param port the UDP port of the receiver.
+	 * @param numChannels the number of channels to send.
+	 * @param format the format of the samples.
+	 * @param maxFrames the largest number of frames that will be passed
+	 * to a single call to write().
+	 *
+	 * @return 0 on success, a negative value otherwise.
+	 */
+	int setup(const std::string& host, int port, unsigned int numChannels, NetworkAudio::Format format = NetworkAudio::kInt24, unsigned int maxFrames = 4096);
+	/**
+	 * Send some frames. Blocks are split into several packets if they
+	 * don't fit in one.
+	 *
+	 * @param interleaved the samples, interleaved.
+	 * @param frames the number of frames in @p interleaved.
+	 * @param framesElapsed the time of the first frame, usually
+	 * `context->audioFramesElapsed`.
+	 *
+	 * @return 0 on success, -1 if the frames had to be dropped because the
+	 * sending thread is not keeping up.
+	 */
+	int write(const float* interleaved, unsigned int frames, uint64_t framesElapsed);
+	/**
+	 * Send the audio inputs of the current block.
+	 *
+	 * @param context the context passed to render().
+	 * @param startChannel the first input channel to send. Channels that
+	 * don't exist are sent as silence.
+	 */
+	int writeAudio(BelaContext* context, unsigned int startChannel = 0);
+	/**
+	 * Get the number of packets that have been dropped because the
+	 * sending thread was not keeping up.
+	 */
+	unsigned int getNumDropped() const { return dropped.load(std::memory_order_relaxed); }
+private:
+	void flush();
+	std::unique_ptr<UdpClient> socket;
+	std::unique_ptr<MessageBus> bus;
+	std::unique_ptr<AuxTaskNonRT> sendTask;
+	std::atomic<bool> sendPending {false};
+	std::atomic<unsigned int> dropped {0};
+	std::vector<float> interleavedBuffer;
+	NetworkAudio::Format format;
+	unsigned int numChannels = 0;
+	unsigned int framesPerPacket = 0;
+	uint16_t sequence = 0;
+	uint32_t ssrc = 0;
+};
+
+/**
+ * Receive audio from a NetworkAudioSender, or any other source of RTP
+ * packets in one of the formats of NetworkAudio.
+ *
+ * A thread reads the packets as they arrive and writes their samples
+ * directly in their place in a ring buffer, according to their timestamp.
+ * read(), which is meant to be called from the audio thread, plays the ring
+ * buffer back with a delay that adapts to the jitter of the network. The
+ * playback rate is adjusted by a fraction of a percent to keep that delay
+ * constant when the sender's clock drifts with respect to the receiver's,
+ * interpolating the samples. Frames that didn't arrive in time are
+ * concealed by repeating the last frames received, fading out. The two
+ * threads only share lock-free state.
+ */
+class NetworkAudioReceiver
+{
+public:
+	/// The default minimum delay between receiving and playing a frame.
+	static constexpr unsigned int kDefaultMinLatency = 256;
+	/// The default maximum delay between receiving and playing a frame.
+	static constexpr unsigned int kDefaultMaxLatency = 8192;
+	/// The maximum deviation of the playback rate from the nominal one.
+	static constexpr double kMaxRatioDeviation = 0.002;
+	NetworkAudioReceiver() {};
+	NetworkAudioReceiver(int port, unsigned int numChannels, float sampleRate, unsigned int minLatency = kDefaultMinLatency, unsigned int maxLatency = kDefaultMaxLatency)
+	{
+		setup(port, numChannels, sampleRate, minLatency, maxLatency);
+	}
+	~NetworkAudioReceiver();
+	/**
+	 * Open the socket and start receiving.
+	 *
+	 * @param port the UDP port to receive on.
+	 * @param numChannels the number of channels in the stream.
+	 * @param sampleRate the sample rate of the stream and of the output.
+	 * @param minLatency the minimum delay, in frames, between the time a
+	 * frame is received and the time it is played.
+	 * @param maxLatency the maximum delay. If the delay gets longer than
+	 * this, e.g.: because a burst of packets arrives after a network
+	 * stall, playback skips ahead.
+	 *
+	 * @return 0 on success, a negative value otherwise.
+	 */
+	int setup(int port, unsigned int numChannels, float sampleRate, unsigned int minLatency = kDefaultMinLatency, unsigned int maxLatency = kDefaultMaxLatency);
+	/**
+	 * Get the next frames of the stream. Outputs silence until the
+	 * first packet is received.
+	 *
+	 * @param interleaved where to store the interleaved samples.
+	 * @param frames the number of frames to get.
+	 */
+	void read(float* interleaved, unsigned int frames);
+	/**
+	 * Get the next block of the stream and write it to the audio outputs.
+	 *
+	 * @param context the context passed to render().
+	 * @param startChannel the first output channel to write to.
+	 */
+	void readAudio(BelaContext* context, unsigned int startChannel = 0);
+	/**
+	 * Get the current delay, in frames, between the most recent frame
+	 * received and the frame being played, averaged over about a second.
+	 */
+	float getLatency() const { return latency; }
+	/**
+	 * Get the delay that the rate control is aiming at, which depends on
+	 * the jitter of the network.
+	 */
+	float getTargetLatency() const { return targetLatency; }
+	/**
+	 * Get the current ratio between the playback rate and the nominal
+	 * rate.
+	 */
+	double getRatio() const { return ratio; }
+	/**
+	 * Get the interarrival jitter, in frames, as defined by RFC 3550.
+	 */
+	float getJitter() const { return jitter.load(std::memory_order_relaxed); }
+	unsigned int getNumReceived() const { return numReceived.load(std::memory_order_relaxed); }
+	/**
+	 * Get the number of packets that have not been received, according to
+	 * their sequence numbers.
+	 */
+	unsigned int getNumLost() const { return numLost.load(std::memory_order_relaxed); }
+	/**
+	 * Get the number of packets that arrived too late to be played.
+	 */
+	unsigned int getNumLate() const { return numLate.load(std::memory_order_relaxed); }
+	/**
+	 * Get the number of frames that have been concealed.
+	 */
+	unsigned int getNumConcealed() const { return numConcealed; }
+	/**
+	 * Get the number of times playback had to skip because the delay was
+	 * out of range.
+	 */
+	unsigned int getNumResyncs() const { return numResyncs; }
+private:
+	friend bool NetworkAudioReceiverTest();
+	void receiveLoop();
+	void handlePacket(const uint8_t* data, unsigned int size, uint64_t timestampNs);
+	void fetchFrame(uint64_t frame, float* out);
+	void resync(uint64_t end);
+	void updateRate(uint64_t end, unsigned int frames);
+	std::unique_ptr<UdpServer> socket;
+	std::thread receiveThread;
+	std::atomic<bool> shouldStop {false};
+	unsigned int numChannels = 0;
+	float sampleRate = 44100;
+	unsigned int minLatency = 0;
+	unsigned int maxLatency = 0;
+
+	// the ring buffer. Frames are stored at their timestamp modulo
+	// capacity. Timestamps on the shared state are 32-bit, as in RTP.
+	std::vector<float> samples;
+	// for each frame, its timestamp + 1, stored after its samples
+	std::unique_ptr<std::atomic<uint32_t>[]> stamps;
+	uint32_t capacity = 0;
+	// the end of the most recent packet
+	std::atomic<uint32_t> writeEnd {0};
+	// the oldest frame the reader may still read. Older frames are
+	// dropped and newer frames are not written until it moves on, so
+	// that the writer never overwrites a frame being read.
+	std::atomic<uint32_t> readStart {0};
+	std::atomic<bool> started {false};
+	std::atomic<uint32_t> packetFrames {0};
+	std::atomic<float> jitter {0};
+	std::atomic<unsigned int> numReceived {0};
+	std::atomic<unsigned int> numLost {0};
+	std::atomic<unsigned int> numLate {0};
+
+	// only accessed by the receiving thread
+	uint32_t ssrc = 0;
+	uint32_t timestampOffset = 0;
+	uint16_t expectedSequence = 0;
+	uint32_t lastTimestamp = 0;
+	double lastArrival = 0;
+
+	// only accessed by read()
+	bool playing = false;
+	// the next frame to be fetched from the ring buffer
+	uint64_t fetchPos = 0;
+	// the position of the output between window[1] and window[2]
+	double frac = 0;
+	std::vector<float> window; // 4 frames, for the interpolation
+	double ratio = 1;
+	double drift = 0;
+	float latency = 0;
+	float targetLatency = 0;
+	uint32_t lastEnd = 0;
+	// packet loss concealment
+	std::vector<float> history; // the last frames received
+	unsigned int historyFrames = 0;
+	unsigned int historyPos = 0;
+	unsigned int concealPos = 0;
+	float concealGain = 0;
+	unsigned int lossFrames = 0;
+	unsigned int concealFrames = 0;
+	unsigned int crossfade = 0;
+	unsigned int fadeIn = 0;
+	unsigned int numConcealed = 0;
+	unsigned int numResyncs = 0;
+};
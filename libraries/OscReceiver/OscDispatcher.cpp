@@ -0,0 +1,433 @@
+#include "OscDispatcher.h"
+#include <algorithm>
+#include <string.h>
+#include <arpa/inet.h>
+
+constexpr unsigned int OscMessageView::kMaxArgs;
+constexpr unsigned int OscDispatcher::kParameterQueueSize;
+constexpr unsigned int OscDispatcher::kMaxBundleDepth;
+
+static uint32_t readUint32(const char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static uint64_t readUint64(const char* p)
+{
+	return ((uint64_t)readUint32(p) << 32) | readUint32(p + 4);
+}
+
+// get past a null-terminated string, padded to a multiple of 4 bytes
+static const char* skipString(const char* p, const char* end)
+{
+	const char* nul = (const char*)memchr(p, 0, end - p);
+	if(!nul)
+		return nullptr;
+	size_t len = (nul - p + 4) & ~3;
+	if(len > (size_t)(end - p))
+		return nullptr;
+	return p + len;
+}
+
+bool OscMessageView::parse(const char* data, size_t size)
+{
+	const char* end = data + size;
+	numArgs = 0;
+	typeTags = "";
+	address = "";
+	if(!size || '/' != data[0])
+		return false;
+	const char* p = skipString(data, end);
+	if(!p)
+		return false;
+	address = data;
+	if(p == end)
+		return true; // no type tags
+	if(',' != *p)
+		return false;
+	const char* tags = p + 1;
+	p = skipString(p, end);
+	if(!p)
+		return false;
+	for(const char* t = tags; *t; ++t)
+	{
+		if(numArgs >= kMaxArgs)
+			return false;
+		args[numArgs++] = p;
+		size_t argSize;
+		switch(*t)
+		{
+		case 'i':
+		case 'f':
+		case 'c':
+		case 'r':
+		case 'm':
+			argSize = 4;
+			break;
+		case 'h':
+		case 'd':
+		case 't':
+			argSize = 8;
+			break;
+		case 's':
+		case 'S':
+		{
+			const char* next = skipString(p, end);
+			if(!next)
+				return false;
+			argSize = next - p;
+			break;
+		}
+		case 'b':
+		{
+			if(end - p < 4)
+				return false;
+			// check the declared size before padding it, so that it
+			// can't wrap around
+			uint64_t blobSize = readUint32(p);
+			if(blobSize > (uint64_t)(end - p - 4))
+				return false;
+			argSize = 4 + ((blobSize + 3) & ~3);
+			break;
+		}
+		case 'T':
+		case 'F':
+		case 'N':
+		case 'I':
+		case '[':
+		case ']':
+			argSize = 0;
+			break;
+		default:
+			return false;
+		}
+		if(argSize > (size_t)(end - p))
+			return false;
+		p += argSize;
+	}
+	typeTags = tags;
+	return true;
+}
+
+bool OscMessageView::isNumber(unsigned int n) const
+{
+	char type = getType(n);
+	return 'i' == type || 'f' == type || 'h' == type || 'd' == type;
+}
+
+float OscMessageView::getFloat(unsigned int n) const
+{
+	switch(getType(n))
+	{
+	case 'f':
+	{
+		uint32_t v = readUint32(args[n]);
+		float f;
+		memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+	case 'd':
+	{
+		uint64_t v = readUint64(args[n]);
+		double d;
+		memcpy(&d, &v, sizeof(d));
+		return d;
+	}
+	case 'i':
+		return (int32_t)readUint32(args[n]);
+	case 'h':
+		return (int64_t)readUint64(args[n]);
+	default:
+		return 0;
+	}
+}
+
+int32_t OscMessageView::getInt(unsigned int n) const
+{
+	switch(getType(n))
+	{
+	case 'i':
+		return readUint32(args[n]);
+	case 'f':
+		return getFloat(n);
+	default:
+		return 0;
+	}
+}
+
+bool OscMessageView::getBool(unsigned int n) const
+{
+	char type = getType(n);
+	if('T' == type || 'F' == type)
+		return 'T' == type;
+	return getFloat(n) != 0;
+}
+
+const char* OscMessageView::getString(unsigned int n) const
+{
+	char type = getType(n);
+	if('s' == type || 'S' == type)
+		return args[n];
+	return "";
+}
+
+const void* OscMessageView::getBlob(unsigned int n, size_t& size) const
+{
+	if('b' != getType(n))
+	{
+		size = 0;
+		return nullptr;
+	}
+	size = readUint32(args[n]);
+	return args[n] + 4;
+}
+
+void OscParameter::setup(float initial, unsigned int rampFrames)
+{
+	value = target = initial;
+	remaining = 0;
+	this->rampFrames = rampFrames;
+}
+
+void OscParameter::setTarget(float target)
+{
+	this->target = target;
+	if(rampFrames)
+	{
+		increment = (target - value) / rampFrames;
+		remaining = rampFrames;
+	} else {
+		value = target;
+		remaining = 0;
+	}
+}
+
+int OscDispatcher::addHandler(const std::string& address, Handler handler, void* callbackArg, const char* typeTags)
+{
+	if(!handler)
+		return -1;
+	Route route {};
+	route.handler = handler;
+	route.arg = callbackArg;
+	route.checkTypeTags = (nullptr != typeTags);
+	if(typeTags)
+		route.typeTags = typeTags;
+	return addRoute(address, std::move(route));
+}
+
+int OscDispatcher::addParameter(const std::string& address, OscParameter& parameter, unsigned int argIndex)
+{
+	if(!parameterUpdates.capacity())
+		parameterUpdates.setup(kParameterQueueSize);
+	Route route {};
+	route.parameter = &parameter;
+	route.argIndex = argIndex;
+	return addRoute(address, std::move(route));
+}
+
+int OscDispatcher::findChild(const Node& node, const char* name, size_t length) const
+{
+	auto it = std::lower_bound(node.children.begin(), node.children.end(), 0,
+		[this, name, length](unsigned int child, int) {
+			return nodes[child].name.compare(0, std::string::npos, name, length) < 0;
+		});
+	if(it != node.children.end() && !nodes[*it].name.compare(0, std::string::npos, name, length))
+		return *it;
+	return -1;
+}
+
+int OscDispatcher::addRoute(const std::string& address, Route&& route)
+{
+	if(address.size() < 2 || '/' != address[0] || '/' == address.back())
+		return -1;
+	if(nodes.empty())
+		nodes.emplace_back(); // the root
+	unsigned int idx = 0;
+	size_t start = 1;
+	while(start <= address.size())
+	{
+		size_t end = address.find('/', start);
+		if(std::string::npos == end)
+			end = address.size();
+		if(end == start)
+			return -1; // empty component
+		std::string name = address.substr(start, end - start);
+		int child;
+		if("*" == name)
+		{
+			child = nodes[idx].wildcard;
+			if(child < 0)
+			{
+				child = nodes.size();
+				nodes.emplace_back();
+				nodes[child].name = name;
+				nodes[idx].wildcard = child;
+			}
+		} else {
+			child = findChild(nodes[idx], name.c_str(), name.size());
+			if(child < 0)
+			{
+				child = nodes.size();
+				nodes.emplace_back();
+				nodes[child].name = name;
+				std::vector<unsigned int>& children = nodes[idx].children;
+				auto it = std::lower_bound(children.begin(), children.end(), name,
+					[this](unsigned int c, const std::string& n) {
+						return nodes[c].name < n;
+					});
+				children.insert(it, child);
+			}
+		}
+		idx = child;
+		start = end + 1;
+	}
+	nodes[idx].routes.push_back(routes.size());
+	routes.push_back(std::move(route));
+	return 0;
+}
+
+// address points to the '/' that precedes the next component of the
+// received address, or to its end
+unsigned int OscDispatcher::match(unsigned int idx, const char* address, const OscMessageView& msg)
+{
+	if(!*address)
+	{
+		unsigned int handled = 0;
+		for(auto r : nodes[idx].routes)
+		{
+			Route& route = routes[r];
+			if(route.parameter)
+			{
+				if(!msg.isNumber(route.argIndex))
+					continue;
+				if(!parameterUpdates.push({route.parameter, msg.getFloat(route.argIndex)}))
+					dropped.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				if(route.checkTypeTags && route.typeTags != msg.getTypeTags())
+					continue;
+				route.handler(msg, route.arg);
+			}
+			++handled;
+		}
+		return handled;
+	}
+	const char* name = address + 1;
+	const char* end = strchr(name, '/');
+	if(!end)
+		end = name + strlen(name);
+	unsigned int handled = 0;
+	int child = findChild(nodes[idx], name, end - name);
+	if(child >= 0)
+		handled += match(child, end, msg);
+	// components without `*` take precedence
+	if(!handled && nodes[idx].wildcard >= 0 && end != name)
+		handled += match(nodes[idx].wildcard, end, msg);
+	return handled;
+}
+
+int OscDispatcher::dispatchPacket(const char* data, size_t size, unsigned int depth, void (*unhandled)(const char*, size_t, void*), void* arg)
+{
+	if(size >= 8 && !memcmp(data, "#bundle", 8))
+	{
+		// skip the time tag: messages are dispatched as soon as they
+		// are received
+		if(size < 16 || depth >= kMaxBundleDepth)
+			return -1;
+		const char* p = data + 16;
+		const char* end = data + size;
+		int handled = 0;
+		while(end - p >= 4)
+		{
+			uint32_t elementSize = readUint32(p);
+			p += 4;
+			if(elementSize > (size_t)(end - p))
+				return -1;
+			int ret = dispatchPacket(p, elementSize, depth + 1, unhandled, arg);
+			if(ret < 0)
+				return ret;
+			handled += ret;
+			p += elementSize;
+		}
+		return handled;
+	}
+	if(!view.parse(data, size))
+		return -1;
+	if(nodes.empty() || !match(0, view.getAddress(), view))
+	{
+		if(unhandled)
+			unhandled(data, size, arg);
+		return 0;
+	}
+	return 1;
+}
+
+int OscDispatcher::dispatch(const char* data, size_t size, void (*unhandled)(const char* data, size_t size, void* arg), void* arg)
+{
+	return dispatchPacket(data, size, 0, unhandled, arg);
+}
+
+void OscDispatcher::updateParameters()
+{
+	ParameterUpdate update;
+	while(parameterUpdates.pop(update))
+		update.parameter->setTarget(update.value);
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <oscpkt.hh>
+static unsigned int faders;
+static float lastFader;
+bool OscDispatcherTest()
+{
+	OscDispatcher dispatcher;
+	OscParameter gain(0, 4);
+	unsigned int unhandled = 0;
+	auto nop = [](const OscMessageView&, void*) {};
+	assert(-1 == dispatcher.addHandler("fader", nop));
+	assert(-1 == dispatcher.addHandler("/fader//1", nop));
+	assert(-1 == dispatcher.addHandler("/fader", nullptr));
+	dispatcher.addHandler("/fader/*/value", [](const OscMessageView& msg, void* arg) {
+		++faders;
+		lastFader = msg.getFloat(0);
+		assert(!strcmp("s", msg.getTypeTags() + 1));
+		assert(!strcmp("hello", msg.getString(1)));
+	}, nullptr, "fs");
+	dispatcher.addParameter("/mixer/gain", gain, 1);
+	dispatcher.addHandler("/mixer/*", [](const OscMessageView& msg, void* arg) {
+		assert(!strcmp("/mixer/pan", msg.getAddress()));
+	});
+	oscpkt::PacketWriter pw;
+	oscpkt::Message m1("/fader/3/value");
+	m1.pushFloat(0.5).pushStr("hello");
+	oscpkt::Message m2("/fader/3/value");
+	m2.pushInt32(1); // wrong type tags
+	oscpkt::Message m3("/mixer/gain");
+	m3.pushStr("x").pushInt32(8);
+	oscpkt::Message m4("/mixer");
+	oscpkt::Message m5("/mixer/pan");
+	pw.startBundle().addMessage(m1).addMessage(m2).startBundle().addMessage(m3).endBundle().addMessage(m4).addMessage(m5).endBundle();
+	auto count = [](const char* data, size_t size, void* arg) { ++*(unsigned int*)arg; };
+	assert(3 == dispatcher.dispatch(pw.packetData(), pw.packetSize(), count, &unhandled));
+	assert(1 == faders && 0.5 == lastFader && 2 == unhandled);
+	// parameters are updated when the audio thread asks for it
+	assert(0 == gain.process());
+	dispatcher.updateParameters();
+	assert(2 == gain.process() && 4 == gain.process() && 6 == gain.process() && 8 == gain.process() && 8 == gain.process());
+	// truncated packets are rejected
+	pw.init().addMessage(m1);
+	assert(-1 == dispatcher.dispatch(pw.packetData(), pw.packetSize() - 4));
+	// and so are blobs larger than the packet
+	const char badBlob[] = "/b\0\0,b\0\0\xff\xff\xff\xff";
+	OscMessageView view;
+	assert(!view.parse(badBlob, sizeof(badBlob) - 1));
+	const char badBlob2[] = "/b\0\0,b\0\0\xff\xff\xff\xfc";
+	assert(!view.parse(badBlob2, sizeof(badBlob2) - 1));
+	printf("OscDispatcherTest successful\n");
+	return true;
+}
+#endif
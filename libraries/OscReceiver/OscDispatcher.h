@@ -0,0 +1,236 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <SpscQueue.h>
+
+/**
+ * A read-only view of an OSC message, pointing into the received packet.
+ *
+ * The arguments are located once when the message is parsed and are
+ * converted from network byte order when they are accessed, so that
+ * nothing is copied. A view is only valid for the duration of the handler
+ * it is passed to.
+ */
+class OscMessageView
+{
+public:
+	/// The maximum number of arguments in a message.
+	static constexpr unsigned int kMaxArgs = 64;
+	/**
+	 * Parse a single OSC message (not a bundle).
+	 *
+	 * @return true on success, false if the message is malformed.
+	 */
+	bool parse(const char* data, size_t size);
+	/**
+	 * Get the address of the message, e.g.: `/fader/1`.
+	 */
+	const char* getAddress() const { return address; }
+	/**
+	 * Get the type tags of the message, without the leading `,`.
+	 */
+	const char* getTypeTags() const { return typeTags; }
+	unsigned int getNumArgs() const { return numArgs; }
+	/**
+	 * Get the type tag of an argument, or 0 if @p n is out of range.
+	 */
+	char getType(unsigned int n) const { return n < numArgs ? typeTags[n] : 0; }
+	/**
+	 * Whether an argument is a number (`i`, `f`, `h` or `d`) that can be
+	 * read with getFloat().
+	 */
+	bool isNumber(unsigned int n) const;
+	/**
+	 * Get an `f` or `d` argument, also converting `i` and `h` arguments.
+	 * Other arguments return 0.
+	 */
+	float getFloat(unsigned int n) const;
+	/**
+	 * Get an `i` argument, also converting `f` arguments. Other arguments
+	 * return 0.
+	 */
+	int32_t getInt(unsigned int n) const;
+	/**
+	 * Get a `T` or `F` argument. Other arguments return whether they are
+	 * non-zero numbers.
+	 */
+	bool getBool(unsigned int n) const;
+	/**
+	 * Get an `s` or `S` argument, or an empty string.
+	 */
+	const char* getString(unsigned int n) const;
+	/**
+	 * Get a `b` argument.
+	 *
+	 * @param n the index of the argument.
+	 * @param size the size of the blob.
+	 *
+	 * @return a pointer to the content of the blob, or `nullptr`.
+	 */
+	const void* getBlob(unsigned int n, size_t& size) const;
+private:
+	const char* address = "";
+	const char* typeTags = "";
+	unsigned int numArgs = 0;
+	const char* args[kMaxArgs];
+};
+
+/**
+ * A parameter controlled via OSC, which ramps smoothly towards the latest
+ * value received. See OscDispatcher::addParameter().
+ */
+class OscParameter
+{
+public:
+	OscParameter() {};
+	/**
+	 * @param initial the initial value.
+	 * @param rampFrames the duration of the ramp towards a new value, in
+	 * samples.
+	 */
+	OscParameter(float initial, unsigned int rampFrames = 0) { setup(initial, rampFrames); }
+	void setup(float initial, unsigned int rampFrames = 0);
+	void setRampFrames(unsigned int rampFrames) { this->rampFrames = rampFrames; }
+	/**
+	 * Start a ramp towards @p target.
+	 */
+	void setTarget(float target);
+	/**
+	 * Get the next value of the ramp. Call this once per sample.
+	 */
+	float process()
+	{
+		if(remaining)
+		{
+			if(--remaining)
+				value += increment;
+			else
+				value = target;
+		}
+		return value;
+	}
+	float getValue() const { return value; }
+	float getTarget() const { return target; }
+private:
+	float value = 0;
+	float target = 0;
+	float increment = 0;
+	unsigned int rampFrames = 0;
+	unsigned int remaining = 0;
+};
+
+/**
+ * Route OSC messages to handlers according to their address.
+ *
+ * Addresses are split into their components when a handler is added, and
+ * stored in a tree that is walked when a message is received, without
+ * allocating memory or taking locks. A component can be a single `*`,
+ * which matches any one component of a received address, so that one
+ * handler can receive `/track/1`, `/track/2` and so on. If an address
+ * matches both a component and a `*`, only the handlers for the component
+ * are called. Pattern matching in the received addresses is not supported.
+ *
+ * Handlers and parameters have to be added before messages start being
+ * dispatched: the tree is not modified after that.
+ */
+class OscDispatcher
+{
+public:
+	/// The maximum number of parameter updates waiting to be read by
+	/// the audio thread.
+	static constexpr unsigned int kParameterQueueSize = 1024;
+	/// The maximum nesting of bundles.
+	static constexpr unsigned int kMaxBundleDepth = 8;
+	typedef std::function<void(const OscMessageView& msg, void* arg)> Handler;
+	/**
+	 * Add a handler for an address.
+	 *
+	 * @param address the address, which can contain `*` components.
+	 * @param handler the function which messages to @p address are
+	 * passed to. It is called on the thread that calls dispatch().
+	 * @param callbackArg an argument to pass to @p handler.
+	 * @param typeTags if not `nullptr`, the handler is only called for
+	 * messages with these type tags (without the leading `,`), so that it
+	 * can read the arguments without checking their type.
+	 *
+	 * @return 0 on success, -1 if @p address or @p handler are not
+	 * valid.
+	 */
+	int addHandler(const std::string& address, Handler handler, void* callbackArg = nullptr, const char* typeTags = nullptr);
+	/**
+	 * Forward the value of a numeric argument of the messages to an
+	 * address to an OscParameter used by the audio thread. The values are
+	 * passed through a lock-free queue and applied when
+	 * updateParameters() is called.
+	 *
+	 * @param address the address, which can contain `*` components.
+	 * @param parameter the parameter. It must be valid for as long as
+	 * messages are dispatched.
+	 * @param argIndex the index of the argument to use.
+	 *
+	 * @return 0 on success, -1 if @p address is not valid.
+	 */
+	int addParameter(const std::string& address, OscParameter& parameter, unsigned int argIndex = 0);
+	/**
+	 * Apply the values received since the last call to the parameters.
+	 * Call this once per block from the audio thread.
+	 */
+	void updateParameters();
+	/**
+	 * Get the number of parameter updates that have been dropped
+	 * because updateParameters() wasn't called often enough.
+	 */
+	unsigned int getNumDropped() const { return dropped.load(std::memory_order_relaxed); }
+	/**
+	 * Dispatch the messages contained in an OSC packet, which can be a
+	 * message or a bundle.
+	 *
+	 * @param data the packet.
+	 * @param size the size of the packet.
+	 * @param unhandled if not `nullptr`, this is called for each message
+	 * that no handler or parameter was added for, with the bytes of the
+	 * message.
+	 * @param arg an argument to pass to @p unhandled.
+	 *
+	 * @return the number of messages in the packet that were handled, or
+	 * -1 if the packet is malformed.
+	 */
+	int dispatch(const char* data, size_t size, void (*unhandled)(const char* data, size_t size, void* arg) = nullptr, void* arg = nullptr);
+	/**
+	 * Whether any handler or parameter has been added.
+	 */
+	bool empty() const { return routes.empty(); }
+private:
+	struct Route {
+		Handler handler;
+		void* arg;
+		std::string typeTags;
+		bool checkTypeTags;
+		OscParameter* parameter;
+		unsigned int argIndex;
+	};
+	struct Node {
+		std::string name;
+		std::vector<unsigned int> children; // sorted by name
+		int wildcard = -1; // the `*` child
+		std::vector<unsigned int> routes;
+	};
+	struct ParameterUpdate {
+		OscParameter* parameter;
+		float value;
+	};
+	int addRoute(const std::string& address, Route&& route);
+	int findChild(const Node& node, const char* name, size_t length) const;
+	unsigned int match(unsigned int node, const char* address, const OscMessageView& msg);
+	int dispatchPacket(const char* data, size_t size, unsigned int depth, void (*unhandled)(const char*, size_t, void*), void* arg);
+	std::vector<Node> nodes;
+	std::vector<Route> routes;
+	SpscQueue<ParameterUpdate> parameterUpdates;
+	std::atomic<unsigned int> dropped {0};
+	OscMessageView view;
+};
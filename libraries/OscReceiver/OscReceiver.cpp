@@ -5,6 +5,8 @@
 constexpr unsigned int OscReceiverBlockReadUs = 50000;
 constexpr unsigned int OscReceiverSleepBetweenReadsUs = 5000;
 constexpr unsigned int OscReceiverInBufferSize = 65536; // maximum UDP packet size
+constexpr unsigned int OscReceiverBatchSize = 16; // maximum number of packets read at once
+constexpr int OscReceiverSocketBufferSize = 262144; // absorb bursts from several controllers
 
 OscReceiver::OscReceiver(){}
 OscReceiver::OscReceiver(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive, void* callbackArg){
@@ -36,8 +38,6 @@ void OscReceiver::receive_task_func(){
 
 void OscReceiver::setup(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> _on_receive, void* callbackArg)
 {
-	inBuffer.resize(OscReceiverInBufferSize);
-
 	onReceiveArg = callbackArg;
 	on_receive = _on_receive;
 	pr = std::unique_ptr<oscpkt::PacketReader>(new oscpkt::PacketReader());
@@ -47,27 +47,62 @@ void OscReceiver::setup(int port, std::function<void(oscpkt::Message* msg, const
 		fprintf(stderr, "OscReceiver: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
 		return;
 	}
+	if(socket->setupBatch(OscReceiverBatchSize, OscReceiverInBufferSize)){
+		fprintf(stderr, "OscReceiver: Unable to allocate receive buffers\n");
+		return;
+	}
+	socket->setReceiveBufferSize(OscReceiverSocketBufferSize);
 	receive_task = std::unique_ptr<std::thread>(new std::thread(&OscReceiver::receive_task_func, this));
 }
 
+int OscReceiver::addHandler(const std::string& address, OscDispatcher::Handler handler, void* callbackArg, const char* typeTags)
+{
+	if(receive_task)
+	{
+		fprintf(stderr, "OscReceiver: handlers must be added before setup()\n");
+		return -1;
+	}
+	return dispatcher.addHandler(address, handler, callbackArg, typeTags);
+}
+
+int OscReceiver::addParameter(const std::string& address, OscParameter& parameter, unsigned int argIndex)
+{
+	if(receive_task)
+	{
+		fprintf(stderr, "OscReceiver: parameters must be added before setup()\n");
+		return -1;
+	}
+	return dispatcher.addParameter(address, parameter, argIndex);
+}
+
+void OscReceiver::unhandledCallback(const char* data, size_t size, void* arg)
+{
+	OscReceiver* that = (OscReceiver*)arg;
+	const struct sockaddr_in& from = *that->currentFrom;
+	std::string addr = std::string(inet_ntoa(from.sin_addr)) + ":" + std::to_string(from.sin_port);
+	that->pr->init(data, size);
+	if (!that->pr->isOk()){
+		fprintf(stderr, "OscReceiver: oscpkt error parsing received message: %i\n", that->pr->getErr());
+		return;
+	}
+	that->on_receive(that->pr->popMessage(), addr.c_str(), that->onReceiveArg);
+}
+
 int OscReceiver::waitForMessage(int timeout){
-	int ret = socket->waitUntilReady(true, timeout);
-	if (ret == -1){
-		fprintf(stderr, "OscReceiver: Error polling UDP socket: %d %s\n", errno, strerror(errno));
+	// read all the packets that are available in one go
+	int ret = socket->readBatch(timeout);
+	if (ret < 0){
+		fprintf(stderr, "OscReceiver: Error reading UDP socket: %d %s\n", errno, strerror(errno));
 		return -1;
-	} else if(ret == 1){
-		int msgLength = socket->read(inBuffer.data(), inBuffer.size(), false);
-		if (msgLength < 0){
-			fprintf(stderr, "OscReceiver: Error reading UDP socket: %d %s\n", errno, strerror(errno));
-			return -1;
-		}
-		std::string addr = std::string(socket->getLastRecvAddr()) + ":" + std::to_string(socket->getLastRecvPort());
-		pr->init(inBuffer.data(), msgLength);
-		if (!pr->isOk()){
-			fprintf(stderr, "OscReceiver: oscpkt error parsing received message: %i\n", pr->getErr());
-			return ret;
-		}
-		on_receive(pr->popMessage(), addr.c_str(), onReceiveArg);
+	}
+	for(int n = 0; n < ret; ++n){
+		const UdpServer::Packet& packet = socket->getPacket(n);
+		currentFrom = &packet.from;
+		if(!dispatcher.empty()){
+			if(dispatcher.dispatch((const char*)packet.data, packet.size, on_receive ? unhandledCallback : nullptr, this) < 0)
+				fprintf(stderr, "OscReceiver: error parsing received message\n");
+		} else if(on_receive)
+			unhandledCallback((const char*)packet.data, packet.size, this);
 	}
 	return ret;
 }
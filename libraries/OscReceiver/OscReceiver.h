@@ -4,8 +4,10 @@
 #include <memory>
 #include <vector>
 #include <oscpkt.hh>
+#include "OscDispatcher.h"
 
 class UdpServer;
+struct sockaddr_in;
 namespace std {
 	class thread;
 };
@@ -18,12 +20,17 @@ namespace std {
  * OscReceiver::setup() by the user, is run off the audio thread at
  * non-realtime priority.
  *
+ * Alternatively, handlers for specific addresses can be added with
+ * addHandler() and addParameter() before calling setup(). Received messages
+ * are then routed by an OscDispatcher, and the onreceive callback only
+ * receives the messages that are not handled otherwise.
+ *
  * For documentation of oscpkt see http://gruntthepeon.free.fr/oscpkt/
  */
 class OscReceiver{
 public:
 	OscReceiver();
-	OscReceiver(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive, void* callbackArg = nullptr);
+	OscReceiver(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive = nullptr, void* callbackArg = nullptr);
 	~OscReceiver();
 
 	/**
@@ -32,11 +39,38 @@ public:
 	* Must be called once during setup()
 	*
 	* @param port the port number used to receive OSC messages
-	* @param on_receive the callback function which received OSC messages are passed to
+	* @param on_receive the callback function which received OSC messages are passed to.
+	* If handlers have been added, it only receives the messages that are not handled.
 	* @param callbackArg an argument to pass to the callback
 	*
 	*/
-	void setup(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive, void* callbackArg = nullptr);
+	void setup(int port, std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive = nullptr, void* callbackArg = nullptr);
+
+	/**
+	* \brief Adds a handler for the messages to an address
+	*
+	* Must be called before setup(). See OscDispatcher::addHandler().
+	*
+	* @return 0 on success, -1 otherwise.
+	*/
+	int addHandler(const std::string& address, OscDispatcher::Handler handler, void* callbackArg = nullptr, const char* typeTags = nullptr);
+
+	/**
+	* \brief Forwards the messages to an address to an OscParameter
+	*
+	* Must be called before setup(). See OscDispatcher::addParameter().
+	*
+	* @return 0 on success, -1 otherwise.
+	*/
+	int addParameter(const std::string& address, OscParameter& parameter, unsigned int argIndex = 0);
+
+	/**
+	* \brief Applies the values received to the parameters
+	*
+	* Call this once per block from render(), before processing the
+	* parameters.
+	*/
+	void updateParameters() { dispatcher.updateParameters(); }
 
 private:
 	bool lShouldStop = false;
@@ -48,10 +82,14 @@ private:
 	std::unique_ptr<std::thread> receive_task;
 
 	void receive_task_func();
+	static void unhandledCallback(const char* data, size_t size, void* arg);
 
 	std::unique_ptr<oscpkt::PacketReader> pr;
-	std::vector<char> inBuffer;
+	// the sender of the packet being handled
+	const struct sockaddr_in* currentFrom = nullptr;
 
 	std::function<void(oscpkt::Message* msg, const char* addr, void* arg)> on_receive;
 	void* onReceiveArg = nullptr;
+
+	OscDispatcher dispatcher;
 };
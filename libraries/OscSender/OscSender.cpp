@@ -4,9 +4,11 @@
 #include <libraries/UdpClient/UdpClient.h>
 #include <oscpkt.hh>
 #include <AuxTaskNonRT.h>
+#include <libraries/MessageBus/MessageBus.h>
 
 #define OSCSENDER_MAX_ARGS 1024
 #define OSCSENDER_MAX_BYTES 65536
+#define OSCSENDER_BUFFER_SIZE 262144 // packets waiting to be sent
 
 OscSender::OscSender(){}
 OscSender::OscSender(int port, std::string ip_address){
@@ -14,9 +16,27 @@ OscSender::OscSender(int port, std::string ip_address){
 }
 OscSender::~OscSender(){}
 
-void OscSender::send_task_func(void* buf, int size){
-	OscSender* instance = this;
-	instance->socket->send(buf, size);
+// Send all the packets written so far, passing several of them to each
+// system call. This runs on send_task.
+void OscSender::send_task_func(){
+	sendPending = false;
+	MessageBus::Message messages[UdpClient::kMaxBatch];
+	const void* data[UdpClient::kMaxBatch];
+	unsigned int sizes[UdpClient::kMaxBatch];
+	bool more = true;
+	while(more){
+		unsigned int n = 0;
+		while(n < UdpClient::kMaxBatch && (more = bus->read(messages[n]))){
+			data[n] = messages[n].data;
+			sizes[n] = messages[n].size;
+			++n;
+		}
+		if(!n)
+			break;
+		socket->sendBatch(data, sizes, n);
+		for(unsigned int k = 0; k < n; ++k)
+			bus->release(messages[k]);
+	}
 }
 
 void OscSender::setup(int port, std::string ip_address){
@@ -27,9 +47,10 @@ void OscSender::setup(int port, std::string ip_address){
     
     socket = std::unique_ptr<UdpClient>(new UdpClient());
 	socket->setup(port, ip_address.c_str());
-	
+
+	bus = std::unique_ptr<MessageBus>(new MessageBus(OSCSENDER_BUFFER_SIZE));
 	send_task = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
-	send_task->create(std::string("OscSndrTsk_") + ip_address + std::to_string(port), [this](void* buf, int size){send_task_func(buf, size); });
+	send_task->create(std::string("OscSndrTsk_") + ip_address + std::to_string(port), [this](){ send_task_func(); });
 }
 
 OscSender &OscSender::newMessage(std::string address){
@@ -58,12 +79,16 @@ OscSender &OscSender::add(void *ptr, size_t num_bytes){
 	return *this;
 }
 
-void OscSender::send(){
-	pw->init().addMessage(*msg);
-	send_task->schedule(pw->packetData(), pw->packetSize());
+int OscSender::send(){
+	return send(*msg);
 }
 
-void OscSender::send(const oscpkt::Message& extMsg){
+int OscSender::send(const oscpkt::Message& extMsg){
 	pw->init().addMessage(extMsg);
-	send_task->schedule(pw->packetData(), pw->packetSize());
+	if(!bus->write(0, pw->packetData(), pw->packetSize()))
+		return -1;
+	// wake up send_task, unless it's already due to run
+	if(!sendPending.exchange(true))
+		send_task->schedule();
+	return 0;
 }
@@ -3,9 +3,11 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <atomic>
 
 class UdpClient;
 class AuxTaskNonRT;
+class MessageBus;
 namespace oscpkt{
 	class Message;
 	class PacketWriter;
@@ -18,6 +20,9 @@ namespace oscpkt{
  * std::string and binary blob arguments. Sending a stream of floats is
  * also supported.
  *
+ * Messages are queued and sent by a separate thread, which sends all the
+ * messages queued since it last ran with as few system calls as possible.
+ *
  * Uses oscpkt (http://gruntthepeon.free.fr/oscpkt/) underneath
  */
 class OscSender{
@@ -100,21 +105,27 @@ class OscSender{
 		 * with add(), the message is sent with this function. It is safe to call
 		 * from the audio thread.
 		 *
+		 * @return 0 on success, -1 if the message could not be queued because
+		 * too many messages are waiting to be sent.
 		 */
-		void send();
+		int send();
 		/**
 		 * \brief Sends a message
 		 *
 		 * Sends the message you pass in, which you will have created
 		 * externally. It is safe to call from the audio thread.
+		 *
+		 * @return 0 on success, -1 otherwise.
 		 */
-		void send(const oscpkt::Message& extMsg);
+		int send(const oscpkt::Message& extMsg);
 
         	std::unique_ptr<UdpClient> socket;
         
         	std::unique_ptr<oscpkt::Message> msg;
         	std::unique_ptr<oscpkt::PacketWriter> pw;
 
+		std::unique_ptr<MessageBus> bus;
+		std::atomic<bool> sendPending{false};
 		std::unique_ptr<AuxTaskNonRT> send_task;
-		void send_task_func(void* buf, int size);
+		void send_task_func();
 };
@@ -0,0 +1,350 @@
+#include "OscillatorBank.h"
+
+// The routines below replicate the arithmetic of oscillator_bank_neon()
+// operation by operation, so that on the same inputs they produce the
+// same output:
+// - the table index is the phase truncated to an unsigned integer
+// - the interpolated value is (before * (1 - frac) + after * frac) * amplitude
+// - the outputs of each group of four oscillators are summed pairwise,
+//   (o0 + o1) + (o2 + o3), and added to the output buffer, one group at
+//   a time
+// - phases are wrapped by subtracting (floor(phase) & tableSize), which
+//   requires a power-of-two table size and frequencies below the table size
+
+static inline unsigned int toIndex(float phase)
+{
+	// like vcvt.u32.f32, this saturates negative values and NaN to 0
+	return phase > 0 ? (unsigned int)phase : 0;
+}
+
+// Process up to four oscillators, as if the missing ones had zero
+// amplitude and frequency.
+static void processGroupScalar(int numAudioFrames, float* audioOut, int numOscillators, unsigned int lookupTableSize,
+		float* phases, float* frequencies, float* amplitudes,
+		const float* freqDerivatives, const float* ampDerivatives,
+		const float* lookupTable)
+{
+	float ph[4] = {0};
+	float fr[4] = {0};
+	float am[4] = {0};
+	float dfr[4] = {0};
+	float dam[4] = {0};
+	for(int l = 0; l < numOscillators; ++l)
+	{
+		ph[l] = phases[l];
+		fr[l] = frequencies[l];
+		am[l] = amplitudes[l];
+		dfr[l] = freqDerivatives[l];
+		dam[l] = ampDerivatives[l];
+	}
+	for(int n = 0; n < numAudioFrames; ++n)
+	{
+		float s[4];
+		for(unsigned int l = 0; l < 4; ++l)
+		{
+			unsigned int idx = toIndex(ph[l]);
+			float frac = ph[l] - (float)idx;
+			s[l] = (lookupTable[idx] * (1.f - frac) + lookupTable[idx + 1] * frac) * am[l];
+			ph[l] += fr[l];
+			fr[l] += dfr[l];
+			ph[l] -= (float)(toIndex(ph[l]) & lookupTableSize);
+			am[l] += dam[l];
+		}
+		audioOut[n] += (s[0] + s[1]) + (s[2] + s[3]);
+	}
+	for(int l = 0; l < numOscillators; ++l)
+	{
+		phases[l] = ph[l];
+		frequencies[l] = fr[l];
+		amplitudes[l] = am[l];
+	}
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+static const char* const kOscillatorBankBackend = "neon";
+static const int kVectorSize = 4;
+static void processGroup(int numAudioFrames, float* audioOut, unsigned int lookupTableSize,
+		float* phases, float* frequencies, float* amplitudes,
+		const float* freqDerivatives, const float* ampDerivatives,
+		const float* lookupTable)
+{
+	float32x4_t ph = vld1q_f32(phases);
+	float32x4_t fr = vld1q_f32(frequencies);
+	float32x4_t am = vld1q_f32(amplitudes);
+	const float32x4_t dfr = vld1q_f32(freqDerivatives);
+	const float32x4_t dam = vld1q_f32(ampDerivatives);
+	const float32x4_t one = vdupq_n_f32(1);
+	const uint32x4_t size = vdupq_n_u32(lookupTableSize);
+	for(int n = 0; n < numAudioFrames; ++n)
+	{
+		uint32x4_t idx = vcvtq_u32_f32(ph);
+		float32x4_t frac = vsubq_f32(ph, vcvtq_f32_u32(idx));
+		// load the two consecutive samples for each oscillator and
+		// separate the ones before from the ones after
+		float32x4_t ab01 = vcombine_f32(vld1_f32(lookupTable + vgetq_lane_u32(idx, 0)), vld1_f32(lookupTable + vgetq_lane_u32(idx, 1)));
+		float32x4_t ab23 = vcombine_f32(vld1_f32(lookupTable + vgetq_lane_u32(idx, 2)), vld1_f32(lookupTable + vgetq_lane_u32(idx, 3)));
+		float32x4x2_t ba = vuzpq_f32(ab01, ab23);
+		float32x4_t s = vaddq_f32(vmulq_f32(ba.val[0], vsubq_f32(one, frac)), vmulq_f32(ba.val[1], frac));
+		s = vmulq_f32(s, am);
+		float32x2_t sum = vpadd_f32(vget_low_f32(s), vget_high_f32(s));
+		sum = vpadd_f32(sum, sum);
+		audioOut[n] += vget_lane_f32(sum, 0);
+		ph = vaddq_f32(ph, fr);
+		fr = vaddq_f32(fr, dfr);
+		ph = vsubq_f32(ph, vcvtq_f32_u32(vandq_u32(vcvtq_u32_f32(ph), size)));
+		am = vaddq_f32(am, dam);
+	}
+	vst1q_f32(phases, ph);
+	vst1q_f32(frequencies, fr);
+	vst1q_f32(amplitudes, am);
+}
+#elif defined(__SSE2__)
+#ifdef __AVX__
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+// (s0 + s1) + (s2 + s3)
+static inline float horizontalSum(__m128 s)
+{
+	__m128 t = _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(_mm_add_ss(t, _mm_movehl_ps(t, t)));
+}
+static inline __m128i toIndex(__m128 phase)
+{
+	// truncate, saturating negative values and NaN to 0. Phases are
+	// always smaller than 2^31, so the signed conversion is enough.
+	return _mm_cvttps_epi32(_mm_max_ps(phase, _mm_setzero_ps()));
+}
+#ifdef __AVX__
+static const char* const kOscillatorBankBackend =
+#ifdef __AVX2__
+	"avx2";
+#else
+	"avx";
+#endif
+static const int kVectorSize = 8;
+static inline __m256i toIndex(__m256 phase)
+{
+	return _mm256_cvttps_epi32(_mm256_max_ps(phase, _mm256_setzero_ps()));
+}
+static inline __m256i andIndex(__m256i a, __m256i b)
+{
+#ifdef __AVX2__
+	return _mm256_and_si256(a, b);
+#else
+	return _mm256_castps_si256(_mm256_and_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b)));
+#endif
+}
+static void processGroup(int numAudioFrames, float* audioOut, unsigned int lookupTableSize,
+		float* phases, float* frequencies, float* amplitudes,
+		const float* freqDerivatives, const float* ampDerivatives,
+		const float* lookupTable)
+{
+	__m256 ph = _mm256_loadu_ps(phases);
+	__m256 fr = _mm256_loadu_ps(frequencies);
+	__m256 am = _mm256_loadu_ps(amplitudes);
+	const __m256 dfr = _mm256_loadu_ps(freqDerivatives);
+	const __m256 dam = _mm256_loadu_ps(ampDerivatives);
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256i size = _mm256_set1_epi32(lookupTableSize);
+	for(int n = 0; n < numAudioFrames; ++n)
+	{
+		__m256i idx = toIndex(ph);
+		__m256 frac = _mm256_sub_ps(ph, _mm256_cvtepi32_ps(idx));
+#ifdef __AVX2__
+		__m256 before = _mm256_i32gather_ps(lookupTable, idx, 4);
+		__m256 after = _mm256_i32gather_ps(lookupTable + 1, idx, 4);
+#else
+		alignas(32) int i[8];
+		_mm256_store_si256((__m256i*)i, idx);
+		__m256 before = _mm256_setr_ps(lookupTable[i[0]], lookupTable[i[1]], lookupTable[i[2]], lookupTable[i[3]],
+				lookupTable[i[4]], lookupTable[i[5]], lookupTable[i[6]], lookupTable[i[7]]);
+		__m256 after = _mm256_setr_ps(lookupTable[i[0] + 1], lookupTable[i[1] + 1], lookupTable[i[2] + 1], lookupTable[i[3] + 1],
+				lookupTable[i[4] + 1], lookupTable[i[5] + 1], lookupTable[i[6] + 1], lookupTable[i[7] + 1]);
+#endif
+		__m256 s = _mm256_add_ps(_mm256_mul_ps(before, _mm256_sub_ps(one, frac)), _mm256_mul_ps(after, frac));
+		s = _mm256_mul_ps(s, am);
+		// each group of four is added separately, in order
+		audioOut[n] += horizontalSum(_mm256_castps256_ps128(s));
+		audioOut[n] += horizontalSum(_mm256_extractf128_ps(s, 1));
+		ph = _mm256_add_ps(ph, fr);
+		fr = _mm256_add_ps(fr, dfr);
+		ph = _mm256_sub_ps(ph, _mm256_cvtepi32_ps(andIndex(toIndex(ph), size)));
+		am = _mm256_add_ps(am, dam);
+	}
+	_mm256_storeu_ps(phases, ph);
+	_mm256_storeu_ps(frequencies, fr);
+	_mm256_storeu_ps(amplitudes, am);
+}
+#else // __AVX__
+static const char* const kOscillatorBankBackend = "sse2";
+static const int kVectorSize = 4;
+static void processGroup(int numAudioFrames, float* audioOut, unsigned int lookupTableSize,
+		float* phases, float* frequencies, float* amplitudes,
+		const float* freqDerivatives, const float* ampDerivatives,
+		const float* lookupTable)
+{
+	__m128 ph = _mm_loadu_ps(phases);
+	__m128 fr = _mm_loadu_ps(frequencies);
+	__m128 am = _mm_loadu_ps(amplitudes);
+	const __m128 dfr = _mm_loadu_ps(freqDerivatives);
+	const __m128 dam = _mm_loadu_ps(ampDerivatives);
+	const __m128 one = _mm_set1_ps(1);
+	const __m128i size = _mm_set1_epi32(lookupTableSize);
+	for(int n = 0; n < numAudioFrames; ++n)
+	{
+		__m128i idx = toIndex(ph);
+		__m128 frac = _mm_sub_ps(ph, _mm_cvtepi32_ps(idx));
+		alignas(16) int i[4];
+		_mm_store_si128((__m128i*)i, idx);
+		__m128 before = _mm_setr_ps(lookupTable[i[0]], lookupTable[i[1]], lookupTable[i[2]], lookupTable[i[3]]);
+		__m128 after = _mm_setr_ps(lookupTable[i[0] + 1], lookupTable[i[1] + 1], lookupTable[i[2] + 1], lookupTable[i[3] + 1]);
+		__m128 s = _mm_add_ps(_mm_mul_ps(before, _mm_sub_ps(one, frac)), _mm_mul_ps(after, frac));
+		s = _mm_mul_ps(s, am);
+		audioOut[n] += horizontalSum(s);
+		ph = _mm_add_ps(ph, fr);
+		fr = _mm_add_ps(fr, dfr);
+		ph = _mm_sub_ps(ph, _mm_cvtepi32_ps(_mm_and_si128(toIndex(ph), size)));
+		am = _mm_add_ps(am, dam);
+	}
+	_mm_storeu_ps(phases, ph);
+	_mm_storeu_ps(frequencies, fr);
+	_mm_storeu_ps(amplitudes, am);
+}
+#endif // __AVX__
+#else
+static const char* const kOscillatorBankBackend = "scalar";
+static const int kVectorSize = 4;
+static void processGroup(int numAudioFrames, float* audioOut, unsigned int lookupTableSize,
+		float* phases, float* frequencies, float* amplitudes,
+		const float* freqDerivatives, const float* ampDerivatives,
+		const float* lookupTable)
+{
+	processGroupScalar(numAudioFrames, audioOut, 4, lookupTableSize, phases, frequencies, amplitudes, freqDerivatives, ampDerivatives, lookupTable);
+}
+#endif
+
+extern "C" const char* oscillator_bank_intrinsics_backend()
+{
+	return kOscillatorBankBackend;
+}
+
+extern "C" void oscillator_bank_intrinsics(int numAudioFrames, float *audioOut,
+		int activePartialNum, int lookupTableSize,
+		float *phases, float *frequencies, float *amplitudes,
+		float *freqDerivatives, float *ampDerivatives,
+		float *lookupTable)
+{
+	int n = 0;
+	for(; n + kVectorSize <= activePartialNum; n += kVectorSize)
+		processGroup(numAudioFrames, audioOut, lookupTableSize, phases + n, frequencies + n, amplitudes + n,
+			freqDerivatives + n, ampDerivatives + n, lookupTable);
+	// the remaining oscillators are processed four at a time
+	for(; n < activePartialNum; n += 4)
+	{
+		int count = activePartialNum - n < 4 ? activePartialNum - n : 4;
+		processGroupScalar(numAudioFrames, audioOut, count, lookupTableSize, phases + n, frequencies + n, amplitudes + n,
+			freqDerivatives + n, ampDerivatives + n, lookupTable);
+	}
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+static void oscillator_bank_reference(int numAudioFrames, float *audioOut,
+		int activePartialNum, int lookupTableSize,
+		float *phases, float *frequencies, float *amplitudes,
+		float *freqDerivatives, float *ampDerivatives,
+		float *lookupTable)
+{
+	for(int n = 0; n < activePartialNum; n += 4)
+	{
+		int count = activePartialNum - n < 4 ? activePartialNum - n : 4;
+		processGroupScalar(numAudioFrames, audioOut, count, lookupTableSize, phases + n, frequencies + n, amplitudes + n,
+			freqDerivatives + n, ampDerivatives + n, lookupTable);
+	}
+}
+
+bool OscillatorBankTest()
+{
+	const int tableSize = 1024;
+	const int frames = 256;
+	std::vector<float> table(tableSize + 1);
+	for(int n = 0; n < tableSize + 1; ++n)
+		table[n] = sinf(2 * M_PI * n / tableSize);
+	const int oscillatorCounts[] = {4, 5, 8, 13, 64};
+	for(auto numOscillators : oscillatorCounts)
+	{
+		std::vector<float> params[5];
+		for(auto& p : params)
+			p.resize(numOscillators);
+		for(int n = 0; n < numOscillators; ++n)
+		{
+			params[0][n] = rand() / (float)RAND_MAX * tableSize; // phase
+			params[1][n] = rand() / (float)RAND_MAX * tableSize * 0.4f; // frequency
+			params[2][n] = rand() / (float)RAND_MAX; // amplitude
+			params[3][n] = (rand() / (float)RAND_MAX - 0.5f) * 0.001f; // frequency derivative
+			params[4][n] = (rand() / (float)RAND_MAX - 0.5f) * 0.0001f; // amplitude derivative
+		}
+		std::vector<float> refParams[5];
+		for(unsigned int n = 0; n < 5; ++n)
+			refParams[n] = params[n];
+		std::vector<float> out(frames);
+		std::vector<float> refOut(frames);
+		for(unsigned int block = 0; block < 4; ++block)
+		{
+			std::fill(out.begin(), out.end(), 0);
+			std::fill(refOut.begin(), refOut.end(), 0);
+			oscillator_bank_intrinsics(frames, out.data(), numOscillators, tableSize,
+				params[0].data(), params[1].data(), params[2].data(), params[3].data(), params[4].data(), table.data());
+#if defined(__arm__) && !defined(OSCILLATOR_BANK_NO_ASM)
+			// the assembly implementation reads whole groups of four
+			// oscillators, so only compare it on those
+			if(0 == numOscillators % 4)
+				oscillator_bank_neon(frames, refOut.data(), numOscillators, tableSize,
+					refParams[0].data(), refParams[1].data(), refParams[2].data(), refParams[3].data(), refParams[4].data(), table.data());
+			else
+#endif
+			oscillator_bank_reference(frames, refOut.data(), numOscillators, tableSize,
+				refParams[0].data(), refParams[1].data(), refParams[2].data(), refParams[3].data(), refParams[4].data(), table.data());
+			// the arithmetic is the same, so the results are
+			// bit-exact, unless the compiler is allowed to reorder
+			// operations or to contract them into fused
+			// multiply-adds, which round differently
+#if defined(__FAST_MATH__) || defined(__FMA__) || defined(__ARM_FEATURE_FMA)
+			const float tolerance = 1e-5f * numOscillators;
+#else
+			const float tolerance = 0;
+#endif
+			for(int n = 0; n < frames; ++n)
+				assert(fabsf(out[n] - refOut[n]) <= tolerance);
+			for(unsigned int p = 0; p < 3; ++p)
+				for(int n = 0; n < numOscillators; ++n)
+					assert(fabsf(params[p][n] - refParams[p][n]) <= tolerance * (1 + fabsf(refParams[p][n])));
+		}
+		// sanity check against a direct computation, with the
+		// derivatives set to 0
+		std::vector<float> phases(numOscillators);
+		std::vector<float> freqs = params[1];
+		std::vector<float> amps = params[2];
+		std::vector<float> zeros(numOscillators);
+		std::fill(out.begin(), out.end(), 0);
+		oscillator_bank_intrinsics(frames, out.data(), numOscillators, tableSize,
+			phases.data(), freqs.data(), amps.data(), zeros.data(), zeros.data(), table.data());
+		for(int n = 0; n < frames; ++n)
+		{
+			double expected = 0;
+			for(int k = 0; k < numOscillators; ++k)
+				expected += amps[k] * sin(2 * M_PI * fmod(params[1][k] * n, tableSize) / tableSize);
+			assert(fabs(out[n] - expected) < 1e-3 * numOscillators);
+		}
+	}
+	printf("OscillatorBankTest successful (%s)\n", kOscillatorBankBackend);
+	return true;
+}
+#endif
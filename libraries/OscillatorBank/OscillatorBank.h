@@ -2,6 +2,14 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <stdlib.h>
+
+// On ARMv7 the hand-written assembly routine is used by default. Define
+// OSCILLATOR_BANK_NO_ASM to use the intrinsics implementation instead.
+#if defined(__arm__) && !defined(OSCILLATOR_BANK_NO_ASM)
+#define OSCILLATOR_BANK_USE_ASM
+#endif
+
 extern "C" {
 	// Function prototype for ARM assembly implementation of oscillator bank
 	void oscillator_bank_neon(int numAudioFrames, float *audioOut,
@@ -9,13 +17,27 @@ extern "C" {
 							  float *phases, float *frequencies, float *amplitudes,
 							  float *freqDerivatives, float *ampDerivatives,
 							  float *lookupTable);
+	// Portable implementation of the above, using NEON, AVX or SSE2
+	// intrinsics, or plain C++, depending on the target. It gives the same
+	// results as the assembly and has no alignment requirements. Unlike
+	// the assembly, it also handles a number of oscillators that is not a
+	// multiple of 4.
+	void oscillator_bank_intrinsics(int numAudioFrames, float *audioOut,
+							  int activePartialNum, int lookupTableSize,
+							  float *phases, float *frequencies, float *amplitudes,
+							  float *freqDerivatives, float *ampDerivatives,
+							  float *lookupTable);
+	// The instruction set used by oscillator_bank_intrinsics()
+	const char* oscillator_bank_intrinsics_backend();
 }
 
 /**
  * A class for computing a table-lookup oscillator bank.
- * The internal routine is highly optimized, written in NEON assembly.
+ * The internal routine is highly optimized: on ARMv7 it is written in NEON
+ * assembly, elsewhere it uses the NEON, AVX or SSE2 intrinsics available
+ * at build time, falling back to plain C++.
  * All oscillators in the bank share the same wavetable. Linear interpolation
- * is used.
+ * is used. The length of the wavetable must be a power of two.
  */
 class OscillatorBank{
 public:
@@ -55,6 +77,9 @@ public:
 		wavetableLength = newWavetableLength;
 		numOscillators = newNumOscillators;
 		sampleRate = newSampleRate;
+		// The routines process oscillators in groups of (up to) 8: pad
+		// the buffers so that those with fewer oscillators are silent
+		unsigned int allocatedOscillators = (numOscillators + 7) & ~7;
 		// Initialise the sine wavetable
 		if(posix_memalign((void **)&wavetable, 16, (wavetableLength + 1) * sizeof(float))) {
 			fprintf(stderr, "Error allocating wavetable\n");
@@ -62,28 +87,30 @@ public:
 		}
 
 		// Allocate the other buffers
-		if(posix_memalign((void **)&phases, 16, numOscillators * sizeof(float))) {
+		if(posix_memalign((void **)&phases, 16, allocatedOscillators * sizeof(float))) {
 			fprintf(stderr, "Error allocating phase buffer\n");
 			return -1;
 		}
-		if(posix_memalign((void **)&frequencies, 16, numOscillators * sizeof(float))) {
+		if(posix_memalign((void **)&frequencies, 16, allocatedOscillators * sizeof(float))) {
 			fprintf(stderr, "Error allocating frequency buffer\n");
 			return -1;
 		}
-		if(posix_memalign((void **)&amplitudes, 16, numOscillators * sizeof(float))) {
+		if(posix_memalign((void **)&amplitudes, 16, allocatedOscillators * sizeof(float))) {
 			fprintf(stderr, "Error allocating amplitude buffer\n");
 			return -1;
 		}
-		if(posix_memalign((void **)&dFrequencies, 16, numOscillators * sizeof(float))) {
+		if(posix_memalign((void **)&dFrequencies, 16, allocatedOscillators * sizeof(float))) {
 			fprintf(stderr, "Error allocating frequency derivative buffer\n");
 			return -1;
 		}
-		if(posix_memalign((void **)&dAmplitudes, 16, numOscillators * sizeof(float))) {
+		if(posix_memalign((void **)&dAmplitudes, 16, allocatedOscillators * sizeof(float))) {
 			fprintf(stderr, "Error allocating amplitude derivative buffer\n");
 			return -1;
 		}
+		memset(frequencies, 0, sizeof(float)*allocatedOscillators);
+		memset(amplitudes, 0, sizeof(float)*allocatedOscillators);
 		clearArrays();
-			return 0;
+		return 0;
 	}
 
 	/**
@@ -178,13 +205,28 @@ public:
 	void process(unsigned int frames, float* output){
 		// Initialise buffer to 0
 		memset(output, 0, frames * sizeof(float));
+#ifdef OSCILLATOR_BANK_USE_ASM
 		oscillator_bank_neon(frames, output,
+#else
+		oscillator_bank_intrinsics(frames, output,
+#endif
 				numOscillators, wavetableLength,
 				phases, frequencies, amplitudes,
 				dFrequencies, dAmplitudes,
 				wavetable);
 	}
 
+	/**
+	 * Get the name of the implementation used by process().
+	 */
+	static const char* getBackend(){
+#ifdef OSCILLATOR_BANK_USE_ASM
+		return "neon-asm";
+#else
+		return oscillator_bank_intrinsics_backend();
+#endif
+	}
+
 private:
 	float sampleRate;
 	int numOscillators;
@@ -0,0 +1,347 @@
+#include "SparseOscillatorBank.h"
+#include "OscillatorBank.h"
+#include <limits.h>
+
+// handles are (generation << kIndexBits) | index
+static const unsigned int kIndexBits = 16;
+static const unsigned int kIndexMask = (1 << kIndexBits) - 1;
+static const unsigned int kGenerationMask = INT_MAX >> kIndexBits;
+
+int SparseOscillatorBank::setup(float sampleRate, unsigned int newWavetableLength, unsigned int maxPartials)
+{
+	cleanup();
+	if(maxPartials > kIndexMask + 1)
+	{
+		fprintf(stderr, "SparseOscillatorBank: too many partials: %u\n", maxPartials);
+		return -1;
+	}
+	wavetableLength = newWavetableLength;
+	// frequencies are stored as change in wavetable position per sample
+	frequencyScale = wavetableLength / sampleRate;
+	if(posix_memalign((void **)&wavetable, 16, (wavetableLength + 1) * sizeof(float)))
+	{
+		fprintf(stderr, "Error allocating wavetable\n");
+		return -1;
+	}
+	memset(wavetable, 0, (wavetableLength + 1) * sizeof(float));
+	// the routines process oscillators in groups of (up to) 8: the
+	// slots past the active ones are always silent
+	unsigned int allocatedOscillators = (maxPartials + 7) & ~7;
+	float** buffers[] = {&phases, &frequencies, &amplitudes, &dFrequencies, &dAmplitudes};
+	for(auto buffer : buffers)
+	{
+		if(posix_memalign((void **)buffer, 16, allocatedOscillators * sizeof(float)))
+		{
+			fprintf(stderr, "Error allocating oscillator buffers\n");
+			return -1;
+		}
+		memset(*buffer, 0, allocatedOscillators * sizeof(float));
+	}
+	controls.resize(maxPartials);
+	slotOf.assign(maxPartials, -1);
+	generations.assign(maxPartials, 0);
+	freeIndices.resize(maxPartials);
+	// lowest indices are used first
+	for(unsigned int n = 0; n < maxPartials; ++n)
+		freeIndices[n] = maxPartials - 1 - n;
+	toRemove.reserve(maxPartials);
+	numActive = 0;
+	return 0;
+}
+
+void SparseOscillatorBank::cleanup()
+{
+	float** buffers[] = {&wavetable, &phases, &frequencies, &amplitudes, &dFrequencies, &dAmplitudes};
+	for(auto buffer : buffers)
+	{
+		free(*buffer);
+		*buffer = nullptr;
+	}
+	controls.clear();
+	slotOf.clear();
+	generations.clear();
+	freeIndices.clear();
+	numActive = 0;
+}
+
+int SparseOscillatorBank::getSlot(int partial)
+{
+	if(partial < 0)
+		return -1;
+	unsigned int index = partial & kIndexMask;
+	if(index >= slotOf.size() || generations[index] != ((unsigned int)partial >> kIndexBits))
+		return -1;
+	return slotOf[index];
+}
+
+int SparseOscillatorBank::start(float frequency, float amplitude, int voice, float phase)
+{
+	if(freeIndices.empty())
+		return -1;
+	unsigned int index = freeIndices.back();
+	freeIndices.pop_back();
+	unsigned int slot = numActive++;
+	slotOf[index] = slot;
+	phases[slot] = phase * wavetableLength;
+	frequencies[slot] = frequency * frequencyScale;
+	amplitudes[slot] = amplitude;
+	dFrequencies[slot] = 0;
+	dAmplitudes[slot] = 0;
+	Control& c = controls[slot];
+	c.amplitude.scheduled = false;
+	c.frequency.scheduled = false;
+	c.partial = (generations[index] << kIndexBits) | index;
+	c.voice = voice;
+	c.stopping = false;
+	return c.partial;
+}
+
+void SparseOscillatorBank::stop(int partial, unsigned int releaseSamples, unsigned int delaySamples)
+{
+	int slot = getSlot(partial);
+	if(slot < 0)
+		return;
+	controls[slot].stopping = true;
+	rampAmplitude(partial, 0, releaseSamples, delaySamples);
+}
+
+void SparseOscillatorBank::stopVoice(int voice, unsigned int releaseSamples, unsigned int delaySamples)
+{
+	// backwards, as stop() may move the last slot into the current one
+	for(int slot = numActive - 1; slot >= 0; --slot)
+	{
+		if(controls[slot].voice == voice)
+			stop(controls[slot].partial, releaseSamples, delaySamples);
+	}
+}
+
+void SparseOscillatorBank::rampAmplitude(int partial, float amplitude, unsigned int rampSamples, unsigned int delaySamples)
+{
+	int slot = getSlot(partial);
+	if(slot < 0)
+		return;
+	Control& c = controls[slot];
+	scheduleRamp(c.amplitude, amplitudes[slot], dAmplitudes[slot], amplitude, rampSamples, delaySamples);
+	if(c.stopping && !c.amplitude.scheduled)
+		remove(slot);
+}
+
+void SparseOscillatorBank::rampFrequency(int partial, float frequency, unsigned int rampSamples, unsigned int delaySamples)
+{
+	int slot = getSlot(partial);
+	if(slot < 0)
+		return;
+	scheduleRamp(controls[slot].frequency, frequencies[slot], dFrequencies[slot], frequency * frequencyScale, rampSamples, delaySamples);
+}
+
+bool SparseOscillatorBank::isActive(int partial)
+{
+	return getSlot(partial) >= 0;
+}
+
+void SparseOscillatorBank::scheduleRamp(Ramp& ramp, float& value, float& derivative, float target, unsigned int rampSamples, unsigned int delaySamples)
+{
+	ramp.target = target;
+	ramp.delay = delaySamples;
+	ramp.length = rampSamples;
+	ramp.scheduled = true;
+	// hold the current value until the ramp begins
+	derivative = 0;
+	if(!ramp.delay)
+		startRamp(ramp, value, derivative);
+}
+
+void SparseOscillatorBank::startRamp(Ramp& ramp, float& value, float& derivative)
+{
+	if(ramp.length)
+	{
+		derivative = (ramp.target - value) / ramp.length;
+	} else {
+		value = ramp.target;
+		derivative = 0;
+		ramp.scheduled = false;
+	}
+}
+
+void SparseOscillatorBank::advanceRamp(Ramp& ramp, float& value, float& derivative, unsigned int frames)
+{
+	// frames never goes past the next event of the ramp
+	if(!ramp.scheduled)
+		return;
+	if(ramp.delay)
+	{
+		ramp.delay -= frames;
+		if(!ramp.delay)
+			startRamp(ramp, value, derivative);
+	} else {
+		ramp.length -= frames;
+		if(!ramp.length)
+		{
+			// avoid accumulating rounding errors
+			value = ramp.target;
+			derivative = 0;
+			ramp.scheduled = false;
+		}
+	}
+}
+
+unsigned int SparseOscillatorBank::getNextEvent(const Ramp& ramp)
+{
+	if(!ramp.scheduled)
+		return UINT_MAX;
+	return ramp.delay ? ramp.delay : ramp.length;
+}
+
+void SparseOscillatorBank::remove(unsigned int slot)
+{
+	unsigned int index = controls[slot].partial & kIndexMask;
+	slotOf[index] = -1;
+	generations[index] = (generations[index] + 1) & kGenerationMask;
+	freeIndices.push_back(index);
+	// keep the active partials contiguous by moving the last one here
+	unsigned int last = --numActive;
+	if(slot != last)
+	{
+		phases[slot] = phases[last];
+		frequencies[slot] = frequencies[last];
+		amplitudes[slot] = amplitudes[last];
+		dFrequencies[slot] = dFrequencies[last];
+		dAmplitudes[slot] = dAmplitudes[last];
+		controls[slot] = controls[last];
+		slotOf[controls[slot].partial & kIndexMask] = slot;
+	}
+	phases[last] = 0;
+	frequencies[last] = 0;
+	amplitudes[last] = 0;
+	dFrequencies[last] = 0;
+	dAmplitudes[last] = 0;
+}
+
+void SparseOscillatorBank::process(unsigned int frames, float* output)
+{
+	memset(output, 0, frames * sizeof(float));
+	unsigned int done = 0;
+	while(done < frames)
+	{
+		// run up to the next sample where a ramp begins or ends, so
+		// that the derivatives are constant throughout the segment
+		unsigned int segment = frames - done;
+		for(unsigned int n = 0; n < numActive; ++n)
+		{
+			unsigned int next = getNextEvent(controls[n].amplitude);
+			if(next < segment)
+				segment = next;
+			next = getNextEvent(controls[n].frequency);
+			if(next < segment)
+				segment = next;
+		}
+		if(numActive)
+		{
+			// the assembly routine works on groups of four
+			// oscillators; the padding slots are silent
+#ifdef OSCILLATOR_BANK_USE_ASM
+			oscillator_bank_neon(segment, output + done,
+#else
+			oscillator_bank_intrinsics(segment, output + done,
+#endif
+					(numActive + 3) & ~3, wavetableLength,
+					phases, frequencies, amplitudes,
+					dFrequencies, dAmplitudes,
+					wavetable);
+		}
+		done += segment;
+		for(unsigned int n = 0; n < numActive; ++n)
+		{
+			Control& c = controls[n];
+			advanceRamp(c.amplitude, amplitudes[n], dAmplitudes[n], segment);
+			advanceRamp(c.frequency, frequencies[n], dFrequencies[n], segment);
+			if(c.stopping && !c.amplitude.scheduled)
+				toRemove.push_back(n);
+		}
+		// backwards, so that the slots still to be removed are not moved
+		for(unsigned int n = toRemove.size(); n > 0; --n)
+			remove(toRemove[n - 1]);
+		toRemove.clear();
+	}
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <vector>
+bool SparseOscillatorBankTest()
+{
+	const float sampleRate = 44100;
+	const unsigned int tableSize = 1024;
+	const unsigned int frames = 2048;
+	const unsigned int blockSize = 37;
+	SparseOscillatorBank bank;
+	assert(0 == bank.setup(sampleRate, tableSize, 4));
+	float* table = bank.getWavetable();
+	for(unsigned int n = 0; n < tableSize + 1; ++n)
+		table[n] = sinf(2 * M_PI * n / tableSize);
+
+	// a: amplitude ramp from 0.5 to 0.1 during [50, 350), frequency ramp
+	// from 440 to 880 during [0, 1000)
+	int a = bank.start(440, 0.5);
+	bank.rampAmplitude(a, 0.1, 300, 50);
+	bank.rampFrequency(a, 880, 1000);
+	// b: released during [123, 323)
+	int b = bank.start(1000, 0.25);
+	bank.stop(b, 200, 123);
+	// c and d: stopped at once at 700
+	int c = bank.start(330, 0.2, 1, 0.25);
+	int d = bank.start(550, 0.2, 1);
+	bank.stopVoice(1, 0, 700);
+	assert(-1 == bank.start(100, 1));
+	assert(4 == bank.getNumActive());
+
+	std::vector<float> out(frames);
+	for(unsigned int n = 0; n < frames; n += blockSize)
+	{
+		unsigned int count = n + blockSize < frames ? blockSize : frames - n;
+		bank.process(count, out.data() + n);
+		unsigned int end = n + count;
+		assert(bank.isActive(b) == (end < 323));
+		assert(bank.isActive(c) == (end < 700));
+		assert(bank.isActive(d) == (end < 700));
+		assert(bank.getNumActive() == 1 + (end < 323) + 2 * (end < 700));
+	}
+	assert(bank.isActive(a));
+
+	// direct computation of the same schedule
+	double phases[4] = {0, 0, 0.25, 0};
+	for(unsigned int n = 0; n < frames; ++n)
+	{
+		double amp[4];
+		double freq[4];
+		amp[0] = n < 50 ? 0.5 : n < 350 ? 0.5 - 0.4 * (n - 50) / 300 : 0.1;
+		freq[0] = n < 1000 ? 440 + 440.0 * n / 1000 : 880;
+		amp[1] = n < 123 ? 0.25 : n < 323 ? 0.25 - 0.25 * (n - 123) / 200 : 0;
+		freq[1] = 1000;
+		amp[2] = amp[3] = n < 700 ? 0.2 : 0;
+		freq[2] = 330;
+		freq[3] = 550;
+		double expected = 0;
+		for(unsigned int k = 0; k < 4; ++k)
+		{
+			expected += amp[k] * sin(2 * M_PI * phases[k]);
+			phases[k] += freq[k] / sampleRate;
+		}
+		assert(fabs(out[n] - expected) < 1e-3);
+	}
+
+	// handles of removed partials are not valid any more, even when
+	// their index is reused
+	int e = bank.start(200, 0.1);
+	assert(bank.isActive(e));
+	assert(!bank.isActive(b) && !bank.isActive(c) && !bank.isActive(d));
+	bank.stop(b);
+	assert(bank.isActive(e) && 2 == bank.getNumActive());
+	bank.stop(e);
+	assert(!bank.isActive(e) && 1 == bank.getNumActive());
+	printf("SparseOscillatorBankTest successful\n");
+	return true;
+}
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+
+/**
+ * A table-lookup oscillator bank where partials are started and stopped
+ * individually, for additive synthesis with a varying number of partials.
+ *
+ * Only the partials that are currently playing are computed: their
+ * states are kept compacted at the beginning of contiguous arrays, so
+ * the cost of process() scales with the number of active partials, not
+ * with the maximum number of partials. It uses the same routines as
+ * OscillatorBank.
+ *
+ * Amplitude and frequency changes can be scheduled as linear ramps
+ * starting at a given sample in the future and lasting any number of
+ * samples. They are applied sample-accurately, regardless of how they
+ * line up with the blocks passed to process().
+ *
+ * Partials are identified by the handle returned by start(). Handles of
+ * partials that have been removed are ignored, even if their slot has
+ * been reused by a new partial. Partials can optionally be tagged with a
+ * voice number, so that all the partials of a voice can be stopped at once.
+ *
+ * All methods must be called from the same thread that calls process(),
+ * and none of them allocates memory after setup().
+ */
+class SparseOscillatorBank
+{
+public:
+	SparseOscillatorBank() {};
+	~SparseOscillatorBank() { cleanup(); };
+	/**
+	 * Initialize the oscillator bank.
+	 *
+	 * @param sampleRate the sampling rate of the output samples.
+	 * @param wavetableLength the length of the wavetable. This has to
+	 * be a power of two. The internal wavetable will have length
+	 * `wavetableLength + 1`.
+	 * @param maxPartials the maximum number of partials that can be
+	 * playing at the same time.
+	 *
+	 * @return 0 upon success, a negative value otherwise.
+	 */
+	int setup(float sampleRate, unsigned int wavetableLength, unsigned int maxPartials);
+	void cleanup();
+	/**
+	 * Get the wavetable. It is the responsibilty of the user to fill it
+	 * with one period of the waveform, followed by a copy of the first
+	 * sample.
+	 *
+	 * @return a pointer to the wavetable array, of length `(getWavetableLength() + 1)`
+	 */
+	float* getWavetable() { return wavetable; }
+	unsigned int getWavetableLength() { return wavetableLength; }
+	/**
+	 * Start a partial.
+	 *
+	 * @param frequency the frequency in Hz
+	 * @param amplitude the initial amplitude. Use 0 and then
+	 * rampAmplitude() for a fade in.
+	 * @param voice an arbitrary number that can be passed to
+	 * stopVoice() to stop all the partials with the same number.
+	 * @param phase the initial phase, between 0 and 1.
+	 *
+	 * @return a handle to the partial, or -1 if all the partials are in
+	 * use.
+	 */
+	int start(float frequency, float amplitude, int voice = -1, float phase = 0);
+	/**
+	 * Stop a partial, ramping its amplitude down to 0. Once the ramp is
+	 * complete, the partial is removed and its handle becomes invalid.
+	 *
+	 * @param partial the handle of the partial
+	 * @param releaseSamples the duration of the ramp
+	 * @param delaySamples the number of samples, counting from the
+	 * beginning of the next call to process(), before the ramp begins.
+	 *
+	 * If both @p releaseSamples and @p delaySamples are 0, the partial is
+	 * removed immediately.
+	 */
+	void stop(int partial, unsigned int releaseSamples = 0, unsigned int delaySamples = 0);
+	/**
+	 * Stop all the partials that were started with the given @p voice.
+	 * See stop() for the arguments.
+	 */
+	void stopVoice(int voice, unsigned int releaseSamples = 0, unsigned int delaySamples = 0);
+	/**
+	 * Schedule a linear ramp of the amplitude of a partial. This replaces
+	 * any amplitude ramp that is scheduled or ongoing for the partial:
+	 * the amplitude holds its current value until the new ramp begins.
+	 * If the partial is being stopped, it is removed at the end of the
+	 * new ramp instead.
+	 *
+	 * @param partial the handle of the partial
+	 * @param amplitude the amplitude at the end of the ramp
+	 * @param rampSamples the duration of the ramp. If 0, the amplitude
+	 * is set at once.
+	 * @param delaySamples the number of samples, counting from the
+	 * beginning of the next call to process(), before the ramp begins.
+	 */
+	void rampAmplitude(int partial, float amplitude, unsigned int rampSamples, unsigned int delaySamples = 0);
+	/**
+	 * Schedule a linear ramp of the frequency of a partial. See
+	 * rampAmplitude() for the arguments.
+	 */
+	void rampFrequency(int partial, float frequency, unsigned int rampSamples, unsigned int delaySamples = 0);
+	/**
+	 * Whether a partial is still playing.
+	 */
+	bool isActive(int partial);
+	/**
+	 * Get the number of partials currently playing.
+	 */
+	unsigned int getNumActive() { return numActive; }
+	/**
+	 * Get the maximum number of partials.
+	 */
+	unsigned int getMaxPartials() { return controls.size(); }
+	/**
+	 * Process the active partials.
+	 *
+	 * @param frames the number of frames to process
+	 * @param output the array where the @p frames output values will be
+	 * stored.
+	 */
+	void process(unsigned int frames, float* output);
+private:
+	struct Ramp {
+		float target;
+		unsigned int delay; // samples before the ramp starts
+		unsigned int length; // samples before the ramp ends, once started
+		bool scheduled;
+	};
+	// the state of each slot that is not needed by the oscillator routine
+	struct Control {
+		Ramp amplitude;
+		Ramp frequency;
+		int partial;
+		int voice;
+		bool stopping;
+	};
+	int getSlot(int partial);
+	static void scheduleRamp(Ramp& ramp, float& value, float& derivative, float target, unsigned int rampSamples, unsigned int delaySamples);
+	static void startRamp(Ramp& ramp, float& value, float& derivative);
+	static void advanceRamp(Ramp& ramp, float& value, float& derivative, unsigned int frames);
+	static unsigned int getNextEvent(const Ramp& ramp);
+	void remove(unsigned int slot);
+	float* wavetable = nullptr;
+	// the states of the active partials, used by the oscillator
+	// routine. These are sized to a multiple of the vector size, and
+	// the slots past the active ones are kept silent.
+	float* phases = nullptr;
+	float* frequencies = nullptr;
+	float* amplitudes = nullptr;
+	float* dFrequencies = nullptr;
+	float* dAmplitudes = nullptr;
+	std::vector<Control> controls; // by slot
+	// a handle is made of an index in slotOf and generations, and of the
+	// generation of that index at the time the partial was started
+	std::vector<int> slotOf; // -1 if inactive
+	std::vector<unsigned int> generations;
+	std::vector<unsigned int> freeIndices;
+	std::vector<unsigned int> toRemove;
+	unsigned int numActive = 0;
+	unsigned int wavetableLength = 0;
+	float frequencyScale = 0;
+};
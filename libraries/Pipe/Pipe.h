@@ -5,6 +5,8 @@
  * 
  * A bi-directional pipe to exchange data between a RT and a non-RT thread.
  * 
+ * Each read and write is a system call. To exchange messages between
+ * threads of the same process, MessageBus is cheaper.
  */
 class Pipe
 {
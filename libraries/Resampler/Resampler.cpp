@@ -0,0 +1,352 @@
+#include "Resampler.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+constexpr unsigned int Resampler::kDefaultTaps;
+constexpr unsigned int Resampler::kMaxPhases;
+
+// the number of input frames appended to the history at once
+static constexpr unsigned int kBlockFrames = 256;
+// the longest filter we are willing to compute
+static constexpr unsigned int kMaxTaps = 2048;
+// the cutoff of the filter, relative to the lower of the two Nyquist
+// frequencies. Together with kKaiserBeta and kDefaultTaps, this puts the
+// stopband just below Nyquist, with about 85dB of attenuation.
+static constexpr double kRolloff = 0.91;
+static constexpr double kKaiserBeta = 8.5;
+
+// The dot product of two arrays of n floats, with n a multiple of 4.
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+static const char* kResamplerBackend = "neon";
+static inline float dot(const float* a, const float* b, unsigned int n)
+{
+	float32x4_t acc0 = vdupq_n_f32(0);
+	float32x4_t acc1 = vdupq_n_f32(0);
+	unsigned int k = 0;
+	for(; k + 8 <= n; k += 8)
+	{
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + k), vld1q_f32(b + k));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a + k + 4), vld1q_f32(b + k + 4));
+	}
+	if(k < n)
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + k), vld1q_f32(b + k));
+	float32x4_t acc = vaddq_f32(acc0, acc1);
+	float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+static const char* kResamplerBackend = "sse2";
+static inline float dot(const float* a, const float* b, unsigned int n)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	unsigned int k = 0;
+	for(; k + 8 <= n; k += 8)
+	{
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + k + 4), _mm_loadu_ps(b + k + 4)));
+	}
+	if(k < n)
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+	float sum[4];
+	_mm_storeu_ps(sum, _mm_add_ps(acc0, acc1));
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+#else
+static const char* kResamplerBackend = "scalar";
+static inline float dot(const float* a, const float* b, unsigned int n)
+{
+	float acc[4] = {0, 0, 0, 0};
+	for(unsigned int k = 0; k < n; k += 4)
+		for(unsigned int l = 0; l < 4; ++l)
+			acc[l] += a[k + l] * b[k + l];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+#endif
+
+const char* Resampler::getBackend()
+{
+	return kResamplerBackend;
+}
+
+// Modified Bessel function of the first kind, order 0
+static double besselI0(double x)
+{
+	double sum = 1;
+	double term = 1;
+	for(unsigned int k = 1; k < 50; ++k)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if(term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while(b)
+	{
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+int Resampler::setup(unsigned int inRate, unsigned int outRate, unsigned int newNumChannels, unsigned int taps)
+{
+	if(!inRate || !outRate || !newNumChannels || !taps)
+		return -1;
+	numChannels = newNumChannels;
+	unsigned int g = gcd(inRate, outRate);
+	up = outRate / g;
+	down = inRate / g;
+	if(up > kMaxPhases)
+	{
+		// find the closest fraction with at most kMaxPhases phases
+		double ratio = outRate / double(inRate);
+		double bestError = INFINITY;
+		for(unsigned int p = 1; p <= kMaxPhases; ++p)
+		{
+			unsigned int q = std::max(1.0, round(p / ratio));
+			double error = fabs(p / double(q) - ratio);
+			if(error < bestError)
+			{
+				bestError = error;
+				up = p;
+				down = q;
+			}
+		}
+	}
+	double cutoff;
+	if(up == down)
+	{
+		// a plain delay line: the filter is an impulse
+		cutoff = 1;
+		numTaps = 4;
+	} else {
+		cutoff = kRolloff * std::min(1.0, up / double(down));
+		numTaps = std::min(double(kMaxTaps), ceil(taps / cutoff * kRolloff));
+		// a multiple of 4, for the SIMD kernels
+		numTaps = (numTaps + 3) & ~3;
+	}
+	unsigned int half = numTaps / 2;
+	coeffs.resize(up * numTaps);
+	double i0Beta = besselI0(kKaiserBeta);
+	for(unsigned int p = 0; p < up; ++p)
+	{
+		float* c = coeffs.data() + p * numTaps;
+		double sum = 0;
+		for(unsigned int q = 0; q < numTaps; ++q)
+		{
+			// distance from the output sample to input sample q, in
+			// input samples
+			double x = p / double(up) + half - 1 - double(q);
+			double r = x / half;
+			double window = fabs(r) < 1 ? besselI0(kKaiserBeta * sqrt(1 - r * r)) / i0Beta : 0;
+			double arg = M_PI * cutoff * x;
+			double sinc = fabs(arg) < 1e-9 ? 1 : sin(arg) / arg;
+			c[q] = cutoff * sinc * window;
+			sum += c[q];
+		}
+		// unity gain at DC for every phase
+		for(unsigned int q = 0; q < numTaps; ++q)
+			c[q] /= sum;
+	}
+	capacity = numTaps + kBlockFrames;
+	history.resize(numChannels * capacity);
+	reset(0);
+	return 0;
+}
+
+uint64_t Resampler::reset(uint64_t outputFrame)
+{
+	uint64_t t = outputFrame * down;
+	int64_t first = int64_t(t / up) - (numTaps / 2 - 1);
+	uint64_t start = std::max(first, int64_t(0));
+	// the history before the start of the input is silence
+	length = start - first;
+	std::fill(history.begin(), history.end(), 0);
+	time = t - first * int64_t(up);
+	return start;
+}
+
+void Resampler::append(const float* in, unsigned int frames)
+{
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		float* dest = history.data() + c * capacity + length;
+		for(unsigned int n = 0; n < frames; ++n)
+			dest[n] = in[n * numChannels + c];
+	}
+	length += frames;
+}
+
+unsigned int Resampler::process(float* out, unsigned int outFrames, const float* in, unsigned int inFrames, unsigned int& inUsed)
+{
+	unsigned int half = numTaps / 2;
+	unsigned int produced = 0;
+	inUsed = 0;
+	while(produced < outFrames)
+	{
+		uint64_t i = time / up;
+		unsigned int p = time % up;
+		// the first sample needed by the filter is always in history
+		uint64_t first = i + 1 - half;
+		if(i + half < length)
+		{
+			const float* c = coeffs.data() + p * numTaps;
+			for(unsigned int ch = 0; ch < numChannels; ++ch)
+				out[produced * numChannels + ch] = dot(c, history.data() + ch * capacity + first, numTaps);
+			++produced;
+			time += down;
+		} else if(inUsed < inFrames) {
+			if(length == capacity)
+			{
+				// drop what is no longer needed
+				unsigned int drop = std::min(first, uint64_t(length));
+				for(unsigned int ch = 0; ch < numChannels; ++ch)
+				{
+					float* h = history.data() + ch * capacity;
+					memmove(h, h + drop, (length - drop) * sizeof(h[0]));
+				}
+				length -= drop;
+				time -= uint64_t(drop) * up;
+			}
+			unsigned int frames = std::min(inFrames - inUsed, capacity - length);
+			append(in + inUsed * numChannels, frames);
+			inUsed += frames;
+		} else
+			break;
+	}
+	return produced;
+}
+
+int Resampler::process(std::vector<float>& out, const float* in, size_t inFrames, unsigned int numChannels, unsigned int inRate, unsigned int outRate)
+{
+	if(inRate == outRate)
+	{
+		out.assign(in, in + inFrames * numChannels);
+		return 0;
+	}
+	Resampler r;
+	if(r.setup(inRate, outRate, numChannels))
+		return -1;
+	size_t outFrames = r.getOutputFrames(inFrames);
+	out.resize(outFrames * numChannels);
+	// silence to flush the end of the signal through the filter
+	std::vector<float> zeros(kBlockFrames * numChannels);
+	size_t inPos = 0;
+	size_t done = 0;
+	while(done < outFrames)
+	{
+		unsigned int used;
+		unsigned int toWrite = std::min(outFrames - done, size_t(1) << 20);
+		float* dest = out.data() + done * numChannels;
+		if(inPos < inFrames)
+		{
+			unsigned int toRead = std::min(inFrames - inPos, size_t(1) << 20);
+			done += r.process(dest, toWrite, in + inPos * numChannels, toRead, used);
+			inPos += used;
+		} else
+			done += r.process(dest, toWrite, zeros.data(), kBlockFrames, used);
+	}
+	return 0;
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+// The amplitude of the component of x at frequency f, relative to rate
+static double amplitude(const std::vector<float>& x, unsigned int channels, unsigned int channel, double f, unsigned int rate, size_t start, size_t end)
+{
+	double re = 0;
+	double im = 0;
+	for(size_t n = start; n < end; ++n)
+	{
+		re += x[n * channels + channel] * cos(2 * M_PI * f * n / rate);
+		im += x[n * channels + channel] * sin(2 * M_PI * f * n / rate);
+	}
+	return 2 * sqrt(re * re + im * im) / (end - start);
+}
+
+bool ResamplerTest()
+{
+	const unsigned int kChannels = 2;
+	const unsigned int rates[][2] = {
+		{48000, 44100},
+		{44100, 48000},
+		{22050, 44100},
+		{96000, 44100},
+		{44100, 44101}, // approximated
+	};
+	for(auto& rate : rates)
+	{
+		unsigned int inRate = rate[0];
+		unsigned int outRate = rate[1];
+		size_t inFrames = inRate / 2;
+		// a tone below both Nyquists on channel 0, and one above the
+		// output Nyquist, when downsampling, on channel 1
+		double f0 = 1000;
+		double f1 = inRate > outRate ? outRate * 0.6 : 3000;
+		std::vector<float> in(inFrames * kChannels);
+		for(size_t n = 0; n < inFrames; ++n)
+		{
+			in[n * kChannels + 0] = 0.5 * sin(2 * M_PI * f0 * n / inRate);
+			in[n * kChannels + 1] = 0.5 * sin(2 * M_PI * f1 * n / inRate);
+		}
+		std::vector<float> offline;
+		assert(0 == Resampler::process(offline, in.data(), inFrames, kChannels, inRate, outRate));
+		size_t outFrames = offline.size() / kChannels;
+		assert(llabs(int64_t(outFrames) - int64_t(inFrames * outRate / inRate)) <= 1);
+		// steer clear of the edges
+		size_t start = outFrames / 10;
+		size_t end = outFrames - start;
+		assert(fabs(amplitude(offline, kChannels, 0, f0, outRate, start, end) - 0.5) < 0.002);
+		// the output is aligned with the input, unless the ratio was
+		// approximated
+		for(size_t n = start; n < end && outRate != 44101; n += 97)
+			assert(fabs(offline[n * kChannels] - 0.5 * sin(2 * M_PI * f0 * n / outRate)) < 0.002);
+		if(inRate > outRate)
+			assert(amplitude(offline, kChannels, 1, f1 - outRate * 0.2, outRate, start, end) < 0.001);
+		else
+			assert(fabs(amplitude(offline, kChannels, 1, f1, outRate, start, end) - 0.5) < 0.002);
+
+		// streaming in blocks of random size gives the same result
+		Resampler r(inRate, outRate, kChannels);
+		std::vector<float> streamed(offline.size());
+		size_t inPos = 0;
+		size_t outPos = 0;
+		srand(1);
+		while(inPos < inFrames && outPos < outFrames)
+		{
+			unsigned int inBlock = std::min(size_t(rand() % 300 + 1), inFrames - inPos);
+			unsigned int outBlock = std::min(size_t(rand() % 300 + 1), outFrames - outPos);
+			unsigned int used;
+			outPos += r.process(streamed.data() + outPos * kChannels, outBlock, in.data() + inPos * kChannels, inBlock, used);
+			inPos += used;
+		}
+		for(size_t n = 0; n < outPos * kChannels; ++n)
+			assert(streamed[n] == offline[n]);
+
+		// after a reset, the output starts from the requested frame
+		size_t frame = outFrames / 3;
+		uint64_t inStart = r.reset(frame);
+		assert(inStart <= r.getInputFrame(frame));
+		std::vector<float> jumped(100 * kChannels);
+		unsigned int used;
+		unsigned int written = r.process(jumped.data(), 100, in.data() + inStart * kChannels, inFrames - inStart, used);
+		assert(100 == written);
+		for(size_t n = 0; n < jumped.size(); ++n)
+			assert(fabs(jumped[n] - offline[frame * kChannels + n]) < 1e-5);
+	}
+	printf("ResamplerTest successful (%s)\n", Resampler::getBackend());
+	return true;
+}
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A polyphase windowed-sinc sample-rate converter, for interleaved
+ * multichannel audio.
+ *
+ * The ratio between the output and the input sample rate is reduced to a
+ * fraction L/M and each output sample is computed as the dot product of
+ * the input around its position with one of L precomputed phases of a
+ * Kaiser-windowed sinc. The dot products use NEON or SSE where available.
+ * The filter is centred on the output sample, so the output is aligned with
+ * the input: output frame `n` is at input time `n * M / L`.
+ *
+ * This is not meant to be run on the audio thread: use it at load time or
+ * on a disk thread. Converting to a power-of-two subdivision of the rate,
+ * e.g. 88200 to 44100, is as cheap as any other ratio.
+ */
+class Resampler
+{
+public:
+	/// The default number of taps for each phase when upsampling. This
+	/// is multiplied by the decimation ratio when downsampling.
+	static constexpr unsigned int kDefaultTaps = 64;
+	/// The maximum number of phases. When the ratio needs more, it is
+	/// approximated by the closest fraction that doesn't.
+	static constexpr unsigned int kMaxPhases = 1024;
+	Resampler() {};
+	Resampler(unsigned int inRate, unsigned int outRate, unsigned int numChannels, unsigned int taps = kDefaultTaps)
+	{
+		setup(inRate, outRate, numChannels, taps);
+	}
+	/**
+	 * Compute the filter and allocate the buffers. This is followed by
+	 * an implicit reset(0).
+	 *
+	 * @param inRate the sample rate of the input.
+	 * @param outRate the sample rate of the output.
+	 * @param numChannels the number of interleaved channels.
+	 * @param taps the length of the filter, in input samples, when
+	 * upsampling. Longer filters have a sharper transition band and a
+	 * higher stopband attenuation, at the expense of CPU time.
+	 *
+	 * @return 0 on success, a negative value otherwise.
+	 */
+	int setup(unsigned int inRate, unsigned int outRate, unsigned int numChannels, unsigned int taps = kDefaultTaps);
+	/**
+	 * Forget the input received so far and prepare to output from
+	 * @p outputFrame on.
+	 *
+	 * @param outputFrame the position of the next output frame, in the
+	 * timeline of the output.
+	 *
+	 * @return the input frame from which process() expects its input.
+	 * This is a few frames before the input that corresponds to @p
+	 * outputFrame, so that the filter has some history.
+	 */
+	uint64_t reset(uint64_t outputFrame = 0);
+	/**
+	 * Convert interleaved frames.
+	 *
+	 * This stops as soon as either @p outFrames frames have been written
+	 * or all of the input has been used. Input is consumed ahead of the
+	 * output by about half the filter length.
+	 *
+	 * @param out the destination of the output.
+	 * @param outFrames the maximum number of frames to write to @p out.
+	 * @param in the input.
+	 * @param inFrames the number of frames in @p in.
+	 * @param inUsed the number of frames of @p in that have been used.
+	 *
+	 * @return the number of frames written to @p out.
+	 */
+	unsigned int process(float* out, unsigned int outFrames, const float* in, unsigned int inFrames, unsigned int& inUsed);
+	/**
+	 * Convert a whole signal.
+	 *
+	 * @param out the destination, which is resized to contain
+	 * `inFrames * outRate / inRate` frames, rounded up.
+	 * @param in interleaved input.
+	 * @param inFrames the number of frames in @p in.
+	 * @param numChannels the number of interleaved channels.
+	 * @param inRate the sample rate of the input.
+	 * @param outRate the sample rate of the output.
+	 *
+	 * @return 0 on success, a negative value otherwise.
+	 */
+	static int process(std::vector<float>& out, const float* in, size_t inFrames, unsigned int numChannels, unsigned int inRate, unsigned int outRate);
+	/**
+	 * Get the number of output frames corresponding to @p inFrames input
+	 * frames, rounded up.
+	 */
+	uint64_t getOutputFrames(uint64_t inFrames) const { return (inFrames * up + down - 1) / down; }
+	/**
+	 * Get the input frame that corresponds to @p outputFrame, rounded
+	 * down.
+	 */
+	uint64_t getInputFrame(uint64_t outputFrame) const { return outputFrame * down / up; }
+	unsigned int getNumChannels() const { return numChannels; }
+	/**
+	 * Get the length of the filter, in input frames.
+	 */
+	unsigned int getNumTaps() const { return numTaps; }
+	/**
+	 * Get the name of the instruction set used for the filter.
+	 */
+	static const char* getBackend();
+private:
+	void append(const float* in, unsigned int frames);
+	std::vector<float> coeffs; // numTaps for each of the `up` phases
+	std::vector<float> history; // numChannels * capacity
+	unsigned int numChannels = 0;
+	unsigned int numTaps = 0;
+	unsigned int up = 1;
+	unsigned int down = 1;
+	unsigned int capacity = 0;
+	// number of frames in history
+	unsigned int length = 0;
+	// the position of the next output frame, relative to the first frame
+	// in history, in units of 1/up input frames
+	uint64_t time = 0;
+};
@@ -1,29 +1,37 @@
 #include "Scope.h"
 #include <libraries/ne10/NE10.h>
 #include <math.h>
+#include <cmath>
 #include <libraries/WSServer/WSServer.h>
-#include <JSON.h>
+#include <JSONDocument.h>
+#include <JSONWriter.h>
 #include <AuxTaskRT.h>
+#include <AuxTaskNonRT.h>
 #include <stdexcept>
+#include <algorithm>
+#include <string.h>
+#include <stdarg.h>
 
 Scope::Scope(): isUsingOutBuffer(false), 
                 isUsingBuffer(false), 
                 isResizing(true), 
+                xOffset(0), 
                 upSampling(1), 
                 downSampling(1), 
+                holdOff(0), 
+                forceSend(true), 
                 triggerPrimed(false), 
-                started(false), 
-		windowFFT(NULL),
-		inFFT(NULL),
-		outFFT(NULL),
-		cfg(NULL)
+                started(false)
 		{}
 
-Scope::Scope(unsigned int numChannels, float sampleRate){
+Scope::Scope(unsigned int numChannels, float sampleRate) : Scope(){
 	setup(numChannels, sampleRate);
 }
 
 void Scope::cleanup(){
+	stop();
+	// wait for the FFT worker before freeing what it uses
+	scopeFFTTask.reset();
 	dealloc();
 }
 Scope::~Scope(){
@@ -31,17 +39,16 @@ Scope::~Scope(){
 }
 
 void Scope::dealloc(){
-	delete[] windowFFT;
-	NE10_FREE(inFFT);
-	NE10_FREE(outFFT);
-	NE10_FREE(cfg);
+	fft.cleanup();
+	windowFFT.clear();
+	inFFT.clear();
+	outFFT.clear();
+	powerFFT.clear();
 }
 
 void Scope::triggerTask(){
     if (TIME_DOMAIN == plotMode){
         triggerTimeDomain();
-    } else if (FREQ_DOMAIN == plotMode){
-        triggerFFT();
     }
 }
 
@@ -51,8 +58,11 @@ void Scope::setup(unsigned int _numChannels, float _sampleRate){
    
     setSetting(L"numChannels", _numChannels);
     setSetting(L"sampleRate", _sampleRate);
+    setSetting(L"FFTAverage", 1);
+    setSetting(L"FFTOverlap", 0.5);
 	
 	// set up the websocket server
+	controlDocument = std::unique_ptr<JSONDocument>(new JSONDocument());
 	ws_server = std::unique_ptr<WSServer>(new WSServer());
 	ws_server->setup(5432);
 	ws_server->addAddress("scope_data", nullptr, nullptr, nullptr, true);
@@ -70,6 +80,10 @@ void Scope::setup(unsigned int _numChannels, float _sampleRate){
 	// setup the auxiliary tasks
 	scopeTriggerTask = std::unique_ptr<AuxTaskRT>(new AuxTaskRT());
 	scopeTriggerTask->create("scope-trigger-task", [this](){ triggerTask(); });
+	// the spectra are computed at a lower priority than anything
+	// real-time
+	scopeFFTTask = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
+	scopeFFTTask->create("scope-fft-task", [this](){ doFFT(); });
 }
 
 void Scope::start(){
@@ -77,8 +91,12 @@ void Scope::start(){
 	// reset the pointers
 writePointer = 0;
     readPointer = 0;
+    loggedFFT = 0;
+    hopCountFFT = 0;
 
     logCount = 0;
+    samplesSinceSend = 0;
+    forceSend = true;
     started = true;
 
 }
@@ -103,12 +121,28 @@ void Scope::setPlotMode(){
 	if(TIME_DOMAIN == plotMode) {
 		channelWidth = frameWidth * FRAMES_STORED;
 	} else {
-		channelWidth = FFTLength;
+		// leave room for the audio thread to keep writing while the
+		// FFT worker reads the latest window. A power of two, so that
+		// the indices stay consistent when loggedFFT wraps around
+		channelWidth = Fft::roundUpToPowerOfTwo(2 * FFTLength);
 	}
     buffer.resize(numChannels*channelWidth);
+	if(TIME_DOMAIN == plotMode) {
+		minBuffer.resize(buffer.size());
+		maxBuffer.resize(buffer.size());
+	}
+	minLogged.resize(numChannels);
+	maxLogged.resize(numChannels);
     
     // setup the output buffer
     outBuffer.resize(numChannels*frameWidth);
+    outMinBuffer.resize(outBuffer.size());
+    outMaxBuffer.resize(outBuffer.size());
+	// room for the header, the offset and scale of each channel and a
+	// min/max pair for each point
+	frameBuffer.resize(sizeof(FrameHeader) + numChannels*2*sizeof(float) + outBuffer.size()*2*sizeof(int16_t));
+	lastFrame.resize(frameBuffer.size());
+	lastFrameSize = 0;
     
     // reset the trigger
     triggerPointer = 0;
@@ -119,26 +153,37 @@ void Scope::setPlotMode(){
     downSampleCount = 1;
     autoTriggerCount = 0;
     customTriggered = false;
+    samplesSinceSend = 0;
         
     if (FREQ_DOMAIN == plotMode){
 		dealloc();
-		inFFT  = (ne10_fft_cpx_float32_t*) NE10_MALLOC (FFTLength * sizeof (ne10_fft_cpx_float32_t));
-		outFFT = (ne10_fft_cpx_float32_t*) NE10_MALLOC (FFTLength * sizeof (ne10_fft_cpx_float32_t));
-		cfg = ne10_fft_alloc_c2c_float32_neon (FFTLength);
-    	windowFFT = new float[FFTLength];
-    	
-    	pointerFFT = 0;
-        collectingFFT = true;
+		fft.setup(FFTLength);
+		// all channels are transformed in one go
+		inFFT.resize(numChannels * FFTLength);
+		outFFT.resize(numChannels * fft.getNumBins());
+		powerFFT.resize(outFFT.size());
+		averageFFT.resize(outFFT.size());
+		// doFFT() sizes it according to FFTAverage
+		historyFFT.clear();
+		windowFFT.resize(FFTLength);
+		
+		loggedFFT = 0;
+		lastLoggedFFT = 0;
+		hopCountFFT = 0;
+		averageCountFFT = 0;
+		averagePosFFT = 0;
     
     	// Calculate a Hann window
 		// The coherentGain compensates for the loss of energy due to the windowing.
 		// and yields a ~unitary peak for a sinewave centered in the bin.
 		float coherentGain = 0.5f;
-    	for(int n = 0; n < FFTLength; n++) {
-			windowFFT[n] = 0.5f * (1.0f - cosf(2.0 * M_PI * n / (float)(FFTLength - 1))) / coherentGain;
-    	}
+		Fft::makeWindow(windowFFT.data(), FFTLength, Fft::kHann);
+		for(auto& w : windowFFT)
+			w /= coherentGain;
         
     }
+	// the frame rate cap depends on the frame width
+	setXParams();
 	isResizing = false; 
 // printf("end setPlotMode\n");
 }
@@ -147,10 +192,41 @@ void Scope::log(const float* values){
 	
 	if (!prelog()) return;
 
+	const float* mins = values;
+	const float* maxs = values;
+    if (TIME_DOMAIN == plotMode && downSampling > 1){
+		// keep track of the peaks of the samples that are not stored, so
+		// that they don't get lost when downsampling
+		if (1 == downSampleCount){
+			std::copy(values, values + numChannels, minLogged.begin());
+			std::copy(values, values + numChannels, maxLogged.begin());
+		} else {
+			for (int i=0; i<numChannels; i++) {
+				minLogged[i] = std::min(minLogged[i], values[i]);
+				maxLogged[i] = std::max(maxLogged[i], values[i]);
+			}
+		}
+        if (downSampleCount < downSampling){
+            downSampleCount++;
+            isUsingBuffer = false;
+            return;
+        }
+        downSampleCount = 1;
+        mins = minLogged.data();
+        maxs = maxLogged.data();
+    }
+
     // save the logged samples into the buffer
+    // channels are stored sequentially in the buffer i.e [[channel1], [channel2], etc...]
 	for (int i=0; i<numChannels; i++) {
 		buffer[i*channelWidth + writePointer] = values[i];
 	}
+	if (TIME_DOMAIN == plotMode){
+		for (int i=0; i<numChannels; i++) {
+			minBuffer[i*channelWidth + writePointer] = mins[i];
+			maxBuffer[i*channelWidth + writePointer] = maxs[i];
+		}
+	}
 
 	postlog();
 
@@ -158,36 +234,25 @@ void Scope::log(const float* values){
 
 void Scope::log(double chn1, ...){
 	
-	if (!prelog()) return;
-    
     va_list args;
     va_start (args, chn1);
     
-    // save the logged samples into the buffer
-    buffer[writePointer] = chn1;
-
+    // numChannels is at most 50, see setup()
+    float values[50];
+    values[0] = chn1;
     for (int i=1; i<numChannels; i++) {
-        // iterate over the function arguments, store them in the relevant part of the buffer
-        // channels are stored sequentially in the buffer i.e [[channel1], [channel2], etc...]
-        buffer[i*channelWidth + writePointer] = (float)va_arg(args, double);
+        // iterate over the function arguments
+        values[i] = (float)va_arg(args, double);
     }
-    
-    postlog();
     va_end (args);
+    
+    log(values);
 }
 
 bool Scope::prelog(){
 	
     if (!started || isResizing || isUsingBuffer) return false;
     
-    if (TIME_DOMAIN == plotMode && downSampling > 1){
-        if (downSampleCount < downSampling){
-            downSampleCount++;
-            return false;
-        }
-        downSampleCount = 1;
-    }
-    
 	isUsingBuffer = true;
     return true;
 }
@@ -197,6 +262,17 @@ void Scope::postlog(){
 	isUsingBuffer = false;
     writePointer = (writePointer+1)%channelWidth;
 	
+	if (FREQ_DOMAIN == plotMode){
+		// make the sample visible to the FFT worker, and wake it up
+		// once every hop
+		loggedFFT.store(loggedFFT.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		if (++hopCountFFT >= hopFFT && !pendingFFT.exchange(true)){
+			hopCountFFT = 0;
+			scopeFFTTask->schedule();
+		}
+		return;
+	}
+	
     if (logCount++ > TRIGGER_LOG_COUNT){
         logCount = 0;
         scopeTriggerTask->schedule();
@@ -237,6 +313,7 @@ void Scope::triggerTimeDomain(){
 // printf("do trigger %i, %i\n", readPointer, writePointer);
     // iterate over the samples between the read and write pointers and check for / deal with triggers
     while (readPointer != writePointer){
+        samplesSinceSend++;
         
         // if we are currently listening for a trigger
         if (triggerPrimed){
@@ -283,26 +360,22 @@ void Scope::triggerTimeDomain(){
 					isUsingBuffer = true;
 					isUsingOutBuffer = true;
 					
-					// copy the previous to next frameWidth/2.0f samples into the outBuffer
-					int startptr = (triggerPointer-(int)(frameWidth/2.0f) + channelWidth)%channelWidth;
-					int endptr = (startptr + frameWidth)%channelWidth;
-					
-					if (endptr > startptr){
-						for (int i=0; i<numChannels; i++){
-							std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*i+endptr], outBuffer.begin()+(i*frameWidth));
-						}
+					// when downsampling, send the peaks of each
+					// point rather than a single value
+					bool minMax = downSampling > 1;
+					if (minMax){
+						copyFrame(outMinBuffer.data(), minBuffer);
+						copyFrame(outMaxBuffer.data(), maxBuffer);
 					} else {
-						for (int i=0; i<numChannels; i++){
-							std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*(i+1)], outBuffer.begin()+(i*frameWidth));
-							std::copy(&buffer[channelWidth*i], &buffer[channelWidth*i+endptr], outBuffer.begin()+((i+1)*frameWidth-endptr));
-						}
+						copyFrame(outBuffer.data(), buffer);
 					}
 					isUsingBuffer = false;
 					
-					// the whole frame has been saved in outBuffer, so send it
-					// sendBufferTask.schedule((void*)&outBuffer[0], outBuffer.size()*sizeof(float));
-					// rt_printf("scheduling sendBufferTask size: %i\n", outBuffer.size());
-					ws_server->sendRt("scope_data", outBuffer.data(), outBuffer.size() * sizeof(float));
+					// the whole frame has been saved, so send it
+					if (minMax)
+						sendFrame(nullptr, outMinBuffer.data(), outMaxBuffer.data(), true);
+					else
+						sendFrame(outBuffer.data(), nullptr, nullptr, true);
 					
 					isUsingOutBuffer = false;
                 }
@@ -330,56 +403,89 @@ void Scope::triggerTimeDomain(){
 
 }
 
-void Scope::triggerFFT(){
-    while (readPointer != writePointer){
-        
-        pointerFFT += 1;
-
-        if (collectingFFT){
-            
-            if (pointerFFT > FFTLength){
-                collectingFFT = false;
-                doFFT();
-            }
-            
-        } else {
-            
-            if (pointerFFT > (FFTLength+holdOffSamples)){
-                pointerFFT = 0;
-                collectingFFT = true;
-            }
-            
-        }
-        
-        // increment the read pointer
-        readPointer = (readPointer+1)%channelWidth;
-    
-    }
-}
-
+// runs on the (non real-time) scope-fft-task
 void Scope::doFFT(){
 
-	if(isResizing)
-		return;
-	
+	pendingFFT = false;
+	// setPlotMode() sets isResizing and then waits for isUsingOutBuffer
+	// to be cleared. We do the opposite, so that at least one of us sees
+	// the other's flag
 	isUsingOutBuffer = true;
+	if(isResizing){
+		isUsingOutBuffer = false;
+		return;
+	}
 	
     // constants
-    int ptr = readPointer-FFTLength+channelWidth;
     float ratio = (float)(FFTLength/2)/(frameWidth*downSampling);
     float logConst = -logf(1.0f/(float)frameWidth)/(float)frameWidth;
     
-    isUsingBuffer = true;
-    for (int c=0; c<numChannels; c++){
-    	
-        // prepare the FFT input & do windowing
-        for (int i=0; i<FFTLength; i++){
-            inFFT[i].r = (ne10_float32_t)(buffer[(ptr+i)%channelWidth+c*channelWidth] * windowFFT[i]);
-            inFFT[i].i = 0;
+    // prepare the FFT input & do windowing. The audio thread doesn't wait
+    // for us: if it has overwritten the latest FFTLength samples while we
+    // were reading them, try again with the newer ones
+    unsigned int end = 0;
+    bool valid = false;
+    for (int attempt=0; attempt<4 && !valid; attempt++){
+        end = loggedFFT.load(std::memory_order_acquire);
+        if (end < (unsigned int)FFTLength)
+            break;
+        // the window may wrap around the end of the circular buffer
+        int start = (end - FFTLength) % channelWidth;
+        int firstLength = std::min(FFTLength, channelWidth - start);
+        for (int c=0; c<numChannels; c++){
+            const float* src = buffer.data() + c*channelWidth;
+            float* dst = inFFT.data() + c*FFTLength;
+            Fft::applyWindow(dst, src + start, windowFFT.data(), firstLength);
+            Fft::applyWindow(dst + firstLength, src, windowFFT.data() + firstLength, FFTLength - firstLength);
         }
-        
-        // do the FFT
-        ne10_fft_c2c_1d_float32_neon (outFFT, inFFT, cfg, 0);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        valid = loggedFFT.load(std::memory_order_relaxed) - end < (unsigned int)(channelWidth - FFTLength);
+    }
+    if (!valid){
+        isUsingOutBuffer = false;
+        return;
+    }
+    
+    // do the FFT of all channels and take the squared magnitude of the spectra
+    fft.fft(outFFT.data(), inFFT.data(), numChannels);
+    Fft::power(powerFFT.data(), outFFT.data(), powerFFT.size());
+    
+    // average the last FFTAverage power spectra, which are kept in a
+    // ring. Until FFTAverage of them have been computed, this is the mean
+    // of the ones computed so far. FFTAverage can be changed at any time:
+    // start over when it is
+    int average = FFTAverage;
+    unsigned int size = powerFFT.size();
+    if (historyFFT.size() != average * size){
+        historyFFT.assign(average * size, 0);
+        sumFFT.assign(size, 0);
+        averageCountFFT = 0;
+        averagePosFFT = 0;
+    }
+    float* oldest = historyFFT.data() + averagePosFFT * size;
+    for (unsigned int n=0; n<size; n++){
+        sumFFT[n] += powerFFT[n] - oldest[n];
+        oldest[n] = powerFFT[n];
+    }
+    averagePosFFT = (averagePosFFT + 1) % average;
+    averageCountFFT = std::min(averageCountFFT + 1, average);
+    double scale = 1.0 / averageCountFFT;
+    for (unsigned int n=0; n<size; n++){
+        // rounding errors may take it slightly below 0
+        averageFFT[n] = std::max(0.0, sumFFT[n] * scale);
+    }
+    
+    // don't send more than one frame every holdOffSamples
+    if (end > lastLoggedFFT)
+        samplesSinceSend += end - lastLoggedFFT;
+    lastLoggedFFT = end;
+    if (samplesSinceSend < holdOffSamples){
+        isUsingOutBuffer = false;
+        return;
+    }
+    
+    for (int c=0; c<numChannels; c++){
+        const float* power = averageFFT.data() + c*fft.getNumBins();
         
         if (ratio < 1.0f){
         
@@ -398,7 +504,7 @@ void Scope::doFFT(){
                 
 				float yAxis[2];
 				for(unsigned int n = 0; n < 2; ++n){
-					float magSquared = outFFT[index + n].r * outFFT[index + n].r + outFFT[index + n].i * outFFT[index + n].i;
+					float magSquared = power[index + n];
 					if (FFTYAxis == 0){ // normalised linear magnitude
 						yAxis[n] = FFTScale * sqrtf(magSquared);
 					} else { // Otherwise it is going to be (FFTYAxis == 1): decibels
@@ -412,11 +518,6 @@ void Scope::doFFT(){
             
         } else {
             
-            /*float mags[FFTLength/2];
-            for (int i=0; i<FFTLength/2; i++){
-                mags[i] = (float)(outFFT[i].r * outFFT[i].r + outFFT[i].i * outFFT[i].i);
-            }*/
-            
             for (int i=0; i<frameWidth; i++){
                 
                 float findex = (float)i*ratio;
@@ -433,12 +534,10 @@ void Scope::doFFT(){
                 if (mindex < 0) mindex = 0;
                 if (maxdex >= FFTLength/2) maxdex = FFTLength/2;
                 
-                // do all magnitudes first, then search? - turns out this doesnt help
                 float maxVal = 0.0f;
                 for (int j=mindex; j<=maxdex; j++){
-                    float mag = (float)(outFFT[j].r * outFFT[j].r + outFFT[j].i * outFFT[j].i);
-                    if (mag > maxVal){
-                        maxVal = mag;
+                    if (power[j] > maxVal){
+                        maxVal = power[j];
                     }
                 }
                 
@@ -451,21 +550,115 @@ void Scope::doFFT(){
         }
         
     }
-    
-	isUsingBuffer = false;
 	
-	// sendBufferTask.schedule((void*)&outBuffer[0], outBuffer.size()*sizeof(float));
-    // rt_printf("scheduling sendBufferTask size: %i\n", outBuffer.size());
-    ws_server->sendRt("scope_data", outBuffer.data(), outBuffer.size() * sizeof(float));
+    sendFrame(outBuffer.data(), nullptr, nullptr, false);
 
     isUsingOutBuffer = false;
 }
 
+void Scope::copyFrame(float* dest, const std::vector<float>& src){
+	// copy the previous to next frameWidth/2.0f samples into dest
+	int startptr = (triggerPointer-(int)(frameWidth/2.0f) + channelWidth)%channelWidth;
+	int endptr = (startptr + frameWidth)%channelWidth;
+	
+	if (endptr > startptr){
+		for (int i=0; i<numChannels; i++){
+			std::copy(&src[channelWidth*i+startptr], &src[channelWidth*i+endptr], dest+(i*frameWidth));
+		}
+	} else {
+		for (int i=0; i<numChannels; i++){
+			std::copy(&src[channelWidth*i+startptr], &src[channelWidth*(i+1)], dest+(i*frameWidth));
+			std::copy(&src[channelWidth*i], &src[channelWidth*i+endptr], dest+((i+1)*frameWidth-endptr));
+		}
+	}
+}
+
+// quantise src[n * stride] so that it can be reconstructed as offset + q * scale
+static void quantise(int16_t* dest, const float* src, unsigned int length, unsigned int stride, float offset, float scale){
+	float invScale = scale > 0 ? 1.f / scale : 0;
+	for (unsigned int n=0; n<length; n++){
+		float value = src[n];
+		float q;
+		if (std::isnan(value))
+			q = Scope::kFrameNoData;
+		else if (std::isinf(value))
+			q = value > 0 ? 32767 : -32767;
+		else
+			q = std::max(-32767.f, std::min(32767.f, (value - offset) * invScale));
+		dest[n * stride] = (int16_t)lrintf(q);
+	}
+}
+
+void Scope::sendFrame(const float* values, const float* mins, const float* maxs, bool rt){
+	bool minMax = !values;
+	FrameHeader* header = (FrameHeader*)frameBuffer.data();
+	header->magic[0] = 'S';
+	header->magic[1] = 'F';
+	header->version = kFrameVersion;
+	header->flags = minMax ? kFrameMinMax : 0;
+	header->numChannels = numChannels;
+	header->numPoints = frameWidth;
+	float* params = (float*)(header + 1);
+	int16_t* data = (int16_t*)(params + 2 * numChannels);
+	for (int c=0; c<numChannels; c++){
+		const float* lows = minMax ? mins + c*frameWidth : values + c*frameWidth;
+		const float* highs = minMax ? maxs + c*frameWidth : lows;
+		// the range of the finite values in this channel
+		float lo = INFINITY;
+		float hi = -INFINITY;
+		for (int i=0; i<frameWidth; i++){
+			if (std::isfinite(lows[i]))
+				lo = std::min(lo, lows[i]);
+			if (std::isfinite(highs[i]))
+				hi = std::max(hi, highs[i]);
+		}
+		if (lo > hi)
+			lo = hi = 0;
+		float offset = (lo + hi) * 0.5f;
+		float scale = (hi - lo) / (2 * 32767.f);
+		params[2*c] = offset;
+		params[2*c+1] = scale;
+		if (minMax){
+			quantise(data, lows, frameWidth, 2, offset, scale);
+			quantise(data + 1, highs, frameWidth, 2, offset, scale);
+			data += 2 * frameWidth;
+		} else {
+			quantise(data, lows, frameWidth, 1, offset, scale);
+			data += frameWidth;
+		}
+	}
+	size_t size = (char*)data - frameBuffer.data();
+	// there is no need to send the same frame again, but send it every
+	// now and then anyhow so that the browser knows we are still here
+	if (!forceSend && samplesSinceSend < keepAliveSamples && size == lastFrameSize && !memcmp(frameBuffer.data(), lastFrame.data(), size))
+		return;
+	forceSend = false;
+	samplesSinceSend = 0;
+	if (rt)
+		ws_server->sendRt("scope_data", frameBuffer.data(), size);
+	else
+		ws_server->sendNonRt("scope_data", frameBuffer.data(), size);
+	std::swap(frameBuffer, lastFrame);
+	lastFrameSize = size;
+}
+
 void Scope::setXParams(){
+    // a new frame is sent at most every framePeriod samples: extend the
+    // holdoff so that this is not exceeded
+    int framePeriod;
     if (TIME_DOMAIN == plotMode){
         holdOffSamples = (int)(sampleRate*0.001*holdOff/downSampling);
+        framePeriod = sampleRate/downSampling/kMaxFrameRate;
+        holdOffSamples = std::max(holdOffSamples, framePeriod - frameWidth);
+        keepAliveSamples = sampleRate/downSampling/2;
     } else if (FREQ_DOMAIN == plotMode){
+        // here it is the shortest time between frames, regardless of
+        // how often the spectra are computed
         holdOffSamples = (int)(sampleRate*0.001*holdOff*upSampling);
+        framePeriod = sampleRate/kMaxFrameRate;
+        holdOffSamples = std::max(holdOffSamples, framePeriod);
+        keepAliveSamples = sampleRate/2;
+        hopFFT = std::max(1, (int)(FFTLength*(1 - FFTOverlap)));
     }
     xOffsetSamples = xOffset/upSampling;
 }
@@ -477,6 +670,11 @@ void Scope::setTrigger(TriggerMode mode, unsigned int channel, TriggerSlope dir,
 	setSetting(L"triggerLevel", level);
 }
 
+void Scope::setFFT(unsigned int average, float overlap){
+	setSetting(L"FFTAverage", average);
+	setSetting(L"FFTOverlap", overlap);
+}
+
 void Scope::setSetting(std::wstring setting, float value){
 	
 	// std::string str = std::string(setting.begin(), setting.end());
@@ -512,6 +710,7 @@ void Scope::setSetting(std::wstring setting, float value){
         start();
 	} else if (setting.compare(L"downSampling") == 0){
         downSampling = (int)value;
+        setXParams();
 	} else if (setting.compare(L"holdOff") == 0){
 		holdOff = value;
 		setXParams();
@@ -525,6 +724,14 @@ void Scope::setSetting(std::wstring setting, float value){
         FFTXAxis = (int)value;
 	} else if (setting.compare(L"FFTYAxis") == 0){
         FFTYAxis = (int)value;
+	} else if (setting.compare(L"FFTAverage") == 0){
+		value = std::max(1, (int)value);
+		FFTAverage = (int)value;
+	} else if (setting.compare(L"FFTOverlap") == 0){
+		value = std::max(0.f, std::min(0.95f, value));
+		FFTOverlap = value;
+		if (!isResizing)
+			setXParams();
 	} else if (setting.compare(L"numChannels") == 0){
 		numChannels = (int)value;
 	} else if (setting.compare(L"sampleRate") == 0){
@@ -532,6 +739,8 @@ void Scope::setSetting(std::wstring setting, float value){
 	}
 	
 	settings[setting] = value;
+	// make sure the browser gets a frame with the new settings
+	forceSend = true;
 }
 
 // called when scope_control websocket is connected
@@ -545,16 +754,15 @@ void Scope::scope_control_connected(){
 	// printf("connection!\n");
 	
 	// send connection JSON
-	JSONObject root;
-	root[L"event"] = new JSONValue(L"connection");
-	for (auto setting : settings){
-		root[setting.first] = new JSONValue(setting.second);
+	JSONWriter json;
+	json.beginObject();
+	json.key("event").value("connection");
+	for (auto& setting : settings){
+		json.key(std::string(setting.first.begin(), setting.first.end())).value(setting.second);
 	}
-	JSONValue *value = new JSONValue(root);
-	std::wstring wide = value->Stringify().c_str();
-	std::string str( wide.begin(), wide.end() );
-	// printf("sending JSON: \n%s\n", str.c_str());
-	ws_server->sendNonRt("scope_control", str.c_str());
+	json.endObject();
+	// printf("sending JSON: \n%s\n", json.c_str());
+	ws_server->sendNonRt("scope_control", json.c_str());
 }
 
 // on_data callback for scope_control websocket
@@ -563,35 +771,33 @@ void Scope::scope_control_data(const char* data){
 	
 	// printf("recieved: %s\n", data);
 	
-	// parse the data into a JSONValue
-	JSONValue *value = JSON::Parse(data);
-	if (value == NULL || !value->IsObject()){
+	// parse the data into controlDocument, reusing its memory
+	if (!controlDocument->parse(data) || !controlDocument->getRoot().isObject()){
 		printf("could not parse JSON:\n%s\n", data);
 		return;
 	}
 	
 	// look for the "event" key
-	JSONObject root = value->AsObject();
-	if (root.find(L"event") != root.end() && root[L"event"]->IsString()){
-		std::wstring event = root[L"event"]->AsString();
-		// std::wcout << "event: " << event << "\n";
-		if (event.compare(L"connection-reply") == 0){
+	JSONDocument::Value event = controlDocument->getRoot()["event"];
+	if (event.isString()){
+		// printf("event: %s\n", event.asString());
+		if (event.equals("connection-reply")){
 			// parse all settings and start scope
-			parse_settings(value);
+			parse_settings(*controlDocument);
 			start();
 		}
 		return;
 	}
-	parse_settings(value);
+	parse_settings(*controlDocument);
 }
 
-void Scope::parse_settings(JSONValue* value){
+void Scope::parse_settings(const JSONDocument& doc){
 	// printf("parsing settings\n");
-	std::vector<std::wstring> keys = value->ObjectKeys();
-	for (auto& key : keys){
-		JSONValue *key_value = value->Child(key.c_str());
-		if (key_value && key_value->IsNumber())
-			setSetting(key, (float)key_value->AsNumber());
+	for (auto value = doc.getRoot().getFirst(); value.isValid(); value = value.getNext()){
+		if (value.isNumber()){
+			const char* key = value.getKey();
+			setSetting(std::wstring(key, key + value.getKeyLength()), (float)value.asNumber());
+		}
 	}
 }
 
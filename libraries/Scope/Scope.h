@@ -1,8 +1,10 @@
 #pragma once
-#include <ne10/NE10_types.h>
+#include <libraries/Fft/Fft.h>
 #include <vector>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <stdint.h>
 
 #define FRAMES_STORED 4
 
@@ -10,18 +12,49 @@
 
 // forward declarations
 class WSServer;
-class JSONValue;
-// typedef std::map<std::wstring, JSONValue*> JSONObject;
+class JSONDocument;
 class AuxTaskRT;
+class AuxTaskNonRT;
 
 /** 
  * \brief An oscilloscope which allows data to be visualised in a browser in real time.
  *
  * To use the scope, ensure the Bela IDE is running, and navigate to 
  * http://bela.local/scope
+ *
+ * Frames are sent to the browser as int16 values, one (or, when
+ * downsampling, a min/max pair) per point of the frame, and there are as many
+ * points as pixels on the screen of the browser. At most kMaxFrameRate frames
+ * are sent each second and frames identical to the previous one are not sent,
+ * so that the bandwidth depends on the width of the screen and not on the
+ * sample rate.
+ *
+ * In frequency-domain mode, the audio thread only writes the logged samples
+ * into a lock-free ring buffer. The spectra are computed on a non real-time
+ * thread, with overlapping windows and averaging across frames.
  */
 class Scope{
     public:
+	/// The maximum number of frames sent to the browser each second.
+	static constexpr unsigned int kMaxFrameRate = 30;
+	/**
+	 * The header of a frame sent on the scope_data websocket. All fields
+	 * are little endian. The header is followed by an `offset` and a
+	 * `scale` float for each channel and then, for each channel in turn,
+	 * `numPoints` int16 values, or `numPoints` min/max pairs if `flags`
+	 * has kFrameMinMax set. Each value `q` stands for `offset + q *
+	 * scale`, while kFrameNoData stands for a missing value.
+	 */
+	struct FrameHeader {
+		char magic[2]; ///< "SF"
+		uint8_t version; ///< kFrameVersion
+		uint8_t flags;
+		uint16_t numChannels;
+		uint16_t numPoints;
+	};
+	static constexpr uint8_t kFrameVersion = 1;
+	static constexpr uint8_t kFrameMinMax = 1;
+	static constexpr int16_t kFrameNoData = -32768;
 	typedef enum {
 		AUTO, ///< Auto triggering
 		NORMAL, ///< Normal triggering
@@ -82,6 +115,18 @@ class Scope{
 	 * Set the triggering mode for the scope
 	 */
 	void setTrigger(TriggerMode mode, unsigned int channel = 0, TriggerSlope dir = BOTH, float level = 0);
+
+	/**
+	 * Set the analysis parameters for the frequency-domain mode. These can
+	 * also be changed from the browser through the `FFTAverage` and
+	 * `FFTOverlap` settings.
+	 *
+	 * @param average the number of consecutive spectra that are averaged
+	 * together. 1 means no averaging.
+	 * @param overlap the fraction of each FFT window that overlaps with
+	 * the previous one, between 0 and 0.95.
+	 */
+	void setFFT(unsigned int average, float overlap = 0.5);
 		
     private:
 	typedef enum {
@@ -92,20 +137,21 @@ class Scope{
         void start();
         void stop();
         void triggerTimeDomain();
-        void triggerFFT();
         bool triggered();
         bool prelog();
         void postlog();
+        void copyFrame(float* dest, const std::vector<float>& src);
+        void sendFrame(const float* values, const float* mins, const float* maxs, bool rt);
         void setPlotMode();
         void doFFT();
         void setXParams();
         void scope_control_connected();
         void scope_control_data(const char* data);
-        void parse_settings(JSONValue* value);
+        void parse_settings(const JSONDocument& doc);
         
-	bool volatile isUsingOutBuffer;
+	std::atomic<bool> isUsingOutBuffer;
 	bool volatile isUsingBuffer;
-	bool volatile isResizing;
+	std::atomic<bool> isResizing;
 		
         // settings
         int numChannels;
@@ -128,10 +174,24 @@ class Scope{
         int channelWidth;
         int downSampleCount;
         int holdOffSamples;
+        int keepAliveSamples; // how often to send a frame, even if unchanged
+        int samplesSinceSend;
+        bool volatile forceSend;
         
         // buffers
         std::vector<float> buffer;
+        // smallest and largest values logged in the downSampling samples
+        // ending at each position of buffer
+        std::vector<float> minBuffer;
+        std::vector<float> maxBuffer;
+        std::vector<float> minLogged; // for the samples logged so far
+        std::vector<float> maxLogged;
         std::vector<float> outBuffer;
+        std::vector<float> outMinBuffer;
+        std::vector<float> outMaxBuffer;
+        std::vector<char> frameBuffer; // the encoded frame
+        std::vector<char> lastFrame; // the last frame sent
+        size_t lastFrameSize = 0;
         
         // pointers
         int writePointer;
@@ -153,22 +213,38 @@ class Scope{
 		int newFFTLength;
         float FFTScale;
 		float FFTLogOffset;
-        int pointerFFT;
-        bool collectingFFT;
-        float *windowFFT;
         int FFTXAxis;
         int FFTYAxis;
+        int FFTAverage;
+        float FFTOverlap;
+        int hopFFT; // samples between the start of consecutive windows
+        int hopCountFFT;
+        // samples logged since the last setPlotMode(), which the FFT
+        // worker uses to find the latest window in the ring buffer
+        std::atomic<unsigned int> loggedFFT {0};
+        std::atomic<bool> pendingFFT {false};
+        unsigned int lastLoggedFFT;
+        int averageCountFFT; // spectra in historyFFT, up to FFTAverage
+        int averagePosFFT; // where the next spectrum goes in historyFFT
         
-        ne10_fft_cpx_float32_t* inFFT;
-        ne10_fft_cpx_float32_t* outFFT;
-        ne10_fft_cfg_float32_t cfg;
+        Fft fft;
+        std::vector<float> windowFFT;
+        std::vector<float> inFFT; // windowed input for all channels
+        std::vector<ne10_fft_cpx_float32_t> outFFT; // spectra for all channels
+        std::vector<float> powerFFT; // power spectra for all channels
+        std::vector<float> historyFFT; // the last FFTAverage power spectra
+        std::vector<double> sumFFT; // the sum of the spectra in historyFFT
+        std::vector<float> averageFFT; // their mean, for all channels
         
         std::unique_ptr<AuxTaskRT> scopeTriggerTask;
         void triggerTask();
 		
 		void setSetting(std::wstring setting, float value);
 
+        // reused for each message received on scope_control
+        std::unique_ptr<JSONDocument> controlDocument;
         std::unique_ptr<WSServer> ws_server;
+        std::unique_ptr<AuxTaskNonRT> scopeFFTTask;
         
 		std::map<std::wstring, float> settings;
 };
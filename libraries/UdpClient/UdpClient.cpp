@@ -7,6 +7,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+
+constexpr unsigned int UdpClient::kMaxBatch;
 
 	UdpClient::UdpClient(){}
 	UdpClient::UdpClient(int aPort, const char* aServerName){
@@ -63,6 +68,46 @@ static void dieUninitialized(std::string str){
 		}
 		return 1;
 	};
+	int UdpClient::sendBatch(const void* const* messages, const unsigned int* sizes, unsigned int numMessages){
+		if(!enabled)
+			return -1;
+		struct mmsghdr headers[kMaxBatch];
+		struct iovec iovecs[kMaxBatch];
+		unsigned int sent = 0;
+		while(sent < numMessages){
+			unsigned int num = numMessages - sent;
+			if(num > kMaxBatch)
+				num = kMaxBatch;
+			for(unsigned int n = 0; n < num; ++n){
+				iovecs[n].iov_base = (void*)messages[sent + n];
+				iovecs[n].iov_len = sizes[sent + n];
+				memset(&headers[n], 0, sizeof(headers[n]));
+				headers[n].msg_hdr.msg_name = &destinationServer;
+				headers[n].msg_hdr.msg_namelen = sizeof(destinationServer);
+				headers[n].msg_hdr.msg_iov = &iovecs[n];
+				headers[n].msg_hdr.msg_iovlen = 1;
+			}
+			int ret = sendmmsg(outSocket, headers, num, 0);
+			if(ret < 0){
+				if(EINTR == errno)
+					continue;
+				return sent ? sent : -1;
+			}
+			if(!ret)
+				break;
+			sent += ret;
+		}
+		return sent;
+	}
+	int UdpClient::setSendBufferSize(int size){
+		if(setsockopt(outSocket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0)
+			return -1;
+		int actual;
+		socklen_t len = sizeof(actual);
+		if(getsockopt(outSocket, SOL_SOCKET, SO_SNDBUF, &actual, &len) < 0)
+			return -1;
+		return actual;
+	}
 	int UdpClient::write(const char* remoteHostname, int remotePortNumber, void* sourceBuffer, int numBytesToWrite){
 		setServer(remoteHostname);
 		setPort(remotePortNumber);
@@ -44,6 +44,30 @@ class UdpClient{
 		 */
 		int send(void* message, int size);
 
+		/// The maximum number of packets passed to each system call by sendBatch().
+		static constexpr unsigned int kMaxBatch = 64;
+		/**
+		 * Sends several packets.
+		 *
+		 * Sends the packets to the destination server on the destination
+		 * port, passing up to kMaxBatch of them to each system call.
+		 * @param messages an array of pointers to the packets.
+		 * @param sizes an array with the size of each packet.
+		 * @param numMessages the number of packets.
+		 * @return the number of packets sent or -1 if an error occurred
+		 * before any was sent.
+		 */
+		int sendBatch(const void* const* messages, const unsigned int* sizes, unsigned int numMessages);
+
+		/**
+		 * Sets the size of the kernel send buffer.
+		 *
+		 * The kernel may limit it to /proc/sys/net/core/wmem_max.
+		 * @param size the size in bytes.
+		 * @return the size actually in use, or -1 if an error occurred.
+		 */
+		int setSendBufferSize(int size);
+
 		int write(const char* remoteHostname, int remotePortNumber, void* sourceBuffer, int numBytesToWrite);
 		int waitUntilReady(bool readyForReading, int timeoutMsecs);
 		int setSocketBroadcast(int broadcastEnable);
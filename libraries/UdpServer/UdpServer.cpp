@@ -5,6 +5,11 @@
  *      Author: giulio moro
  */
 #include "UdpServer.h"
+#include <poll.h>
+#include <time.h>
+
+// space for the SCM_TIMESTAMPNS control message of each datagram
+static const size_t kControlSize = CMSG_SPACE(sizeof(struct timespec));
 
 void UdpServer::cleanup(){
 	close();
@@ -129,3 +134,83 @@ int UdpServer::empty(int maxCount){
 	printf("socket emptied with %d reads\n", count);
 	return count;
 }
+
+int UdpServer::setupBatch(unsigned int maxPackets, unsigned int maxPacketSize){
+	if(!maxPackets || !maxPacketSize)
+		return -1;
+	// not initialised, so that only the pages the kernel actually writes
+	// to are backed by memory
+	batchBuffer.reset(new char[(size_t)maxPackets * maxPacketSize]);
+	batchPacketSize = maxPacketSize;
+	batchHeaders.resize(maxPackets);
+	batchIovecs.resize(maxPackets);
+	batchAddrs.resize(maxPackets);
+	batchControl.resize(maxPackets * kControlSize);
+	batchPackets.resize(maxPackets);
+	for(unsigned int n = 0; n < maxPackets; ++n){
+		batchIovecs[n].iov_base = batchBuffer.get() + (size_t)n * maxPacketSize;
+		batchIovecs[n].iov_len = maxPacketSize;
+		struct msghdr& hdr = batchHeaders[n].msg_hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &batchAddrs[n];
+		hdr.msg_iov = &batchIovecs[n];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = &batchControl[n * kControlSize];
+	}
+	return 0;
+}
+
+int UdpServer::readBatch(int timeoutMsecs){
+	if(enabled==false || batchHeaders.empty())
+		return -1;
+	struct pollfd pfd;
+	pfd.fd = inSocket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int ret = poll(&pfd, 1, timeoutMsecs < 0 ? -1 : timeoutMsecs);
+	if(ret <= 0)
+		return ret;
+	// these are overwritten by each call
+	for(auto& h : batchHeaders){
+		h.msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		h.msg_hdr.msg_controllen = kControlSize;
+		h.msg_hdr.msg_flags = 0;
+	}
+	int num = recvmmsg(inSocket, batchHeaders.data(), batchHeaders.size(), MSG_DONTWAIT, NULL);
+	if(num < 0)
+		return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+	for(int n = 0; n < num; ++n){
+		struct msghdr& hdr = batchHeaders[n].msg_hdr;
+		Packet& packet = batchPackets[n];
+		packet.data = batchIovecs[n].iov_base;
+		packet.size = batchHeaders[n].msg_len;
+		packet.truncated = hdr.msg_flags & MSG_TRUNC;
+		packet.timestampNs = 0;
+		packet.from = batchAddrs[n];
+		for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)){
+			if(SOL_SOCKET == cmsg->cmsg_level && SCM_TIMESTAMPNS == cmsg->cmsg_type){
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				packet.timestampNs = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			}
+		}
+	}
+	if(num > 0)
+		from = batchAddrs[num - 1];
+	return num;
+}
+
+int UdpServer::setReceiveBufferSize(int size){
+	if(setsockopt(inSocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+		return -1;
+	int actual;
+	socklen_t len = sizeof(actual);
+	if(getsockopt(inSocket, SOL_SOCKET, SO_RCVBUF, &actual, &len) < 0)
+		return -1;
+	return actual;
+}
+
+int UdpServer::enableTimestamps(bool enable){
+	int value = enable;
+	return setsockopt(inSocket, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) < 0 ? -1 : 0;
+}
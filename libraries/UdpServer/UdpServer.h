@@ -18,8 +18,23 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <memory>
+#include <vector>
 
 class UdpServer{
+	public:
+		/*
+		 * A datagram received by readBatch().
+		 */
+		struct Packet {
+			const void* data;
+			unsigned int size;
+			bool truncated; // the datagram didn't fit in the buffer and its end was discarded
+			uint64_t timestampNs; // when the kernel received it (CLOCK_REALTIME), or 0 if timestamps are not enabled
+			struct sockaddr_in from;
+		};
 	private:
 		int port;
 		int enabled;
@@ -34,6 +49,13 @@ class UdpServer{
 		int length;
 		socklen_t fromLength;
 		struct sockaddr_in from;
+		std::unique_ptr<char[]> batchBuffer;
+		unsigned int batchPacketSize = 0;
+		std::vector<struct mmsghdr> batchHeaders;
+		std::vector<struct iovec> batchIovecs;
+		std::vector<struct sockaddr_in> batchAddrs;
+		std::vector<char> batchControl;
+		std::vector<Packet> batchPackets;
 	public:
 		UdpServer();
 		UdpServer(int aPort);
@@ -66,6 +88,38 @@ class UdpServer{
 		int waitUntilReady(bool readyForReading, int timeoutMsecs);
 		int getLastRecvPort();
 		const char* getLastRecvAddr();
+		/*
+		 * Allocates the buffers used by readBatch().
+		 *
+			maxPackets is the maximum number of datagrams returned by each call to readBatch()
+			and maxPacketSize is the size of the buffer for each of them: longer datagrams are truncated.
+			Returns 0 on success, -1 otherwise.
+		 */
+		int setupBatch(unsigned int maxPackets, unsigned int maxPacketSize = 65536);
+		/*
+		 * Waits for datagrams and reads as many as are available, with a single system call.
+		 *
+			Waits up to timeoutMsecs (or forever, if it is < 0) for the socket to be ready, then reads
+			up to the maxPackets passed to setupBatch(). The datagrams can then be accessed with getPacket()
+			until the next call.
+			Returns the number of datagrams read, 0 if it times out, or -1 if an error occurs.
+		 */
+		int readBatch(int timeoutMsecs);
+		const Packet& getPacket(unsigned int n) const { return batchPackets[n]; }
+		/*
+		 * Sets the size of the kernel receive buffer (SO_RCVBUF), which holds the datagrams
+		 * that haven't been read yet.
+		 *
+			The kernel may limit it to /proc/sys/net/core/rmem_max.
+			Returns the size actually in use, or -1 if an error occurs.
+		 */
+		int setReceiveBufferSize(int size);
+		/*
+		 * Enables kernel receive timestamps (SO_TIMESTAMPNS) for the datagrams read with readBatch().
+		 *
+			Returns 0 on success, -1 otherwise.
+		 */
+		int enableTimestamps(bool enable);
 };
 
 
@@ -3,9 +3,15 @@
 #include <seasocks/IgnoringLogger.h>
 #include <seasocks/Server.h>
 #include <seasocks/WebSocket.h>
+#include <seasocks/Connection.h>
 #include <AuxTaskNonRT.h>
+#include <libraries/MessageBus/MessageBus.h>
 #include <cstring>
 
+constexpr unsigned int WSServer::kBufferSize;
+constexpr unsigned int WSServer::kMaxPending;
+constexpr unsigned int WSServer::kMaxCoalesceSize;
+
 WSServer::WSServer(){}
 WSServer::WSServer(int port){
 	setup(port);
@@ -22,6 +28,22 @@ struct WSServerDataHandler : seasocks::WebSocket::Handler {
 	std::function<void(std::string)> on_connect;
 	std::function<void(std::string)> on_disconnect;
 	bool binary;
+	bool coalesce = false;
+	unsigned int channel;
+	std::shared_ptr<MessageBus> bus;
+	// The records waiting to be sent by the server thread, oldest first,
+	// from queueStart on. They stay in bus until send() is done with them.
+	std::vector<MessageBus::Message> queue;
+	size_t queueStart = 0;
+	size_t queued = 0; // bytes in queue
+	bool sendScheduled = false;
+	std::mutex queueMutex;
+	std::atomic<unsigned int> dropped {0};
+	// only used by send(). They keep their capacity, so that they don't
+	// allocate once they have grown large enough
+	std::vector<MessageBus::Message> sending;
+	std::vector<seasocks::WebSocket*> targets;
+	std::vector<char> coalesceBuffer;
 	void onConnect(seasocks::WebSocket *socket) override {
 		connections.insert(socket);
 		if(on_connect)
@@ -38,28 +60,80 @@ struct WSServerDataHandler : seasocks::WebSocket::Handler {
 		if (on_disconnect)
 			on_disconnect(address);
 	}
-};
-
-void WSServer::client_task_func(std::shared_ptr<WSServerDataHandler> handler, const void* buf, unsigned int size){
-	if (handler->binary){
-		// make a copy of the data before we send it out
-		auto data = std::make_shared<std::vector<void*> >(size);
-		memcpy(data->data(), buf, size);
-		handler->server->execute([handler, data, size]{
-			for (auto c : handler->connections){
-				c->send((uint8_t*) data->data(), size);
+	// Add a record to the queue, releasing the oldest ones if the queue
+	// is full. Called with queueMutex held.
+	void push(const MessageBus::Message& message) {
+		queue.push_back(message);
+		queued += message.size;
+		while(queued > WSServer::kMaxPending && queue.size() - queueStart > 1)
+		{
+			queued -= queue[queueStart].size;
+			bus->release(queue[queueStart]);
+			++queueStart;
+			++dropped;
+		}
+		// don't let the released entries pile up if the server thread
+		// is held up
+		if(queueStart > queue.size() / 2)
+		{
+			queue.erase(queue.begin(), queue.begin() + queueStart);
+			queueStart = 0;
+		}
+	}
+	// Send the queued records to the clients that are keeping up, then
+	// release them. This runs on the server thread.
+	void send() {
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			sendScheduled = false;
+			// swapping keeps the capacity of both
+			sending.clear();
+			sending.swap(queue);
+			sending.erase(sending.begin(), sending.begin() + queueStart);
+			queueStart = 0;
+			queued = 0;
+		}
+		targets.clear();
+		bool someDropped = false;
+		for(auto c : connections){
+			// the server buffers what the client hasn't received
+			// yet: don't let it grow without bounds
+			if(static_cast<seasocks::Connection*>(c)->outputBufferSize() > WSServer::kMaxPending)
+				someDropped = true;
+			else
+				targets.push_back(c);
+		}
+		for(size_t n = 0; n < sending.size();){
+			const char* data = (const char*)sending[n].data;
+			size_t size = sending[n].size;
+			++n;
+			if(binary && coalesce && size <= WSServer::kMaxCoalesceSize
+				&& n < sending.size() && size + sending[n].size <= WSServer::kMaxCoalesceSize)
+			{
+				// gather the following small records in one message
+				char* dest = coalesceBuffer.data();
+				memcpy(dest, data, size);
+				while(n < sending.size() && size + sending[n].size <= WSServer::kMaxCoalesceSize){
+					memcpy(dest + size, sending[n].data, sending[n].size);
+					size += sending[n].size;
+					++n;
+				}
+				data = dest;
 			}
-		});
-	} else {
-		// make a copy of the data before we send it out
-		std::string str = (const char*)buf;
-		handler->server->execute([handler, str]{
-			for (auto c : handler->connections){
-				c->send(str.c_str());
+			for(auto c : targets){
+				if(binary)
+					c->send((const uint8_t*)data, size);
+				else
+					c->send(data);
 			}
-		});
+		}
+		if(someDropped)
+			dropped += sending.size();
+		for(auto& message : sending)
+			bus->release(message);
+		sending.clear();
 	}
-}
+};
 
 void WSServer::setup(int _port) {
 	port = _port;
@@ -70,6 +144,10 @@ void WSServer::setup(int _port) {
 	server_task = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
 	server_task->create(std::string("WSServer_")+std::to_string(_port), [this](){ server->serve("/dev/null", port); });
 	server_task->schedule();
+
+	bus = std::make_shared<MessageBus>(kBufferSize);
+	send_task = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
+	send_task->create(std::string("WSServer_send_")+std::to_string(_port), [this](){ flush(); });
 }
 
 void WSServer::addAddress(std::string _address, std::function<void(std::string, void*, int)> on_receive, std::function<void(std::string)> on_connect, std::function<void(std::string)> on_disconnect, bool binary){
@@ -80,13 +158,80 @@ void WSServer::addAddress(std::string _address, std::function<void(std::string,
 	handler->on_connect = on_connect;
 	handler->on_disconnect = on_disconnect;
 	handler->binary = binary;
+	handler->channel = handlers.size();
+	handler->bus = bus;
 	server->addWebSocketHandler((std::string("/")+_address).c_str(), handler);
-	
-	address_book[_address] = {
-		.thread = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT()),
-		.handler = handler,
-	};
-	address_book[_address].thread->create(std::string("WSClient_")+_address, [this, handler](void* buf, int size){ client_task_func(handler, buf, size); });
+	handlers.push_back(handler);
+}
+
+void WSServer::setCoalescing(const std::string& _address, bool coalesce){
+	WSServerDataHandler* handler = find(_address.c_str());
+	if(handler){
+		handler->coalesceBuffer.resize(coalesce ? kMaxCoalesceSize : 0);
+		handler->coalesce = coalesce;
+	}
+}
+
+unsigned int WSServer::getNumDropped(const std::string& _address){
+	WSServerDataHandler* handler = find(_address.c_str());
+	return handler ? handler->dropped.load() : 0;
+}
+
+// this doesn't allocate, so that it can be used from the audio thread
+WSServerDataHandler* WSServer::find(const char* _address){
+	for(auto& handler : handlers){
+		if(handler->address == _address)
+			return handler.get();
+	}
+	return nullptr;
+}
+
+int WSServer::write(const char* _address, const void* header, unsigned int headerSize, const void* payload, unsigned int payloadSize){
+	WSServerDataHandler* handler = find(_address);
+	if(!handler || !bus)
+		return -1;
+	unsigned int size = headerSize + payloadSize;
+	unsigned int padded = size;
+	if(!handler->binary)
+		padded = size + 1; // null-terminated
+	else if(handler->coalesce)
+		padded = (size + 7) & ~7;
+	char* dest = (char*)bus->reserve(handler->channel, padded);
+	if(!dest)
+		return -1;
+	if(headerSize)
+		memcpy(dest, header, headerSize);
+	if(payloadSize)
+		memcpy(dest + headerSize, payload, payloadSize);
+	memset(dest + size, 0, padded - size);
+	bus->commit(dest);
+	return 0;
+}
+
+// Move the messages written so far to the queues of their addresses, and
+// get the server thread to send them. The records are not copied: each of
+// them is released once it has been sent or dropped. The queue of each
+// address holds at most kMaxPending bytes, so that a slow address doesn't
+// hold up the whole buffer. This runs on send_task, or on the caller's
+// thread for sendNonRt().
+void WSServer::flush(){
+	std::lock_guard<std::mutex> lock(flushMutex);
+	sendPending = false;
+	MessageBus::Message message;
+	while(bus->read(message)){
+		auto& handler = handlers[message.channel];
+		std::lock_guard<std::mutex> lock(handler->queueMutex);
+		handler->push(message);
+	}
+	for(auto& handler : handlers){
+		{
+			std::lock_guard<std::mutex> lock(handler->queueMutex);
+			if(handler->queue.size() == handler->queueStart || handler->sendScheduled)
+				continue;
+			handler->sendScheduled = true;
+		}
+		handler->server->execute([handler]{ handler->send(); });
+	}
 }
 
 int WSServer::sendNonRt(const char* _address, const char* str) {
@@ -94,28 +239,27 @@ int WSServer::sendNonRt(const char* _address, const char* str) {
 }
 
 int WSServer::sendNonRt(const char* _address, const void* buf, unsigned int size) {
-	try {
-		client_task_func(address_book.at(_address).handler, buf, size);
-		return 0;
-	} catch (std::exception&) {
+	if(write(_address, nullptr, 0, buf, size))
 		return -1;
-	}
+	flush();
+	return 0;
 }
 
 int WSServer::sendRt(const char* _address, const char* str){
-	try {
-		return address_book.at(_address).thread->schedule(str);
-	} catch (std::exception&) {
-		return -1;
-	}
+	return sendRt(_address, nullptr, 0, str, strlen(str));
 }
 
 int WSServer::sendRt(const char* _address, const void* buf, unsigned int size){
-	try {
-		return address_book.at(_address).thread->schedule(buf, size);
-	} catch (std::exception&) {
+	return sendRt(_address, nullptr, 0, buf, size);
+}
+
+int WSServer::sendRt(const char* _address, const void* header, unsigned int headerSize, const void* payload, unsigned int payloadSize){
+	if(write(_address, header, headerSize, payload, payloadSize))
 		return -1;
-	}
+	// wake up send_task, unless it's already due to run
+	if(!sendPending.exchange(true))
+		send_task->schedule();
+	return 0;
 }
 
 void WSServer::cleanup(){
@@ -5,6 +5,8 @@
 #include <map>
 #include <vector>
 #include <functional>
+#include <atomic>
+#include <mutex>
 
 // forward declarations for faster render.cpp compiles
 namespace seasocks{
@@ -12,8 +14,23 @@ namespace seasocks{
 	class WebSocket;
 }
 class AuxTaskNonRT;
+class MessageBus;
 struct WSServerDataHandler;
 
+/**
+ * A websocket server, with RT-safe send functions.
+ *
+ * Outgoing messages are written once, with their header if they have one,
+ * into a preallocated buffer shared by all the addresses of the server,
+ * without allocating memory. They stay there until the websocket thread has
+ * sent them: a separate thread only queues references to them for each
+ * address. Messages sent in quick succession, e.g. within the same audio
+ * block, are handed over to the websocket thread together.
+ *
+ * If the clients of an address can't keep up, the oldest messages waiting
+ * to be sent to it are dropped, so that clients such as a scope always get
+ * the most recent data.
+ */
 class WSServer{
 	friend struct WSServerDataHandler;
 	public:
@@ -23,12 +40,42 @@ class WSServer{
 		
 		void setup(int port);
 
+		/// The size of the buffer that holds the messages waiting to be
+		/// sent. This is also the limit for the size of a message.
+		static constexpr unsigned int kBufferSize = 1 << 20;
+		/// How many bytes can be waiting to be sent on each address
+		/// before the oldest messages are dropped. The same limit
+		/// applies to the data buffered by the server for each client.
+		static constexpr unsigned int kMaxPending = kBufferSize / 4;
+		/// Messages up to this size can be coalesced.
+		static constexpr unsigned int kMaxCoalesceSize = 4096;
+
 		void addAddress(std::string address, std::function<void(std::string, void*, int)> on_receive = nullptr, std::function<void(std::string)> on_connect = nullptr, std::function<void(std::string)> on_disconnect = nullptr, bool binary = false);
+		/**
+		 * Allow consecutive binary messages to @p address to be sent as
+		 * a single websocket message. Only enable this if the client
+		 * can split them, e.g. because each message starts with a
+		 * header that contains its size. Each message on this address
+		 * is padded with zeros to a multiple of 8 bytes, whether it is
+		 * coalesced or not.
+		 */
+		void setCoalescing(const std::string& address, bool coalesce);
 		
 		int sendNonRt(const char* address, const char* str);
 		int sendNonRt(const char* address, const void* buf, unsigned int size);
 		int sendRt(const char* address, const char* str);
 		int sendRt(const char* address, const void* buf, unsigned int size);
+		/**
+		 * Send a binary message made of a header followed by a
+		 * payload, without having to copy them together first.
+		 */
+		int sendRt(const char* address, const void* header, unsigned int headerSize, const void* payload, unsigned int payloadSize);
+		/**
+		 * Get the number of messages that have been dropped on @p
+		 * address because its clients couldn't keep up. A message that
+		 * was dropped for some of the clients only is counted once.
+		 */
+		unsigned int getNumDropped(const std::string& address);
 		
 	private:
 		void cleanup();
@@ -37,12 +84,15 @@ class WSServer{
 		std::string address;
 		std::shared_ptr<seasocks::Server> server;
 		
-		struct AddressBookItem {
-			std::unique_ptr<AuxTaskNonRT> thread;
-			std::shared_ptr<WSServerDataHandler> handler;
-		};
-		std::map<std::string, AddressBookItem> address_book;
+		// indexed by the channel of the messages in bus
+		std::vector<std::shared_ptr<WSServerDataHandler>> handlers;
+		std::shared_ptr<MessageBus> bus;
 		std::unique_ptr<AuxTaskNonRT> server_task;
+		std::unique_ptr<AuxTaskNonRT> send_task;
+		std::atomic<bool> sendPending {false};
+		std::mutex flushMutex;
 		
-		void client_task_func(std::shared_ptr<WSServerDataHandler> handler, const void* buf, unsigned int size);
+		WSServerDataHandler* find(const char* address);
+		int write(const char* address, const void* header, unsigned int headerSize, const void* payload, unsigned int payloadSize);
+		void flush();
 };
@@ -0,0 +1,219 @@
+#include "BinaryFileWriter.h"
+#include "WriteFile.h"
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+static uint32_t roundUpToPowerOfTwo(uint32_t value, uint32_t min)
+{
+	uint32_t ret = min;
+	while(ret < value)
+		ret *= 2;
+	return ret;
+}
+
+int BinaryFileWriter::setup(const std::string& filename, unsigned int newNumChannels, bool overwrite, const Settings& settings)
+{
+	cleanup();
+	if(!newNumChannels)
+		return -EINVAL;
+	numChannels = newNumChannels;
+	frameSize = numChannels * sizeof(float);
+	writeSize = roundUpToPowerOfTwo(settings.writeSize, DirectFile::kBlockSize);
+	capacity = roundUpToPowerOfTwo(settings.bufferSize, 2 * writeSize);
+	if(posix_memalign((void**)&buffer, DirectFile::kBlockSize, capacity))
+	{
+		buffer = nullptr;
+		return -ENOMEM;
+	}
+	int ret;
+	if(overwrite)
+	{
+		ret = file.open(filename, settings.direct, settings.preallocateSize);
+	} else {
+		char* unique = WriteFile::generateUniqueFilename(filename.c_str());
+		ret = file.open(unique, settings.direct, settings.preallocateSize);
+		free(unique);
+	}
+	if(ret)
+	{
+		free(buffer);
+		buffer = nullptr;
+		return ret;
+	}
+	writePos = 0;
+	readPos = 0;
+	droppedFrames = 0;
+	error = 0;
+	FileWriterThread::add(this);
+	return 0;
+}
+
+void BinaryFileWriter::cleanup()
+{
+	if(!buffer)
+		return;
+	// once removed, the writing thread won't access this object
+	FileWriterThread::remove(this);
+	writeBlocks(true);
+	file.close();
+	free(buffer);
+	buffer = nullptr;
+	uint64_t dropped = getDroppedFrames();
+	if(dropped)
+		fprintf(stderr, "BinaryFileWriter: %s: %llu frames were dropped\n", getFilename().c_str(), (unsigned long long)dropped);
+}
+
+bool BinaryFileWriter::log(const float* data, unsigned int frames)
+{
+	if(!buffer)
+		return false;
+	uint32_t w = writePos.load(std::memory_order_relaxed);
+	uint32_t r = readPos.load(std::memory_order_acquire);
+	unsigned int fit = (capacity - (w - r)) / frameSize;
+	unsigned int dropped = 0;
+	if(frames > fit)
+	{
+		dropped = frames - fit;
+		frames = fit;
+		droppedFrames.store(droppedFrames.load(std::memory_order_relaxed) + dropped, std::memory_order_relaxed);
+	}
+	uint32_t size = frames * frameSize;
+	uint32_t offset = w & (capacity - 1);
+	uint32_t first = std::min(size, capacity - offset);
+	memcpy(buffer + offset, data, first);
+	memcpy(buffer, (const char*)data + first, size - first);
+	w += size;
+	writePos.store(w, std::memory_order_release);
+	if(w - r >= writeSize)
+		FileWriterThread::wake();
+	return !dropped;
+}
+
+float BinaryFileWriter::getBufferStatus()
+{
+	if(!buffer)
+		return 0;
+	uint32_t used = writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_relaxed);
+	return 1 - used / float(capacity);
+}
+
+void BinaryFileWriter::service()
+{
+	writeBlocks(false);
+}
+
+// Write all the complete blocks of writeSize bytes that are in the buffer
+// or, if flush is true, all of the data.
+bool BinaryFileWriter::writeBlocks(bool flush)
+{
+	if(error)
+		return false;
+	uint32_t r = readPos.load(std::memory_order_relaxed);
+	while(1)
+	{
+		uint32_t available = writePos.load(std::memory_order_acquire) - r;
+		if(!flush)
+			available &= ~(writeSize - 1);
+		uint32_t offset = r & (capacity - 1);
+		// one write per contiguous region. All of them start at a
+		// block boundary and, as the buffer is a whole number of
+		// blocks, the last block can be written in full even when it
+		// is only partly filled.
+		uint32_t size = std::min(available, capacity - offset);
+		if(!size)
+			break;
+		int ret = file.append(buffer + offset, size);
+		if(ret < 0)
+		{
+			error = -ret;
+			fprintf(stderr, "BinaryFileWriter: error while writing %s: %s\n", getFilename().c_str(), strerror(error));
+			return false;
+		}
+		r += size;
+		readPos.store(r, std::memory_order_release);
+	}
+	return true;
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <vector>
+static bool checkFile(const std::string& filename, unsigned int numChannels, uint64_t frames, unsigned int seed)
+{
+	FILE* f = fopen(filename.c_str(), "r");
+	assert(f);
+	fseek(f, 0, SEEK_END);
+	assert(ftell(f) == long(frames * numChannels * sizeof(float)));
+	fseek(f, 0, SEEK_SET);
+	std::vector<float> frame(numChannels);
+	for(uint64_t n = 0; n < frames; ++n)
+	{
+		assert(numChannels == fread(frame.data(), sizeof(float), numChannels, f));
+		for(unsigned int c = 0; c < numChannels; ++c)
+			assert(frame[c] == float(seed + n * numChannels + c));
+	}
+	fclose(f);
+	unlink(filename.c_str());
+	return true;
+}
+
+bool BinaryFileWriterTest()
+{
+	const unsigned int kNumFiles = 3;
+	const unsigned int channels[kNumFiles] = {16, 3, 1};
+	BinaryFileWriter writers[kNumFiles];
+	BinaryFileWriter::Settings settings;
+	settings.bufferSize = 1 << 18;
+	settings.writeSize = 1 << 14;
+	settings.preallocateSize = 1 << 20;
+	for(unsigned int n = 0; n < kNumFiles; ++n)
+	{
+		std::string name = "/tmp/BinaryFileWriterTest" + std::to_string(n) + ".bin";
+		assert(0 == writers[n].setup(name, channels[n], true, settings));
+	}
+	// blocks of different sizes, so that frames straddle the end of
+	// the buffer
+	const unsigned int blockSizes[] = {16, 1, 37, 128};
+	uint64_t frames = 0;
+	for(unsigned int b = 0; b < 4000; ++b)
+	{
+		unsigned int blockSize = blockSizes[b % 4];
+		for(unsigned int n = 0; n < kNumFiles; ++n)
+		{
+			std::vector<float> data(blockSize * channels[n]);
+			for(unsigned int k = 0; k < data.size(); ++k)
+				data[k] = n + frames * channels[n] + k;
+			assert(writers[n].log(data.data(), blockSize));
+		}
+		frames += blockSize;
+	}
+	for(unsigned int n = 0; n < kNumFiles; ++n)
+	{
+		assert(0 == writers[n].getDroppedFrames());
+		std::string name = writers[n].getFilename();
+		writers[n].cleanup();
+		assert(0 == writers[n].getError());
+		checkFile(name, channels[n], frames, n);
+	}
+
+	// frames that don't fit in the buffer are dropped
+	BinaryFileWriter w;
+	settings.bufferSize = settings.writeSize = 8192;
+	settings.direct = false;
+	assert(0 == w.setup("/tmp/BinaryFileWriterTest.bin", 2, true, settings));
+	std::vector<float> data(2 * 3000);
+	for(unsigned int n = 0; n < data.size(); ++n)
+		data[n] = n;
+	assert(!w.log(data.data(), 3000));
+	unsigned int logged = 16384 / 8;
+	assert(3000 - logged == w.getDroppedFrames());
+	w.cleanup();
+	checkFile("/tmp/BinaryFileWriterTest.bin", 2, logged, 0);
+	printf("BinaryFileWriterTest successful\n");
+	return true;
+}
+#endif
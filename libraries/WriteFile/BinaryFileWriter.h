@@ -0,0 +1,120 @@
+#pragma once
+#include "DirectFile.h"
+#include "FileWriterThread.h"
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Log interleaved frames of `float` values to a binary file, for logging
+ * many channels at high rates for long periods of time.
+ *
+ * log() copies the data into a buffer and never blocks. A single
+ * low-priority thread, shared by all the objects, writes the buffers to
+ * disk in large blocks. It is woken up when an object has accumulated
+ * enough data, without polling. Files are written with `O_DIRECT` where
+ * the filesystem supports it, so that they don't fill the page cache, and
+ * can be preallocated as they grow, to limit fragmentation and the time
+ * spent in the filesystem when writing.
+ *
+ * When the disk can't keep up and the buffer is full, the frames that
+ * don't fit are dropped and counted: see getDroppedFrames().
+ *
+ * The file contains the values as written in memory, with no header, and
+ * can be read e.g. in Matlab with:
+ *
+ *     fid = fopen('out.bin', 'r');
+ *     A = fread(fid, [numChannels, Inf], 'float');
+ */
+class BinaryFileWriter : private FileWriterThread::Client
+{
+public:
+	struct Settings
+	{
+		/// Size of the buffer in bytes. This is rounded up to a
+		/// power of two, and to at least twice `writeSize`.
+		unsigned int bufferSize = 1 << 22;
+		/// Size of each write to disk, in bytes. This is rounded up to
+		/// a power of two, and to at least 4096. The writing thread is
+		/// woken up when this much data is available.
+		unsigned int writeSize = 1 << 16;
+		/// When more than 0, disk space is allocated in advance in
+		/// increments of this many bytes.
+		unsigned int preallocateSize = 1 << 24;
+		/// Whether to try and bypass the page cache.
+		bool direct = true;
+	};
+	BinaryFileWriter() {};
+	~BinaryFileWriter() { cleanup(); }
+	BinaryFileWriter(const BinaryFileWriter&) = delete;
+	BinaryFileWriter& operator=(const BinaryFileWriter&) = delete;
+	/**
+	 * Open the file and allocate the buffer. Call this from setup().
+	 *
+	 * @param filename the path of the file.
+	 * @param numChannels the number of values in each frame.
+	 * @param overwrite if false, existing files will not be overwritten
+	 * and the filename will be automatically incremented.
+	 * @param settings the sizes of the buffers and of the writes.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(const std::string& filename, unsigned int numChannels, bool overwrite, const Settings& settings);
+	int setup(const std::string& filename, unsigned int numChannels, bool overwrite = false)
+	{
+		return setup(filename, numChannels, overwrite, Settings());
+	}
+	/**
+	 * Write all the data still in the buffer, trim the file to the size
+	 * of the data and close it. Call this from cleanup().
+	 */
+	void cleanup();
+	/**
+	 * Log interleaved frames. This can be called from the audio thread.
+	 *
+	 * @param data `frames * getNumChannels()` values.
+	 * @param frames the number of frames.
+	 *
+	 * @return false if any frames were dropped because the buffer was
+	 * full.
+	 */
+	bool log(const float* data, unsigned int frames = 1);
+	unsigned int getNumChannels() { return numChannels; }
+	/**
+	 * Get the name of the file. This may be different from the one passed
+	 * to setup() if `overwrite` was false.
+	 */
+	const std::string& getFilename() { return file.getFilename(); }
+	/**
+	 * Get the number of frames that have been dropped because the buffer
+	 * was full.
+	 */
+	uint64_t getDroppedFrames() { return droppedFrames.load(std::memory_order_relaxed); }
+	/**
+	 * Get the number of frames that have been written to disk.
+	 */
+	uint64_t getWrittenFrames() { return file.getSize() / frameSize; }
+	/**
+	 * Get the fraction of the buffer that is free, between 0 (full:
+	 * frames are being dropped) and 1 (empty).
+	 */
+	float getBufferStatus();
+	/**
+	 * Get the last error that occurred when writing the file, or 0.
+	 */
+	int getError() { return error; }
+private:
+	void service() override;
+	bool writeBlocks(bool flush);
+	DirectFile file;
+	char* buffer = nullptr;
+	uint32_t capacity;
+	uint32_t writeSize;
+	uint32_t frameSize;
+	unsigned int numChannels = 0;
+	// monotonic positions in bytes, wrapped to the buffer by masking
+	std::atomic<uint32_t> writePos;
+	std::atomic<uint32_t> readPos;
+	std::atomic<uint64_t> droppedFrames;
+	int error;
+};
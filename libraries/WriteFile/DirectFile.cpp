@@ -0,0 +1,137 @@
+#include "DirectFile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+constexpr uint32_t DirectFile::kBlockSize;
+
+int DirectFile::open(const std::string& newFilename, bool newDirect, uint32_t newPreallocateSize)
+{
+	close();
+	filename = newFilename;
+	direct = newDirect;
+	// use 64-bit offsets even where off_t is 32 bits, as logs can grow
+	// beyond 2 GiB
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE;
+	fd = ::open(filename.c_str(), flags | (direct ? O_DIRECT : 0), 0644);
+	if(fd < 0 && direct && EINVAL == errno)
+	{
+		// the filesystem doesn't support O_DIRECT
+		direct = false;
+		fd = ::open(filename.c_str(), flags, 0644);
+	}
+	if(fd < 0)
+	{
+		int ret = -errno;
+		fprintf(stderr, "DirectFile: unable to open %s: %s\n", filename.c_str(), strerror(errno));
+		return ret;
+	}
+	preallocateSize = (newPreallocateSize + kBlockSize - 1) & ~(kBlockSize - 1);
+	size = 0;
+	allocatedSize = 0;
+	return 0;
+}
+
+void DirectFile::disableDirect()
+{
+	direct = false;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+}
+
+int DirectFile::append(const void* data, uint32_t dataSize)
+{
+	if(fd < 0)
+		return -EBADF;
+	const char* p = (const char*)data;
+	uint32_t remaining = dataSize;
+	while(remaining)
+	{
+		// O_DIRECT needs the buffer, the size and the offset to be
+		// aligned. A write that is not a multiple of kBlockSize (e.g.:
+		// after a short write) leaves us unaligned for good.
+		if(direct && ((size & (kBlockSize - 1)) || ((uintptr_t)p & (kBlockSize - 1))))
+			disableDirect();
+		uint32_t toWrite = direct ? (remaining + kBlockSize - 1) & ~(kBlockSize - 1) : remaining;
+		if(preallocateSize && size + toWrite > allocatedSize)
+		{
+			uint64_t newSize = std::max(allocatedSize + preallocateSize, size + toWrite);
+			// not all filesystems support this: just carry on
+			if(!posix_fallocate64(fd, allocatedSize, newSize - allocatedSize))
+				allocatedSize = newSize;
+			else
+				preallocateSize = 0;
+		}
+		ssize_t ret = pwrite64(fd, p, toWrite, size);
+		if(ret < 0)
+		{
+			if(EINTR == errno)
+				continue;
+			if(EINVAL == errno && direct)
+			{
+				// O_DIRECT was accepted by open() but not by write()
+				disableDirect();
+				continue;
+			}
+			return -errno;
+		}
+		uint32_t written = std::min(uint32_t(ret), remaining);
+		size += written;
+		p += written;
+		remaining -= written;
+	}
+	return dataSize;
+}
+
+void DirectFile::close()
+{
+	if(fd < 0)
+		return;
+	// remove the preallocated space and the padding of the last block
+	if(ftruncate64(fd, size))
+		fprintf(stderr, "DirectFile: unable to truncate %s: %s\n", filename.c_str(), strerror(errno));
+	::close(fd);
+	fd = -1;
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <sys/stat.h>
+#include <vector>
+bool DirectFileTest()
+{
+	// a file larger than 2 GiB, so that offsets don't fit in 32 bits
+	const char* filename = "/tmp/DirectFileTest.bin";
+	const uint64_t totalSize = (2ULL << 30) + 3 * DirectFile::kBlockSize;
+	const uint32_t chunkSize = 1 << 20;
+	std::vector<char> chunk(chunkSize + DirectFile::kBlockSize);
+	// aligned for O_DIRECT
+	char* data = (char*)(((uintptr_t)chunk.data() + DirectFile::kBlockSize - 1) & ~(uintptr_t)(DirectFile::kBlockSize - 1));
+	DirectFile file;
+	assert(0 == file.open(filename, true, 64 << 20));
+	for(uint64_t written = 0; written < totalSize; )
+	{
+		uint32_t size = std::min<uint64_t>(chunkSize, totalSize - written);
+		memset(data, written / chunkSize, size);
+		assert(size == (uint32_t)file.append(data, size));
+		written += size;
+	}
+	assert(totalSize == file.getSize());
+	file.close();
+	struct stat64 st;
+	assert(0 == stat64(filename, &st));
+	assert(totalSize == (uint64_t)st.st_size);
+	// the data past 2 GiB is where it should be
+	int fd = ::open(filename, O_RDONLY | O_LARGEFILE);
+	char c;
+	assert(1 == pread64(fd, &c, 1, totalSize - 1));
+	assert((char)((totalSize - 1) / chunkSize) == c);
+	::close(fd);
+	unlink(filename);
+	printf("DirectFileTest successful\n");
+	return true;
+}
+#endif
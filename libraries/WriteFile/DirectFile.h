@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+
+/**
+ * A file that is only appended to, in large blocks, bypassing the page
+ * cache with `O_DIRECT` where the filesystem supports it and falling back
+ * to regular writes where it doesn't. Disk space can be preallocated as the
+ * file grows.
+ *
+ * For `O_DIRECT` writes to be possible, the data passed to append() must be
+ * aligned to kBlockSize and all writes but the last must be a multiple of
+ * kBlockSize.
+ */
+class DirectFile
+{
+public:
+	static constexpr uint32_t kBlockSize = 4096;
+	DirectFile() {};
+	~DirectFile() { close(); }
+	DirectFile(const DirectFile&) = delete;
+	DirectFile& operator=(const DirectFile&) = delete;
+	/**
+	 * Create the file, truncating it if it exists.
+	 *
+	 * @param filename the path of the file.
+	 * @param direct whether to try and bypass the page cache.
+	 * @param preallocateSize when more than 0, disk space is allocated in
+	 * advance in increments of this many bytes.
+	 *
+	 * @return 0 on success, a negative error code otherwise.
+	 */
+	int open(const std::string& filename, bool direct, uint32_t preallocateSize);
+	/**
+	 * Append data at the end of the file.
+	 *
+	 * When the file is written with `O_DIRECT`, the last block is written
+	 * in full, so @p data must be readable up to @p size rounded up to
+	 * kBlockSize. The extra data is overwritten by the next write or
+	 * removed by close().
+	 *
+	 * @return @p size on success, a negative error code otherwise.
+	 */
+	int append(const void* data, uint32_t size);
+	/**
+	 * Trim the file to the size of the data that has been appended and
+	 * close it.
+	 */
+	void close();
+	bool isOpen() { return fd >= 0; }
+	/**
+	 * Get the number of bytes that have been appended.
+	 */
+	uint64_t getSize() { return size; }
+	const std::string& getFilename() { return filename; }
+private:
+	void disableDirect();
+	std::string filename;
+	uint64_t size;
+	uint64_t allocatedSize;
+	uint32_t preallocateSize;
+	int fd = -1;
+	bool direct;
+};
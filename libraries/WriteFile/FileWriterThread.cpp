@@ -0,0 +1,41 @@
+#include "FileWriterThread.h"
+#include <Bela.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+static std::mutex gClientsMutex;
+static std::vector<FileWriterThread::Client*> gClients;
+static AuxiliaryTask gTask;
+static std::atomic<bool> gWakePending(false);
+
+static void run(void*)
+{
+	// wake() calls from now on will schedule us again
+	gWakePending.store(false, std::memory_order_release);
+	std::lock_guard<std::mutex> lock(gClientsMutex);
+	for(auto c : gClients)
+		c->service();
+}
+
+void FileWriterThread::add(Client* client)
+{
+	std::lock_guard<std::mutex> lock(gClientsMutex);
+	if(!gTask)
+		gTask = Bela_createAuxiliaryTask(run, 20, "FileWriterThread", nullptr);
+	gClients.push_back(client);
+}
+
+void FileWriterThread::remove(Client* client)
+{
+	std::lock_guard<std::mutex> lock(gClientsMutex);
+	gClients.erase(std::remove(gClients.begin(), gClients.end(), client), gClients.end());
+}
+
+void FileWriterThread::wake()
+{
+	// one wake-up services all the clients
+	if(!gWakePending.exchange(true, std::memory_order_acq_rel))
+		Bela_scheduleAuxiliaryTask(gTask);
+}
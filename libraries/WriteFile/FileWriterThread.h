@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * A low-priority thread that writes files to disk on behalf of objects that
+ * are fed from the audio thread, e.g. BinaryFileWriter and LogFileWriter.
+ *
+ * Rather than polling, the thread sleeps until wake() is called, typically
+ * when one of the clients has accumulated enough data to be worth writing,
+ * and then calls Client::service() on all the clients.
+ */
+class FileWriterThread
+{
+public:
+	class Client
+	{
+	public:
+		virtual ~Client() {}
+		/**
+		 * Write whatever data is ready. This is called from the
+		 * writing thread.
+		 */
+		virtual void service() = 0;
+	};
+	/**
+	 * Start calling client->service(). Do not call this from the audio
+	 * thread.
+	 */
+	static void add(Client* client);
+	/**
+	 * Stop calling client->service(). Once this returns, service() is not
+	 * running and won't be called again. Do not call this from the audio
+	 * thread.
+	 */
+	static void remove(Client* client);
+	/**
+	 * Have the thread service all the clients. This can be called from
+	 * the audio thread.
+	 */
+	static void wake();
+};
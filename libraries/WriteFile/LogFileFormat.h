@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * The layout of the files written by LogFileWriter and read by
+ * LogFileReader. All values are little-endian.
+ *
+ * A file starts with a FileHeader, followed by one ChannelHeader per
+ * channel. The headers are padded to FileHeader::headerSize bytes.
+ *
+ * Then come the chunks, each FileHeader::chunkSize bytes long, each holding
+ * up to FileHeader::chunkFrames consecutive frames. A chunk starts with a
+ * ChunkHeader, followed by one column per channel, at the offset given by
+ * ChannelHeader::offset from the start of the chunk. Columns are aligned to
+ * 16 bytes.
+ *
+ * A file that was not closed properly can still be read up to its last
+ * complete chunk.
+ */
+namespace LogFileFormat {
+static constexpr char kMagic[8] = {'B', 'E', 'L', 'A', 'L', 'O', 'G', 0};
+static constexpr uint32_t kVersion = 1;
+static constexpr uint32_t kChunkMagic = 0x4b4e4843; // "CHNK"
+
+enum Encoding {
+	kFloat32 = 0, ///< 32-bit floats
+	kInt16 = 1, ///< int16, value = sample * scale + bias
+	kInt16Delta = 2, ///< as kInt16, but each sample is stored as the difference from the previous one in the chunk
+};
+
+struct FileHeader
+{
+	char magic[8]; ///< kMagic
+	uint32_t version; ///< kVersion
+	uint32_t headerSize; ///< size of all the headers, including padding
+	uint32_t numChannels;
+	uint32_t chunkFrames; ///< maximum number of frames in a chunk
+	uint32_t chunkSize; ///< size of a chunk in bytes
+	uint32_t reserved0;
+	double sampleRate;
+	uint64_t reserved[3];
+};
+
+struct ChannelHeader
+{
+	char name[32]; ///< null-terminated
+	uint32_t encoding; ///< an Encoding
+	uint32_t offset; ///< offset of the column from the start of the chunk
+	float scale; ///< for integer encodings
+	float bias; ///< for integer encodings
+	uint32_t reserved[4];
+};
+
+struct ChunkHeader
+{
+	uint32_t magic; ///< kChunkMagic
+	uint32_t frames; ///< number of valid frames in the chunk
+	uint64_t timestamp; ///< timestamp of the first frame, in frames
+	uint32_t reserved[4];
+};
+
+static_assert(sizeof(FileHeader) == 64, "Unexpected FileHeader size");
+static_assert(sizeof(ChannelHeader) == 64, "Unexpected ChannelHeader size");
+static_assert(sizeof(ChunkHeader) == 32, "Unexpected ChunkHeader size");
+} // namespace LogFileFormat
@@ -0,0 +1,148 @@
+#include "LogFileReader.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+using namespace LogFileFormat;
+
+void LogFileReader::Column::decode(float* out) const
+{
+	switch(encoding)
+	{
+	case kFloat32:
+		memcpy(out, data, frames * sizeof(float));
+		break;
+	case kInt16:
+	{
+		const int16_t* in = (const int16_t*)data;
+		for(unsigned int n = 0; n < frames; ++n)
+			out[n] = in[n] * scale + bias;
+		break;
+	}
+	case kInt16Delta:
+	{
+		const int16_t* in = (const int16_t*)data;
+		uint16_t value = 0;
+		for(unsigned int n = 0; n < frames; ++n)
+		{
+			value += uint16_t(in[n]);
+			out[n] = int16_t(value) * scale + bias;
+		}
+		break;
+	}
+	}
+}
+
+int LogFileReader::open(const std::string& filename)
+{
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		return -errno;
+	struct stat st;
+	if(fstat(fd, &st))
+	{
+		int ret = -errno;
+		::close(fd);
+		return ret;
+	}
+	size = st.st_size;
+	if(size < sizeof(FileHeader))
+	{
+		::close(fd);
+		return -EINVAL;
+	}
+	void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after the file is closed
+	::close(fd);
+	if(MAP_FAILED == map)
+		return -errno;
+	data = (const char*)map;
+	const FileHeader* fh = (const FileHeader*)data;
+	if(memcmp(fh->magic, kMagic, sizeof(kMagic)) || fh->version != kVersion
+		|| fh->headerSize > size
+		|| sizeof(FileHeader) + uint64_t(fh->numChannels) * sizeof(ChannelHeader) > fh->headerSize
+		|| fh->chunkSize < sizeof(ChunkHeader))
+	{
+		fprintf(stderr, "LogFileReader: %s is not a valid log file\n", filename.c_str());
+		close();
+		return -EINVAL;
+	}
+	sampleRate = fh->sampleRate;
+	const ChannelHeader* ch = (const ChannelHeader*)(fh + 1);
+	for(unsigned int c = 0; c < fh->numChannels; ++c)
+	{
+		uint32_t sampleSize = kFloat32 == ch[c].encoding ? sizeof(float) : sizeof(int16_t);
+		if(ch[c].encoding > kInt16Delta || ch[c].offset < sizeof(ChunkHeader)
+			|| ch[c].offset + uint64_t(fh->chunkFrames) * sampleSize > fh->chunkSize)
+		{
+			fprintf(stderr, "LogFileReader: %s: invalid channel %u\n", filename.c_str(), c);
+			close();
+			return -EINVAL;
+		}
+		Channel channel;
+		channel.name = std::string(ch[c].name, strnlen(ch[c].name, sizeof(ch[c].name)));
+		channel.encoding = (Encoding)ch[c].encoding;
+		channel.scale = ch[c].scale;
+		channel.bias = ch[c].bias;
+		channels.push_back(channel);
+		offsets.push_back(ch[c].offset);
+	}
+	// index the chunks, stopping at the first incomplete or invalid one
+	numFrames = 0;
+	for(size_t offset = fh->headerSize; offset + fh->chunkSize <= size; offset += fh->chunkSize)
+	{
+		const ChunkHeader* chunk = (const ChunkHeader*)(data + offset);
+		if(kChunkMagic != chunk->magic || chunk->frames > fh->chunkFrames)
+			break;
+		chunks.push_back({chunk->timestamp, chunk->frames});
+		chunkData.push_back(data + offset);
+		numFrames += chunk->frames;
+	}
+	return 0;
+}
+
+void LogFileReader::close()
+{
+	if(data)
+		munmap((void*)data, size);
+	data = nullptr;
+	channels.clear();
+	chunks.clear();
+	chunkData.clear();
+	offsets.clear();
+}
+
+int LogFileReader::getChannelIndex(const std::string& name)
+{
+	for(unsigned int c = 0; c < channels.size(); ++c)
+		if(channels[c].name == name)
+			return c;
+	return -1;
+}
+
+LogFileReader::Column LogFileReader::getColumn(size_t chunk, unsigned int channel)
+{
+	const Channel& ch = channels[channel];
+	return {
+		chunkData[chunk] + offsets[channel],
+		chunks[chunk].frames,
+		ch.encoding,
+		ch.scale,
+		ch.bias,
+	};
+}
+
+void LogFileReader::readChannel(unsigned int channel, float* out)
+{
+	for(size_t n = 0; n < chunks.size(); ++n)
+	{
+		Column column = getColumn(n, channel);
+		column.decode(out);
+		out += column.frames;
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "LogFileFormat.h"
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Read files written by LogFileWriter.
+ *
+ * The file is memory-mapped: columns are accessed in place, without
+ * copying, and only the parts of the file that are actually accessed are
+ * read from disk. This does not depend on the Bela core, so that it can be
+ * built into offline analysis tools.
+ */
+class LogFileReader
+{
+public:
+	typedef LogFileFormat::Encoding Encoding;
+	struct Channel
+	{
+		std::string name;
+		Encoding encoding;
+		float scale;
+		float bias;
+	};
+	/**
+	 * The data of one channel in one chunk, as stored in the file.
+	 */
+	struct Column
+	{
+		const void* data; ///< `frames` values encoded as `encoding`
+		unsigned int frames;
+		Encoding encoding;
+		float scale;
+		float bias;
+		/**
+		 * Get the values, or `nullptr` if the column is not encoded
+		 * as kFloat32.
+		 */
+		const float* asFloat() const { return LogFileFormat::kFloat32 == encoding ? (const float*)data : nullptr; }
+		/**
+		 * Get the encoded values, or `nullptr` if the column is not
+		 * encoded as kInt16 or kInt16Delta.
+		 */
+		const int16_t* asInt16() const { return LogFileFormat::kFloat32 != encoding ? (const int16_t*)data : nullptr; }
+		/**
+		 * Decode the values into @p out, which must have space for
+		 * `frames` values.
+		 */
+		void decode(float* out) const;
+	};
+	struct Chunk
+	{
+		uint64_t timestamp; ///< timestamp of the first frame
+		unsigned int frames;
+	};
+	LogFileReader() {};
+	~LogFileReader() { close(); }
+	LogFileReader(const LogFileReader&) = delete;
+	LogFileReader& operator=(const LogFileReader&) = delete;
+	/**
+	 * Open and map the file, and check its structure. The data is valid
+	 * until close() is called.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int open(const std::string& filename);
+	void close();
+	double getSampleRate() { return sampleRate; }
+	unsigned int getNumChannels() { return channels.size(); }
+	const Channel& getChannel(unsigned int channel) { return channels[channel]; }
+	/**
+	 * Get the index of the channel with the given name, or -1.
+	 */
+	int getChannelIndex(const std::string& name);
+	size_t getNumChunks() { return chunks.size(); }
+	const Chunk& getChunk(size_t chunk) { return chunks[chunk]; }
+	/**
+	 * Get the data of a channel in a chunk.
+	 */
+	Column getColumn(size_t chunk, unsigned int channel);
+	/**
+	 * Get the total number of frames in the file.
+	 */
+	uint64_t getNumFrames() { return numFrames; }
+	/**
+	 * Decode all the frames of a channel, ignoring gaps between chunks.
+	 *
+	 * @param channel the channel.
+	 * @param out space for getNumFrames() values.
+	 */
+	void readChannel(unsigned int channel, float* out);
+private:
+	std::vector<Channel> channels;
+	std::vector<Chunk> chunks;
+	std::vector<const char*> chunkData;
+	std::vector<uint32_t> offsets;
+	const char* data = nullptr;
+	size_t size;
+	uint64_t numFrames;
+	double sampleRate;
+};
@@ -0,0 +1,338 @@
+#include "LogFileWriter.h"
+#include "WriteFile.h"
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace LogFileFormat;
+
+static uint32_t roundUp(uint32_t value, uint32_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+int LogFileWriter::setup(const std::string& filename, float sampleRate, const std::vector<Channel>& newChannels, bool overwrite, const Settings& settings)
+{
+	cleanup();
+	if(!newChannels.size() || !settings.chunkFrames || !settings.numChunks)
+		return -EINVAL;
+	chunkFrames = settings.chunkFrames;
+	// a power of two, so that the chunk counts can wrap around
+	numChunks = 1;
+	while(numChunks < settings.numChunks)
+		numChunks *= 2;
+
+	// the headers and each chunk are padded to whole blocks, so that
+	// they can be written directly from the buffers
+	uint32_t headerSize = roundUp(sizeof(FileHeader) + newChannels.size() * sizeof(ChannelHeader), DirectFile::kBlockSize);
+	char* header;
+	if(posix_memalign((void**)&header, DirectFile::kBlockSize, headerSize))
+		return -ENOMEM;
+	memset(header, 0, headerSize);
+	FileHeader* fh = (FileHeader*)header;
+	ChannelHeader* ch = (ChannelHeader*)(fh + 1);
+	channels.resize(newChannels.size());
+	uint32_t offset = sizeof(ChunkHeader);
+	for(unsigned int c = 0; c < newChannels.size(); ++c)
+	{
+		const Channel& in = newChannels[c];
+		ChannelState& out = channels[c];
+		out.encoding = in.encoding;
+		out.offset = offset;
+		out.previous = 0;
+		strncpy(ch[c].name, in.name.c_str(), sizeof(ch[c].name) - 1);
+		ch[c].encoding = in.encoding;
+		ch[c].offset = offset;
+		if(kFloat32 == in.encoding)
+		{
+			ch[c].scale = 1;
+			ch[c].bias = 0;
+			offset += chunkFrames * sizeof(float);
+		} else {
+			// map [min, max] onto [-32767, 32767]
+			ch[c].scale = (in.max - in.min) / 65534.f;
+			ch[c].bias = (in.max + in.min) / 2.f;
+			if(ch[c].scale <= 0)
+				ch[c].scale = 1;
+			out.invScale = 1.f / ch[c].scale;
+			out.bias = ch[c].bias;
+			offset += chunkFrames * sizeof(int16_t);
+		}
+		offset = roundUp(offset, 16);
+	}
+	chunkSize = roundUp(offset, DirectFile::kBlockSize);
+	memcpy(fh->magic, kMagic, sizeof(kMagic));
+	fh->version = kVersion;
+	fh->headerSize = headerSize;
+	fh->numChannels = channels.size();
+	fh->chunkFrames = chunkFrames;
+	fh->chunkSize = chunkSize;
+	fh->sampleRate = sampleRate;
+
+	int ret = -ENOMEM;
+	if(posix_memalign((void**)&chunks, DirectFile::kBlockSize, chunkSize * numChunks))
+	{
+		chunks = nullptr;
+		free(header);
+		return ret;
+	}
+	// the padding is written to disk: don't leak memory contents there
+	memset(chunks, 0, chunkSize * numChunks);
+	if(overwrite)
+	{
+		ret = file.open(filename, settings.direct, settings.preallocateSize);
+	} else {
+		char* unique = WriteFile::generateUniqueFilename(filename.c_str());
+		ret = file.open(unique, settings.direct, settings.preallocateSize);
+		free(unique);
+	}
+	if(!ret)
+	{
+		ret = file.append(header, headerSize);
+		ret = ret < 0 ? ret : 0;
+	}
+	free(header);
+	if(ret)
+	{
+		file.close();
+		free(chunks);
+		chunks = nullptr;
+		return ret;
+	}
+	currentChunk = nullptr;
+	nextTimestamp = 0;
+	filledChunks = 0;
+	writtenChunks = 0;
+	droppedFrames = 0;
+	error = 0;
+	FileWriterThread::add(this);
+	return 0;
+}
+
+void LogFileWriter::cleanup()
+{
+	if(!chunks)
+		return;
+	// once removed, the writing thread won't access this object
+	FileWriterThread::remove(this);
+	if(currentChunk)
+		finishChunk();
+	service();
+	file.close();
+	free(chunks);
+	chunks = nullptr;
+	uint64_t dropped = getDroppedFrames();
+	if(dropped)
+		fprintf(stderr, "LogFileWriter: %s: %llu frames were dropped\n", getFilename().c_str(), (unsigned long long)dropped);
+}
+
+bool LogFileWriter::startChunk(uint64_t timestamp)
+{
+	uint32_t filled = filledChunks.load(std::memory_order_relaxed);
+	if(filled - writtenChunks.load(std::memory_order_acquire) >= numChunks)
+		return false;
+	currentChunk = chunks + (filled & (numChunks - 1)) * chunkSize;
+	ChunkHeader* header = (ChunkHeader*)currentChunk;
+	header->magic = kChunkMagic;
+	header->timestamp = timestamp;
+	currentFrames = 0;
+	for(auto& c : channels)
+		c.previous = 0;
+	return true;
+}
+
+void LogFileWriter::finishChunk()
+{
+	((ChunkHeader*)currentChunk)->frames = currentFrames;
+	currentChunk = nullptr;
+	filledChunks.store(filledChunks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	FileWriterThread::wake();
+}
+
+static inline int16_t toInt16(float value, float invScale, float bias)
+{
+	float v = (value - bias) * invScale;
+	if(v > 32767)
+		v = 32767;
+	if(v < -32767)
+		v = -32767;
+	return lrintf(v);
+}
+
+bool LogFileWriter::log(const float* data, unsigned int frames, uint64_t timestamp)
+{
+	if(!chunks)
+		return false;
+	if(currentChunk && timestamp != nextTimestamp)
+		finishChunk();
+	nextTimestamp = timestamp + frames;
+	unsigned int numChannels = channels.size();
+	while(frames)
+	{
+		if(!currentChunk && !startChunk(timestamp))
+		{
+			droppedFrames.store(droppedFrames.load(std::memory_order_relaxed) + frames, std::memory_order_relaxed);
+			return false;
+		}
+		unsigned int n = std::min(frames, chunkFrames - currentFrames);
+		for(unsigned int c = 0; c < numChannels; ++c)
+		{
+			ChannelState& ch = channels[c];
+			const float* in = data + c;
+			char* column = currentChunk + ch.offset;
+			switch(ch.encoding)
+			{
+			case kFloat32:
+			{
+				float* out = (float*)column + currentFrames;
+				for(unsigned int i = 0; i < n; ++i)
+					out[i] = in[i * numChannels];
+				break;
+			}
+			case kInt16:
+			{
+				int16_t* out = (int16_t*)column + currentFrames;
+				for(unsigned int i = 0; i < n; ++i)
+					out[i] = toInt16(in[i * numChannels], ch.invScale, ch.bias);
+				break;
+			}
+			case kInt16Delta:
+			{
+				int16_t* out = (int16_t*)column + currentFrames;
+				int16_t previous = ch.previous;
+				for(unsigned int i = 0; i < n; ++i)
+				{
+					int16_t q = toInt16(in[i * numChannels], ch.invScale, ch.bias);
+					out[i] = int16_t(uint16_t(q) - uint16_t(previous));
+					previous = q;
+				}
+				ch.previous = previous;
+				break;
+			}
+			}
+		}
+		data += n * numChannels;
+		frames -= n;
+		timestamp += n;
+		currentFrames += n;
+		if(currentFrames == chunkFrames)
+			finishChunk();
+	}
+	return true;
+}
+
+void LogFileWriter::service()
+{
+	if(error)
+		return;
+	uint32_t written = writtenChunks.load(std::memory_order_relaxed);
+	while(written != filledChunks.load(std::memory_order_acquire))
+	{
+		int ret = file.append(chunks + (written & (numChunks - 1)) * chunkSize, chunkSize);
+		if(ret < 0)
+		{
+			error = -ret;
+			fprintf(stderr, "LogFileWriter: error while writing %s: %s\n", getFilename().c_str(), strerror(error));
+			return;
+		}
+		++written;
+		writtenChunks.store(written, std::memory_order_release);
+	}
+}
+
+#if 0
+#undef NDEBUG
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "LogFileReader.h"
+
+static float testValue(uint64_t frame, unsigned int channel)
+{
+	return sinf(frame * 0.01f * (channel + 1)) * 0.9f;
+}
+
+bool LogFileWriterTest()
+{
+	const char* filename = "/tmp/LogFileWriterTest.bin";
+	std::vector<LogFileWriter::Channel> channels(3);
+	channels[0].name = "float";
+	channels[1].name = "int16";
+	channels[1].encoding = LogFileFormat::kInt16;
+	channels[2].name = "delta";
+	channels[2].encoding = LogFileFormat::kInt16Delta;
+	channels[2].min = -2;
+	channels[2].max = 2;
+	const unsigned int numChannels = channels.size();
+	LogFileWriter::Settings settings;
+	settings.chunkFrames = 100;
+	settings.numChunks = 3;
+	LogFileWriter writer;
+	assert(0 == writer.setup(filename, 44100, channels, true, settings));
+	// blocks of 16 frames with a gap after the 40th, then a large block
+	std::vector<float> data(numChannels * 1000);
+	std::vector<uint64_t> timestamps;
+	uint64_t timestamp = 0;
+	for(unsigned int b = 0; b < 61; ++b)
+	{
+		unsigned int frames = 60 == b ? 1000 : 16;
+		for(unsigned int n = 0; n < frames; ++n)
+			for(unsigned int c = 0; c < numChannels; ++c)
+				data[n * numChannels + c] = testValue(timestamp + n, c);
+		if(40 == b)
+			assert(writer.log(data.data(), frames, timestamp));
+		else
+			assert(writer.log(data.data(), frames));
+		for(unsigned int n = 0; n < frames; ++n)
+			timestamps.push_back(timestamp + n);
+		timestamp += frames;
+		if(39 == b)
+			timestamp += 12345;
+	}
+	writer.cleanup();
+	assert(0 == writer.getError());
+	assert(0 == writer.getDroppedFrames());
+
+	LogFileReader reader;
+	assert(0 == reader.open(filename));
+	assert(44100 == reader.getSampleRate());
+	assert(numChannels == reader.getNumChannels());
+	assert(1 == reader.getChannelIndex("int16"));
+	assert(-1 == reader.getChannelIndex("none"));
+	assert(LogFileFormat::kInt16Delta == reader.getChannel(2).encoding);
+	assert(timestamps.size() == reader.getNumFrames());
+	// 640 frames in 7 chunks, the gap, then 1320 frames in 14 chunks
+	assert(21 == reader.getNumChunks());
+	assert(40 == reader.getChunk(6).frames);
+	assert(640 + 12345 == reader.getChunk(7).timestamp);
+	assert(20 == reader.getChunk(20).frames);
+	const float tolerance[] = {0, 1.f / 32767, 2.f / 32767};
+	std::vector<float> decoded(reader.getNumFrames());
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		reader.readChannel(c, decoded.data());
+		for(unsigned int n = 0; n < decoded.size(); ++n)
+			assert(fabsf(decoded[n] - testValue(timestamps[n], c)) <= tolerance[c]);
+	}
+	// float columns are accessed in place
+	LogFileReader::Column column = reader.getColumn(7, 0);
+	assert(column.asFloat() && !column.asInt16());
+	assert(column.asFloat()[1] == testValue(640 + 12345 + 1, 0));
+	assert(0 == ((uintptr_t)column.data & 15));
+	reader.close();
+
+	// a truncated file is read up to its last complete chunk
+	struct stat st;
+	stat(filename, &st);
+	assert(0 == truncate(filename, st.st_size - 1));
+	assert(0 == reader.open(filename));
+	assert(20 == reader.getNumChunks());
+	reader.close();
+	unlink(filename);
+	printf("LogFileWriterTest successful\n");
+	return true;
+}
+#endif
@@ -0,0 +1,134 @@
+#pragma once
+#include "LogFileFormat.h"
+#include "DirectFile.h"
+#include "FileWriterThread.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * Log interleaved frames of `float` values to a self-describing, columnar
+ * binary file, see LogFileFormat.h. Read it back with LogFileReader.
+ *
+ * The file header stores the sample rate and the name and encoding of each
+ * channel. The data is stored in chunks of consecutive frames, each with
+ * the timestamp of its first frame, e.g. from `context->audioFramesElapsed`,
+ * so that gaps due to dropped frames can be told apart. Each channel can be
+ * stored as 32-bit floats or, to halve the size of the file, as 16-bit
+ * integers over a given range, optionally delta-encoded so that slowly
+ * changing signals compress better with general-purpose tools.
+ *
+ * log() encodes the data straight into the chunk being filled and never
+ * blocks. Complete chunks are written to disk by FileWriterThread. When the
+ * disk can't keep up and all the chunks are full, frames are dropped and
+ * counted: see getDroppedFrames().
+ */
+class LogFileWriter : private FileWriterThread::Client
+{
+public:
+	typedef LogFileFormat::Encoding Encoding;
+	struct Channel
+	{
+		/// Name of the channel, up to 31 characters.
+		std::string name;
+		Encoding encoding = LogFileFormat::kFloat32;
+		/// The range of the values, for integer encodings. Values
+		/// outside of it are clipped.
+		float min = -1;
+		float max = 1;
+	};
+	struct Settings
+	{
+		/// Number of frames in each chunk.
+		unsigned int chunkFrames = 1024;
+		/// Number of chunks that can be waiting to be written.
+		unsigned int numChunks = 16;
+		/// See BinaryFileWriter::Settings.
+		unsigned int preallocateSize = 1 << 24;
+		/// Whether to try and bypass the page cache.
+		bool direct = true;
+	};
+	LogFileWriter() {};
+	~LogFileWriter() { cleanup(); }
+	LogFileWriter(const LogFileWriter&) = delete;
+	LogFileWriter& operator=(const LogFileWriter&) = delete;
+	/**
+	 * Create the file and write its header. Call this from setup().
+	 *
+	 * @param filename the path of the file.
+	 * @param sampleRate the rate at which frames are logged.
+	 * @param channels the description of each channel.
+	 * @param overwrite if false, existing files will not be overwritten
+	 * and the filename will be automatically incremented.
+	 * @param settings the size of the chunks and how many of them are
+	 * allocated.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(const std::string& filename, float sampleRate, const std::vector<Channel>& channels, bool overwrite, const Settings& settings);
+	int setup(const std::string& filename, float sampleRate, const std::vector<Channel>& channels, bool overwrite = false)
+	{
+		return setup(filename, sampleRate, channels, overwrite, Settings());
+	}
+	/**
+	 * Write the chunk being filled and close the file. Call this from
+	 * cleanup().
+	 */
+	void cleanup();
+	/**
+	 * Log interleaved frames. This can be called from the audio thread.
+	 *
+	 * @param data `frames * getNumChannels()` values.
+	 * @param frames the number of frames.
+	 * @param timestamp the timestamp of the first frame. When it is not
+	 * contiguous with the previous call, a new chunk is started.
+	 *
+	 * @return false if any frames were dropped.
+	 */
+	bool log(const float* data, unsigned int frames, uint64_t timestamp);
+	/**
+	 * Log interleaved frames that follow those of the previous call.
+	 */
+	bool log(const float* data, unsigned int frames = 1)
+	{
+		return log(data, frames, nextTimestamp);
+	}
+	unsigned int getNumChannels() { return channels.size(); }
+	const std::string& getFilename() { return file.getFilename(); }
+	/**
+	 * Get the number of frames that have been dropped because all the
+	 * chunks were waiting to be written.
+	 */
+	uint64_t getDroppedFrames() { return droppedFrames.load(std::memory_order_relaxed); }
+	/**
+	 * Get the last error that occurred when writing the file, or 0.
+	 */
+	int getError() { return error; }
+private:
+	struct ChannelState
+	{
+		Encoding encoding;
+		uint32_t offset;
+		float invScale;
+		float bias;
+		int16_t previous;
+	};
+	void service() override;
+	bool startChunk(uint64_t timestamp);
+	void finishChunk();
+	std::vector<ChannelState> channels;
+	DirectFile file;
+	char* chunks = nullptr;
+	uint32_t chunkSize;
+	unsigned int chunkFrames;
+	unsigned int numChunks;
+	// the chunk being filled, or nullptr
+	char* currentChunk = nullptr;
+	unsigned int currentFrames;
+	uint64_t nextTimestamp = 0;
+	// monotonic chunk counts, wrapped to numChunks
+	std::atomic<uint32_t> filledChunks;
+	std::atomic<uint32_t> writtenChunks;
+	std::atomic<uint64_t> droppedFrames;
+	int error;
+};
@@ -70,6 +70,9 @@ public:
 	 * Binary files cAn be imported e.g. in Matlab:
 	 *   fid=fopen('out','r');
 	 *   A = fread(fid, 'float');
+	 * To log many channels in binary format for long periods of time,
+	 * consider BinaryFileWriter or, for files that describe their own
+	 * contents, LogFileWriter instead.
 	 * */
 	void setFileType(WriteFileType newFileType);
 